@@ -24,6 +24,13 @@ include(FetchContent)
 
 find_package(Git)
 
+# The dump writer runs on a thread of its own
+set(THREADS_PREFER_PTHREAD_FLAG ON)
+find_package(Threads REQUIRED)
+
+# Compressed dumps, uses the system's zlib
+find_package(ZLIB REQUIRED)
+
 # Abseil
 FetchContent_Declare(absl
   GIT_REPOSITORY https://github.com/abseil/abseil-cpp
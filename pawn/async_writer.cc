@@ -0,0 +1,534 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/async_writer.h"
+
+#include <fcntl.h>           // open()
+#include <linux/io_uring.h>  // io_uring_params
+#include <sys/mman.h>        // mmap()
+#include <sys/stat.h>        // fstat()
+#include <sys/syscall.h>     // __NR_io_uring_setup
+#include <unistd.h>          // close(), ftruncate(), pwrite()
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/log/die_if_null.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+
+struct AsyncWriter::Buffer {
+  struct Deleter {
+    void operator()(uint8_t* data) const { free(data); }
+  };
+
+  std::unique_ptr<uint8_t, Deleter> data;
+  size_t size = 0;     // Bytes to write
+  int64_t offset = 0;  // File position
+  size_t written = 0;
+  bool direct_io = false;  // Last submitted with O_DIRECT
+};
+
+class AsyncWriter::Backend {
+ public:
+  virtual ~Backend() = default;
+
+  // Maximum number of writes in flight.
+  virtual int capacity() const = 0;
+
+  // Starts writing size bytes of data at file position offset, on behalf of
+  // buffer.
+  virtual absl::Status Submit(Buffer* buffer, const uint8_t* data,
+                              size_t size, int64_t offset) = 0;
+
+  // Waits for a write to complete. Sets buffer and the number of bytes
+  // written, or a negative errno value.
+  virtual absl::Status Wait(Buffer*& buffer, int64_t& result) = 0;
+};
+
+// Writes synchronously, one buffer at a time.
+class AsyncWriter::PwriteBackend : public AsyncWriter::Backend {
+ public:
+  explicit PwriteBackend(int fd) : fd_(fd) {}
+
+  int capacity() const override { return 1; }
+
+  absl::Status Submit(Buffer* buffer, const uint8_t* data, size_t size,
+                      int64_t offset) override {
+    ssize_t result;
+    do {
+      result = pwrite(fd_, data, size, offset);
+    } while (result == -1 && errno == EINTR);
+    buffer_ = buffer;
+    result_ = result == -1 ? -errno : result;
+    return absl::OkStatus();
+  }
+
+  absl::Status Wait(Buffer*& buffer, int64_t& result) override {
+    buffer = buffer_;
+    result = result_;
+    return absl::OkStatus();
+  }
+
+ private:
+  int fd_;
+  Buffer* buffer_ = nullptr;
+  int64_t result_ = 0;
+};
+
+// Minimal io_uring through the raw system calls, see io_uring(7). Only this
+// backend's thread touches the rings, the kernel is the other side.
+class AsyncWriter::IoUringBackend : public AsyncWriter::Backend {
+ public:
+  ~IoUringBackend() override {
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    if (ring_fd_ != -1) {
+      close(ring_fd_);
+    }
+  }
+
+  static absl::StatusOr<std::unique_ptr<IoUringBackend>> Create(int fd,
+                                                                int entries) {
+    std::unique_ptr<IoUringBackend> backend(new IoUringBackend(fd));
+    io_uring_params params = {};
+    backend->ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (backend->ring_fd_ == -1) {
+      return absl::UnavailableError(
+          absl::StrCat("io_uring_setup: ", std::strerror(errno)));
+    }
+    // IORING_OP_WRITE came with the same kernel (5.6) as this feature.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+      return absl::UnavailableError("Kernel lacks IORING_OP_WRITE");
+    }
+    backend->capacity_ = params.sq_entries;
+
+    backend->sq_ring_size_ =
+        params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    backend->cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      backend->sq_ring_size_ = backend->cq_ring_size_ =
+          std::max(backend->sq_ring_size_, backend->cq_ring_size_);
+    }
+    backend->sq_ring_ =
+        mmap(nullptr /* Address hint */, backend->sq_ring_size_,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             backend->ring_fd_, IORING_OFF_SQ_RING);
+    backend->cq_ring_ =
+        single_mmap ? backend->sq_ring_
+                    : mmap(nullptr /* Address hint */, backend->cq_ring_size_,
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           backend->ring_fd_, IORING_OFF_CQ_RING);
+    backend->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    backend->sqes_ =
+        mmap(nullptr /* Address hint */, backend->sqes_size_,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             backend->ring_fd_, IORING_OFF_SQES);
+    if (backend->sq_ring_ == MAP_FAILED || backend->cq_ring_ == MAP_FAILED ||
+        backend->sqes_ == MAP_FAILED) {
+      return absl::UnavailableError(
+          absl::StrCat("Could not map io_uring: ", std::strerror(errno)));
+    }
+
+    auto* sq = static_cast<uint8_t*>(backend->sq_ring_);
+    backend->sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    backend->sq_mask_ =
+        *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    backend->sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    auto* cq = static_cast<uint8_t*>(backend->cq_ring_);
+    backend->cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    backend->cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    backend->cq_mask_ =
+        *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    backend->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return backend;  // GCC 7 needs the extra move
+  }
+
+  int capacity() const override { return capacity_; }
+
+  absl::Status Submit(Buffer* buffer, const uint8_t* data, size_t size,
+                      int64_t offset) override {
+    const uint32_t tail = *sq_tail_;
+    const uint32_t index = tail & sq_mask_;
+    io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes_)[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = fd_;
+    sqe.addr = reinterpret_cast<uintptr_t>(data);
+    sqe.len = size;
+    sqe.off = offset;
+    sqe.user_data = reinterpret_cast<uintptr_t>(buffer);
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    while (syscall(__NR_io_uring_enter, ring_fd_, 1 /* To submit */,
+                   0 /* Min complete */, 0 /* Flags */, nullptr, 0) == -1) {
+      if (errno != EINTR) {
+        return absl::InternalError(
+            absl::StrCat("io_uring_enter: ", std::strerror(errno)));
+      }
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Wait(Buffer*& buffer, int64_t& result) override {
+    for (;;) {
+      const uint32_t head = *cq_head_;
+      if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        buffer = reinterpret_cast<Buffer*>(cqe.user_data);
+        result = cqe.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return absl::OkStatus();
+      }
+      if (syscall(__NR_io_uring_enter, ring_fd_, 0 /* To submit */,
+                  1 /* Min complete */, IORING_ENTER_GETEVENTS, nullptr,
+                  0) == -1 &&
+          errno != EINTR) {
+        return absl::InternalError(
+            absl::StrCat("io_uring_enter: ", std::strerror(errno)));
+      }
+    }
+  }
+
+ private:
+  explicit IoUringBackend(int fd) : fd_(fd) {}
+
+  int fd_;
+  int ring_fd_ = -1;
+  int capacity_ = 0;
+
+  void* sq_ring_ = MAP_FAILED;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = MAP_FAILED;
+  size_t cq_ring_size_ = 0;
+  void* sqes_ = MAP_FAILED;
+  size_t sqes_size_ = 0;
+
+  uint32_t* sq_tail_ = nullptr;
+  uint32_t sq_mask_ = 0;
+  uint32_t* sq_array_ = nullptr;
+  uint32_t* cq_head_ = nullptr;
+  uint32_t* cq_tail_ = nullptr;
+  uint32_t cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+std::string AsyncWriter::Stats::ToString() const {
+  return absl::StrFormat(
+      "%d KiB%s in %d writes (%s%s), %d buffers, max queue depth %d, stalled "
+      "%s, closed in %s, waited for writes %s",
+      bytes >> 10,
+      hole_bytes > 0 ? absl::StrFormat(" (%d KiB holes)", hole_bytes >> 10)
+                     : "",
+      writes, io_uring ? "io_uring" : "pwrite", direct_io ? ", O_DIRECT" : "",
+      buffers, max_queue_depth, absl::FormatDuration(stall_time),
+      absl::FormatDuration(close_time), absl::FormatDuration(write_time));
+}
+
+AsyncWriter::AsyncWriter(const Options& options, int fd, bool direct_io)
+    : options_(options), fd_(fd), direct_io_(direct_io) {}
+
+AsyncWriter::~AsyncWriter() {
+  if (!closed_) {
+    Close().IgnoreError();
+  }
+}
+
+absl::StatusOr<std::unique_ptr<AsyncWriter>> AsyncWriter::Create(
+    const std::string& path, const Options& options) {
+  if (options.buffer_size == 0 || options.buffer_size % kAlignment != 0 ||
+      options.max_buffers < 1 || options.max_buffers > kMaxBuffers ||
+      options.queue_depth < 1) {
+    return absl::InvalidArgumentError("Invalid writer options");
+  }
+
+  constexpr int kFlags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int fd = -1;
+  bool direct_io = false;
+  if (options.use_direct_io) {
+    // Not all filesystems support O_DIRECT, tmpfs for example.
+    fd = open(path.c_str(), kFlags | O_DIRECT, 0644);
+    direct_io = fd != -1;
+  }
+  if (fd == -1) {
+    fd = open(path.c_str(), kFlags, 0644);
+  }
+  if (fd == -1) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Could not open ", path, " for writing: ", std::strerror(errno)));
+  }
+
+  std::unique_ptr<AsyncWriter> writer(
+      new AsyncWriter(options, fd, direct_io));
+  if (options.use_io_uring) {
+    auto backend = IoUringBackend::Create(fd, options.queue_depth);
+    if (backend.ok()) {
+      writer->backend_ = std::move(backend).value();
+      writer->stats_.io_uring = true;
+    }
+  }
+  if (!writer->backend_) {
+    writer->backend_ = std::make_unique<PwriteBackend>(fd);
+  }
+  writer->thread_ = std::thread([w = writer.get()] { w->WriterLoop(); });
+  return writer;  // GCC 7 needs the extra move
+}
+
+void AsyncWriter::Append(const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    Buffer* buffer = current_ ? current_ : NextBuffer();
+    const size_t chunk = std::min(size, options_.buffer_size - buffer->size);
+    std::memcpy(buffer->data.get() + buffer->size, bytes, chunk);
+    buffer->size += chunk;
+    bytes += chunk;
+    size -= chunk;
+    if (buffer->size == options_.buffer_size) {
+      Flush();
+    }
+  }
+}
+
+void AsyncWriter::AppendFill(uint8_t value, size_t count) {
+  while (count > 0) {
+    Buffer* buffer = current_ ? current_ : NextBuffer();
+    const size_t chunk = std::min(count, options_.buffer_size - buffer->size);
+    std::memset(buffer->data.get() + buffer->size, value, chunk);
+    buffer->size += chunk;
+    count -= chunk;
+    if (buffer->size == options_.buffer_size) {
+      Flush();
+    }
+  }
+}
+
+void AsyncWriter::AppendHole(size_t count) {
+  // Fill up to the next aligned file offset, so that O_DIRECT can continue
+  // after the hole.
+  if (current_ != nullptr) {
+    const size_t unaligned = current_->size % kAlignment;
+    const size_t partial =
+        unaligned == 0 ? 0 : std::min(count, kAlignment - unaligned);
+    AppendFill(0, partial);
+    count -= partial;
+    if (count >= kAlignment && current_ != nullptr) {
+      Flush();
+    }
+  }
+  if (current_ == nullptr) {
+    const size_t hole = count / kAlignment * kAlignment;
+    offset_ += hole;
+    stats_.hole_bytes += hole;
+    count -= hole;
+  }
+  AppendFill(0, count);
+}
+
+AsyncWriter::Buffer* AsyncWriter::NextBuffer() {
+  Buffer* buffer = nullptr;
+  if (!free_.Pop(buffer)) {
+    if (buffers_.size() < options_.max_buffers) {
+      buffers_.push_back(std::make_unique<Buffer>());
+      buffer = buffers_.back().get();
+      buffer->data.reset(static_cast<uint8_t*>(
+          ABSL_DIE_IF_NULL(aligned_alloc(kAlignment, options_.buffer_size))));
+    } else {
+      // All buffers are queued, the storage cannot keep up.
+      const absl::Time start = absl::Now();
+      absl::MutexLock lock(&mutex_);
+      while (!free_.Pop(buffer)) {
+        free_pushed_.Wait(&mutex_);
+      }
+      stats_.stall_time += absl::Now() - start;
+    }
+  }
+  buffer->size = 0;
+  buffer->written = 0;
+  buffer->offset = offset_;
+  current_ = buffer;
+  return buffer;
+}
+
+void AsyncWriter::Flush() {
+  offset_ += current_->size;
+  const int depth = queued_.fetch_add(1, std::memory_order_relaxed) + 1;
+  stats_.max_queue_depth = std::max(stats_.max_queue_depth, depth);
+  full_.Push(current_);  // Cannot fail, there are at most kMaxBuffers
+  current_ = nullptr;
+  absl::MutexLock lock(&mutex_);
+  full_pushed_.Signal();
+}
+
+absl::Status AsyncWriter::Close() {
+  closed_ = true;
+  const int64_t size = offset_ + (current_ ? current_->size : 0);
+  if (current_ && current_->size > 0) {
+    // O_DIRECT needs whole blocks, the padding is truncated below.
+    const size_t aligned =
+        (current_->size + kAlignment - 1) / kAlignment * kAlignment;
+    std::memset(current_->data.get() + current_->size, 0,
+                aligned - current_->size);
+    current_->size = aligned;
+    Flush();
+  }
+
+  const absl::Time start = absl::Now();
+  {
+    absl::MutexLock lock(&mutex_);
+    closing_ = true;
+    full_pushed_.Signal();
+  }
+  thread_.join();
+  stats_.close_time = absl::Now() - start;
+
+  absl::Status status = status_;
+  // Truncates the padding, or extends the file over a final hole.
+  struct stat st;
+  if (status.ok() && (fstat(fd_, &st) == -1 || st.st_size != size) &&
+      ftruncate(fd_, size) == -1) {
+    status = absl::InternalError(
+        absl::StrCat("Could not truncate output: ", std::strerror(errno)));
+  }
+  if (close(fd_) == -1 && status.ok()) {
+    status = absl::InternalError(
+        absl::StrCat("Could not close output: ", std::strerror(errno)));
+  }
+  stats_.bytes = size;
+  stats_.writes = writes_;
+  stats_.buffers = buffers_.size();
+  stats_.write_time = write_time_;
+  stats_.direct_io = direct_io_;
+  return status;
+}
+
+void AsyncWriter::WriterLoop() {
+  int in_flight = 0;
+  for (;;) {
+    Buffer* buffer;
+    while (in_flight < backend_->capacity() && full_.Pop(buffer)) {
+      ++writes_;
+      if (Submit(buffer)) {
+        ++in_flight;
+      }
+    }
+    if (in_flight == 0) {
+      absl::MutexLock lock(&mutex_);
+      while (full_.size() == 0 && !closing_) {
+        full_pushed_.Wait(&mutex_);
+      }
+      if (full_.size() == 0) {
+        return;  // Closing, all written
+      }
+      continue;
+    }
+
+    const absl::Time start = absl::Now();
+    int64_t result;
+    if (auto status = backend_->Wait(buffer, result); !status.ok()) {
+      // Only happens for invalid arguments to io_uring_enter(). The buffers
+      // in flight are lost.
+      status_ = status;
+      return;
+    }
+    write_time_ += absl::Now() - start;
+    if (!Complete(buffer, result)) {
+      --in_flight;
+    }
+  }
+}
+
+bool AsyncWriter::Submit(Buffer* buffer) {
+  if (!status_.ok()) {
+    Recycle(buffer);  // Skip writing after the first error
+    return false;
+  }
+  buffer->direct_io = direct_io_;
+  if (auto status = backend_->Submit(
+          buffer, buffer->data.get() + buffer->written,
+          buffer->size - buffer->written, buffer->offset + buffer->written);
+      !status.ok()) {
+    status_ = status;
+    Recycle(buffer);
+    return false;
+  }
+  return true;
+}
+
+bool AsyncWriter::Complete(Buffer* buffer, int64_t result) {
+  if (result == -EINVAL && buffer->direct_io && buffer->written == 0) {
+    // Some filesystems accept O_DIRECT in open(), but reject the writes. All
+    // writes in flight fail then. The first failure turns O_DIRECT off, and
+    // each of them is retried without it.
+    if (direct_io_) {
+      const int flags = fcntl(fd_, F_GETFL);
+      if (flags != -1 && fcntl(fd_, F_SETFL, flags & ~O_DIRECT) != -1) {
+        direct_io_ = false;
+      }
+    }
+    if (!direct_io_) {
+      return Submit(buffer);
+    }
+  }
+  if (result <= 0) {
+    if (status_.ok()) {
+      status_ = absl::InternalError(absl::StrFormat(
+          "Could not write %d bytes at offset %d: %s", buffer->size,
+          buffer->offset,
+          result < 0 ? std::strerror(-result) : "No space left"));
+    }
+    Recycle(buffer);
+    return false;
+  }
+  buffer->written += result;
+  if (buffer->written < buffer->size) {
+    ++writes_;
+    return Submit(buffer);  // Short write
+  }
+  Recycle(buffer);
+  return false;
+}
+
+void AsyncWriter::Recycle(Buffer* buffer) {
+  free_.Push(buffer);
+  queued_.fetch_sub(1, std::memory_order_relaxed);
+  absl::MutexLock lock(&mutex_);
+  free_pushed_.Signal();
+}
+
+}  // namespace security::pawn
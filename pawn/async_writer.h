@@ -0,0 +1,220 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Sequential file output that never makes the caller wait for the
+// filesystem. Append() copies data into large, page-aligned buffers. Full
+// buffers travel through a lock-free single-producer/single-consumer ring to
+// a writer thread, which submits them with io_uring, keeping several writes
+// in flight. Without io_uring, the writer thread uses pwrite(). Files are
+// opened with O_DIRECT where the filesystem supports it, so that the dump
+// does not evict other data from the page cache.
+// The caller only waits if all buffers are queued, i.e. if the storage is
+// slower than the flash for Options::max_buffers buffers in a row. That time
+// is reported as stall time.
+
+#ifndef PAWN_ASYNC_WRITER_H_
+#define PAWN_ASYNC_WRITER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// kCapacity must be a power of two.
+template <typename T, size_t kCapacity>
+class SpscRing {
+ public:
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+  // Returns false if the ring is full. Producer only.
+  bool Push(T value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+      return false;
+    }
+    slots_[tail % kCapacity] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the ring is empty. Consumer only.
+  bool Pop(T& value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = std::move(slots_[head % kCapacity]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Number of elements, may be outdated by the time it returns.
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  // Keep the indices on separate cache lines, so that the producer and the
+  // consumer do not invalidate each other's.
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+  T slots_[kCapacity] = {};
+};
+
+class AsyncWriter {
+ public:
+  // Alignment of buffers, file offsets and sizes for O_DIRECT.
+  static constexpr size_t kAlignment = 4096;
+
+  // Limit for Options::max_buffers.
+  static constexpr int kMaxBuffers = 256;
+
+  struct Options {
+    // Size of each buffer, a multiple of kAlignment.
+    size_t buffer_size = 1 << 20;  // 1MiB
+
+    // Buffers are allocated on demand, up to this many.
+    int max_buffers = 64;
+
+    // Number of writes in flight with io_uring.
+    int queue_depth = 4;
+
+    bool use_io_uring = true;
+    bool use_direct_io = true;
+  };
+
+  struct Stats {
+    int64_t bytes = 0;  // File size
+    int64_t hole_bytes = 0;  // Not written, see AppendHole()
+    int64_t writes = 0;
+    int buffers = 0;  // Allocated
+    // Most buffers that were queued or being written at the same time
+    int max_queue_depth = 0;
+    // Time Append() waited for a buffer
+    absl::Duration stall_time;
+    // Time Close() waited for the remaining writes
+    absl::Duration close_time;
+    // Time the writer thread waited for writes to complete
+    absl::Duration write_time;
+    bool io_uring = false;
+    bool direct_io = false;
+
+    std::string ToString() const;
+  };
+
+  // Creates path, replacing any existing file. Falls back to pwrite() if
+  // io_uring is unavailable and to buffered I/O if O_DIRECT is.
+  static absl::StatusOr<std::unique_ptr<AsyncWriter>> Create(
+      const std::string& path, const Options& options);
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  // Closes the file if Close() was not called, ignoring errors.
+  ~AsyncWriter();
+
+  // Appends size bytes of data, or count copies of value, to the file.
+  void Append(const void* data, size_t size);
+  void AppendFill(uint8_t value, size_t count);
+
+  // Appends count bytes that read back as zeros. Whole kAlignment blocks are
+  // not written, but left as a hole in the file.
+  void AppendHole(size_t count);
+
+  // Writes all remaining data and closes the file. Returns the first error
+  // that occurred, if any. Must be called at most once.
+  absl::Status Close();
+
+  // Number of buffers that are queued or being written.
+  int queue_depth() const {
+    return queued_.load(std::memory_order_relaxed);
+  }
+
+  // Complete after Close().
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Buffer;
+  class Backend;
+  class PwriteBackend;
+  class IoUringBackend;
+
+  AsyncWriter(const Options& options, int fd, bool direct_io);
+
+  // Returns a buffer to append to, waiting for one if needed.
+  Buffer* NextBuffer();
+  // Hands the current buffer to the writer thread.
+  void Flush();
+
+  // Writer thread functions
+  void WriterLoop();
+  // Submits the unwritten part of buffer. Returns whether a write is in
+  // flight.
+  bool Submit(Buffer* buffer);
+  // Handles a completed write of buffer with the number of bytes written or a
+  // negative errno value. Returns whether a write is in flight again.
+  bool Complete(Buffer* buffer, int64_t result);
+  // Returns buffer to the producer.
+  void Recycle(Buffer* buffer);
+
+  const Options options_;
+  const int fd_;
+
+  std::unique_ptr<Backend> backend_;
+  std::thread thread_;
+  std::vector<std::unique_ptr<Buffer>> buffers_;  // Producer only
+
+  Buffer* current_ = nullptr;
+  int64_t offset_ = 0;  // File position of current_
+  bool closed_ = false;
+
+  SpscRing<Buffer*, kMaxBuffers> full_;  // To the writer thread
+  SpscRing<Buffer*, kMaxBuffers> free_;  // Back from the writer thread
+  std::atomic<int> queued_ = 0;
+
+  // Wakes up the side that waits for a ring. Only taken when a buffer changes
+  // hands, never while writing.
+  absl::Mutex mutex_;
+  absl::CondVar full_pushed_;
+  absl::CondVar free_pushed_;
+  bool closing_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Written by the writer thread, read after joining it
+  absl::Status status_;
+  int64_t writes_ = 0;
+  absl::Duration write_time_;
+  bool direct_io_;
+
+  Stats stats_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_ASYNC_WRITER_H_
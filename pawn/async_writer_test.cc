@@ -0,0 +1,208 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/async_writer.h"
+
+#include <sys/stat.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::AllOf;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+using ::testing::Le;
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+TEST(SpscRingTest, PushesAndPops) {
+  SpscRing<int, 4> ring;
+  int value;
+  EXPECT_THAT(ring.Pop(value), IsFalse());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_THAT(ring.Push(i), IsTrue());
+  }
+  EXPECT_THAT(ring.Push(4), IsFalse());
+  EXPECT_THAT(ring.size(), Eq(4));
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_THAT(ring.Pop(value), IsTrue());
+    EXPECT_THAT(value, Eq(i));
+  }
+  EXPECT_THAT(ring.Pop(value), IsFalse());
+}
+
+TEST(SpscRingTest, PassesValuesBetweenThreads) {
+  constexpr int kCount = 100000;
+  SpscRing<int, 16> ring;
+  std::thread producer([&ring] {
+    for (int i = 0; i < kCount; ++i) {
+      while (!ring.Push(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  bool in_order = true;
+  while (expected < kCount) {
+    int value;
+    if (!ring.Pop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    in_order = in_order && value == expected;
+    ++expected;
+  }
+  producer.join();
+  EXPECT_THAT(in_order, IsTrue());
+}
+
+// Returns a path in the test's temporary directory unique to the running
+// test.
+std::string TestOutputPath() {
+  const ::testing::TestInfo* info =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  std::string name =
+      absl::StrCat(info->test_suite_name(), ".", info->name());
+  std::replace(name.begin(), name.end(), '/', '_');
+  return absl::StrCat(::testing::TempDir(), "/", name);
+}
+
+// Parameters are whether to use io_uring and O_DIRECT.
+class AsyncWriterTest
+    : public ::testing::TestWithParam<std::tuple<bool, bool>> {
+ protected:
+  AsyncWriter::Options MakeOptions() const {
+    AsyncWriter::Options options;
+    options.buffer_size = AsyncWriter::kAlignment;
+    options.max_buffers = 2;
+    options.queue_depth = 2;
+    options.use_io_uring = std::get<0>(GetParam());
+    options.use_direct_io = std::get<1>(GetParam());
+    return options;
+  }
+
+  // ctest runs each test in a process of its own, possibly in parallel.
+  std::string path_ = TestOutputPath();
+};
+
+TEST_P(AsyncWriterTest, WritesAppendedData) {
+  auto writer = AsyncWriter::Create(path_, MakeOptions());
+  ASSERT_THAT(writer.ok(), IsTrue()) << writer.status();
+
+  // Many buffers' worth of blocks and fills, ending in a partial block.
+  std::string expected;
+  for (int i = 0; i < 1000; ++i) {
+    const std::string block(64, static_cast<char>(i));
+    (*writer)->Append(block.data(), block.size());
+    expected += block;
+    if (i % 7 == 0) {
+      (*writer)->AppendFill(0xFF, 100 + i);
+      expected.append(100 + i, '\xFF');
+    }
+  }
+  (*writer)->Append("tail", 4);
+  expected += "tail";
+
+  ASSERT_THAT((*writer)->Close().ok(), IsTrue());
+  EXPECT_THAT((*writer)->queue_depth(), Eq(0));
+  EXPECT_THAT(ReadFile(path_), Eq(expected));
+
+  const AsyncWriter::Stats& stats = (*writer)->stats();
+  EXPECT_THAT(stats.bytes, Eq(expected.size()));
+  EXPECT_THAT(stats.writes, Ge(expected.size() / AsyncWriter::kAlignment));
+  // A second buffer is only needed if the first one is still being written.
+  EXPECT_THAT(stats.buffers, AllOf(Ge(1), Le(2)));
+  EXPECT_THAT(stats.max_queue_depth, Ge(1));
+  if (!std::get<0>(GetParam())) {
+    EXPECT_THAT(stats.io_uring, IsFalse());
+  }
+  if (!std::get<1>(GetParam())) {
+    EXPECT_THAT(stats.direct_io, IsFalse());
+  }
+}
+
+TEST_P(AsyncWriterTest, WritesEmptyFile) {
+  auto writer = AsyncWriter::Create(path_, MakeOptions());
+  ASSERT_THAT(writer.ok(), IsTrue()) << writer.status();
+  ASSERT_THAT((*writer)->Close().ok(), IsTrue());
+  EXPECT_THAT(ReadFile(path_), Eq(""));
+}
+
+TEST_P(AsyncWriterTest, LeavesHoles) {
+  auto writer = AsyncWriter::Create(path_, MakeOptions());
+  ASSERT_THAT(writer.ok(), IsTrue()) << writer.status();
+
+  // Holes at unaligned offsets, smaller than a block, spanning a buffer and
+  // at the end of the file.
+  std::string expected;
+  for (size_t hole : {size_t{10}, AsyncWriter::kAlignment * 3 + 5,
+                      size_t{1} << 21}) {
+    (*writer)->Append("data", 4);
+    (*writer)->AppendHole(hole);
+    expected += "data";
+    expected.append(hole, '\0');
+  }
+  ASSERT_THAT((*writer)->Close().ok(), IsTrue());
+  EXPECT_THAT(ReadFile(path_), Eq(expected));
+  EXPECT_THAT((*writer)->stats().hole_bytes,
+              Ge(AsyncWriter::kAlignment * 2 + (size_t{1} << 21) -
+                 AsyncWriter::kAlignment));
+
+  struct stat st;
+  ASSERT_THAT(stat(path_.c_str(), &st), Eq(0));
+  EXPECT_THAT(st.st_size, Eq(expected.size()));
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AsyncWriterTest,
+                         ::testing::Combine(::testing::Bool(),
+                                            ::testing::Bool()));
+
+TEST(AsyncWriterCreateTest, FailsForBadPathOrOptions) {
+  EXPECT_THAT(
+      AsyncWriter::Create(::testing::TempDir() + "/missing/output", {})
+          .status()
+          .code(),
+      Eq(absl::StatusCode::kFailedPrecondition));
+
+  AsyncWriter::Options options;
+  options.buffer_size = 1000;
+  EXPECT_THAT(AsyncWriter::Create(::testing::TempDir() + "/async_writer_bad",
+                                  options)
+                  .status()
+                  .code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -0,0 +1,123 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/bios_window.h"
+
+#include <immintrin.h>  // _mm_stream_load_si128()
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr uint64_t k4GiB = uint64_t{1} << 32;
+
+// Copies with 16-byte non-temporal loads (MOVNTDQA). These avoid polluting
+// the cache on write-combining mappings and are plain wide loads otherwise.
+// src must be 16-byte aligned.
+__attribute__((target("sse4.1"))) void CopyStreaming(
+    uint8_t* dest, const volatile uint8_t* src, size_t size) {
+  for (size_t i = 0; i < size; i += 16) {
+    auto* p = const_cast<__m128i*>(
+        reinterpret_cast<const volatile __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_stream_load_si128(p));
+  }
+}
+
+// Copies with 64-bit loads. Without prefetching, each load turns into a
+// separate SPI read, so there is nothing to gain from wider ones.
+void CopyQwords(uint8_t* dest, const volatile uint8_t* src, size_t size) {
+  for (size_t i = 0; i < size; i += 8) {
+    const uint64_t value = *reinterpret_cast<const volatile uint64_t*>(src + i);
+    std::memcpy(dest + i, &value, sizeof(value));
+  }
+}
+
+}  // namespace
+
+BiosWindow::BiosWindow(std::unique_ptr<PhysicalMemory> mem,
+                       int64_t flash_address, int64_t size, bool prefetch)
+    : mem_(std::move(mem)),
+      flash_address_(flash_address),
+      size_(size),
+      prefetch_(prefetch) {}
+
+BiosWindow::~BiosWindow() = default;
+
+absl::StatusOr<std::unique_ptr<BiosWindow>> BiosWindow::Create(
+    Chipset& chipset) {
+  const Chipset::FregN bios = chipset.ReadFregNRegister(1);
+  if (bios.region_base > bios.region_limit) {
+    return absl::NotFoundError("No BIOS region");
+  }
+  const Chipset::BiosCntl bios_cntl = chipset.ReadBiosCntlRegister();
+  if (bios_cntl.top_swap_status) {
+    // Top swap exchanges the topmost blocks of the window.
+    return absl::FailedPreconditionError("Top swap is active");
+  }
+
+  const int64_t size = std::min<int64_t>(
+      int64_t{bios.region_limit} - bios.region_base + 1, kMaxSize);
+  // The window is read in bulk, prefault it.
+  auto mem = chipset.MapPhysicalMemory(k4GiB - size, size, /*populate=*/true);
+  if (!mem.ok()) {
+    return mem.status();
+  }
+  return absl::WrapUnique(new BiosWindow(
+      std::move(mem).value(), int64_t{bios.region_limit} + 1 - size, size,
+      bios_cntl.spi_read_configuration == Chipset::kSrcPrefetchAndCache));
+}
+
+bool BiosWindow::Contains(int64_t flash_address, int64_t size) const {
+  return flash_address >= flash_address_ &&
+         flash_address + size <= flash_address_ + size_;
+}
+
+void BiosWindow::Read(int64_t flash_address,
+                      absl::Span<uint8_t> data) const {
+  const int64_t offset = flash_address - flash_address_;
+  const auto* base = static_cast<const volatile uint8_t*>(mem_->MmioBase());
+  if (base == nullptr) {
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = mem_->ReadUint8(offset + i);
+    }
+    return;
+  }
+
+  const volatile uint8_t* src = base + offset;
+  size_t done = 0;
+  if (reinterpret_cast<uintptr_t>(src) % 16 == 0) {
+    done = data.size() / 16 * 16;
+    if (prefetch_ && __builtin_cpu_supports("sse4.1")) {
+      CopyStreaming(data.data(), src, done);
+    } else {
+      CopyQwords(data.data(), src, done);
+    }
+  }
+  for (; done < data.size(); ++done) {
+    data[done] = src[done];
+  }
+}
+
+}  // namespace security::pawn
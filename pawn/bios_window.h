@@ -0,0 +1,84 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reads the BIOS region through its memory-mapped decode window. The chipset
+// decodes the end of the BIOS region (FREG1) directly below 4GiB, so that the
+// CPU can execute firmware from it. Copying from that window lets the SPI
+// controller stream data, instead of issuing one 64-byte hardware sequencing
+// cycle at a time and polling for its completion.
+// Use like this:
+//   auto window = BiosWindow::Create(*chipset);
+//   QCHECK_OK(window.status());
+//   if ((*window)->Contains(flash_address, data.size())) {
+//     (*window)->Read(flash_address, absl::MakeSpan(data));
+//   }
+
+#ifndef PAWN_BIOS_WINDOW_H_
+#define PAWN_BIOS_WINDOW_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+class PhysicalMemory;
+
+class BiosWindow {
+ public:
+  // Only the last 16MiB of the BIOS region are decoded by default.
+  static constexpr int64_t kMaxSize = 16 << 20;
+
+  BiosWindow(const BiosWindow&) = delete;
+  BiosWindow& operator=(const BiosWindow&) = delete;
+
+  ~BiosWindow();
+
+  // Maps the decode window of the BIOS region. Returns an error if there is no
+  // BIOS region or if the window does not match the flash layout because top
+  // swap is active.
+  static absl::StatusOr<std::unique_ptr<BiosWindow>> Create(Chipset& chipset);
+
+  // Flash linear address range covered by the window.
+  int64_t flash_address() const { return flash_address_; }
+  int64_t size() const { return size_; }
+
+  // Whether the SPI controller prefetches window reads (BIOS_CNTL SRC), in
+  // which case wide loads are used.
+  bool prefetch() const { return prefetch_; }
+
+  // Returns whether size bytes at flash linear address flash_address can be
+  // read through the window.
+  bool Contains(int64_t flash_address, int64_t size) const;
+
+  // Copies data.size() bytes at flash linear address flash_address into data.
+  // The range must be contained in the window.
+  void Read(int64_t flash_address, absl::Span<uint8_t> data) const;
+
+ private:
+  BiosWindow(std::unique_ptr<PhysicalMemory> mem, int64_t flash_address,
+             int64_t size, bool prefetch);
+
+  std::unique_ptr<PhysicalMemory> mem_;
+  int64_t flash_address_;
+  int64_t size_;
+  bool prefetch_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_BIOS_WINDOW_H_
@@ -0,0 +1,107 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/bios_window.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/physical_memory.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr int kFlashSize = 1 << 20;  // 1MiB
+
+class BiosWindowTest : public ::testing::Test {
+ protected:
+  void SetUpDevice(const SimulatedDevice::Options& options) {
+    auto device = SimulatedDevice::Create(
+        SimulatedDevice::MakeFlashImage(kFlashSize), options);
+    ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+    device_ = std::move(device).value();
+    Chipset::HardwareId hw_id;
+    auto chipset = Chipset::Create(device_->pci(), hw_id);
+    ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+    chipset_ = std::move(chipset).value();
+    chipset_->set_memory_mapper(device_->memory_mapper());
+    ASSERT_THAT(chipset_->MapSpiRegisters().ok(), IsTrue());
+  }
+
+  std::unique_ptr<SimulatedDevice> device_;
+  std::unique_ptr<Chipset> chipset_;
+};
+
+TEST_F(BiosWindowTest, ReadsBiosRegion) {
+  SimulatedDevice::Options options;
+  options.bios_cntl = 0x08;  // SRC: Prefetching and caching enabled
+  SetUpDevice(options);
+
+  auto window = BiosWindow::Create(*chipset_);
+  ASSERT_THAT(window.ok(), IsTrue()) << window.status();
+  // FREG1 covers everything but the first 4KiB.
+  EXPECT_THAT((*window)->flash_address(), Eq(0x1000));
+  EXPECT_THAT((*window)->size(), Eq(kFlashSize - 0x1000));
+  EXPECT_THAT((*window)->prefetch(), IsTrue());
+  EXPECT_THAT((*window)->Contains(0x1000, kFlashSize - 0x1000), IsTrue());
+  EXPECT_THAT((*window)->Contains(0x0FC0, 0x80), IsFalse());
+
+  std::vector<uint8_t> data(kFlashSize - 0x1000);
+  (*window)->Read(0x1000, absl::MakeSpan(data));
+  EXPECT_THAT(std::string(data.begin(), data.end()),
+              Eq(device_->flash_image().substr(0x1000)));
+
+  // Unaligned reads
+  std::vector<uint8_t> small(21);
+  (*window)->Read(0x2003, absl::MakeSpan(small));
+  EXPECT_THAT(std::string(small.begin(), small.end()),
+              Eq(device_->flash_image().substr(0x2003, 21)));
+}
+
+TEST_F(BiosWindowTest, ReadsWithoutPrefetch) {
+  SetUpDevice({});
+
+  auto window = BiosWindow::Create(*chipset_);
+  ASSERT_THAT(window.ok(), IsTrue()) << window.status();
+  EXPECT_THAT((*window)->prefetch(), IsFalse());
+  std::vector<uint8_t> data(0x1000);
+  (*window)->Read(0x80000, absl::MakeSpan(data));
+  EXPECT_THAT(std::string(data.begin(), data.end()),
+              Eq(device_->flash_image().substr(0x80000, 0x1000)));
+}
+
+TEST_F(BiosWindowTest, RejectsTopSwap) {
+  SimulatedDevice::Options options;
+  options.bios_cntl = 0x10;  // TSS
+  SetUpDevice(options);
+
+  EXPECT_THAT(BiosWindow::Create(*chipset_).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+}  // namespace security::pawn
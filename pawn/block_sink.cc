@@ -0,0 +1,224 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/block_sink.h"
+
+#include <emmintrin.h>  // _mm_cmpeq_epi8()
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+
+bool IsErased(absl::Span<const uint8_t> data) {
+  const uint8_t* p = data.data();
+  const uint8_t* const end = p + data.size();
+  // AND four vectors together, so that there is only one compare and branch
+  // per cache line.
+  for (; end - p >= 64; p += 64) {
+    const __m128i v = _mm_and_si128(
+        _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+                      _mm_loadu_si128(
+                          reinterpret_cast<const __m128i*>(p + 16))),
+        _mm_and_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48))));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(-1))) != 0xFFFF) {
+      return false;
+    }
+  }
+  return std::all_of(p, end, [](uint8_t byte) { return byte == 0xFF; });
+}
+
+SinkGraph::SinkGraph(const Options& options) : options_(options) {
+  for (int i = 0; i < options_.num_threads; ++i) {
+    threads_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+SinkGraph::~SinkGraph() {
+  Stop();
+  // Unconsumed slices return to the pool, which needs to be still around.
+  for (auto& node : nodes_) {
+    node->queue.clear();
+  }
+}
+
+void SinkGraph::AddSink(std::unique_ptr<BlockSink> sink) {
+  absl::MutexLock lock(&mutex_);
+  nodes_.push_back(std::make_unique<Node>());
+  nodes_.back()->sink = std::move(sink);
+}
+
+std::shared_ptr<BlockSlice> SinkGraph::Allocate(int64_t flash_address,
+                                                int size, int block_size) {
+  std::unique_ptr<BlockSlice> slice;
+  {
+    const absl::Time start = absl::Now();
+    absl::MutexLock lock(&mutex_);
+    if (slices_in_use_ == options_.max_slices) {
+      ++waiting_allocations_;
+      while (slices_in_use_ == options_.max_slices) {
+        progress_.Wait(&mutex_);
+      }
+      --waiting_allocations_;
+      stats_.backpressure_time += absl::Now() - start;
+    }
+    ++slices_in_use_;
+    if (!free_slices_.empty()) {
+      slice = std::move(free_slices_.back());
+      free_slices_.pop_back();
+    }
+  }
+  if (!slice) {
+    slice = std::make_unique<BlockSlice>();
+  }
+  slice->flash_address = flash_address;
+  slice->block_size = block_size;
+  slice->data.resize(size);
+  slice->block_status.assign(size / block_size, Chipset::kBlockNotRead);
+  return std::shared_ptr<BlockSlice>(
+      slice.release(), [this](BlockSlice* slice) { Release(slice); });
+}
+
+int SinkGraph::num_waiting_allocations() const {
+  absl::MutexLock lock(&mutex_);
+  return waiting_allocations_;
+}
+
+void SinkGraph::Release(BlockSlice* slice) {
+  absl::MutexLock lock(&mutex_);
+  free_slices_.emplace_back(slice);
+  --slices_in_use_;
+  progress_.SignalAll();
+}
+
+void SinkGraph::Publish(std::shared_ptr<const BlockSlice> slice) {
+  {
+    absl::MutexLock lock(&mutex_);
+    ++stats_.slices;
+    for (auto& node : nodes_) {
+      if (node->status.ok()) {
+        node->queue.push_back(slice);
+      }
+    }
+    work_available_.SignalAll();
+  }
+  // Without any sinks, the last reference goes away here, outside the lock.
+}
+
+SinkGraph::Node* SinkGraph::FindWork() {
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    Node* node = nodes_[(next_node_ + i) % nodes_.size()].get();
+    if (!node->busy && !node->queue.empty()) {
+      next_node_ = (next_node_ + i + 1) % nodes_.size();
+      return node;
+    }
+  }
+  return nullptr;
+}
+
+bool SinkGraph::Idle() const {
+  return std::all_of(nodes_.begin(), nodes_.end(), [](const auto& node) {
+    return !node->busy && node->queue.empty();
+  });
+}
+
+void SinkGraph::WorkerLoop() {
+  mutex_.Lock();
+  for (;;) {
+    Node* node;
+    while ((node = FindWork()) == nullptr && !stopping_) {
+      work_available_.Wait(&mutex_);
+    }
+    if (node == nullptr) {
+      break;
+    }
+    std::shared_ptr<const BlockSlice> slice = std::move(node->queue.front());
+    node->queue.pop_front();
+    node->busy = true;
+    mutex_.Unlock();
+
+    absl::Status status = node->sink->Consume(*slice);
+    slice.reset();  // May release the slice, which takes the lock
+
+    std::deque<std::shared_ptr<const BlockSlice>> dropped;
+    mutex_.Lock();
+    node->busy = false;
+    if (!status.ok()) {
+      node->status = std::move(status);
+      // A lagging sink may hold the last references, drop them unlocked.
+      dropped.swap(node->queue);
+    }
+    // Another thread may pick up the next slice for this sink.
+    work_available_.Signal();
+    progress_.SignalAll();
+    if (!dropped.empty()) {
+      mutex_.Unlock();
+      dropped.clear();
+      mutex_.Lock();
+    }
+  }
+  mutex_.Unlock();
+}
+
+absl::Status SinkGraph::Finish() {
+  {
+    absl::MutexLock lock(&mutex_);
+    while (!Idle()) {
+      progress_.Wait(&mutex_);
+    }
+  }
+  Stop();
+
+  absl::Status result;
+  for (auto& node : nodes_) {
+    absl::Status status = node->status;
+    if (status.ok()) {
+      status = node->sink->Finish();
+    }
+    if (!status.ok() && result.ok()) {
+      result = absl::Status(status.code(), absl::StrCat(node->sink->name(),
+                                                        ": ",
+                                                        status.message()));
+    }
+  }
+  return result;
+}
+
+void SinkGraph::Stop() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+    work_available_.SignalAll();
+  }
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+}  // namespace security::pawn
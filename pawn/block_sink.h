@@ -0,0 +1,169 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Fan-out of read flash blocks to several consumers. The reader publishes
+// each run of blocks once, as an immutable, reference-counted BlockSlice, and
+// every BlockSink added to a SinkGraph consumes it on a small thread pool.
+// Each sink sees all slices in publication order, one at a time, while
+// different sinks run concurrently. Slice memory is recycled once all sinks
+// are done with it. At most Options::max_slices slices are in use, after that
+// the reader waits in Allocate(), which bounds memory and lets slow sinks
+// throttle reading.
+// Use like this:
+//   SinkGraph graph({});
+//   graph.AddSink(std::move(sink));
+//   for (...) {
+//     std::shared_ptr<BlockSlice> slice = graph.Allocate(fla, size, 64);
+//     ... read into slice->data, set slice->block_status ...
+//     graph.Publish(std::move(slice));
+//   }
+//   QCHECK_OK(graph.Finish());
+
+#ifndef PAWN_BLOCK_SINK_H_
+#define PAWN_BLOCK_SINK_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+// Consecutive blocks read at flash_address, with the status of each. The
+// contents of blocks whose status is not kBlockOk are undefined.
+struct BlockSlice {
+  int64_t flash_address = 0;
+  int block_size = 0;
+  std::vector<uint8_t> data;
+  std::vector<Chipset::BlockStatus> block_status;
+
+  int num_blocks() const { return block_status.size(); }
+  bool ok(int index) const { return block_status[index] == Chipset::kBlockOk; }
+  absl::Span<const uint8_t> block(int index) const {
+    return absl::MakeConstSpan(data).subspan(index * block_size, block_size);
+  }
+};
+
+// Returns whether data is all 0xFF, the value of erased flash. Checks 64
+// bytes per iteration with SSE2.
+bool IsErased(absl::Span<const uint8_t> data);
+
+class BlockSink {
+ public:
+  virtual ~BlockSink() = default;
+
+  // Short description for reports, for example the output filename.
+  virtual std::string name() const = 0;
+
+  // Called for each slice, in publication order. Calls for a single sink
+  // never overlap. After an error, the sink gets no more slices.
+  virtual absl::Status Consume(const BlockSlice& slice) = 0;
+
+  // Called once after the last slice.
+  virtual absl::Status Finish() { return absl::OkStatus(); }
+
+  // Returns a one-line summary of the results, available after Finish().
+  virtual std::string Summary() const { return ""; }
+};
+
+class SinkGraph {
+ public:
+  struct Options {
+    int num_threads = 2;
+
+    // Slices that may be in use at the same time.
+    int max_slices = 16;
+  };
+
+  struct Stats {
+    int64_t slices = 0;
+    // Time Allocate() waited for sinks to release a slice
+    absl::Duration backpressure_time;
+  };
+
+  explicit SinkGraph(const Options& options);
+
+  SinkGraph(const SinkGraph&) = delete;
+  SinkGraph& operator=(const SinkGraph&) = delete;
+
+  // Stops the threads, unconsumed slices are dropped.
+  ~SinkGraph();
+
+  // Adds a sink. Must be called before the first Publish().
+  void AddSink(std::unique_ptr<BlockSink> sink);
+
+  // Returns a slice for size bytes at flash_address to read into. Its
+  // block_status is all kBlockNotRead. Waits while max_slices are in use.
+  std::shared_ptr<BlockSlice> Allocate(int64_t flash_address, int size,
+                                       int block_size);
+
+  // Hands a filled slice to all sinks.
+  void Publish(std::shared_ptr<const BlockSlice> slice);
+
+  // Waits until all sinks consumed all slices, then finishes them. Returns
+  // the first error of any sink.
+  absl::Status Finish();
+
+  int num_sinks() const { return nodes_.size(); }
+  const BlockSink& sink(int index) const { return *nodes_[index]->sink; }
+  const Stats& stats() const { return stats_; }
+
+  // Number of Allocate() calls currently waiting for a slice. For testing.
+  int num_waiting_allocations() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Node {
+    std::unique_ptr<BlockSink> sink;
+    std::deque<std::shared_ptr<const BlockSlice>> queue;
+    bool busy = false;
+    absl::Status status;
+  };
+
+  void WorkerLoop();
+  // Returns a node with work that no other thread works on, or nullptr.
+  Node* FindWork() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool Idle() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Release(BlockSlice* slice) ABSL_LOCKS_EXCLUDED(mutex_);
+  void Stop();
+
+  const Options options_;
+  std::vector<std::thread> threads_;
+  Stats stats_;
+
+  mutable absl::Mutex mutex_;
+  absl::CondVar work_available_;
+  absl::CondVar progress_;
+  // Nodes are only added before the threads have anything to do.
+  std::vector<std::unique_ptr<Node>> nodes_;
+  size_t next_node_ ABSL_GUARDED_BY(mutex_) = 0;  // For round robin
+  std::vector<std::unique_ptr<BlockSlice>> free_slices_
+      ABSL_GUARDED_BY(mutex_);
+  int slices_in_use_ ABSL_GUARDED_BY(mutex_) = 0;
+  int waiting_allocations_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_BLOCK_SINK_H_
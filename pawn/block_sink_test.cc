@@ -0,0 +1,219 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/block_sink.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+// Records the first byte and address of every slice.
+class RecordingSink : public BlockSink {
+ public:
+  struct Record {
+    std::vector<int64_t> addresses;
+    std::vector<uint8_t> first_bytes;
+    bool finished = false;
+  };
+
+  explicit RecordingSink(Record* record, absl::Notification* wait = nullptr)
+      : record_(record), wait_(wait) {}
+
+  std::string name() const override { return "recording"; }
+
+  absl::Status Consume(const BlockSlice& slice) override {
+    if (wait_ != nullptr) {
+      wait_->WaitForNotification();
+    }
+    record_->addresses.push_back(slice.flash_address);
+    record_->first_bytes.push_back(slice.data[0]);
+    return absl::OkStatus();
+  }
+
+  absl::Status Finish() override {
+    record_->finished = true;
+    return absl::OkStatus();
+  }
+
+ private:
+  Record* record_;
+  absl::Notification* wait_;
+};
+
+class FailingSink : public BlockSink {
+ public:
+  explicit FailingSink(absl::Notification* wait = nullptr) : wait_(wait) {}
+
+  std::string name() const override { return "failing"; }
+  absl::Status Consume(const BlockSlice& slice) override {
+    if (wait_ != nullptr) {
+      wait_->WaitForNotification();
+    }
+    return absl::DataLossError("Broken");
+  }
+
+ private:
+  absl::Notification* wait_;
+};
+
+// Notifies once it consumed count slices.
+class CountingSink : public BlockSink {
+ public:
+  CountingSink(int count, absl::Notification* done)
+      : count_(count), done_(done) {}
+
+  std::string name() const override { return "counting"; }
+  absl::Status Consume(const BlockSlice& slice) override {
+    if (--count_ == 0) {
+      done_->Notify();
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  int count_;
+  absl::Notification* done_;
+};
+
+void PublishSlices(SinkGraph& graph, int count) {
+  for (int i = 0; i < count; ++i) {
+    std::shared_ptr<BlockSlice> slice =
+        graph.Allocate(i * 128, 128, 64 /* Block size */);
+    slice->data[0] = i;
+    graph.Publish(std::move(slice));
+  }
+}
+
+TEST(IsErasedTest, FindsNonErasedBytesAnywhere) {
+  std::vector<uint8_t> data(200, 0xFF);
+  EXPECT_THAT(IsErased(data), IsTrue());
+  EXPECT_THAT(IsErased({}), IsTrue());
+  for (int i = 0; i < data.size(); ++i) {
+    data[i] = 0xFE;
+    EXPECT_THAT(IsErased(data), IsFalse()) << i;
+    data[i] = 0xFF;
+  }
+}
+
+TEST(SinkGraphTest, AllocatesUnreadBlocks) {
+  SinkGraph graph({});
+  std::shared_ptr<BlockSlice> slice = graph.Allocate(0x1000, 256, 64);
+  EXPECT_THAT(slice->flash_address, Eq(0x1000));
+  EXPECT_THAT(slice->data.size(), Eq(256));
+  EXPECT_THAT(slice->block_status,
+              ElementsAre(Chipset::kBlockNotRead, Chipset::kBlockNotRead,
+                          Chipset::kBlockNotRead, Chipset::kBlockNotRead));
+  EXPECT_THAT(slice->block(1).data(), Eq(&slice->data[64]));
+}
+
+TEST(SinkGraphTest, DeliversSlicesInOrderToAllSinks) {
+  SinkGraph::Options options;
+  options.max_slices = 2;
+  SinkGraph graph(options);
+  RecordingSink::Record first, second;
+  graph.AddSink(std::make_unique<RecordingSink>(&first));
+  graph.AddSink(std::make_unique<RecordingSink>(&second));
+  PublishSlices(graph, 5);
+  EXPECT_THAT(graph.Finish().ok(), IsTrue());
+
+  for (const auto* record : {&first, &second}) {
+    EXPECT_THAT(record->addresses, ElementsAre(0, 128, 256, 384, 512));
+    EXPECT_THAT(record->first_bytes, ElementsAre(0, 1, 2, 3, 4));
+    EXPECT_THAT(record->finished, IsTrue());
+  }
+  EXPECT_THAT(graph.stats().slices, Eq(5));
+}
+
+TEST(SinkGraphTest, ReusesSlices) {
+  SinkGraph graph({});
+  const BlockSlice* first = graph.Allocate(0, 64, 64).get();
+  EXPECT_THAT(graph.Allocate(64, 64, 64).get(), Eq(first));
+}
+
+TEST(SinkGraphTest, WaitsForSlowSinks) {
+  SinkGraph::Options options;
+  options.max_slices = 1;
+  SinkGraph graph(options);
+  RecordingSink::Record record;
+  absl::Notification consume;
+  graph.AddSink(std::make_unique<RecordingSink>(&record, &consume));
+  graph.Publish(graph.Allocate(0, 64, 64));
+  // The only slice is still in use, so this one has to wait for it.
+  std::thread allocator([&graph] { graph.Allocate(64, 64, 64); });
+  while (graph.num_waiting_allocations() == 0) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  consume.Notify();
+  allocator.join();
+  EXPECT_THAT(graph.Finish().ok(), IsTrue());
+  EXPECT_THAT(graph.stats().backpressure_time > absl::ZeroDuration(),
+              IsTrue());
+}
+
+TEST(SinkGraphTest, ReportsSinkErrors) {
+  SinkGraph graph({});
+  RecordingSink::Record record;
+  graph.AddSink(std::make_unique<FailingSink>());
+  graph.AddSink(std::make_unique<RecordingSink>(&record));
+  PublishSlices(graph, 3);
+  const absl::Status status = graph.Finish();
+  EXPECT_THAT(status.code(), Eq(absl::StatusCode::kDataLoss));
+  EXPECT_THAT(status.message(), HasSubstr("failing: Broken"));
+  // Other sinks are not affected.
+  EXPECT_THAT(record.addresses.size(), Eq(3));
+  EXPECT_THAT(record.finished, IsTrue());
+}
+
+TEST(SinkGraphTest, DropsQueueOfLaggingFailedSink) {
+  SinkGraph graph({});
+  absl::Notification fail, fast_done;
+  graph.AddSink(std::make_unique<FailingSink>(&fail));
+  graph.AddSink(std::make_unique<CountingSink>(5, &fast_done));
+  PublishSlices(graph, 5);
+  // The failing sink's queue now holds the last references to four slices.
+  fast_done.WaitForNotification();
+  fail.Notify();
+  EXPECT_THAT(graph.Finish().code(), Eq(absl::StatusCode::kDataLoss));
+}
+
+TEST(SinkGraphTest, DropsSlicesWithoutSinks) {
+  SinkGraph::Options options;
+  options.max_slices = 1;
+  SinkGraph graph(options);
+  PublishSlices(graph, 3);
+  EXPECT_THAT(graph.Finish().ok(), IsTrue());
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -12,8 +12,6 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <vector>
-
 #include "pawn/chipset.h"
 
 #include "absl/log/die_if_null.h"
@@ -21,6 +19,9 @@
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "pawn/chipset_intel_100_series.h"
+#include "pawn/chipset_intel_200_series.h"
+#include "pawn/chipset_intel_300_series.h"
 #include "pawn/chipset_intel_6_series.h"
 #include "pawn/chipset_intel_7_series.h"
 #include "pawn/chipset_intel_8_series.h"
@@ -28,11 +29,27 @@
 #include "pawn/chipset_intel_ich10.h"
 #include "pawn/chipset_intel_ich8.h"
 #include "pawn/chipset_intel_ich9.h"
+#include "pawn/hardware_sequencing.h"
+#include "pawn/mapping_pool.h"
 #include "pawn/pci.h"
 #include "pawn/physical_memory.h"
 
 namespace security::pawn {
 
+Chipset::Chipset(const HardwareId& probed_id, Pci& pci)
+    : hardware_id_(probed_id), pci_(&pci) {}
+
+Chipset::~Chipset() = default;
+
+template <typename ChipsetT>
+std::unique_ptr<Chipset> Chipset::Make(const HardwareId& hw_id, Pci& pci,
+                                       const ReadEngine& read_engine) {
+  std::unique_ptr<Chipset> chipset =
+      absl::make_unique<ChipsetT>(Tag{}, hw_id, pci);
+  chipset->read_engine_ = read_engine;
+  return chipset;
+}
+
 absl::StatusOr<std::unique_ptr<Chipset>> Chipset::Create(
     Pci& pci, Chipset::HardwareId& probed_id) {
   const Chipset::HardwareId hw_id = {pci.ReadConfigUint16(pci::kVidRegister),
@@ -44,26 +61,44 @@ absl::StatusOr<std::unique_ptr<Chipset>> Chipset::Create(
         "Only Intel chipsets are currently supported");
   }
 
+  // ICH8 has the SPI registers at a different offset, all later generations
+  // up to the 9 Series share the ICH9 layout. The 100 Series and later have a
+  // wider FCYCLE and FLA, and a separate SPIBAR.
+  constexpr const ReadEngine& kIch8Engine =
+      HardwareSequencingEngine<IntelIch8Chipset>::kEngine;
+  constexpr const ReadEngine& kIch9Engine =
+      HardwareSequencingEngine<IntelIch9Chipset>::kEngine;
+  constexpr const ReadEngine& k100SeriesEngine =
+      HardwareSequencingEngine<Intel100SeriesChipset>::kEngine;
   if (IntelIch8Chipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<IntelIch8Chipset>(Tag{}, hw_id, pci);
+    return Make<IntelIch8Chipset>(hw_id, pci, kIch8Engine);
   }
   if (IntelIch9Chipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<IntelIch9Chipset>(Tag{}, hw_id, pci);
+    return Make<IntelIch9Chipset>(hw_id, pci, kIch9Engine);
   }
   if (IntelIch10Chipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<IntelIch10Chipset>(Tag{}, hw_id, pci);
+    return Make<IntelIch10Chipset>(hw_id, pci, kIch9Engine);
   }
   if (Intel6SeriesChipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<Intel6SeriesChipset>(Tag{}, hw_id, pci);
+    return Make<Intel6SeriesChipset>(hw_id, pci, kIch9Engine);
   }
   if (Intel7SeriesChipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<Intel7SeriesChipset>(Tag{}, hw_id, pci);
+    return Make<Intel7SeriesChipset>(hw_id, pci, kIch9Engine);
   }
   if (Intel8SeriesChipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<Intel8SeriesChipset>(Tag{}, hw_id, pci);
+    return Make<Intel8SeriesChipset>(hw_id, pci, kIch9Engine);
   }
   if (Intel9SeriesChipset::SupportsDevice(hw_id)) {
-    return absl::make_unique<Intel9SeriesChipset>(Tag{}, hw_id, pci);
+    return Make<Intel9SeriesChipset>(hw_id, pci, kIch9Engine);
+  }
+  if (Intel100SeriesChipset::SupportsDevice(hw_id)) {
+    return Make<Intel100SeriesChipset>(hw_id, pci, k100SeriesEngine);
+  }
+  if (Intel200SeriesChipset::SupportsDevice(hw_id)) {
+    return Make<Intel200SeriesChipset>(hw_id, pci, k100SeriesEngine);
+  }
+  if (Intel300SeriesChipset::SupportsDevice(hw_id)) {
+    return Make<Intel300SeriesChipset>(hw_id, pci, k100SeriesEngine);
   }
 
   return absl::UnimplementedError(
@@ -74,25 +109,53 @@ const Chipset::HardwareId& Chipset::hardware_id() const {
   return hardware_id_;
 }
 
+void Chipset::set_memory_mapper(MemoryMapper memory_mapper) {
+  memory_mapper_ = std::move(memory_mapper);
+}
+
+absl::StatusOr<std::unique_ptr<PhysicalMemory>> Chipset::MapPhysicalMemory(
+    uintptr_t physical_address, size_t length, bool populate) {
+  if (memory_mapper_) {
+    return memory_mapper_(physical_address, length);
+  }
+  return MappingPool::Default().Map(
+      physical_address, length,
+      populate ? MappingPool::kMapPopulate : MappingPool::kMapDefault);
+}
+
 absl::Status Chipset::MapRootComplex(const Chipset::Rcba& rcba) {
   if (!rcba.enable) {
     return absl::InvalidArgumentError("RCBA Enable (EN) must be set");
   }
-  absl::Status status;
   // The size of the root complex is aligned on 4KiB. All Intel chipsets
   // released 2008 or later have 4 pages mapped.
   // See Chipset Configuration Registers (Memory Space), p. 275-276
 
-  auto mem_or = PhysicalMemory::Create(rcba.base_address, 0x4000 /* 16KiB */);
+  return MapRegisterMemory(rcba.base_address, kRootComplexSize);
+}
+
+absl::Status Chipset::MapSpiRegisters() {
+  return MapRootComplex(ReadRcbaRegister());
+}
+
+absl::Status Chipset::MapRegisterMemory(uintptr_t physical_address,
+                                        size_t length) {
+  auto mem_or = MapPhysicalMemory(physical_address, length);
   if (!mem_or.ok()) {
     return mem_or.status();
   }
   rcrb_mem_ = std::move(mem_or).value();
-  return status;
+  InvalidateRegisterShadow();
+  return absl::OkStatus();
 }
 
 void Chipset::UnMapRootComplex() {
   rcrb_mem_.reset(nullptr);
+  InvalidateRegisterShadow();
+}
+
+void Chipset::InvalidateRegisterShadow() {
+  register_shadow_ = {};
 }
 
 absl::Status Chipset::ReadSpiWithHardwareSequencing(
@@ -109,10 +172,10 @@ absl::Status Chipset::ReadSpiWithHardwareSequencing(
   // of bytes to be read is programmed in to the control register (HSFC) and a
   // read cycle is triggered by setting the corresponding FCYCLE and FCGO bits.
   // The hardware will signal completion or a flash cycle by setting the FDONE
-  // bit in the status register. To keep things simple, this function just uses
-  // busy waiting for this.
+  // bit in the status register. The cycle waiter polls for this, backing off
+  // gradually.
   // The whole process is repeated until size / block_size blocks have been
-  // read.
+  // read. The loop itself is implemented in HardwareSequencingEngine.
 
   ABSL_DIE_IF_NULL(block_read);
   if (block_size < 4 || block_size > 64 /* Chipset limit */) {
@@ -124,59 +187,33 @@ absl::Status Chipset::ReadSpiWithHardwareSequencing(
     return absl::InvalidArgumentError("Size must be divisible by block size");
   }
 
-  auto hsfs = ReadHsfsRegister();
-  if (hsfs.spi_cycle_in_progress) {
-    return absl::UnavailableError("SPI flash cycle in progress");
-  }
-
-  std::vector<uint32_t> buf(block_size / 4, 0);
-  for (int cur_flash_address = flash_address;
-       cur_flash_address < flash_address + size;
-       cur_flash_address += block_size) {
-    // Copy flash lockdown and read-only bits. Clear all status bits.
-    hsfs = ReadHsfsRegister();
-    hsfs.access_error_log = false;
-    hsfs.flash_cycle_error = false;
-    hsfs.flash_cycle_done = false;
-    WriteHsfsRegister(hsfs);
-    // Initiate SPI flash read cycle.
-    auto faddr = ReadFaddrRegister();
-    faddr.flash_linear_address = cur_flash_address;
-    WriteFaddrRegister(faddr);
-    auto hsfc = ReadHsfcRegister();
-    hsfc.flash_data_byte_count = block_size - 1;
-    hsfc.flash_cycle = FlashCycle::kFcycleRead;
-    hsfc.flash_cycle_go = true;
-    WriteHsfcRegister(hsfc);
-    do {
-      hsfs = ReadHsfsRegister();
-    } while (!hsfs.flash_cycle_done);
-    if (hsfs.flash_cycle_error && block_read_error) {
-      // We may have tried to read a protected area.
-      if (!block_read_error(cur_flash_address)) {
-        return absl::OkStatus();
-      }
-    }
-
-    // The chipset only decodes memory accesses with a maximum width of 32-bit,
-    // hence the loop in 32-bit increments.
-    for (int i = 0; i < buf.size(); ++i) {
-      buf[i] = ReadFdataNRegister(i);
-    }
-    if (!block_read(cur_flash_address,
-                    reinterpret_cast<const char*>(buf.data()))) {
-      return absl::OkStatus();
-    }
-  }
-  if (block_read_done) {
-    block_read_done();
+  return read_engine_.read(*this, flash_address, size, block_size, block_read,
+                           block_read_error, block_read_done);
+}
+
+absl::Status Chipset::ReadSpiWithHardwareSequencing(
+    int flash_address, absl::Span<uint8_t> data, int block_size,
+    absl::Span<BlockStatus> block_status) {
+  if (block_size < 4 || block_size > 64 /* Chipset limit */ ||
+      block_size % 4 != 0) {
+    return absl::InvalidArgumentError(
+        "Block size must be a multiple of 4 between 4-64 (inclusive).");
   }
-  return absl::OkStatus();
+  if (data.size() % block_size != 0) {
+    return absl::InvalidArgumentError("Size must be divisible by block size");
+  }
+  if (!block_status.empty() &&
+      block_status.size() != data.size() / block_size) {
+    return absl::InvalidArgumentError(
+        "Block status must have one entry per block");
+  }
+  return read_engine_.read_into(*this, flash_address, data, block_size,
+                                block_status);
 }
 
 PhysicalMemory* Chipset::rcrb_mem() {
   if (rcrb_mem_ == nullptr) {
-    LOG(FATAL) << "Call MapRootComplex() first.";
+    LOG(FATAL) << "Call MapSpiRegisters() first.";
   }
   return rcrb_mem_.get();
 }
@@ -24,7 +24,7 @@
 //                                  nullptr /* Do not fill hardware id */,
 //                                  &status);
 //   QCHECK_OK(status);
-//   QCHECK_OK(chipset->MapRootComplex(chipset->ReadRcbaRegister())));
+//   QCHECK_OK(chipset->MapSpiRegisters());
 //   ...
 //
 // All abbreviations and terms are taken from the latest publicly available
@@ -35,12 +35,16 @@
 #ifndef PAWN_CHIPSET_H_
 #define PAWN_CHIPSET_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/cycle_waiter.h"
 
 namespace security::pawn {
 
@@ -101,6 +105,8 @@ class Chipset {
   };
 
   // Hardware Sequencing Flash Status Register
+  // Access types: FLOCKDN is sticky (write-once, cleared on reset), AEL, FCERR
+  // and FDONE are R/WC (cleared by writing 1), all other fields are read-only.
   struct Hsfs {
     bool flash_configuration_lockdown : 1;               // FLOCKDN
     bool flash_descriptor_valid : 1;                     // FDV
@@ -113,27 +119,37 @@ class Chipset {
     bool flash_cycle_done : 1;                           // FDONE
   };
 
+  // FCYCLE is 4 bits wide on 100 Series chipsets and later, which add the
+  // cycle types starting at kFcycle64KbErase.
   enum FlashCycle {
     kFcycleRead = 0,
     kFcycleReserved,
     kFcycleWrite,
-    kFcycleBlockErase
+    kFcycleBlockErase,
+    kFcycle64KbErase,
+    kFcycleReadSfdp,
+    kFcycleReadJedecId,
+    kFcycleWriteStatus,
+    kFcycleReadStatus,
   };
 
   // Hardware Sequencing Flash Control Register
+  // Access types: FGO is self-clearing (cleared by hardware once the cycle
+  // starts), all other fields are read/write.
   struct Hsfc {
     bool flash_spi_smi_enable : 1;       // FSMIE
     bool reserved14 : 1;                 // Reserved
     uint32_t flash_data_byte_count : 6;  // FDBC
-    uint32_t reserved7 : 5;              // Reserved
-    FlashCycle flash_cycle : 2;          // FCYCLE
+    uint32_t reserved7 : 5;              // Reserved (7:3, or 7:5)
+    FlashCycle flash_cycle : 4;          // FCYCLE
     bool flash_cycle_go : 1;             // FGO
   };
 
-  // Flash Address Register
+  // Flash Address Register. FLA is 25 bits wide before the 100 Series and 27
+  // bits wide afterwards.
   struct Faddr {
-    uint32_t reserved25 : 7;             // Reserved
-    uint32_t flash_linear_address : 25;  // FLA
+    uint32_t reserved25 : 7;             // Reserved (31:25, or 31:27)
+    uint32_t flash_linear_address : 27;  // FLA
   };
 
   // Flash Regions Access Permissions Register
@@ -144,22 +160,22 @@ class Chipset {
     uint32_t bios_region_read_access : 8;         // BRRA
   };
 
-  // Flash Region N Register
+  // Flash Region N Register. Base and limit are flash linear addresses.
   struct FregN {
-    uint32_t reserved31 : 3;     // Reserved
-    uint32_t region_limit : 13;  // RL
-    uint32_t reserved15 : 3;     // Reserved
-    uint32_t region_base : 13;   // RB
+    uint32_t reserved31 : 3;  // Reserved
+    uint32_t region_limit;    // RL
+    uint32_t reserved15 : 3;  // Reserved
+    uint32_t region_base;     // RB
   };
 
-  // Protected Range N Register
+  // Protected Range N Register. Base and limit are flash linear addresses.
   struct PrN {
     bool write_protection_enable : 1;
     uint32_t reserved30 : 2;  // Reserved
-    uint32_t protected_range_limit : 13;
+    uint32_t protected_range_limit;
     bool read_protection_enable : 1;
     uint32_t reserved14 : 2;  // Reserved
-    uint32_t protected_range_base : 13;
+    uint32_t protected_range_base;
   };
 
   // Software Sequencing Flash Status Register
@@ -172,7 +188,8 @@ class Chipset {
     bool spi_cycle_in_progress : 1;  // SCIP
   };
 
-  enum SpiCycleFrequency { kScf20Mhz = 0, kScf33Mhz };
+  // 50MHz is only available on PCH platforms (5 Series and later).
+  enum SpiCycleFrequency { kScf20Mhz = 0, kScf33Mhz, kScf50Mhz = 4 };
 
   // Software Sequencing Flash Control Register
   struct Ssfc {
@@ -189,10 +206,38 @@ class Chipset {
     bool reserved0 : 1;                         // Reserved
   };
 
+  // Flash Descriptor Section Select (FDOC FDSS)
+  enum FlashDescriptorSection {
+    kFdssMap = 0,  // Signature and Descriptor Map
+    kFdssComponent,
+    kFdssRegion,
+    kFdssMaster,
+  };
+
+  // Encoding of the flash descriptor. The 100 Series widened the component
+  // densities in FLCOMP and the region bases and limits in FLREGn to address
+  // flash beyond 32MiB.
+  enum FlashDescriptorFormat {
+    kDescriptorFormatIch8 = 0,  // ICH8 to 9 Series
+    kDescriptorFormat100Series,
+  };
+
+  // Result of reading a single block of SPI flash.
+  enum BlockStatus : uint8_t {
+    kBlockOk = 0,
+    kBlockReadError,  // Flash cycle error, contents are undefined
+    kBlockNotRead,    // Reading stopped before this block
+  };
+
+  // Maps length bytes of physical memory starting at physical_address.
+  using MemoryMapper =
+      std::function<absl::StatusOr<std::unique_ptr<PhysicalMemory>>(
+          uintptr_t physical_address, size_t length)>;
+
   Chipset(const Chipset&) = delete;
   Chipset& operator=(const Chipset&) = delete;
 
-  virtual ~Chipset() = default;
+  virtual ~Chipset();
 
   // Creates a new Chipset instance by probing the PCI bus and setting the
   // appropriate register and base offsets if the chipset is supported.
@@ -203,14 +248,48 @@ class Chipset {
 
   const HardwareId& hardware_id() const;
 
+  // Overrides how physical memory is mapped. By default, memory is mapped
+  // using PhysicalMemory::Create(). Set this before calling MapRootComplex(),
+  // for example to run against a simulated device.
+  void set_memory_mapper(MemoryMapper memory_mapper);
+
+  // Maps length bytes of physical memory starting at physical_address, using
+  // the memory mapper if one was set. If populate is true, the page tables of
+  // the mapping are prefaulted, which helps with memory that is read in bulk.
+  absl::StatusOr<std::unique_ptr<PhysicalMemory>> MapPhysicalMemory(
+      uintptr_t physical_address, size_t length, bool populate = false);
+
   // Registers in PCI Configuration Space.
   virtual BiosCntl ReadBiosCntlRegister() = 0;
   virtual Rcba ReadRcbaRegister() = 0;
 
+  // Waits for flash cycles to complete. Use this to adjust the polling
+  // strategy and deadline, or to inspect the cycle latency histogram.
+  CycleWaiter& cycle_waiter() { return cycle_waiter_; }
+
+  // Size of the Root Complex Register Block (Chipset Configuration Space).
+  static constexpr uint32_t kRootComplexSize = 0x4000;  // 16KiB
+
   // Map the Chipset Configuration Space physical memory.
   virtual absl::Status MapRootComplex(const Rcba& rcba);
   void UnMapRootComplex();
 
+  // Maps the SPI memory mapped configuration registers. Up to the 9 Series,
+  // these are part of the Chipset Configuration Space and this is the same
+  // as MapRootComplex(ReadRcbaRegister()). Later chipsets have no root
+  // complex, their SPI controller is a PCI function of its own.
+  virtual absl::Status MapSpiRegisters();
+
+  // Whether the chipset can run software sequencing flash cycles. The
+  // SSFS/SSFC, PREOP, OPTYPE and OPMENU registers are not available
+  // otherwise.
+  virtual bool SupportsSoftwareSequencing() const { return true; }
+
+  // Encoding of the flash descriptor this chipset loads at reset.
+  virtual FlashDescriptorFormat GetFlashDescriptorFormat() const {
+    return kDescriptorFormatIch8;
+  }
+
   // Registers in Chipset Configuration Space (Memory Space).
   virtual Gcs ReadGcsRegister() = 0;
 
@@ -226,6 +305,20 @@ class Chipset {
   virtual Ssfs ReadSsfsRegister() = 0;
   virtual Ssfc ReadSsfcRegister() = 0;
 
+  // Prefix Opcode Configuration, Opcode Type Configuration and Opcode Menu
+  // Configuration Registers, as raw values. Byte i of OPMENU is opcode i,
+  // bits 2i+1:2i of OPTYPE are its type.
+  virtual uint16_t ReadPreopRegister() = 0;
+  virtual uint16_t ReadOptypeRegister() = 0;
+  virtual uint64_t ReadOpmenuRegister() = 0;
+
+  // Selects dword index of a flash descriptor section in the Flash Descriptor
+  // Observability Control Register (FDOC) and returns it from the Flash
+  // Descriptor Observability Data Register (FDOD). The chipset serves these
+  // from its copy of the descriptor, so no flash cycles are involved.
+  virtual uint32_t ReadFdodRegister(FlashDescriptorSection section,
+                                    int index) = 0;
+
   // Reads the contents of the SPI flash using the hardware sequencing method.
   // This method reads size bytes in blocks of block_size starting at flash
   // linear address flash_address.
@@ -236,12 +329,34 @@ class Chipset {
   // If either of the block_read or block_read_error callbacks return false,
   // this function stops reading and returns with absl::OkStatus().
   // block_read_done is called after reading.
+  // The callbacks for a block run while the flash cycle for the next block is
+  // already in progress, so that the controller is not kept idle.
+  // If a flash cycle does not complete in time (see cycle_waiter()), this
+  // function returns absl::DeadlineExceededError().
   virtual absl::Status ReadSpiWithHardwareSequencing(
       int flash_address, int size, int block_size,
       std::function<bool(int flash_address, const char* data)> block_read,
       std::function<bool(int flash_address)> block_read_error,
       std::function<void()> block_read_done);
 
+  // Reads data.size() bytes in blocks of block_size starting at flash linear
+  // address flash_address directly into data, without intermediate copies.
+  // data.size() must be a multiple of block_size. If block_status is not
+  // empty, it must have one entry per block and receives the result of each
+  // block read. If a flash cycle does not complete in time, this function
+  // returns absl::DeadlineExceededError() and the remaining blocks are marked
+  // kBlockNotRead.
+  absl::Status ReadSpiWithHardwareSequencing(
+      int flash_address, absl::Span<uint8_t> data, int block_size,
+      absl::Span<BlockStatus> block_status = {});
+
+  // Forgets the shadow copies of the flash cycle setup registers, so that
+  // the next flash cycle re-reads them from hardware. Call this if another
+  // agent may have reprogrammed the SPI controller.
+  void InvalidateRegisterShadow();
+
+  // Memory containing the SPI registers at SpiBar(). On chipsets without a
+  // root complex, this maps the SPI registers only.
   // TODO(cblichmann): Public for now, the Pawn command-line tool currently
   //                   needs this.
   PhysicalMemory* rcrb_mem();
@@ -250,11 +365,14 @@ class Chipset {
   struct Tag {};  // Constructor tag
 
   // Make constructor available to deriving classes.
-  Chipset(const HardwareId& probed_id, Pci& pci)
-      : hardware_id_(probed_id), pci_(&pci) {}
+  Chipset(const HardwareId& probed_id, Pci& pci);
 
   Pci& pci() { return *pci_; }
 
+  // Maps length bytes of physical memory starting at physical_address as the
+  // memory returned by rcrb_mem().
+  absl::Status MapRegisterMemory(uintptr_t physical_address, size_t length);
+
   // Returns this chipset's SPIBAR value, usually 0x3800.
   virtual uint16_t SpiBar(int offset) const = 0;
 
@@ -263,10 +381,47 @@ class Chipset {
   virtual void WriteFaddrRegister(const Faddr& faddr) = 0;
   virtual void WriteSsfsRegister(const Ssfs& ssfs) = 0;
   virtual void WriteSsfcRegister(const Ssfc& ssfc) = 0;
+  virtual void WritePreopRegister(uint16_t preop) = 0;
+  virtual void WriteOptypeRegister(uint16_t optype) = 0;
+  virtual void WriteOpmenuRegister(uint64_t opmenu) = 0;
 
  private:
+  template <typename ChipsetT>
+  friend class HardwareSequencingEngine;
+  friend class SoftwareSequencing;
+
+  // Hardware sequencing read loops, selected in Create() to match the
+  // chipset's register layout. See pawn/hardware_sequencing.h.
+  struct ReadEngine {
+    absl::Status (*read)(
+        Chipset& chipset, int flash_address, int size, int block_size,
+        const std::function<bool(int flash_address, const char* data)>&
+            block_read,
+        const std::function<bool(int flash_address)>& block_read_error,
+        const std::function<void()>& block_read_done);
+    absl::Status (*read_into)(Chipset& chipset, int flash_address,
+                              absl::Span<uint8_t> data, int block_size,
+                              absl::Span<BlockStatus> block_status);
+  };
+
+  // Raw values of the flash cycle setup registers, with the fields that are
+  // set for each cycle masked out. To avoid slow MMIO reads, these are only
+  // read once, so that setting up a cycle only ever writes registers.
+  struct RegisterShadow {
+    std::optional<uint32_t> faddr;
+    std::optional<uint16_t> hsfc;
+  };
+
+  template <typename ChipsetT>
+  static std::unique_ptr<Chipset> Make(const HardwareId& hw_id, Pci& pci,
+                                       const ReadEngine& read_engine);
+
   HardwareId hardware_id_;
   Pci* pci_;
+  MemoryMapper memory_mapper_;
+  ReadEngine read_engine_ = {};
+  CycleWaiter cycle_waiter_;
+  RegisterShadow register_shadow_;
   std::unique_ptr<PhysicalMemory> rcrb_mem_;
 };
 
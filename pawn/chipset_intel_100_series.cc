@@ -0,0 +1,279 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/chipset_intel_100_series.h"
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "pawn/bits.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+
+Chipset::BiosCntl Intel100SeriesChipset::ReadBiosCntlRegister() {
+  pci().Invalidate(kBiosCntlRegister, 4);  // Changes at runtime
+  auto bios_cntl = pci().ReadConfigUint32(kBiosCntlRegister);
+  return {
+      bits::Test<5>(bios_cntl),  // EISS, formerly SMM_BWP
+      bits::Test<4>(bios_cntl),  // TSS
+      static_cast<Chipset::SpiReadConfiguration>(
+          bits::Value<3, 2>(bios_cntl)),  // SRC, these bits map directly.
+      bits::Test<1>(bios_cntl),           // LE, formerly BLE
+      bits::Test<0>(bios_cntl),           // WPD, formerly BIOSWE
+  };
+}
+
+Chipset::Rcba Intel100SeriesChipset::ReadRcbaRegister() { return {0, false}; }
+
+absl::Status Intel100SeriesChipset::MapRootComplex(const Chipset::Rcba&) {
+  return absl::UnimplementedError(
+      "Chipset has no Root Complex Register Block");
+}
+
+absl::Status Intel100SeriesChipset::MapSpiRegisters() {
+  if (pci().ReadConfigUint16(kSpiVidRegister) == 0xFFFF) {
+    return absl::NotFoundError("SPI controller (B0:D31:F5) not found");
+  }
+  if (!bits::Test<1>(pci().ReadConfigUint16(kSpiCommandRegister))) {
+    return absl::FailedPreconditionError(
+        "SPI controller memory space (MSE) is disabled");
+  }
+  const uint32_t spi_bar = pci().ReadConfigUint32(kSpiBar0Register);
+  return MapRegisterMemory(bits::Raw<31, 12>(spi_bar), kSpiBarSize);
+}
+
+Chipset::Gcs Intel100SeriesChipset::ReadGcsRegister() {
+  auto bios_cntl = pci().ReadConfigUint32(kBiosCntlRegister);
+  return {
+      bits::Test<6>(bios_cntl) ? Chipset::kBbsLpc : Chipset::kBbsSpi,  // BBS
+      bits::Test<7>(bios_cntl),                                        // BILD
+  };
+}
+
+Chipset::Bfpr Intel100SeriesChipset::ReadBfprRegister() {
+  auto bfpr = BfprReg::Read(*rcrb_mem());
+  return {
+      bits::Value<31, 31>(bfpr),                     // Reserved
+      bits::Set<26, 12>(bits::Value<30, 16>(bfpr)),  // PRL
+      bits::Value<15, 15>(bfpr),                     // Reserved
+      bits::Set<26, 12>(bits::Value<14, 0>(bfpr))    // PRB
+  };
+}
+
+Chipset::Hsfs Intel100SeriesChipset::ReadHsfsRegister() {
+  auto hsfs = HsfsReg::Read(*rcrb_mem());
+  return {
+      bits::Test<15>(hsfs),      // FLOCKDN
+      bits::Test<14>(hsfs),      // FDV
+      bits::Test<13>(hsfs),      // FDOPSS
+      bits::Value<12, 6>(hsfs),  // PRR34_LOCKDN, WRSDIS, Reserved
+      bits::Test<5>(hsfs),       // H_SCIP
+      // BERASE is gone, 4KiB erases have their own FCYCLE value.
+      Chipset::kBerase4Kb,
+      bits::Test<2>(hsfs),  // H_AEL
+      bits::Test<1>(hsfs),  // FCERR
+      bits::Test<0>(hsfs),  // FDONE
+  };
+}
+
+void Intel100SeriesChipset::WriteHsfsRegister(const Chipset::Hsfs& hsfs) {
+  HsfsReg::Write(
+      *rcrb_mem(),
+      bits::Set<15>(hsfs.flash_configuration_lockdown) |
+          bits::Set<14>(hsfs.flash_descriptor_valid) |
+          bits::Set<13>(hsfs.flash_descriptor_override_pinstrap_status) |
+          bits::Set<12, 6>(hsfs.reserved12) |
+          bits::Set<5>(hsfs.spi_cycle_in_progress) |
+          bits::Set<2>(hsfs.access_error_log) |
+          bits::Set<1>(hsfs.flash_cycle_error) |
+          bits::Set<0>(hsfs.flash_cycle_done));
+}
+
+Chipset::Hsfc Intel100SeriesChipset::ReadHsfcRegister() {
+  auto hsfc = HsfcReg::Read(*rcrb_mem());
+  return {
+      bits::Test<15>(hsfc),                                       // FSMIE
+      bits::Test<14>(hsfc),                                       // Reserved
+      bits::Value<13, 8>(hsfc),                                   // FDBC
+      bits::Value<7, 5>(hsfc),                                    // Reserved
+      static_cast<Chipset::FlashCycle>(bits::Value<4, 1>(hsfc)),  // FCYCLE
+      bits::Test<0>(hsfc),                                        // FGO
+  };
+}
+
+void Intel100SeriesChipset::WriteHsfcRegister(const Chipset::Hsfc& hsfc) {
+  HsfcReg::Write(
+      *rcrb_mem(),
+      bits::Set<15>(hsfc.flash_spi_smi_enable) |
+          bits::Set<14>(hsfc.reserved14) |
+          bits::Set<13, 8>(hsfc.flash_data_byte_count) |
+          bits::Set<7, 5>(hsfc.reserved7) |
+          bits::Set<4, 1>(static_cast<uint32_t>(hsfc.flash_cycle)) |
+          bits::Set<0>(hsfc.flash_cycle_go));
+}
+
+Chipset::Faddr Intel100SeriesChipset::ReadFaddrRegister() {
+  auto faddr = FaddrReg::Read(*rcrb_mem());
+  return {bits::Value<31, 27>(faddr), bits::Value<26, 0>(faddr) /* FLA */};
+}
+
+void Intel100SeriesChipset::WriteFaddrRegister(const Chipset::Faddr& faddr) {
+  FaddrReg::Write(
+      *rcrb_mem(),
+      bits::Set<31, 27>(faddr.reserved25) |
+          bits::Set<26, 0>(faddr.flash_linear_address) /* FLA */);
+}
+
+uint32_t Intel100SeriesChipset::ReadFdataNRegister(int register_num) {
+  if (register_num < 0 || register_num > 15) {
+    LOG(FATAL) << "Flash data register out of range (must be in 0..15).";
+  }
+  return FdataReg::Read(*rcrb_mem(), register_num);
+}
+
+Chipset::Frap Intel100SeriesChipset::ReadFrapRegister() {
+  // BIOS_FRACC, same layout as FRAP.
+  auto frap = FrapReg::Read(*rcrb_mem());
+  return {
+      bits::Value<31, 24>(frap),  // BMWAG
+      bits::Value<23, 16>(frap),  // BMRAG
+      bits::Value<15, 8>(frap),   // BRWA
+      bits::Value<7, 0>(frap)     // BRRA
+  };
+}
+
+Chipset::FregN Intel100SeriesChipset::ReadFregNRegister(int index) {
+  auto fregn = FregReg::Read(*rcrb_mem(), index);
+  return {
+      bits::Value<31, 31>(fregn),                             // Reserved
+      bits::Set<26, 12>(bits::Value<30, 16>(fregn)) | 0xFFF,  // RL
+      bits::Value<15, 15>(fregn),                             // Reserved
+      bits::Set<26, 12>(bits::Value<14, 0>(fregn))            // RB
+  };
+}
+
+Chipset::PrN Intel100SeriesChipset::ReadPrNRegister(int index) {
+  auto prn = PrReg::Read(*rcrb_mem(), index);
+  return {
+      bits::Test<31>(prn),  // Write Protection Enable
+      0,                    // Reserved, part of the limit
+      bits::Set<26, 12>(bits::Value<30, 16>(prn)) |
+          0xFFF,                                  // Protected Range Limit
+      bits::Test<15>(prn),                        // Read Protection Enable
+      0,                                          // Reserved, part of the base
+      bits::Set<26, 12>(bits::Value<14, 0>(prn))  // Protected Range Base
+  };
+}
+
+Chipset::Ssfs Intel100SeriesChipset::ReadSsfsRegister() {
+  // Low byte of SSFSTS_CTL.
+  auto ssfs = SsfsReg::Read(*rcrb_mem());
+  return {
+      bits::Value<7, 5>(ssfs),  // Reserved
+      bits::Test<4>(ssfs),      // AEL
+      bits::Test<3>(ssfs),      // FCERR
+      bits::Test<2>(ssfs),      // Cycle Done Status
+      bits::Test<1>(ssfs),      // Reserved
+      bits::Test<0>(ssfs),      // SCIP
+  };
+}
+
+void Intel100SeriesChipset::WriteSsfsRegister(const Chipset::Ssfs& ssfs) {
+  SsfsReg::Write(
+      *rcrb_mem(),
+      bits::Set<7, 5>(ssfs.reserved7) |           // Reserved
+          bits::Set<4>(ssfs.access_error_log) |   // AEL
+          bits::Set<3>(ssfs.flash_cycle_error) |  // FCERR
+          bits::Set<2>(ssfs.cycle_done_status) |
+          bits::Set<1>(ssfs.reserved1) |              // Reserved
+          bits::Set<0>(ssfs.spi_cycle_in_progress));  // SCIP
+}
+
+Chipset::Ssfc Intel100SeriesChipset::ReadSsfcRegister() {
+  // Upper 24 bits of SSFSTS_CTL, which keeps the layout of SSFS/SSFC.
+  auto ssfc = SsfsSsfcReg::Read(*rcrb_mem()) >> 8 /* SSFS */;
+  return {
+      bits::Value<23, 19>(ssfc),  // Reserved
+      static_cast<Chipset::SpiCycleFrequency>(
+          bits::Value<18, 16>(ssfc)),  // SCF
+      bits::Test<15>(ssfc),            // SME
+      bits::Test<14>(ssfc),            // DS
+      bits::Value<13, 8>(ssfc),        // DBC
+      bits::Test<7>(ssfc),             // Reserved
+      bits::Value<6, 4>(ssfc),         // COP
+      bits::Test<3>(ssfc),             // SPOP
+      bits::Test<2>(ssfc),             // ACS
+      bits::Test<1>(ssfc),             // SCGO
+      bits::Test<0>(ssfc),             // Reserved
+  };
+}
+
+void Intel100SeriesChipset::WriteSsfcRegister(const Chipset::Ssfc& ssfc) {
+  // Same split as on earlier generations, SCGO goes out with the second
+  // write.
+  SsfcHighReg::Write(
+      *rcrb_mem(),
+      bits::Set<15, 11>(ssfc.reserved23) |  // Reserved
+          bits::Set<10, 8>(
+              static_cast<uint32_t>(ssfc.spi_cycle_frequency)) |  // SCF
+          bits::Set<7>(ssfc.spi_smi_enable) |                     // SME
+          bits::Set<6>(ssfc.data_cycle) |                         // DS
+          bits::Set<5, 0>(ssfc.data_byte_count));                 // DBC
+  SsfcLowReg::Write(
+      *rcrb_mem(),
+      bits::Set<7>(ssfc.reserved7) |                           // Reserved
+          bits::Set<6, 4>(ssfc.cycle_opcode_pointer) |         // COP
+          bits::Set<3>(ssfc.sequence_prefix_opcode_pointer) |  // SPOP
+          bits::Set<2>(ssfc.atomic_cycle_sequence) |           // ACS
+          bits::Set<1>(ssfc.spi_cycle_go) |                    // SCGO
+          bits::Set<0>(ssfc.reserved0));                       // Reserved
+}
+
+uint16_t Intel100SeriesChipset::ReadPreopRegister() {
+  return PreopReg::Read(*rcrb_mem());
+}
+
+void Intel100SeriesChipset::WritePreopRegister(uint16_t preop) {
+  PreopReg::Write(*rcrb_mem(), preop);
+}
+
+uint16_t Intel100SeriesChipset::ReadOptypeRegister() {
+  return OptypeReg::Read(*rcrb_mem());
+}
+
+void Intel100SeriesChipset::WriteOptypeRegister(uint16_t optype) {
+  OptypeReg::Write(*rcrb_mem(), optype);
+}
+
+uint64_t Intel100SeriesChipset::ReadOpmenuRegister() {
+  return OpmenuReg::Read(*rcrb_mem(), 0) |
+         uint64_t{OpmenuReg::Read(*rcrb_mem(), 1)} << 32;
+}
+
+void Intel100SeriesChipset::WriteOpmenuRegister(uint64_t opmenu) {
+  OpmenuReg::Write(*rcrb_mem(), 0, static_cast<uint32_t>(opmenu));
+  OpmenuReg::Write(*rcrb_mem(), 1, static_cast<uint32_t>(opmenu >> 32));
+}
+
+uint32_t Intel100SeriesChipset::ReadFdodRegister(
+    Chipset::FlashDescriptorSection section, int index) {
+  FdocReg::Write(
+      *rcrb_mem(),
+      bits::Set<14, 12>(static_cast<uint32_t>(section)) |   // FDSS
+          bits::Set<11, 2>(static_cast<uint32_t>(index)));  // FDSI
+  return FdodReg::Read(*rcrb_mem());
+}
+
+}  // namespace security::pawn
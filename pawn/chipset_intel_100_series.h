@@ -0,0 +1,202 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_CHIPSET_INTEL_100_SERIES_H_
+#define PAWN_CHIPSET_INTEL_100_SERIES_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "pawn/chipset.h"
+#include "pawn/mmio.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// All references mentioned in this header and its implementation refer to the
+// Intel 100 Series Chipset Family Platform Controller Hub (PCH) Datasheet,
+// Volume 2 of 2, February 2016 (document number 332691-002).
+// Starting with this generation, there is no Root Complex Register Block. The
+// SPI controller is a PCI function of its own (B0:D31:F5) with its registers
+// at SPIBAR, which is that function's BAR0. Compared to earlier generations,
+// HSFS and HSFC form the 32-bit HSFSTS_CTL register with a 4-bit FCYCLE field,
+// FLA is 27 bits wide and region and protected range bases and limits have 15
+// bits each.
+class Intel100SeriesChipset : public Chipset {
+ public:
+  // Registers in the PCI Configuration Space of the SPI function.
+  // Vendor Identification (16-bit)
+  static constexpr uint32_t kSpiVidRegister =
+      pci::MakeConfigAddress(0x00, 31, 5, 0x00);
+  // SPI BAR0 MMIO (32-bit)
+  static constexpr uint32_t kSpiBar0Register =
+      pci::MakeConfigAddress(0x00, 31, 5, 0x10);
+  // Command (16-bit)
+  static constexpr uint32_t kSpiCommandRegister =
+      pci::MakeConfigAddress(0x00, 31, 5, 0x04);
+  // BIOS Control (BC, 32-bit)
+  static constexpr uint32_t kBiosCntlRegister =
+      pci::MakeConfigAddress(0x00, 31, 5, 0xDC);
+
+  // Size of the SPIBAR memory space.
+  static constexpr uint32_t kSpiBarSize = 0x1000;  // 4KiB
+
+  enum {
+    kBfprRegisterOffset = 0x00,
+    kHsfsRegisterOffset = 0x04,  // Low half of HSFSTS_CTL
+    kHsfcRegisterOffset = 0x06,  // High half of HSFSTS_CTL
+    kFaddrRegisterOffset = 0x08,
+    kFdata0RegisterOffset = 0x10,
+    kFrapRegisterOffset = 0x50,
+    kFreg0RegisterOffset = 0x54,
+    kPr0RegisterOffset = 0x84,
+    kSsfsRegisterOffset = 0xA0,
+    kSsfcRegisterOffset = 0xA1,
+    kPreopRegisterOffset = 0xA4,
+    kOptypeRegisterOffset = 0xA6,
+    kOpmenuRegisterOffset = 0xA8,
+    kFdocRegisterOffset = 0xB4,
+    kFdodRegisterOffset = 0xB8,
+  };
+
+  // The SPI registers are mapped on their own, see MapSpiRegisters().
+  static constexpr uint16_t kSpiBar = 0x0000;
+  static constexpr uint32_t kRegisterMemorySize = kSpiBarSize;
+
+  // The registers above as typed MMIO accessors, relative to SPIBAR (which is
+  // at the start of the mapping).
+  template <typename T, uint32_t kOffset>
+  using SpiReg = MmioReg<T, kOffset, kSpiBarSize>;
+  template <typename T, uint32_t kOffset, int kCount>
+  using SpiRegArray = MmioRegArray<T, kOffset, kCount, kSpiBarSize>;
+  using BfprReg = SpiReg<uint32_t, kBfprRegisterOffset>;
+  using HsfsReg = SpiReg<uint16_t, kHsfsRegisterOffset>;
+  using HsfcReg = SpiReg<uint16_t, kHsfcRegisterOffset>;
+  using FaddrReg = SpiReg<uint32_t, kFaddrRegisterOffset>;
+  using FdataReg = SpiRegArray<uint32_t, kFdata0RegisterOffset, 16>;
+  using FrapReg = SpiReg<uint32_t, kFrapRegisterOffset>;
+  using FregReg = SpiRegArray<uint32_t, kFreg0RegisterOffset, 12>;
+  using PrReg = SpiRegArray<uint32_t, kPr0RegisterOffset, 5>;
+  using SsfsReg = SpiReg<uint8_t, kSsfsRegisterOffset>;
+  // SSFC is not naturally aligned. It is read together with SSFS and written
+  // as a 16-bit and an 8-bit part.
+  using SsfsSsfcReg = SpiReg<uint32_t, kSsfsRegisterOffset>;
+  using SsfcHighReg = SpiReg<uint16_t, kSsfcRegisterOffset + 1>;
+  using SsfcLowReg = SpiReg<uint8_t, kSsfcRegisterOffset>;
+  using PreopReg = SpiReg<uint16_t, kPreopRegisterOffset>;
+  using OptypeReg = SpiReg<uint16_t, kOptypeRegisterOffset>;
+  using OpmenuReg = SpiRegArray<uint32_t, kOpmenuRegisterOffset, 2>;
+  using FdocReg = SpiReg<uint32_t, kFdocRegisterOffset>;
+  using FdodReg = SpiReg<uint32_t, kFdodRegisterOffset>;
+
+  // Raw field layout of the hardware sequencing registers, see
+  // HardwareSequencingEngine.
+  enum : uint32_t {
+    kHsfsFdone = 1 << 0,     // Flash Cycle Done
+    kHsfsFcerr = 1 << 1,     // Flash Cycle Error
+    kHsfsAel = 1 << 2,       // Access Error Log
+    kHsfsScip = 1 << 5,      // SPI Cycle In Progress
+    kHsfsFlockdn = 1 << 15,  // Flash Configuration Lock-Down
+    kHsfcFgo = 1 << 0,       // Flash Cycle Go
+    kHsfcFcycleShift = 1,    // Flash Cycle
+    kHsfcFcycleMask = 0xF << kHsfcFcycleShift,
+    kHsfcFdbcShift = 8,  // Flash Data Byte Count
+    kHsfcFdbcMask = 0x3F << kHsfcFdbcShift,
+    kFaddrFlaMask = (1 << 27) - 1,  // Flash Linear Address
+  };
+
+  static constexpr bool IsIntegratedIo(uint16_t device) {
+    // Sunrise Point-LP, part of 6th and 7th Generation Intel Core U/Y
+    // processors.
+    return (device == 0x9D43 /* Skylake U Base */ ||
+            device == 0x9D46 /* Skylake Y Premium */ ||
+            device == 0x9D48 /* Skylake U Premium */ ||
+            device == 0x9D4B /* Kaby Lake Y Premium */ ||
+            device == 0x9D4E /* Kaby Lake U Premium */ ||
+            device == 0x9D50 /* Kaby Lake U Base */ ||
+            device == 0x9D53 /* Kaby Lake U Base */ ||
+            device == 0x9D56 /* Kaby Lake Y Premium */ ||
+            device == 0x9D58 /* Kaby Lake U Premium */);
+  }
+
+  static constexpr bool SupportsDevice(const Chipset::HardwareId& id) {
+    // Device ids of the LPC/eSPI controller, taken from the Intel 100 Series
+    // Chipset Family PCH Datasheet, Volume 1 of 2.
+    return id.vendor == 0x8086 /* Intel */ &&
+           (IsIntegratedIo(id.device) ||
+            id.device == 0xA143 /* H110 */ || id.device == 0xA144 /* H170 */ ||
+            id.device == 0xA145 /* Z170 */ || id.device == 0xA146 /* Q170 */ ||
+            id.device == 0xA147 /* Q150 */ || id.device == 0xA148 /* B150 */ ||
+            id.device == 0xA149 /* C236 */ || id.device == 0xA14A /* C232 */ ||
+            id.device == 0xA14D /* QM170 */ ||
+            id.device == 0xA14E /* HM170 */ ||
+            id.device == 0xA150 /* CM236 */ ||
+            id.device == 0xA152 /* HM175 */ ||
+            id.device == 0xA153 /* QM175 */ ||
+            id.device == 0xA154 /* CM238 */);
+  }
+
+  Intel100SeriesChipset(Chipset::Tag, const Chipset::HardwareId& probed_id,
+                        Pci& pci)
+      : Chipset(probed_id, pci) {}
+
+  BiosCntl ReadBiosCntlRegister() override;
+  // There is no RCBA, this always returns a disabled one.
+  Chipset::Rcba ReadRcbaRegister() override;
+
+  // Returns absl::UnimplementedError(), use MapSpiRegisters() instead.
+  absl::Status MapRootComplex(const Chipset::Rcba& rcba) override;
+  // Maps SPIBAR, as indicated by BAR0 of the SPI function.
+  absl::Status MapSpiRegisters() override;
+
+  Chipset::FlashDescriptorFormat GetFlashDescriptorFormat() const override {
+    return Chipset::kDescriptorFormat100Series;
+  }
+
+  // There is no GCS register, Boot BIOS Straps (BBS) and BIOS Interface
+  // Lock-Down (BILD) are part of BC.
+  Chipset::Gcs ReadGcsRegister() override;
+
+  Chipset::Bfpr ReadBfprRegister() override;
+  Chipset::Hsfs ReadHsfsRegister() override;
+  Chipset::Hsfc ReadHsfcRegister() override;
+  Chipset::Faddr ReadFaddrRegister() override;
+  uint32_t ReadFdataNRegister(int index) override;
+  Chipset::Frap ReadFrapRegister() override;
+  Chipset::FregN ReadFregNRegister(int index) override;
+  Chipset::PrN ReadPrNRegister(int index) override;
+  Chipset::Ssfs ReadSsfsRegister() override;
+  Chipset::Ssfc ReadSsfcRegister() override;
+  uint16_t ReadPreopRegister() override;
+  uint16_t ReadOptypeRegister() override;
+  uint64_t ReadOpmenuRegister() override;
+  uint32_t ReadFdodRegister(Chipset::FlashDescriptorSection section,
+                            int index) override;
+
+ protected:
+  uint16_t SpiBar(int offset) const override { return kSpiBar + offset; }
+
+  void WriteHsfsRegister(const Chipset::Hsfs& hsfs) override;
+  void WriteHsfcRegister(const Chipset::Hsfc& hsfc) override;
+  void WriteFaddrRegister(const Chipset::Faddr& faddr) override;
+  void WriteSsfsRegister(const Chipset::Ssfs& ssfs) override;
+  void WriteSsfcRegister(const Chipset::Ssfc& ssfc) override;
+  void WritePreopRegister(uint16_t preop) override;
+  void WriteOptypeRegister(uint16_t optype) override;
+  void WriteOpmenuRegister(uint64_t opmenu) override;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_CHIPSET_INTEL_100_SERIES_H_
@@ -0,0 +1,46 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_CHIPSET_INTEL_200_SERIES_H_
+#define PAWN_CHIPSET_INTEL_200_SERIES_H_
+
+#include <cstdint>
+
+#include "pawn/chipset_intel_100_series.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// The Intel 200 Series (Union Point) and X299 PCHs share the SPI controller
+// of the 100 Series. See the Intel 200 Series Chipset Family Platform
+// Controller Hub (PCH) Datasheet, Volume 1 of 2, January 2017 (document number
+// 335192-002).
+class Intel200SeriesChipset : public Intel100SeriesChipset {
+ public:
+  static constexpr bool SupportsDevice(const Chipset::HardwareId& id) {
+    return id.vendor == 0x8086 /* Intel */ &&
+           (id.device == 0xA2C4 /* H270 */ || id.device == 0xA2C5 /* Z270 */ ||
+            id.device == 0xA2C6 /* Q270 */ || id.device == 0xA2C7 /* Q250 */ ||
+            id.device == 0xA2C8 /* B250 */ || id.device == 0xA2C9 /* Z370 */ ||
+            id.device == 0xA2D2 /* X299 */);
+  }
+
+  Intel200SeriesChipset(Chipset::Tag tag, const Chipset::HardwareId& probed_id,
+                        Pci& pci)
+      : Intel100SeriesChipset(tag, probed_id, pci) {}
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_CHIPSET_INTEL_200_SERIES_H_
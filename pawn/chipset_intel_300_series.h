@@ -0,0 +1,57 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_CHIPSET_INTEL_300_SERIES_H_
+#define PAWN_CHIPSET_INTEL_300_SERIES_H_
+
+#include <cstdint>
+
+#include "pawn/chipset_intel_200_series.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// All references mentioned in this header refer to the Intel 300 Series
+// Chipset Family Platform Controller Hub (PCH) Datasheet, Volume 2 of 2, July
+// 2018 (document number 337348-001).
+// The SPI register layout matches the 100 Series, but software sequencing was
+// removed. Only hardware sequencing is available.
+class Intel300SeriesChipset : public Intel200SeriesChipset {
+ public:
+  static constexpr bool IsIntegratedIo(uint16_t device) {
+    // Cannon Point-LP, part of 8th Generation Intel Core U processors.
+    return device == 0x9D84 /* Whiskey Lake U Premium */;
+  }
+
+  static constexpr bool SupportsDevice(const Chipset::HardwareId& id) {
+    return id.vendor == 0x8086 /* Intel */ &&
+           (IsIntegratedIo(id.device) || id.device == 0xA303 /* H310 */ ||
+            id.device == 0xA304 /* H370 */ || id.device == 0xA305 /* Z390 */ ||
+            id.device == 0xA306 /* Q370 */ || id.device == 0xA308 /* B360 */ ||
+            id.device == 0xA309 /* C246 */ || id.device == 0xA30A /* C242 */ ||
+            id.device == 0xA30C /* QM370 */ ||
+            id.device == 0xA30D /* HM370 */ ||
+            id.device == 0xA30E /* CM246 */);
+  }
+
+  Intel300SeriesChipset(Chipset::Tag tag, const Chipset::HardwareId& probed_id,
+                        Pci& pci)
+      : Intel200SeriesChipset(tag, probed_id, pci) {}
+
+  bool SupportsSoftwareSequencing() const override { return false; }
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_CHIPSET_INTEL_300_SERIES_H_
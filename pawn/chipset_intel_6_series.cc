@@ -21,6 +21,7 @@
 namespace security::pawn {
 
 Chipset::BiosCntl Intel6SeriesChipset::ReadBiosCntlRegister() {
+  pci().Invalidate(kBiosCntlRegister, 1);  // Changes at runtime
   auto bios_cntl = pci().ReadConfigUint8(kBiosCntlRegister);
   return {
       bits::Test<5>(bios_cntl),  // SMM_BWP
@@ -33,7 +34,7 @@ Chipset::BiosCntl Intel6SeriesChipset::ReadBiosCntlRegister() {
 }
 
 Chipset::Gcs Intel6SeriesChipset::ReadGcsRegister() {
-  auto gcs = rcrb_mem()->ReadUint32(kGcsRegister);
+  auto gcs = GcsReg::Read(*rcrb_mem());
   return {
       static_cast<Chipset::BootBiosStraps>(
           bits::Value<11, 10>(gcs)),  // BBS, 6-Series, these bits map directly.
@@ -21,7 +21,7 @@
 namespace security::pawn {
 
 Chipset::Gcs Intel8SeriesChipset::ReadGcsRegister() {
-  auto gcs = rcrb_mem()->ReadUint32(kGcsRegister);
+  auto gcs = GcsReg::Read(*rcrb_mem());
   constexpr Chipset::BootBiosStraps kBootBiosStraps[] = {
       Chipset::kBbsLpc, Chipset::kBbsReserved, Chipset::kBbsReserved,
       Chipset::kBbsSpi};
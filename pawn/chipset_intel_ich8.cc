@@ -22,6 +22,7 @@
 namespace security::pawn {
 
 Chipset::BiosCntl IntelIch8Chipset::ReadBiosCntlRegister() {
+  pci().Invalidate(kBiosCntlRegister, 1);  // Changes at runtime
   auto bios_cntl = pci().ReadConfigUint8(kBiosCntlRegister);
   return {
       0,                         // Reserved, SMM_BWP on PCH platforms.
@@ -39,7 +40,7 @@ Chipset::Rcba IntelIch8Chipset::ReadRcbaRegister() {
 }
 
 Chipset::Gcs IntelIch8Chipset::ReadGcsRegister() {
-  auto gcs = rcrb_mem()->ReadUint32(kGcsRegister);
+  auto gcs = GcsReg::Read(*rcrb_mem());
   constexpr Chipset::BootBiosStraps kBootBiosStraps[] = {
       Chipset::kBbsSpi, Chipset::kBbsSpi, Chipset::kBbsPci, Chipset::kBbsLpc};
   return {
@@ -49,7 +50,7 @@ Chipset::Gcs IntelIch8Chipset::ReadGcsRegister() {
 }
 
 Chipset::Bfpr IntelIch8Chipset::ReadBfprRegister() {
-  auto bfpr = rcrb_mem()->ReadUint32(SpiBar(kBfprRegisterOffset));
+  auto bfpr = BfprReg::Read(*rcrb_mem(), SpiBar(0));
   return {
       bits::Value<31, 29>(bfpr),                     // Reserved
       bits::Set<24, 12>(bits::Value<28, 16>(bfpr)),  // PRL
@@ -59,7 +60,7 @@ Chipset::Bfpr IntelIch8Chipset::ReadBfprRegister() {
 }
 
 Chipset::Hsfs IntelIch8Chipset::ReadHsfsRegister() {
-  auto hsfs = rcrb_mem()->ReadUint16(SpiBar(kHsfsRegisterOffset));
+  auto hsfs = HsfsReg::Read(*rcrb_mem(), SpiBar(0));
   return {
       bits::Test<15>(hsfs),      // FLOCKDN
       bits::Test<14>(hsfs),      // FDV
@@ -75,8 +76,8 @@ Chipset::Hsfs IntelIch8Chipset::ReadHsfsRegister() {
 }
 
 void IntelIch8Chipset::WriteHsfsRegister(const Chipset::Hsfs& hsfs) {
-  rcrb_mem()->WriteUint16(
-      SpiBar(kHsfsRegisterOffset),
+  HsfsReg::Write(
+      *rcrb_mem(),
       bits::Set<15>(hsfs.flash_configuration_lockdown) |
           bits::Set<14>(hsfs.flash_descriptor_valid) |
           bits::Set<13>(hsfs.flash_descriptor_override_pinstrap_status) |
@@ -85,11 +86,12 @@ void IntelIch8Chipset::WriteHsfsRegister(const Chipset::Hsfs& hsfs) {
           bits::Set<4>(static_cast<uint32_t>(hsfs.blocksector_erase_size)) |
           bits::Set<2>(hsfs.access_error_log) |
           bits::Set<1>(hsfs.flash_cycle_error) |
-          bits::Set<0>(hsfs.flash_cycle_done));
+          bits::Set<0>(hsfs.flash_cycle_done),
+      SpiBar(0));
 }
 
 Chipset::Hsfc IntelIch8Chipset::ReadHsfcRegister() {
-  auto hsfc = rcrb_mem()->ReadUint16(SpiBar(kHsfcRegisterOffset));
+  auto hsfc = HsfcReg::Read(*rcrb_mem(), SpiBar(0));
   return {
       bits::Test<15>(hsfc),                                       // FSMIE
       bits::Test<14>(hsfc),                                       // Reserved
@@ -101,68 +103,74 @@ Chipset::Hsfc IntelIch8Chipset::ReadHsfcRegister() {
 }
 
 void IntelIch8Chipset::WriteHsfcRegister(const Chipset::Hsfc& hsfc) {
-  rcrb_mem()->WriteUint16(
-      SpiBar(kHsfcRegisterOffset),
+  HsfcReg::Write(
+      *rcrb_mem(),
       bits::Set<15>(hsfc.flash_spi_smi_enable) |
           bits::Set<14>(hsfc.reserved14) |
           bits::Set<13, 8>(hsfc.flash_data_byte_count) |
           bits::Set<7, 3>(hsfc.reserved7) |
           bits::Set<2, 1>(static_cast<uint32_t>(hsfc.flash_cycle)) |
-          bits::Set<0>(hsfc.flash_cycle_go));
+          bits::Set<0>(hsfc.flash_cycle_go),
+      SpiBar(0));
 }
 
 Chipset::Faddr IntelIch8Chipset::ReadFaddrRegister() {
-  auto faddr = rcrb_mem()->ReadUint32(SpiBar(kFaddrRegisterOffset));
+  auto faddr = FaddrReg::Read(*rcrb_mem(), SpiBar(0));
   return {bits::Value<31, 25>(faddr), bits::Value<24, 0>(faddr) /* FLA */};
 }
 
 void IntelIch8Chipset::WriteFaddrRegister(const Chipset::Faddr& faddr) {
-  rcrb_mem()->WriteUint32(
-      SpiBar(kFaddrRegisterOffset),
+  FaddrReg::Write(
+      *rcrb_mem(),
       bits::Set<31, 25>(faddr.reserved25) |
-          bits::Set<24, 0>(faddr.flash_linear_address) /* FLA */);
+          bits::Set<24, 0>(faddr.flash_linear_address) /* FLA */,
+      SpiBar(0));
 }
 
 void IntelIch8Chipset::WriteSsfsRegister(const Chipset::Ssfs& ssfs) {
-  rcrb_mem()->WriteUint8(SpiBar(kSsfsRegisterOffset),
-                         bits::Set<7, 5>(ssfs.reserved7) |           // Reserved
-                             bits::Set<4>(ssfs.access_error_log) |   // AEL
-                             bits::Set<3>(ssfs.flash_cycle_error) |  // FCERR
-                             bits::Set<2>(ssfs.cycle_done_status) |
-                             bits::Set<1>(ssfs.reserved1) |  // Reserved
-                             bits::Set<0>(ssfs.spi_cycle_in_progress));  // SCIP
+  SsfsReg::Write(
+      *rcrb_mem(),
+      bits::Set<7, 5>(ssfs.reserved7) |           // Reserved
+          bits::Set<4>(ssfs.access_error_log) |   // AEL
+          bits::Set<3>(ssfs.flash_cycle_error) |  // FCERR
+          bits::Set<2>(ssfs.cycle_done_status) |
+          bits::Set<1>(ssfs.reserved1) |             // Reserved
+          bits::Set<0>(ssfs.spi_cycle_in_progress),  // SCIP
+      SpiBar(0));
 }
 
 void IntelIch8Chipset::WriteSsfcRegister(const Chipset::Ssfc& ssfc) {
-  // Split 24-bit register into an 8-bit and a 16-bit write. Make sure the SCGO
-  // bit is written with the second write.
-  rcrb_mem()->WriteUint8(SpiBar(kSsfcRegisterOffset),
-                         bits::Set<7, 3>(ssfc.reserved7) |  // Reserved
-                             bits::Set<2, 0>(static_cast<uint32_t>(
-                                 ssfc.spi_cycle_frequency)));  // SCF
-  rcrb_mem()->WriteUint16(
-      SpiBar(kSsfcRegisterOffset + 1 /* 1 byte */),
-      bits::Set<15>(ssfc.spi_smi_enable) |                     // SME
-          bits::Set<14, 14>(ssfc.data_cycle) |                 // DS
-          bits::Set<13, 8>(ssfc.data_byte_count) |             // DBC
-          bits::Set<7>(ssfc.reserved7) |                       // Reserved
+  // Split 24-bit register into a 16-bit write of bits 23:8 and an 8-bit write
+  // of bits 7:0. Make sure the SCGO bit is written with the second write.
+  SsfcHighReg::Write(
+      *rcrb_mem(),
+      bits::Set<15, 11>(ssfc.reserved23) |  // Reserved
+          bits::Set<10, 8>(
+              static_cast<uint32_t>(ssfc.spi_cycle_frequency)) |  // SCF
+          bits::Set<7>(ssfc.spi_smi_enable) |                     // SME
+          bits::Set<6>(ssfc.data_cycle) |                         // DS
+          bits::Set<5, 0>(ssfc.data_byte_count),                  // DBC
+      SpiBar(0));
+  SsfcLowReg::Write(
+      *rcrb_mem(),
+      bits::Set<7>(ssfc.reserved7) |                           // Reserved
           bits::Set<6, 4>(ssfc.cycle_opcode_pointer) |         // COP
           bits::Set<3>(ssfc.sequence_prefix_opcode_pointer) |  // SPOP
           bits::Set<2>(ssfc.atomic_cycle_sequence) |           // ACS
           bits::Set<1>(ssfc.spi_cycle_go) |                    // SCGO
-          bits::Set<0>(ssfc.reserved0));                       // Reserved
+          bits::Set<0>(ssfc.reserved0),                        // Reserved
+      SpiBar(0));
 }
 
 uint32_t IntelIch8Chipset::ReadFdataNRegister(int register_num) {
-  if (register_num < 0 || register_num > 16) {
+  if (register_num < 0 || register_num > 15) {
     LOG(FATAL) << "Flash data register out of range (must be in 0..15).";
   }
-  return rcrb_mem()->ReadUint32(
-      SpiBar(kFdata0RegisterOffset + register_num * 4 /* 32-bit */));
+  return FdataReg::Read(*rcrb_mem(), register_num, SpiBar(0));
 }
 
 Chipset::Frap IntelIch8Chipset::ReadFrapRegister() {
-  auto frap = rcrb_mem()->ReadUint32(SpiBar(kFrapRegisterOffset));
+  auto frap = FrapReg::Read(*rcrb_mem(), SpiBar(0));
   return {
       bits::Value<31, 24>(frap),  // BMWAG
       bits::Value<23, 16>(frap),  // BMRAG
@@ -172,19 +180,17 @@ Chipset::Frap IntelIch8Chipset::ReadFrapRegister() {
 }
 
 Chipset::FregN IntelIch8Chipset::ReadFregNRegister(int index) {
-  auto fregn = rcrb_mem()->ReadUint32(
-      SpiBar(kFreg0RegisterOffset + index * 4 /* 32-bit */));
+  auto fregn = FregReg::Read(*rcrb_mem(), index, SpiBar(0));
   return {
       bits::Value<31, 29>(fregn),                             // Reserved
       bits::Set<24, 12>(bits::Value<28, 16>(fregn)) | 0xFFF,  // RL
       bits::Value<15, 13>(fregn),                             // Reserved
-      bits::Value<12, 0>(fregn)                               // RB
+      bits::Set<24, 12>(bits::Value<12, 0>(fregn))            // RB
   };
 }
 
 Chipset::PrN IntelIch8Chipset::ReadPrNRegister(int index) {
-  auto prn = rcrb_mem()->ReadUint32(
-      SpiBar(kPr0RegisterOffset + index * 4 /* 32-bit */));
+  auto prn = PrReg::Read(*rcrb_mem(), index, SpiBar(0));
   return {
       bits::Test<31>(prn),       // Write Protection Enable
       bits::Value<30, 29>(prn),  // Reserved
@@ -197,7 +203,7 @@ Chipset::PrN IntelIch8Chipset::ReadPrNRegister(int index) {
 }
 
 Chipset::Ssfs IntelIch8Chipset::ReadSsfsRegister() {
-  auto ssfs = rcrb_mem()->ReadUint8(SpiBar(kSsfsRegisterOffset));
+  auto ssfs = SsfsReg::Read(*rcrb_mem(), SpiBar(0));
   return {
       bits::Value<7, 5>(ssfs),  // Reserved
       bits::Test<4>(ssfs),      // AEL
@@ -209,7 +215,8 @@ Chipset::Ssfs IntelIch8Chipset::ReadSsfsRegister() {
 }
 
 Chipset::Ssfc IntelIch8Chipset::ReadSsfcRegister() {
-  auto ssfc = rcrb_mem()->ReadUint32(SpiBar(kSsfcRegisterOffset));
+  // SSFC is not dword-aligned, read it together with SSFS.
+  auto ssfc = SsfsSsfcReg::Read(*rcrb_mem(), SpiBar(0)) >> 8 /* SSFS */;
   return {
       bits::Value<23, 19>(ssfc),  // Reserved
       static_cast<Chipset::SpiCycleFrequency>(
@@ -226,4 +233,41 @@ Chipset::Ssfc IntelIch8Chipset::ReadSsfcRegister() {
   };
 }
 
+uint16_t IntelIch8Chipset::ReadPreopRegister() {
+  return PreopReg::Read(*rcrb_mem(), SpiBar(0));
+}
+
+void IntelIch8Chipset::WritePreopRegister(uint16_t preop) {
+  PreopReg::Write(*rcrb_mem(), preop, SpiBar(0));
+}
+
+uint16_t IntelIch8Chipset::ReadOptypeRegister() {
+  return OptypeReg::Read(*rcrb_mem(), SpiBar(0));
+}
+
+void IntelIch8Chipset::WriteOptypeRegister(uint16_t optype) {
+  OptypeReg::Write(*rcrb_mem(), optype, SpiBar(0));
+}
+
+uint64_t IntelIch8Chipset::ReadOpmenuRegister() {
+  return OpmenuReg::Read(*rcrb_mem(), 0, SpiBar(0)) |
+         uint64_t{OpmenuReg::Read(*rcrb_mem(), 1, SpiBar(0))} << 32;
+}
+
+void IntelIch8Chipset::WriteOpmenuRegister(uint64_t opmenu) {
+  OpmenuReg::Write(*rcrb_mem(), 0, static_cast<uint32_t>(opmenu), SpiBar(0));
+  OpmenuReg::Write(*rcrb_mem(), 1, static_cast<uint32_t>(opmenu >> 32),
+                   SpiBar(0));
+}
+
+uint32_t IntelIch8Chipset::ReadFdodRegister(
+    Chipset::FlashDescriptorSection section, int index) {
+  FdocReg::Write(
+      *rcrb_mem(),
+      bits::Set<14, 12>(static_cast<uint32_t>(section)) |  // FDSS
+          bits::Set<11, 2>(static_cast<uint32_t>(index)),  // FDSI
+      SpiBar(0));
+  return FdodReg::Read(*rcrb_mem(), SpiBar(0));
+}
+
 }  // namespace security::pawn
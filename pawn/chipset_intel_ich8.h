@@ -18,6 +18,7 @@
 #include <cstdint>
 
 #include "pawn/chipset.h"
+#include "pawn/mmio.h"
 #include "pawn/pci.h"
 
 namespace security::pawn {
@@ -48,6 +49,63 @@ class IntelIch8Chipset : public Chipset {
     kPr0RegisterOffset = 0x74,
     kSsfsRegisterOffset = 0x90,
     kSsfcRegisterOffset = 0x91,
+    kPreopRegisterOffset = 0x94,
+    kOptypeRegisterOffset = 0x96,
+    kOpmenuRegisterOffset = 0x98,
+    kFdocRegisterOffset = 0xB0,
+    kFdodRegisterOffset = 0xB4,
+  };
+
+  // SPI Base Address in the RCRB (Page 747).
+  static constexpr uint16_t kSpiBar = 0x3020;
+  // Size of the SPI register block at SPIBAR.
+  static constexpr uint32_t kSpiRegistersSize = 0x100;
+  static_assert(kSpiBar + kSpiRegistersSize <= Chipset::kRootComplexSize);
+
+  // Size of the memory returned by rcrb_mem().
+  static constexpr uint32_t kRegisterMemorySize = Chipset::kRootComplexSize;
+
+  // The registers above as typed MMIO accessors, relative to SPIBAR.
+  template <typename T, uint32_t kOffset>
+  using SpiReg = MmioReg<T, kOffset, kSpiRegistersSize>;
+  template <typename T, uint32_t kOffset, int kCount>
+  using SpiRegArray = MmioRegArray<T, kOffset, kCount, kSpiRegistersSize>;
+  using BfprReg = SpiReg<uint32_t, kBfprRegisterOffset>;
+  using HsfsReg = SpiReg<uint16_t, kHsfsRegisterOffset>;
+  using HsfcReg = SpiReg<uint16_t, kHsfcRegisterOffset>;
+  using FaddrReg = SpiReg<uint32_t, kFaddrRegisterOffset>;
+  using FdataReg = SpiRegArray<uint32_t, kFdata0RegisterOffset, 16>;
+  using FrapReg = SpiReg<uint32_t, kFrapRegisterOffset>;
+  using FregReg = SpiRegArray<uint32_t, kFreg0RegisterOffset, 5>;
+  using PrReg = SpiRegArray<uint32_t, kPr0RegisterOffset, 5>;
+  using SsfsReg = SpiReg<uint8_t, kSsfsRegisterOffset>;
+  // SSFC is not naturally aligned. It is read together with SSFS and written
+  // as a 16-bit and an 8-bit part.
+  using SsfsSsfcReg = SpiReg<uint32_t, kSsfsRegisterOffset>;
+  using SsfcHighReg = SpiReg<uint16_t, kSsfcRegisterOffset + 1>;
+  using SsfcLowReg = SpiReg<uint8_t, kSsfcRegisterOffset>;
+  using PreopReg = SpiReg<uint16_t, kPreopRegisterOffset>;
+  using OptypeReg = SpiReg<uint16_t, kOptypeRegisterOffset>;
+  using OpmenuReg = SpiRegArray<uint32_t, kOpmenuRegisterOffset, 2>;
+  using FdocReg = SpiReg<uint32_t, kFdocRegisterOffset>;
+  using FdodReg = SpiReg<uint32_t, kFdodRegisterOffset>;
+
+  using GcsReg = MmioReg<uint32_t, kGcsRegister, kRegisterMemorySize>;
+
+  // Raw field layout of the hardware sequencing registers, see
+  // ReadHsfsRegister(), ReadHsfcRegister() and ReadFaddrRegister().
+  enum : uint32_t {
+    kHsfsFdone = 1 << 0,     // Flash Cycle Done
+    kHsfsFcerr = 1 << 1,     // Flash Cycle Error
+    kHsfsAel = 1 << 2,       // Access Error Log
+    kHsfsScip = 1 << 5,      // SPI Cycle In Progress
+    kHsfsFlockdn = 1 << 15,  // Flash Configuration Lock-Down
+    kHsfcFgo = 1 << 0,       // Flash Cycle Go
+    kHsfcFcycleShift = 1,    // Flash Cycle
+    kHsfcFcycleMask = 0x3 << kHsfcFcycleShift,
+    kHsfcFdbcShift = 8,  // Flash Data Byte Count
+    kHsfcFdbcMask = 0x3F << kHsfcFdbcShift,
+    kFaddrFlaMask = (1 << 25) - 1,  // Flash Linear Address
   };
 
   static constexpr bool SupportsDevice(const Chipset::HardwareId& id) {
@@ -78,17 +136,23 @@ class IntelIch8Chipset : public Chipset {
   Chipset::PrN ReadPrNRegister(int index) override;
   Chipset::Ssfs ReadSsfsRegister() override;
   Chipset::Ssfc ReadSsfcRegister() override;
+  uint16_t ReadPreopRegister() override;
+  uint16_t ReadOptypeRegister() override;
+  uint64_t ReadOpmenuRegister() override;
+  uint32_t ReadFdodRegister(Chipset::FlashDescriptorSection section,
+                            int index) override;
 
  protected:
-  uint16_t SpiBar(int offset) const override {
-    return 0x3020 + offset;  // Page 747
-  }
+  uint16_t SpiBar(int offset) const override { return kSpiBar + offset; }
 
   void WriteHsfsRegister(const Chipset::Hsfs& hsfs) override;
   void WriteHsfcRegister(const Chipset::Hsfc& hsfc) override;
   void WriteFaddrRegister(const Chipset::Faddr& faddr) override;
   void WriteSsfsRegister(const Chipset::Ssfs& ssfs) override;
   void WriteSsfcRegister(const Chipset::Ssfc& ssfc) override;
+  void WritePreopRegister(uint16_t preop) override;
+  void WriteOptypeRegister(uint16_t optype) override;
+  void WriteOpmenuRegister(uint64_t opmenu) override;
 };
 
 }  // namespace security::pawn
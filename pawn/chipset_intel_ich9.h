@@ -39,14 +39,16 @@ class IntelIch9Chipset : public IntelIch8Chipset {
             id.device == 0x2919 /* ICH9M */);
   }
 
+  // SPI Base Address in the RCRB (Page 821).
+  static constexpr uint16_t kSpiBar = 0x3800;
+  static_assert(kSpiBar + kSpiRegistersSize <= Chipset::kRootComplexSize);
+
   IntelIch9Chipset(Chipset::Tag tag, const Chipset::HardwareId& probed_id,
                    Pci& pci)
       : IntelIch8Chipset(tag, probed_id, pci) {}
 
  protected:
-  uint16_t SpiBar(int offset) const override {
-    return 0x3800 + offset;  // Page 821
-  }
+  uint16_t SpiBar(int offset) const override { return kSpiBar + offset; }
 };
 
 }  // namespace security::pawn
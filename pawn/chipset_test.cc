@@ -0,0 +1,400 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/chipset.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/cycle_waiter.h"
+#include "pawn/physical_memory.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr int kFlashSize = 1 << 20;  // 1MiB
+constexpr int kBlockSize = 64;
+
+struct SimulatedChipset {
+  std::unique_ptr<SimulatedDevice> device;
+  std::unique_ptr<Chipset> chipset;
+};
+
+SimulatedChipset CreateSimulatedChipset(
+    const SimulatedDevice::Options& options,
+    std::string flash_image = SimulatedDevice::MakeFlashImage(kFlashSize)) {
+  SimulatedChipset result;
+  auto device = SimulatedDevice::Create(std::move(flash_image), options);
+  EXPECT_THAT(device.ok(), IsTrue()) << device.status();
+  result.device = std::move(device).value();
+
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create(result.device->pci(), hw_id);
+  EXPECT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  result.chipset = std::move(chipset).value();
+  result.chipset->set_memory_mapper(result.device->memory_mapper());
+  EXPECT_THAT(result.chipset->MapSpiRegisters().ok(), IsTrue());
+  return result;
+}
+
+// Reads size bytes at flash_address and returns the data. Addresses of blocks
+// that failed to read are stored in errors.
+std::string ReadFlash(Chipset& chipset, int flash_address, int size,
+                      std::vector<int>* errors = nullptr) {
+  std::string data;
+  EXPECT_THAT(chipset
+                  .ReadSpiWithHardwareSequencing(
+                      flash_address, size, kBlockSize,
+                      [&data](int, const char* block) {
+                        data.append(block, kBlockSize);
+                        return true;
+                      },
+                      [errors](int fla) {
+                        if (errors) {
+                          errors->push_back(fla);
+                        }
+                        return true;
+                      },
+                      nullptr)
+                  .ok(),
+              IsTrue());
+  return data;
+}
+
+class ChipsetGenerationTest
+    : public ::testing::TestWithParam<Chipset::HardwareId> {};
+
+TEST_P(ChipsetGenerationTest, ReadsWholeFlash) {
+  SimulatedDevice::Options options;
+  options.hardware_id = GetParam();
+  auto [device, chipset] = CreateSimulatedChipset(options);
+
+  EXPECT_THAT(chipset->ReadGcsRegister().boot_bios_straps,
+              Eq(Chipset::kBbsSpi));
+  EXPECT_THAT(chipset->ReadHsfsRegister().flash_descriptor_valid, IsTrue());
+  EXPECT_THAT(chipset->ReadFregNRegister(1).region_base, Eq(0x1000));
+  EXPECT_THAT(chipset->ReadFregNRegister(1).region_limit, Eq(kFlashSize - 1));
+
+  std::vector<int> errors;
+  EXPECT_THAT(ReadFlash(*chipset, 0, kFlashSize, &errors),
+              Eq(device->flash_image()));
+  EXPECT_THAT(errors, IsEmpty());
+  EXPECT_THAT(device->stats().flash_cycles, Eq(kFlashSize / kBlockSize));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    AllGenerations, ChipsetGenerationTest,
+    ::testing::Values(Chipset::HardwareId{0x8086, 0x2810, 0x02},  // ICH8
+                      Chipset::HardwareId{0x8086, 0x2918, 0x02},  // ICH9
+                      Chipset::HardwareId{0x8086, 0x3A18, 0x00},  // ICH10
+                      Chipset::HardwareId{0x8086, 0x1C44, 0x05},  // Z68
+                      Chipset::HardwareId{0x8086, 0x1E47, 0x04},  // Q77
+                      Chipset::HardwareId{0x8086, 0x8C4E, 0x05},  // Q87
+                      Chipset::HardwareId{0x8086, 0x9C43, 0x04},  // QM87
+                      Chipset::HardwareId{0x8086, 0x8CC4, 0x00},  // Z97
+                      Chipset::HardwareId{0x8086, 0xA146, 0x31},  // Q170
+                      Chipset::HardwareId{0x8086, 0x9D48, 0x21},  // SPT-LP
+                      Chipset::HardwareId{0x8086, 0xA2C5, 0x00},  // Z270
+                      Chipset::HardwareId{0x8086, 0xA306, 0x10}   // Q370
+                      ));
+
+TEST(ChipsetTest, RejectsUnsupportedChipset) {
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0x0000, 0x00};
+  auto device = SimulatedDevice::Create(
+      SimulatedDevice::MakeFlashImage(kFlashSize), options);
+  ASSERT_THAT(device.ok(), IsTrue());
+
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  EXPECT_THAT(chipset.status().code(), Eq(absl::StatusCode::kUnimplemented));
+  EXPECT_THAT(hw_id.device, Eq(0x0000));
+}
+
+TEST(ChipsetTest, MapsSpiBarWithoutRootComplex) {
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0xA146, 0x31};  // Q170
+  options.spibar = 0xFE020000;
+  options.bios_cntl = 0x02;  // LE
+  auto device = SimulatedDevice::Create(
+      SimulatedDevice::MakeFlashImage(kFlashSize), options);
+  ASSERT_THAT(device.ok(), IsTrue());
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*device)->memory_mapper());
+
+  EXPECT_THAT((*chipset)->ReadRcbaRegister().enable, IsFalse());
+  EXPECT_THAT((*chipset)->MapRootComplex({0xFED1C000, true}).code(),
+              Eq(absl::StatusCode::kUnimplemented));
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+  EXPECT_THAT((*chipset)->ReadBiosCntlRegister().bios_lock_enable, IsTrue());
+  EXPECT_THAT((*chipset)->SupportsSoftwareSequencing(), IsTrue());
+  EXPECT_THAT((*device)->MapPhysicalMemory(0xFE020000, 0x1000).ok(),
+              IsTrue());
+  EXPECT_THAT((*device)->MapPhysicalMemory(0xFED1C000, 0x4000).ok(),
+              IsFalse());
+}
+
+TEST(ChipsetTest, Uses100SeriesRegisterLayout) {
+  // Flash linear addresses have 27 bits, use an image size that wraps around
+  // differently when truncating them to 25 bits.
+  constexpr int kLargeFlashSize = 3 << 20;
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0xA306, 0x10};  // Q370
+  options.freg = {SimulatedDevice::MakeFregNRegister(0x0000, 0x0FFF),
+                  SimulatedDevice::MakeFregNRegister(0x1000, 0x3FFFFFF)};
+  options.pr = {SimulatedDevice::MakePrNRegister(0x2000000, 0x2000FFF,
+                                                 /*read_protect=*/true,
+                                                 /*write_protect=*/false)};
+  auto [device, chipset] = CreateSimulatedChipset(
+      options, SimulatedDevice::MakeFlashImage(kLargeFlashSize));
+
+  EXPECT_THAT(chipset->SupportsSoftwareSequencing(), IsFalse());
+  EXPECT_THAT(chipset->ReadFregNRegister(1).region_limit, Eq(0x3FFFFFF));
+  EXPECT_THAT(chipset->ReadPrNRegister(0).protected_range_base,
+              Eq(0x2000000));
+
+  EXPECT_THAT(ReadFlash(*chipset, 0x2010000, 0x1000),
+              Eq(device->flash_image().substr(0x2010000 % kLargeFlashSize,
+                                              0x1000)));
+  EXPECT_THAT(chipset->ReadFaddrRegister().flash_linear_address,
+              Eq(0x2010000 + 0x1000 - kBlockSize));
+  EXPECT_THAT(chipset->ReadHsfcRegister().flash_cycle,
+              Eq(Chipset::kFcycleRead));
+  EXPECT_THAT(chipset->ReadHsfcRegister().flash_data_byte_count,
+              Eq(kBlockSize - 1));
+
+  std::vector<int> errors;
+  ReadFlash(*chipset, 0x2000000, 0x1000, &errors);
+  EXPECT_THAT(errors.size(), Eq(0x1000 / kBlockSize));
+}
+
+TEST(ChipsetTest, ReportsInjectedErrors) {
+  SimulatedDevice::Options options;
+  options.error_ranges = {{0x1040, 0x107F}, {0x2000, 0x2000}};
+  auto [device, chipset] = CreateSimulatedChipset(options);
+
+  std::vector<int> errors;
+  ReadFlash(*chipset, 0x1000, 0x1100, &errors);
+  EXPECT_THAT(errors, ElementsAre(0x1040, 0x2000));
+}
+
+TEST(ChipsetTest, ReportsReadProtectedRanges) {
+  SimulatedDevice::Options options;
+  options.pr = {SimulatedDevice::MakePrNRegister(0x3000, 0x3FFF,
+                                                 /*read_protect=*/true,
+                                                 /*write_protect=*/false)};
+  auto [device, chipset] = CreateSimulatedChipset(options);
+
+  EXPECT_THAT(chipset->ReadPrNRegister(0).read_protection_enable, IsTrue());
+  std::vector<int> errors;
+  ReadFlash(*chipset, 0x3000, 0x1000, &errors);
+  EXPECT_THAT(errors.size(), Eq(0x1000 / kBlockSize));
+}
+
+TEST(ChipsetTest, SetsUpFlashCyclesWithoutRegisterReads) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  constexpr int kNumBlocks = 256;
+  const int64_t mmio_reads = device->stats().mmio_reads;
+  ReadFlash(*chipset, 0, kNumBlocks * kBlockSize);
+  // Per block: Poll HSFS once (cycles complete immediately) and read 16
+  // FDATA registers. In addition, HSFS, FADDR and HSFC are read once.
+  EXPECT_THAT(device->stats().mmio_reads - mmio_reads,
+              Eq(kNumBlocks * (1 + kBlockSize / 4) + 3));
+  EXPECT_THAT(device->stats().mmio_writes, Eq(kNumBlocks * 3));
+}
+
+TEST(ChipsetTest, OverlapsCallbacksWithNextCycle) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  constexpr int kNumBlocks = 8;
+  std::vector<int64_t> cycles_started;
+  std::string data;
+  ASSERT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(
+                      0, kNumBlocks * kBlockSize, kBlockSize,
+                      [&](int, const char* block) {
+                        cycles_started.push_back(device->stats().flash_cycles);
+                        data.append(block, kBlockSize);
+                        return true;
+                      },
+                      nullptr, nullptr)
+                  .ok(),
+              IsTrue());
+  // When the callback for block i runs, the cycle for block i + 1 has been
+  // started already.
+  EXPECT_THAT(cycles_started, ElementsAre(2, 3, 4, 5, 6, 7, 8, 8));
+  EXPECT_THAT(data,
+              Eq(device->flash_image().substr(0, kNumBlocks * kBlockSize)));
+}
+
+TEST(ChipsetTest, ReadsBlockSizesThatAreNotWordMultiples) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  constexpr int kOddBlockSize = 6;
+  std::string data;
+  ASSERT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(
+                      0x100, 10 * kOddBlockSize, kOddBlockSize,
+                      [&data](int, const char* block) {
+                        data.append(block, kOddBlockSize);
+                        return true;
+                      },
+                      nullptr, nullptr)
+                  .ok(),
+              IsTrue());
+  EXPECT_THAT(data,
+              Eq(device->flash_image().substr(0x100, 10 * kOddBlockSize)));
+}
+
+TEST(ChipsetTest, StopsWithoutCycleInFlight) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  int blocks_read = 0;
+  ASSERT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(
+                      0, 0x1000, kBlockSize,
+                      [&blocks_read](int, const char*) {
+                        return ++blocks_read < 2;
+                      },
+                      nullptr, nullptr)
+                  .ok(),
+              IsTrue());
+  EXPECT_THAT(blocks_read, Eq(2));
+  EXPECT_THAT(device->stats().flash_cycles, Eq(3));
+  EXPECT_THAT(chipset->ReadHsfsRegister().spi_cycle_in_progress, IsFalse());
+}
+
+TEST(ChipsetTest, TimesOutOnHangingController) {
+  SimulatedDevice::Options options;
+  options.hang_after_cycles = 3;
+  auto [device, chipset] = CreateSimulatedChipset(options);
+  CycleWaiter::Options waiter_options;
+  waiter_options.deadline = absl::Milliseconds(10);
+  chipset->cycle_waiter().set_options(waiter_options);
+
+  int blocks_read = 0;
+  const absl::Status status = chipset->ReadSpiWithHardwareSequencing(
+      0, 0x1000, kBlockSize,
+      [&blocks_read](int, const char*) {
+        ++blocks_read;
+        return true;
+      },
+      nullptr, nullptr);
+  EXPECT_THAT(status.code(), Eq(absl::StatusCode::kDeadlineExceeded));
+  EXPECT_THAT(blocks_read, Eq(3));
+  EXPECT_THAT(chipset->cycle_waiter().histogram().count(), Eq(3));
+}
+
+TEST(ChipsetTest, ReadsIntoSpan) {
+  SimulatedDevice::Options options;
+  options.error_ranges = {{0x1040, 0x107F}};
+  auto [device, chipset] = CreateSimulatedChipset(options);
+
+  // Use an unaligned destination.
+  std::vector<uint8_t> buffer(1 + 0x1000);
+  absl::Span<uint8_t> data = absl::MakeSpan(buffer).subspan(1);
+  std::vector<Chipset::BlockStatus> block_status(0x1000 / kBlockSize);
+  ASSERT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(0x1000, data, kBlockSize,
+                                                  absl::MakeSpan(block_status))
+                  .ok(),
+              IsTrue());
+
+  const std::string expected = device->flash_image().substr(0x1000, 0x1000);
+  EXPECT_THAT(std::string(data.begin(), data.begin() + 0x40),
+              Eq(expected.substr(0, 0x40)));
+  EXPECT_THAT(std::string(data.begin() + 0x80, data.end()),
+              Eq(expected.substr(0x80)));
+  EXPECT_THAT(block_status[0], Eq(Chipset::kBlockOk));
+  EXPECT_THAT(block_status[1], Eq(Chipset::kBlockReadError));
+  EXPECT_THAT(std::count(block_status.begin(), block_status.end(),
+                         Chipset::kBlockOk),
+              Eq(block_status.size() - 1));
+}
+
+TEST(ChipsetTest, MarksUnreadBlocksAfterTimeout) {
+  SimulatedDevice::Options options;
+  options.hang_after_cycles = 3;
+  auto [device, chipset] = CreateSimulatedChipset(options);
+  CycleWaiter::Options waiter_options;
+  waiter_options.deadline = absl::Milliseconds(10);
+  chipset->cycle_waiter().set_options(waiter_options);
+
+  std::vector<uint8_t> data(8 * kBlockSize);
+  std::vector<Chipset::BlockStatus> block_status(8);
+  EXPECT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(0, absl::MakeSpan(data),
+                                                  kBlockSize,
+                                                  absl::MakeSpan(block_status))
+                  .code(),
+              Eq(absl::StatusCode::kDeadlineExceeded));
+  EXPECT_THAT(
+      block_status,
+      ElementsAre(Chipset::kBlockOk, Chipset::kBlockOk, Chipset::kBlockOk,
+                  Chipset::kBlockNotRead, Chipset::kBlockNotRead,
+                  Chipset::kBlockNotRead, Chipset::kBlockNotRead,
+                  Chipset::kBlockNotRead));
+}
+
+TEST(ChipsetTest, RejectsMismatchedBlockStatus) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  std::vector<uint8_t> data(4 * kBlockSize);
+  std::vector<Chipset::BlockStatus> block_status(3);
+  EXPECT_THAT(chipset
+                  ->ReadSpiWithHardwareSequencing(0, absl::MakeSpan(data),
+                                                  kBlockSize,
+                                                  absl::MakeSpan(block_status))
+                  .code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ChipsetTest, FlashAddressesWrapAround) {
+  auto [device, chipset] = CreateSimulatedChipset({});
+
+  EXPECT_THAT(ReadFlash(*chipset, kFlashSize, 0x1000),
+              Eq(device->flash_image().substr(0, 0x1000)));
+}
+
+TEST(ChipsetTest, MapsOnlySimulatedMemory) {
+  auto device =
+      SimulatedDevice::Create(SimulatedDevice::MakeFlashImage(kFlashSize), {});
+  ASSERT_THAT(device.ok(), IsTrue());
+
+  EXPECT_THAT((*device)->MapPhysicalMemory(0xFED1C000, 0x4000).ok(), IsTrue());
+  EXPECT_THAT((*device)->MapPhysicalMemory(0xFED1C000, 0x8000).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -0,0 +1,107 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/component_probe.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr int kSampleSize = 64;
+
+using Sample = std::array<uint8_t, kSampleSize>;
+
+// Reads a single sample. Returns false if the flash cycle failed.
+absl::StatusOr<bool> ReadSample(Chipset& chipset, int64_t flash_address,
+                                Sample& sample) {
+  Chipset::BlockStatus block_status;
+  if (auto status = chipset.ReadSpiWithHardwareSequencing(
+          flash_address, absl::MakeSpan(sample), kSampleSize,
+          absl::MakeSpan(&block_status, 1));
+      !status.ok()) {
+    return status;
+  }
+  return block_status == Chipset::kBlockOk;
+}
+
+}  // namespace
+
+absl::StatusOr<ComponentProbe::Result> ComponentProbe::Probe(
+    Chipset& chipset, const FlashDescriptor& descriptor, int component,
+    int num_samples) {
+  if (component < 0 || component >= descriptor.num_components() ||
+      num_samples <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Invalid component: %d", component));
+  }
+  if (component == 0) {
+    return kPresent;
+  }
+
+  const int64_t base = descriptor.component_base(component);
+  const int64_t size = descriptor.component_size(component);
+  const int64_t reference_size = descriptor.component_size(0);
+  const int64_t stride = std::max<int64_t>(
+      size / num_samples / kSampleSize * kSampleSize, kSampleSize);
+  bool blank = true;
+  bool aliased = true;
+  for (int64_t offset = 0; offset < size && (blank || aliased);
+       offset += stride) {
+    Sample sample;
+    auto ok = ReadSample(chipset, base + offset, sample);
+    if (!ok.ok()) {
+      return ok.status();
+    }
+    if (!*ok) {
+      aliased = false;
+      continue;
+    }
+    blank = blank && std::all_of(sample.begin(), sample.end(),
+                                 [](uint8_t b) { return b == 0xFF; });
+
+    Sample reference;
+    auto reference_ok =
+        ReadSample(chipset, offset % reference_size, reference);
+    if (!reference_ok.ok()) {
+      return reference_ok.status();
+    }
+    aliased = aliased && *reference_ok && sample == reference;
+  }
+  if (blank) {
+    return kMissing;
+  }
+  return aliased ? kAliased : kPresent;
+}
+
+const char* ComponentProbe::ResultName(Result result) {
+  switch (result) {
+    case kPresent:
+      return "present";
+    case kMissing:
+      return "missing";
+    case kAliased:
+      return "aliased";
+  }
+  return "unknown";
+}
+
+}  // namespace security::pawn
@@ -0,0 +1,61 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks whether the flash components listed in the descriptor are actually
+// there. Boards are sometimes shipped with a descriptor for two components
+// but only one chip populated. Depending on the board, the second chip select
+// then either reads as all ones or decodes to the first chip, so that reading
+// the second component yields a mirror of the first one.
+// Use like this:
+//   auto result = ComponentProbe::Probe(*chipset, descriptor, 1);
+//   QCHECK_OK(result.status());
+//   if (*result != ComponentProbe::kPresent) {
+//     ... skip component 1 ...
+//   }
+
+#ifndef PAWN_COMPONENT_PROBE_H_
+#define PAWN_COMPONENT_PROBE_H_
+
+#include "absl/status/statusor.h"
+#include "pawn/chipset.h"
+#include "pawn/flash_descriptor.h"
+
+namespace security::pawn {
+
+class ComponentProbe {
+ public:
+  enum Result {
+    kPresent = 0,
+    kMissing,  // Reads fail or are all ones
+    kAliased,  // Reads return the data of component 0
+  };
+
+  static constexpr int kDefaultSamples = 16;
+
+  // Reads num_samples blocks spread evenly over the component and compares
+  // them against the same offsets in component 0. Component 0 is always
+  // considered present. Note that a component that is completely erased
+  // cannot be told apart from a missing one, dumping either yields all ones.
+  static absl::StatusOr<Result> Probe(Chipset& chipset,
+                                      const FlashDescriptor& descriptor,
+                                      int component,
+                                      int num_samples = kDefaultSamples);
+
+  // Returns a human-readable name for result, e.g. "aliased".
+  static const char* ResultName(Result result);
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_COMPONENT_PROBE_H_
@@ -0,0 +1,113 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/component_probe.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/flash_descriptor.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsTrue;
+
+constexpr int kComponentSize = 1 << 20;  // 1MiB
+
+// Returns a flash image of size bytes with a descriptor for two 1MiB
+// components. second_fill is used for the second MiB, if there is one.
+std::string MakeFlashImage(int size, char second_fill) {
+  std::string image =
+      SimulatedDevice::MakeFlashImage(std::min(size, kComponentSize));
+  image.resize(size, second_fill);
+  auto put = [&image](int offset, uint32_t value) {
+    std::memcpy(&image[offset], &value, sizeof(value));
+  };
+  put(0x10, FlashDescriptor::kSignature);
+  put(0x14, 0x04 << 16 /* FRBA */ | 1 << 8 /* NC */ | 0x03 /* FCBA */);
+  put(0x18, 0x06 /* FMBA */);
+  put(0x30, 0x01 << 3 | 0x01);  // 1MiB each
+  return image;
+}
+
+class ComponentProbeTest : public ::testing::Test {
+ protected:
+  void SetUpDevice(std::string flash_image) {
+    auto device = SimulatedDevice::Create(std::move(flash_image), {});
+    ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+    device_ = std::move(device).value();
+    Chipset::HardwareId hw_id;
+    auto chipset = Chipset::Create(device_->pci(), hw_id);
+    ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+    chipset_ = std::move(chipset).value();
+    chipset_->set_memory_mapper(device_->memory_mapper());
+    ASSERT_THAT(chipset_->MapSpiRegisters().ok(), IsTrue());
+    auto descriptor = FlashDescriptor::ReadFromChipset(*chipset_);
+    ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+    ASSERT_THAT(descriptor->num_components(), Eq(2));
+    descriptor_ = std::make_unique<FlashDescriptor>(*descriptor);
+  }
+
+  ComponentProbe::Result Probe(int component) {
+    auto result = ComponentProbe::Probe(*chipset_, *descriptor_, component);
+    EXPECT_THAT(result.ok(), IsTrue()) << result.status();
+    return result.value_or(ComponentProbe::kPresent);
+  }
+
+  std::unique_ptr<SimulatedDevice> device_;
+  std::unique_ptr<Chipset> chipset_;
+  std::unique_ptr<FlashDescriptor> descriptor_;
+};
+
+TEST_F(ComponentProbeTest, DetectsPresentComponent) {
+  SetUpDevice(MakeFlashImage(2 * kComponentSize, '\x5A'));
+  EXPECT_THAT(Probe(0), Eq(ComponentProbe::kPresent));
+  EXPECT_THAT(Probe(1), Eq(ComponentProbe::kPresent));
+}
+
+TEST_F(ComponentProbeTest, DetectsMissingComponent) {
+  SetUpDevice(MakeFlashImage(2 * kComponentSize, '\xFF'));
+  EXPECT_THAT(Probe(1), Eq(ComponentProbe::kMissing));
+}
+
+TEST_F(ComponentProbeTest, DetectsAliasedComponent) {
+  // Addresses beyond the image wrap around, like a second chip select that
+  // decodes to the first chip.
+  SetUpDevice(MakeFlashImage(kComponentSize, '\0'));
+  EXPECT_THAT(Probe(1), Eq(ComponentProbe::kAliased));
+  EXPECT_THAT(ComponentProbe::ResultName(ComponentProbe::kAliased),
+              Eq(std::string("aliased")));
+}
+
+TEST_F(ComponentProbeTest, RejectsInvalidComponent) {
+  SetUpDevice(MakeFlashImage(kComponentSize, '\0'));
+  EXPECT_THAT(
+      ComponentProbe::Probe(*chipset_, *descriptor_, 2).status().code(),
+      Eq(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace security::pawn
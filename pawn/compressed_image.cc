@@ -0,0 +1,402 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/compressed_image.h"
+
+#include <fcntl.h>     // open()
+#include <sys/stat.h>  // fstat()
+#include <unistd.h>    // close(), pread()
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/async_writer.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr char kMagic[8] = {'P', 'A', 'W', 'N', 'Z', 'I', 'P', '1'};
+constexpr char kIndexMagic[8] = {'P', 'A', 'W', 'N', 'Z', 'I', 'X', '1'};
+constexpr size_t kHeaderSize = sizeof(kMagic) + sizeof(uint64_t);
+constexpr size_t kTrailerSize = 2 * sizeof(uint64_t) + sizeof(kIndexMagic);
+constexpr uint8_t kFill = 0xFF;
+constexpr int64_t kMaxFrameSize = int64_t{1} << 30;
+
+void AppendUint64(std::string& data, uint64_t value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t ConsumeUint64(absl::string_view& data) {
+  uint64_t value;
+  std::memcpy(&value, data.data(), sizeof(value));
+  data.remove_prefix(sizeof(value));
+  return value;
+}
+
+// Reads exactly size bytes at offset. Returns whether that succeeded.
+bool ReadAt(int fd, void* data, size_t size, int64_t offset) {
+  auto* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t result = pread(fd, bytes, size, offset);
+    if (result <= 0) {
+      if (result == -1 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += result;
+    size -= result;
+    offset += result;
+  }
+  return true;
+}
+
+}  // namespace
+
+CompressSink::CompressSink(std::string filename, int64_t offset, int64_t size,
+                           const Options& options,
+                           std::unique_ptr<AsyncWriter> writer)
+    : filename_(std::move(filename)),
+      offset_(offset),
+      size_(size),
+      options_(options),
+      writer_(std::move(writer)) {}
+
+CompressSink::~CompressSink() { Stop(); }
+
+absl::StatusOr<std::unique_ptr<CompressSink>> CompressSink::Create(
+    const std::string& filename, int64_t offset, int64_t size,
+    const Options& options) {
+  if (options.frame_size <= 0 || options.frame_size > kMaxFrameSize ||
+      options.level < 1 || options.level > 9 ||
+      options.num_threads < 0) {
+    return absl::InvalidArgumentError("Invalid compression options");
+  }
+  auto writer = AsyncWriter::Create(filename, options.writer);
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  auto sink = absl::WrapUnique(new CompressSink(
+      filename, offset, size, options, std::move(writer).value()));
+
+  std::string header(kMagic, sizeof(kMagic));
+  AppendUint64(header, options.frame_size);
+  sink->writer_->Append(header.data(), header.size());
+  sink->file_pos_ = header.size();
+
+  const int num_threads =
+      options.num_threads > 0
+          ? options.num_threads
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  for (int i = 0; i < num_threads; ++i) {
+    sink->threads_.emplace_back([s = sink.get()] { s->WorkerLoop(); });
+  }
+  return sink;  // GCC 7 needs the extra move
+}
+
+absl::Status CompressSink::Consume(const BlockSlice& slice) {
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    const int64_t fla = slice.flash_address + i * slice.block_size;
+    if (!slice.ok(i) || fla < offset_ + pos_ ||
+        fla + slice.block_size > offset_ + size_) {
+      continue;
+    }
+    Append(nullptr, fla - offset_ - pos_);
+    Append(slice.block(i).data(), slice.block_size);
+  }
+  return absl::OkStatus();
+}
+
+void CompressSink::Append(const uint8_t* data, int64_t size) {
+  while (size > 0) {
+    if (!current_) {
+      if (free_frames_.empty()) {
+        current_ = std::make_unique<Frame>();
+        current_->data.reserve(options_.frame_size);
+      } else {
+        current_ = std::move(free_frames_.back());
+        free_frames_.pop_back();
+        current_->data.clear();
+        current_->done = false;
+      }
+    }
+    const int64_t chunk = std::min<int64_t>(
+        size, options_.frame_size - current_->data.size());
+    if (data != nullptr) {
+      current_->data.insert(current_->data.end(), data, data + chunk);
+      data += chunk;
+    } else {
+      current_->data.insert(current_->data.end(), chunk, kFill);
+    }
+    size -= chunk;
+    pos_ += chunk;
+    if (current_->data.size() == options_.frame_size) {
+      Submit();
+    }
+  }
+}
+
+void CompressSink::Submit() {
+  {
+    absl::MutexLock lock(&mutex_);
+    queue_.push_back(current_.get());
+    frames_.push_back(std::move(current_));
+    work_available_.Signal();
+  }
+  // Keep every thread busy, with one more frame each to pick up next.
+  WriteFrames(2 * threads_.size());
+}
+
+void CompressSink::WriteFrames(size_t max_pending) {
+  mutex_.Lock();
+  for (;;) {
+    while (!frames_.empty() && frames_.front()->done) {
+      std::unique_ptr<Frame> frame = std::move(frames_.front());
+      frames_.pop_front();
+      mutex_.Unlock();
+      frame_offsets_.push_back(file_pos_);
+      writer_->Append(frame->compressed.data(), frame->compressed_size);
+      file_pos_ += frame->compressed_size;
+      free_frames_.push_back(std::move(frame));
+      mutex_.Lock();
+    }
+    if (frames_.size() <= max_pending) {
+      break;
+    }
+    frame_done_.Wait(&mutex_);
+  }
+  mutex_.Unlock();
+}
+
+void CompressSink::WorkerLoop() {
+  mutex_.Lock();
+  for (;;) {
+    while (queue_.empty() && !stopping_) {
+      work_available_.Wait(&mutex_);
+    }
+    if (queue_.empty()) {
+      break;
+    }
+    Frame* frame = queue_.front();
+    queue_.pop_front();
+    mutex_.Unlock();
+
+    const absl::Time start = absl::Now();
+    uLongf size = compressBound(frame->data.size());
+    frame->compressed.resize(size);
+    // With a buffer of compressBound() bytes, this only fails if zlib runs
+    // out of memory.
+    const int result =
+        compress2(frame->compressed.data(), &size, frame->data.data(),
+                  frame->data.size(), options_.level);
+    CHECK_EQ(result, Z_OK) << "zlib compress2() failed";
+    const absl::Duration elapsed = absl::Now() - start;
+
+    mutex_.Lock();
+    frame->compressed_size = size;
+    frame->done = true;
+    worker_time_ += elapsed;
+    frame_done_.SignalAll();
+  }
+  mutex_.Unlock();
+}
+
+void CompressSink::Stop() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+    work_available_.SignalAll();
+  }
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+absl::Status CompressSink::Finish() {
+  Append(nullptr, size_ - pos_);
+  if (current_ && !current_->data.empty()) {
+    Submit();
+  }
+  WriteFrames(0);
+  Stop();
+  {
+    absl::MutexLock lock(&mutex_);
+    compress_time_ = worker_time_;
+  }
+
+  std::string index;
+  for (uint64_t offset : frame_offsets_) {
+    AppendUint64(index, offset);
+  }
+  AppendUint64(index, size_);
+  AppendUint64(index, file_pos_);
+  index.append(kIndexMagic, sizeof(kIndexMagic));
+  writer_->Append(index.data(), index.size());
+  file_pos_ += index.size();
+  return writer_->Close();
+}
+
+std::string CompressSink::Summary() const {
+  return absl::StrFormat(
+      "%d KiB compressed to %d KiB (%.1f%%) in %d frames, %s on %d threads, "
+      "%s",
+      size_ >> 10, file_pos_ >> 10,
+      size_ > 0 ? 100.0 * file_pos_ / size_ : 0.0, frame_offsets_.size(),
+      absl::FormatDuration(compress_time_), threads_.size(),
+      writer_->stats().ToString());
+}
+
+CompressedImage::~CompressedImage() { close(fd_); }
+
+absl::StatusOr<std::unique_ptr<CompressedImage>> CompressedImage::Open(
+    const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open ", path, ": ", std::strerror(errno)));
+  }
+  auto image = absl::WrapUnique(new CompressedImage(path, fd));
+  const auto invalid = absl::InvalidArgumentError(
+      absl::StrCat(path, " is not a compressed image"));
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < kHeaderSize + kTrailerSize) {
+    return invalid;
+  }
+  char header[kHeaderSize];
+  char trailer[kTrailerSize];
+  if (!ReadAt(fd, header, sizeof(header), 0) ||
+      !ReadAt(fd, trailer, sizeof(trailer), st.st_size - kTrailerSize) ||
+      std::memcmp(header, kMagic, sizeof(kMagic)) != 0 ||
+      std::memcmp(trailer + 2 * sizeof(uint64_t), kIndexMagic,
+                  sizeof(kIndexMagic)) != 0) {
+    return invalid;
+  }
+  absl::string_view data(header + sizeof(kMagic), sizeof(uint64_t));
+  image->frame_size_ = ConsumeUint64(data);
+  data = absl::string_view(trailer, 2 * sizeof(uint64_t));
+  image->size_ = ConsumeUint64(data);
+  const uint64_t index_offset = ConsumeUint64(data);
+  if (image->frame_size_ <= 0 || image->frame_size_ > kMaxFrameSize ||
+      image->size_ < 0) {
+    return invalid;
+  }
+  const uint64_t num_frames =
+      (image->size_ + image->frame_size_ - 1) / image->frame_size_;
+  if (index_offset < kHeaderSize ||
+      index_offset + num_frames * sizeof(uint64_t) !=
+          st.st_size - kTrailerSize) {
+    return invalid;
+  }
+  image->frame_offsets_.resize(num_frames);
+  if (!ReadAt(fd, image->frame_offsets_.data(),
+              num_frames * sizeof(uint64_t), index_offset)) {
+    return invalid;
+  }
+  image->frame_offsets_.push_back(index_offset);
+  uint64_t previous = kHeaderSize;
+  for (uint64_t offset : image->frame_offsets_) {
+    if (offset < previous) {
+      return invalid;
+    }
+    previous = offset;
+  }
+  return image;  // GCC 7 needs the extra move
+}
+
+absl::Status CompressedImage::LoadFrame(int index) {
+  if (index == frame_index_) {
+    return absl::OkStatus();
+  }
+  frame_index_ = -1;
+  const uint64_t offset = frame_offsets_[index];
+  compressed_.resize(frame_offsets_[index + 1] - offset);
+  frame_.resize(std::min(frame_size_, size_ - index * frame_size_));
+  uLongf size = frame_.size();
+  if (!ReadAt(fd_, compressed_.data(), compressed_.size(), offset) ||
+      uncompress(frame_.data(), &size, compressed_.data(),
+                 compressed_.size()) != Z_OK ||
+      size != frame_.size()) {
+    return absl::DataLossError(
+        absl::StrFormat("%s: Frame %d is corrupt", path_, index));
+  }
+  frame_index_ = index;
+  return absl::OkStatus();
+}
+
+absl::Status CompressedImage::Read(int64_t offset, absl::Span<uint8_t> data) {
+  if (offset < 0 || offset + static_cast<int64_t>(data.size()) > size_) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "%d bytes at %d are outside of the image", data.size(), offset));
+  }
+  while (!data.empty()) {
+    const int index = offset / frame_size_;
+    if (auto status = LoadFrame(index); !status.ok()) {
+      return status;
+    }
+    const size_t pos = offset - index * frame_size_;
+    const size_t size = std::min(data.size(), frame_.size() - pos);
+    std::memcpy(data.data(), &frame_[pos], size);
+    data.remove_prefix(size);
+    offset += size;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DecompressImage(const std::string& path,
+                             const std::string& output) {
+  auto image = CompressedImage::Open(path);
+  if (!image.ok()) {
+    return image.status();
+  }
+  auto writer = AsyncWriter::Create(output, {});
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  std::vector<uint8_t> buffer((*image)->frame_size());
+  for (int64_t offset = 0; offset < (*image)->size();
+       offset += buffer.size()) {
+    const auto data = absl::MakeSpan(buffer).first(
+        std::min<int64_t>(buffer.size(), (*image)->size() - offset));
+    if (auto status = (*image)->Read(offset, data); !status.ok()) {
+      return status;
+    }
+    (*writer)->Append(data.data(), data.size());
+  }
+  return (*writer)->Close();
+}
+
+}  // namespace security::pawn
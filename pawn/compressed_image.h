@@ -0,0 +1,171 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Compressed dumps. The image is split into frames of a fixed size, which are
+// compressed with zlib independently of each other, on a pool of threads
+// while reading continues. An index of the frames at the end of the file lets
+// readers decompress any part of the image without the frames before it.
+// File layout, all little-endian:
+//   char magic[8]         "PAWNZIP1"
+//   uint64_t frame_size
+//   frames                A zlib stream each, of frame_size bytes of the
+//                         image, the last one may be shorter
+//   uint64_t offsets[n]   File offset of each frame, a frame ends where the
+//                         next one (or the index) starts
+//   uint64_t image_size
+//   uint64_t index_offset
+//   char magic[8]         "PAWNZIX1"
+
+#ifndef PAWN_COMPRESSED_IMAGE_H_
+#define PAWN_COMPRESSED_IMAGE_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/async_writer.h"
+#include "pawn/block_sink.h"
+
+namespace security::pawn {
+
+// Writes the readable blocks within a range of flash linear addresses to a
+// compressed image, with the parts that are not read filled with 0xFF like in
+// a FileSink.
+class CompressSink : public BlockSink {
+ public:
+  struct Options {
+    int64_t frame_size = 256 << 10;  // 256KiB
+
+    // zlib compression level, 1 (fastest) to 9 (best).
+    int level = 6;
+
+    // Compression threads, 0 for one per CPU.
+    int num_threads = 0;
+
+    AsyncWriter::Options writer;
+  };
+
+  static absl::StatusOr<std::unique_ptr<CompressSink>> Create(
+      const std::string& filename, int64_t offset, int64_t size,
+      const Options& options);
+
+  CompressSink(const CompressSink&) = delete;
+  CompressSink& operator=(const CompressSink&) = delete;
+
+  ~CompressSink() override;
+
+  std::string name() const override { return filename_; }
+  absl::Status Consume(const BlockSlice& slice) override;
+  // Compresses the rest of the image, writes the index and closes the file.
+  absl::Status Finish() override;
+  std::string Summary() const override;
+
+ private:
+  struct Frame {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> compressed;
+    size_t compressed_size = 0;
+    bool done = false;
+  };
+
+  CompressSink(std::string filename, int64_t offset, int64_t size,
+               const Options& options, std::unique_ptr<AsyncWriter> writer);
+
+  // Appends size bytes of data, or of fill if data is nullptr, to the image.
+  void Append(const uint8_t* data, int64_t size);
+  // Hands the current frame to the compression threads.
+  void Submit();
+  // Writes compressed frames in order until at most max_pending are left,
+  // waiting for the threads if needed.
+  void WriteFrames(size_t max_pending) ABSL_LOCKS_EXCLUDED(mutex_);
+  void WorkerLoop();
+  void Stop();
+
+  const std::string filename_;
+  const int64_t offset_;
+  const int64_t size_;
+  const Options options_;
+  std::unique_ptr<AsyncWriter> writer_;
+  std::vector<std::thread> threads_;
+
+  int64_t pos_ = 0;  // Image position
+  std::unique_ptr<Frame> current_;
+  std::vector<std::unique_ptr<Frame>> free_frames_;
+  std::vector<uint64_t> frame_offsets_;
+  uint64_t file_pos_ = 0;
+  absl::Duration compress_time_;
+
+  absl::Mutex mutex_;
+  absl::CondVar work_available_;
+  absl::CondVar frame_done_;
+  // Submitted frames, in image order
+  std::deque<std::unique_ptr<Frame>> frames_ ABSL_GUARDED_BY(mutex_);
+  std::deque<Frame*> queue_ ABSL_GUARDED_BY(mutex_);  // Not compressed yet
+  absl::Duration worker_time_ ABSL_GUARDED_BY(mutex_);
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+// Random access to a compressed image.
+class CompressedImage {
+ public:
+  static absl::StatusOr<std::unique_ptr<CompressedImage>> Open(
+      const std::string& path);
+
+  CompressedImage(const CompressedImage&) = delete;
+  CompressedImage& operator=(const CompressedImage&) = delete;
+
+  ~CompressedImage();
+
+  int64_t size() const { return size_; }
+  int64_t frame_size() const { return frame_size_; }
+  int num_frames() const { return frame_offsets_.size() - 1; }
+
+  // Reads data.size() bytes at offset of the image, decompressing only the
+  // frames that hold them.
+  absl::Status Read(int64_t offset, absl::Span<uint8_t> data);
+
+ private:
+  CompressedImage(std::string path, int fd) : path_(std::move(path)), fd_(fd) {}
+
+  // Decompresses frame index into frame_.
+  absl::Status LoadFrame(int index);
+
+  const std::string path_;
+  const int fd_;
+  int64_t size_ = 0;
+  int64_t frame_size_ = 0;
+  // Includes the index offset as the end of the last frame.
+  std::vector<uint64_t> frame_offsets_;
+  int frame_index_ = -1;  // Of frame_
+  std::vector<uint8_t> frame_;
+  std::vector<uint8_t> compressed_;
+};
+
+// Writes the image of the compressed file at path to output.
+absl::Status DecompressImage(const std::string& path,
+                             const std::string& output);
+
+}  // namespace security::pawn
+
+#endif  // PAWN_COMPRESSED_IMAGE_H_
@@ -0,0 +1,154 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/compressed_image.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "pawn/block_sink.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsTrue;
+using ::testing::Lt;
+
+constexpr int kFrameSize = 4096;
+constexpr int kBlockSize = 64;
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// Returns a path in the test's temporary directory unique to the running
+// test, with suffix appended.
+std::string TestOutputPath(const std::string& suffix) {
+  const ::testing::TestInfo* info =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  return absl::StrCat(::testing::TempDir(), "/", info->test_suite_name(), ".",
+                      info->name(), suffix);
+}
+
+class CompressedImageTest : public ::testing::Test {
+ protected:
+  // Compresses slices of random data and erased blocks, with every tenth
+  // block unreadable, to path_, and keeps the expected image.
+  void Compress(int64_t size, int num_threads) {
+    CompressSink::Options options;
+    options.frame_size = kFrameSize;
+    options.num_threads = num_threads;
+    auto sink = CompressSink::Create(path_, 0 /* Offset */, size, options);
+    ASSERT_THAT(sink.ok(), IsTrue()) << sink.status();
+
+    std::mt19937 random(1);
+    image_.assign(size, '\xFF');
+    // Leave out the last slice, to be filled by Finish().
+    for (int64_t offset = 0; offset + 1024 < size; offset += 1024) {
+      BlockSlice slice;
+      slice.flash_address = offset;
+      slice.block_size = kBlockSize;
+      slice.data.resize(1024, 0xFF);
+      slice.block_status.resize(1024 / kBlockSize, Chipset::kBlockOk);
+      for (int i = 0; i < slice.num_blocks(); ++i) {
+        const int64_t block = offset / kBlockSize + i;
+        if (block % 10 == 9) {
+          slice.block_status[i] = Chipset::kBlockReadError;
+        } else if (block % 3 == 0) {
+          for (int j = 0; j < kBlockSize; ++j) {
+            slice.data[i * kBlockSize + j] = random();
+            image_[block * kBlockSize + j] = slice.data[i * kBlockSize + j];
+          }
+        }
+      }
+      ASSERT_THAT((*sink)->Consume(slice).ok(), IsTrue());
+    }
+    ASSERT_THAT((*sink)->Finish().ok(), IsTrue());
+  }
+
+  // ctest runs each test in a process of its own, possibly in parallel.
+  std::string path_ = TestOutputPath(".compressed");
+  std::string image_;
+};
+
+TEST_F(CompressedImageTest, RoundTrips) {
+  for (int num_threads : {1, 4}) {
+    // Frames and the last partial frame
+    Compress(10 * kFrameSize + 512, num_threads);
+    EXPECT_THAT(ReadFile(path_).size(), Lt(image_.size()));
+
+    const std::string output = TestOutputPath(".decompressed");
+    ASSERT_THAT(DecompressImage(path_, output).ok(), IsTrue());
+    EXPECT_THAT(ReadFile(output) == image_, IsTrue());
+  }
+}
+
+TEST_F(CompressedImageTest, ReadsAnyRange) {
+  Compress(8 * kFrameSize, 2);
+  auto image = CompressedImage::Open(path_);
+  ASSERT_THAT(image.ok(), IsTrue()) << image.status();
+  EXPECT_THAT((*image)->size(), Eq(8 * kFrameSize));
+  EXPECT_THAT((*image)->num_frames(), Eq(8));
+
+  std::vector<uint8_t> data(3 * kFrameSize);
+  for (int64_t offset : {5 * kFrameSize, 0, kFrameSize - 1, 100}) {
+    const size_t size = std::min<size_t>(data.size(), 3 * kFrameSize - 1);
+    ASSERT_THAT(
+        (*image)->Read(offset, absl::MakeSpan(data).first(size)).ok(),
+        IsTrue());
+    EXPECT_THAT(std::string(data.begin(), data.begin() + size) ==
+                    image_.substr(offset, size),
+                IsTrue())
+        << offset;
+  }
+  EXPECT_THAT((*image)->Read(8 * kFrameSize - 1, absl::MakeSpan(data).first(2))
+                  .code(),
+              Eq(absl::StatusCode::kOutOfRange));
+}
+
+TEST_F(CompressedImageTest, DetectsCorruption) {
+  Compress(4 * kFrameSize, 1);
+  std::string data = ReadFile(path_);
+  data[20] ^= 0x55;  // In the first frame
+  std::ofstream(path_, std::ios::binary) << data;
+  auto image = CompressedImage::Open(path_);
+  ASSERT_THAT(image.ok(), IsTrue()) << image.status();
+  std::vector<uint8_t> buffer(16);
+  EXPECT_THAT((*image)->Read(0, absl::MakeSpan(buffer)).code(),
+              Eq(absl::StatusCode::kDataLoss));
+  EXPECT_THAT((*image)->Read(kFrameSize, absl::MakeSpan(buffer)).ok(),
+              IsTrue());
+
+  std::ofstream(path_, std::ios::binary) << "PAWNZIP1 truncated";
+  EXPECT_THAT(CompressedImage::Open(path_).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -0,0 +1,175 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/cycle_waiter.h"
+
+#include <cpuid.h>      // __get_cpuid_count()
+#include <time.h>       // nanosleep()
+#include <x86intrin.h>  // __rdtsc(), _mm_pause()
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cmath>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+namespace {
+
+// Number of PAUSE instructions between polls. Depending on the
+// microarchitecture, PAUSE takes between 10 and 140 cycles.
+constexpr int kPausesPerPoll = 8;
+
+// Number of TSC ticks to wait with TPAUSE between polls. This is roughly one
+// microsecond on current CPUs.
+constexpr uint64_t kTpauseTicks = 2000;
+
+void Tpause(uint64_t ticks) {
+  const uint64_t deadline = __rdtsc() + ticks;
+  // TPAUSE ecx, encoded manually so that older assemblers work, too. ECX = 0
+  // requests the C0.2 state (deeper, slower to wake up).
+  asm volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+               :
+               : "c"(0), "a"(static_cast<uint32_t>(deadline)),
+                 "d"(static_cast<uint32_t>(deadline >> 32))
+               : "cc");
+}
+
+int BucketIndex(int64_t ns) {
+  if (ns <= 0) {
+    return 0;
+  }
+  return std::min(63 - __builtin_clzll(ns), LatencyHistogram::kNumBuckets - 1);
+}
+
+}  // namespace
+
+void LatencyHistogram::Record(absl::Duration latency) {
+  const int64_t ns = absl::ToInt64Nanoseconds(latency);
+  ++buckets_[BucketIndex(ns)];
+  if (count_ == 0 || ns < min_ns_) {
+    min_ns_ = ns;
+  }
+  if (count_ == 0 || ns > max_ns_) {
+    max_ns_ = ns;
+  }
+  sum_ns_ += ns;
+  ++count_;
+}
+
+void LatencyHistogram::Clear() { *this = LatencyHistogram(); }
+
+absl::Duration LatencyHistogram::min() const {
+  return absl::Nanoseconds(min_ns_);
+}
+
+absl::Duration LatencyHistogram::max() const {
+  return absl::Nanoseconds(max_ns_);
+}
+
+absl::Duration LatencyHistogram::mean() const {
+  return count_ == 0 ? absl::ZeroDuration()
+                     : absl::Nanoseconds(sum_ns_ / count_);
+}
+
+absl::Duration LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return absl::ZeroDuration();
+  }
+  const auto rank = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil(percentile / 100.0 * count_)));
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(absl::Nanoseconds(int64_t{1} << (i + 1)), max());
+    }
+  }
+  return max();
+}
+
+std::string LatencyHistogram::ToString() const {
+  std::string result = absl::StrFormat(
+      "%d samples, min %s, mean %s, p50 %s, p99 %s, max %s\n", count_,
+      absl::FormatDuration(min()), absl::FormatDuration(mean()),
+      absl::FormatDuration(Percentile(50)),
+      absl::FormatDuration(Percentile(99)), absl::FormatDuration(max()));
+  for (int i = 0; i < kNumBuckets; ++i) {
+    if (buckets_[i] == 0) {
+      continue;
+    }
+    absl::StrAppendFormat(
+        &result, "  < %-10s %d\n",
+        absl::FormatDuration(absl::Nanoseconds(int64_t{1} << (i + 1))),
+        buckets_[i]);
+  }
+  return result;
+}
+
+CycleWaiter::CycleWaiter(const Options& options) { set_options(options); }
+
+bool CycleWaiter::CpuSupportsTpause() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+         (ecx & (1 << 5)) != 0;  // WAITPKG
+}
+
+void CycleWaiter::set_options(const Options& options) {
+  options_ = options;
+  use_tpause_ = options_.use_tpause && CpuSupportsTpause();
+}
+
+absl::Status CycleWaiter::Wait(absl::FunctionRef<bool()> done) {
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point start = Clock::now();
+  auto record_latency = [this, start] {
+    histogram_.Record(absl::FromChrono(Clock::now() - start));
+    return absl::OkStatus();
+  };
+
+  for (int i = 0; i < options_.spin_polls; ++i) {
+    if (done()) {
+      return record_latency();
+    }
+  }
+
+  const auto pause_until = absl::ToChronoNanoseconds(options_.pause_until);
+  const auto tpause_until = absl::ToChronoNanoseconds(options_.tpause_until);
+  const auto deadline = absl::ToChronoNanoseconds(options_.deadline);
+  const timespec sleep_interval = absl::ToTimespec(options_.sleep_interval);
+  while (!done()) {
+    const auto elapsed = Clock::now() - start;
+    if (elapsed >= deadline) {
+      return absl::DeadlineExceededError(
+          absl::StrCat("SPI flash cycle did not complete within ",
+                       absl::FormatDuration(options_.deadline)));
+    }
+    if (elapsed < pause_until) {
+      for (int i = 0; i < kPausesPerPoll; ++i) {
+        _mm_pause();
+      }
+    } else if (use_tpause_ && elapsed < tpause_until) {
+      Tpause(kTpauseTicks);
+    } else {
+      nanosleep(&sleep_interval, nullptr);
+    }
+  }
+  return record_latency();
+}
+
+}  // namespace security::pawn
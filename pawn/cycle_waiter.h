@@ -0,0 +1,118 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Adaptive waiting for SPI flash cycle completion.
+// Flash cycles take anywhere from a few to several hundred microseconds,
+// depending on the chipset generation, the SPI clock and the flash chip. A
+// plain busy loop reading the status register hammers MMIO, burns a full core
+// and never gives up on a wedged controller. CycleWaiter instead polls in
+// stages with increasing back-off:
+//   1. A short tight spin for cycles that complete almost immediately.
+//   2. Polling with PAUSE in between.
+//   3. Polling with TPAUSE in between, if the CPU supports WAITPKG. Note that
+//      UMONITOR/UMWAIT cannot be used, as they only observe write-back
+//      memory, not device registers.
+//   4. Polling with nanosleep() in between.
+// Waiting stops with absl::DeadlineExceededError() once the deadline passed.
+// Each successful wait is recorded in a latency histogram.
+
+#ifndef PAWN_CYCLE_WAITER_H_
+#define PAWN_CYCLE_WAITER_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+
+// Histogram of latencies with logarithmic (power of two) nanosecond buckets.
+class LatencyHistogram {
+ public:
+  // Bucket i holds latencies in [2^i, 2^(i+1)) nanoseconds, bucket 0 also
+  // holds zero latencies.
+  static constexpr int kNumBuckets = 40;
+
+  void Record(absl::Duration latency);
+  void Clear();
+
+  int64_t count() const { return count_; }
+  absl::Duration min() const;
+  absl::Duration max() const;
+  absl::Duration mean() const;
+  const std::array<int64_t, kNumBuckets>& buckets() const { return buckets_; }
+
+  // Returns the upper bound of the bucket that contains the specified
+  // percentile, which must be in [0, 100].
+  absl::Duration Percentile(double percentile) const;
+
+  // Returns a human-readable summary, followed by one line per non-empty
+  // bucket.
+  std::string ToString() const;
+
+ private:
+  std::array<int64_t, kNumBuckets> buckets_ = {};
+  int64_t count_ = 0;
+  int64_t min_ns_ = 0;
+  int64_t max_ns_ = 0;
+  int64_t sum_ns_ = 0;
+};
+
+class CycleWaiter {
+ public:
+  struct Options {
+    // Number of polls without any delay in between.
+    int spin_polls = 32;
+    // Poll with PAUSE in between until this much time has passed.
+    absl::Duration pause_until = absl::Microseconds(20);
+    // Poll with TPAUSE in between until this much time has passed. Only used
+    // if the CPU supports it.
+    absl::Duration tpause_until = absl::Milliseconds(1);
+    // Poll with nanosleep() in between this often until the deadline.
+    absl::Duration sleep_interval = absl::Microseconds(50);
+    // Hard deadline, measured from the start of the wait.
+    absl::Duration deadline = absl::Seconds(1);
+    // Whether to use TPAUSE at all.
+    bool use_tpause = true;
+  };
+
+  CycleWaiter() : CycleWaiter(Options()) {}
+  explicit CycleWaiter(const Options& options);
+
+  // Returns whether this CPU supports the TPAUSE instruction (WAITPKG).
+  static bool CpuSupportsTpause();
+
+  const Options& options() const { return options_; }
+  void set_options(const Options& options);
+
+  // Calls done until it returns true. On success, the wait time is added to
+  // the latency histogram. Returns absl::DeadlineExceededError() if done did
+  // not return true before the deadline.
+  absl::Status Wait(absl::FunctionRef<bool()> done);
+
+  const LatencyHistogram& histogram() const { return histogram_; }
+  LatencyHistogram& histogram() { return histogram_; }
+
+ private:
+  Options options_;
+  bool use_tpause_;
+  LatencyHistogram histogram_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_CYCLE_WAITER_H_
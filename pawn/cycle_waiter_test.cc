@@ -0,0 +1,88 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/cycle_waiter.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::HasSubstr;
+using ::testing::IsTrue;
+using ::testing::Lt;
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 99; ++i) {
+    histogram.Record(absl::Nanoseconds(1000));  // Bucket [512, 1024)
+  }
+  histogram.Record(absl::Microseconds(100));
+
+  EXPECT_THAT(histogram.count(), Eq(100));
+  EXPECT_THAT(histogram.min(), Eq(absl::Nanoseconds(1000)));
+  EXPECT_THAT(histogram.max(), Eq(absl::Microseconds(100)));
+  EXPECT_THAT(histogram.Percentile(50), Eq(absl::Nanoseconds(1024)));
+  EXPECT_THAT(histogram.Percentile(99), Eq(absl::Nanoseconds(1024)));
+  EXPECT_THAT(histogram.Percentile(100), Eq(absl::Microseconds(100)));
+  EXPECT_THAT(histogram.ToString(), HasSubstr("100 samples"));
+}
+
+TEST(CycleWaiterTest, WaitsUntilDone) {
+  CycleWaiter waiter;
+  int polls = 0;
+  EXPECT_THAT(waiter.Wait([&polls] { return ++polls == 1000; }).ok(),
+              IsTrue());
+  EXPECT_THAT(polls, Eq(1000));
+  EXPECT_THAT(waiter.histogram().count(), Eq(1));
+}
+
+TEST(CycleWaiterTest, BacksOffToSleep) {
+  CycleWaiter::Options options;
+  options.pause_until = absl::ZeroDuration();
+  options.tpause_until = absl::ZeroDuration();
+  options.sleep_interval = absl::Milliseconds(1);
+  CycleWaiter waiter(options);
+
+  const absl::Time done_at = absl::Now() + absl::Milliseconds(5);
+  int polls = 0;
+  EXPECT_THAT(waiter.Wait([&] {
+                ++polls;
+                return absl::Now() >= done_at;
+              }).ok(),
+              IsTrue());
+  // Spinning alone would poll many thousand times.
+  EXPECT_THAT(polls, Lt(options.spin_polls + 10));
+  EXPECT_THAT(waiter.histogram().max(), Ge(absl::Milliseconds(4)));
+}
+
+TEST(CycleWaiterTest, GivesUpAfterDeadline) {
+  CycleWaiter::Options options;
+  options.deadline = absl::Milliseconds(10);
+  CycleWaiter waiter(options);
+
+  const absl::Status status = waiter.Wait([] { return false; });
+  EXPECT_THAT(status.code(), Eq(absl::StatusCode::kDeadlineExceeded));
+  EXPECT_THAT(waiter.histogram().count(), Eq(0));
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -0,0 +1,221 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/flash_descriptor.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "pawn/bits.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+namespace {
+
+// Offsets relative to the signature.
+enum {
+  kFlmap0Offset = 0x04,  // Flash Map 0 Register
+  kFlmap1Offset = 0x08,  // Flash Map 1 Register
+};
+
+// Dwords in the component section: FLCOMP, FLILL, FLPB.
+constexpr int kComponentDwords = 3;
+// Dwords in the descriptor map section: FLVALSIG, FLMAP0..2.
+constexpr int kMapDwords = 4;
+
+uint32_t ReadUint32(absl::Span<const uint8_t> data, int offset) {
+  uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+absl::StatusOr<FlashDescriptor> FlashDescriptor::Parse(
+    absl::Span<const uint8_t> data, Chipset::FlashDescriptorFormat format) {
+  if (data.size() < kSize) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Need %d bytes to parse flash descriptor", kSize));
+  }
+
+  // Descriptors starting with the 5 Series/3400 Series chipsets have 16 bytes
+  // of reserved space before the signature, older ones start with it.
+  int base;
+  if (ReadUint32(data, 0x10) == kSignature) {
+    base = 0x10;
+  } else if (ReadUint32(data, 0x00) == kSignature) {
+    base = 0x00;
+  } else {
+    return absl::NotFoundError("No flash descriptor signature");
+  }
+
+  const uint32_t flmap0 = ReadUint32(data, base + kFlmap0Offset);
+  // Component and Region Base Addresses are bits 11:4 of the offset into the
+  // flash.
+  const uint32_t flmap1 = ReadUint32(data, base + kFlmap1Offset);
+  const int fcba = bits::Value<7, 0>(flmap0) << 4;
+  const int frba = bits::Value<23, 16>(flmap0) << 4;
+  const int fmba = bits::Value<7, 0>(flmap1) << 4;
+  if (fcba + kComponentDwords * 4 > kSize || frba + kNumRegions * 4 > kSize ||
+      fmba + kNumMasters * 4 > kSize) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Invalid flash map: FCBA 0x%03X, FRBA 0x%03X, FMBA 0x%03X", fcba, frba,
+        fmba));
+  }
+
+  const bool pch100 = format == Chipset::kDescriptorFormat100Series;
+  FlashDescriptor descriptor;
+  descriptor.format_ = format;
+  descriptor.num_components_ = bits::Value<9, 8>(flmap0) + 1;
+  if (descriptor.num_components_ > kMaxComponents) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Invalid number of components: %d", descriptor.num_components_));
+  }
+
+  // Flash Components Register. Component densities are encoded as
+  // 512KiB << value, in 3-bit fields up to the 9 Series and 4-bit fields
+  // starting with the 100 Series.
+  const uint32_t flcomp = ReadUint32(data, fcba);
+  const uint32_t densities[kMaxComponents] = {
+      pch100 ? bits::Value<3, 0>(flcomp) : bits::Value<2, 0>(flcomp),
+      pch100 ? bits::Value<7, 4>(flcomp) : bits::Value<5, 3>(flcomp)};
+  for (int i = 0; i < descriptor.num_components_; ++i) {
+    descriptor.component_sizes_[i] = int64_t{512 << 10} << densities[i];
+  }
+  descriptor.read_clock_frequency_ = bits::Value<19, 17>(flcomp);
+  descriptor.fast_read_support_ = bits::Test<20>(flcomp);
+  descriptor.fast_read_clock_frequency_ = bits::Value<23, 21>(flcomp);
+
+  // Flash Invalid Instructions Register, one opcode per byte.
+  const uint32_t flill = ReadUint32(data, fcba + 4);
+  for (int i = 0; i < kNumInvalidInstructions; ++i) {
+    descriptor.invalid_instructions_[i] = flill >> (i * 8) & 0xFF;
+  }
+
+  // Flash Region N Registers, bases and limits are bits 24:12 (26:12 starting
+  // with the 100 Series) of flash linear addresses.
+  for (int i = 0; i < kNumRegions; ++i) {
+    const uint32_t flreg = ReadUint32(data, frba + i * 4);
+    descriptor.regions_[i] =
+        pch100 ? FlashRegion{bits::Value<14, 0>(flreg) << 12,
+                             bits::Value<30, 16>(flreg) << 12 | 0xFFF}
+               : FlashRegion{bits::Value<12, 0>(flreg) << 12,
+                             bits::Value<28, 16>(flreg) << 12 | 0xFFF};
+  }
+
+  // Flash Master N Registers, starting with FLMSTR1 for the host CPU/BIOS.
+  for (int i = 0; i < kNumMasters; ++i) {
+    const uint32_t flmstr = ReadUint32(data, fmba + i * 4);
+    descriptor.masters_[i] = {
+        static_cast<uint16_t>(bits::Value<15, 0>(flmstr)),
+        static_cast<uint8_t>(bits::Value<23, 16>(flmstr)),
+        static_cast<uint8_t>(bits::Value<31, 24>(flmstr))};
+  }
+  return descriptor;
+}
+
+absl::StatusOr<FlashDescriptor> FlashDescriptor::ReadFromChipset(
+    Chipset& chipset) {
+  // Lay the sections out in a descriptor image, so that Parse() applies. The
+  // map goes first, like on ICH8 to ICH10, as their component section may
+  // start right after it.
+  std::vector<uint8_t> data(kSize, 0xFF);
+  auto put = [&data](int offset, uint32_t value) {
+    std::memcpy(data.data() + offset, &value, sizeof(value));
+  };
+  constexpr int kBase = 0x00;
+  for (int i = 0; i < kMapDwords; ++i) {
+    put(kBase + i * 4, chipset.ReadFdodRegister(Chipset::kFdssMap, i));
+  }
+  if (ReadUint32(data, kBase) != kSignature) {
+    return absl::NotFoundError("No valid flash descriptor in chipset");
+  }
+
+  const uint32_t flmap0 = ReadUint32(data, kBase + kFlmap0Offset);
+  const uint32_t flmap1 = ReadUint32(data, kBase + kFlmap1Offset);
+  const struct {
+    Chipset::FlashDescriptorSection section;
+    int offset;
+    int num_dwords;
+  } sections[] = {
+      {Chipset::kFdssComponent,
+       static_cast<int>(bits::Value<7, 0>(flmap0) << 4), kComponentDwords},
+      {Chipset::kFdssRegion,
+       static_cast<int>(bits::Value<23, 16>(flmap0) << 4), kNumRegions},
+      {Chipset::kFdssMaster, static_cast<int>(bits::Value<7, 0>(flmap1) << 4),
+       kNumMasters},
+  };
+  for (const auto& [section, offset, num_dwords] : sections) {
+    if (offset < kBase + kMapDwords * 4 || offset + num_dwords * 4 > kSize) {
+      return absl::FailedPreconditionError(absl::StrFormat(
+          "Invalid flash map: section %d at 0x%03X", section, offset));
+    }
+    for (int i = 0; i < num_dwords; ++i) {
+      put(offset + i * 4, chipset.ReadFdodRegister(section, i));
+    }
+  }
+  return Parse(data, chipset.GetFlashDescriptorFormat());
+}
+
+const char* FlashDescriptor::RegionName(int index) {
+  constexpr const char* kRegionNames[kNumRegions] = {"Descriptor", "BIOS",
+                                                     "ME", "GbE", "PDR"};
+  return index >= 0 && index < kNumRegions ? kRegionNames[index] : "Unknown";
+}
+
+int64_t FlashDescriptor::component_base(int index) const {
+  int64_t base = 0;
+  for (int i = 0; i < index; ++i) {
+    base += component_sizes_[i];
+  }
+  return base;
+}
+
+int64_t FlashDescriptor::total_size() const {
+  int64_t total = 0;
+  for (int i = 0; i < num_components_; ++i) {
+    total += component_sizes_[i];
+  }
+  return total;
+}
+
+std::string FlashDescriptor::ToString() const {
+  std::string result;
+  for (int i = 0; i < num_components_; ++i) {
+    absl::StrAppendFormat(&result, "Component %d: %d KiB\n", i,
+                          component_sizes_[i] >> 10);
+  }
+  for (int i = 0; i < kNumRegions; ++i) {
+    const FlashRegion& region = regions_[i];
+    if (!region.used()) {
+      continue;
+    }
+    absl::StrAppendFormat(&result, "FLREG%d %-10s 0x%08X - 0x%08X\n", i,
+                          RegionName(i), region.base, region.limit);
+  }
+  for (int i = 0; i < kNumMasters; ++i) {
+    const FlashMaster& master = masters_[i];
+    absl::StrAppendFormat(&result, "FLMSTR%d Read: 0x%02X  Write: 0x%02X\n",
+                          i + 1, master.read_access, master.write_access);
+  }
+  return result;
+}
+
+}  // namespace security::pawn
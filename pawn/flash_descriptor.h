@@ -0,0 +1,170 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Parser for the SPI flash descriptor, the data structure at the start of the
+// flash chip that describes the flash components and how the flash is divided
+// into regions. Only the parts needed to size and lay out a dump are decoded.
+// Use like this:
+//   std::vector<uint8_t> data(FlashDescriptor::kSize);
+//   QCHECK_OK(chipset->ReadSpiWithHardwareSequencing(0, absl::MakeSpan(data),
+//                                                    64));
+//   auto descriptor = FlashDescriptor::Parse(data);
+//   QCHECK_OK(descriptor.status());
+//   absl::PrintF("%s", descriptor->ToString());
+// Alternatively, ReadFromChipset() fetches the descriptor through the
+// chipset's observability registers, which does not need any flash cycles.
+//
+// Terms are taken from the "Serial Peripheral Interface (SPI)" chapter of the
+// Intel chipset datasheets.
+
+#ifndef PAWN_FLASH_DESCRIPTOR_H_
+#define PAWN_FLASH_DESCRIPTOR_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+class FlashDescriptor {
+ public:
+  // Flash Valid Signature (FLVALSIG)
+  static constexpr uint32_t kSignature = 0x0FF0A55A;
+
+  // Size of the descriptor region, reading this many bytes from flash linear
+  // address 0 is enough to parse the descriptor.
+  static constexpr int kSize = 0x1000;
+
+  static constexpr int kMaxComponents = 2;
+  static constexpr int kNumRegions = 5;
+  static constexpr int kNumMasters = 3;
+  static constexpr int kNumInvalidInstructions = 4;
+
+  enum Region {
+    kRegionDescriptor = 0,
+    kRegionBios,
+    kRegionMe,   // Management Engine
+    kRegionGbe,  // Gigabit Ethernet
+    kRegionPdr,  // Platform Data
+  };
+
+  enum Master {
+    kMasterBios = 0,  // Host CPU/BIOS
+    kMasterMe,        // Management Engine
+    kMasterGbe,       // Gigabit Ethernet
+  };
+
+  // Flash Region N, base and limit are flash linear addresses (inclusive).
+  struct FlashRegion {
+    uint32_t base;
+    uint32_t limit;
+
+    // Unused regions have their base set above their limit.
+    bool used() const { return base <= limit; }
+    uint32_t size() const { return used() ? limit - base + 1 : 0; }
+  };
+
+  // Flash Master N, access bits are indexed by region.
+  struct FlashMaster {
+    uint16_t requester_id;
+    uint8_t read_access;
+    uint8_t write_access;
+
+    bool CanRead(int region) const { return read_access >> region & 1; }
+    bool CanWrite(int region) const { return write_access >> region & 1; }
+  };
+
+  // Parses the flash descriptor from data, which must hold (at least) the
+  // first kSize bytes of the flash, using the field encoding of format.
+  // Returns absl::NotFoundError() if there is no valid signature.
+  static absl::StatusOr<FlashDescriptor> Parse(
+      absl::Span<const uint8_t> data,
+      Chipset::FlashDescriptorFormat format = Chipset::kDescriptorFormatIch8);
+
+  // Reads the descriptor sections through the Flash Descriptor Observability
+  // registers (FDOC/FDOD), which the chipset serves from the copy it loaded
+  // at reset, and decodes them in the chipset's format. This takes
+  // microseconds and does not use the SPI bus. Returns absl::NotFoundError()
+  // if the chipset has no valid descriptor.
+  static absl::StatusOr<FlashDescriptor> ReadFromChipset(Chipset& chipset);
+
+  // Returns the name of region index, e.g. "BIOS".
+  static const char* RegionName(int index);
+
+  // Number of flash components (NC + 1)
+  int num_components() const { return num_components_; }
+
+  // Density of component index in bytes.
+  int64_t component_size(int index) const { return component_sizes_[index]; }
+
+  // Flash linear address of the first byte of component index. Components
+  // are mapped back to back, in order.
+  int64_t component_base(int index) const;
+
+  // Sum of all component densities. This is the number of bytes to read for
+  // a complete dump, but see max_addressable_size().
+  int64_t total_size() const;
+
+  // Flash linear addresses are 25 bits wide up to the 9 Series and 27 bits
+  // wide starting with the 100 Series, limiting the addressable flash to 32MiB
+  // and 128MiB, respectively.
+  int64_t max_addressable_size() const {
+    return int64_t{1}
+           << (format_ == Chipset::kDescriptorFormat100Series ? 27 : 25);
+  }
+
+  const FlashRegion& region(int index) const { return regions_[index]; }
+  const FlashMaster& master(int index) const { return masters_[index]; }
+
+  // Opcodes that software sequencing must not use (FLILL). Unused entries
+  // are zero.
+  const std::array<uint8_t, kNumInvalidInstructions>& invalid_instructions()
+      const {
+    return invalid_instructions_;
+  }
+
+  // SPI clock frequencies declared for the flash components (FLCOMP RCF,
+  // FRCF). These use the same encoding as the SSFC SPI Cycle Frequency (SCF)
+  // field: 0 for 20MHz, 1 for 33MHz, 4 for 50MHz.
+  int read_clock_frequency() const { return read_clock_frequency_; }
+  int fast_read_clock_frequency() const { return fast_read_clock_frequency_; }
+
+  // Whether all components support the Fast Read (0x0B) opcode (FLCOMP FRS).
+  bool fast_read_support() const { return fast_read_support_; }
+
+  // Returns a human-readable description of the layout, one line per
+  // component and used region.
+  std::string ToString() const;
+
+ private:
+  FlashDescriptor() = default;
+
+  Chipset::FlashDescriptorFormat format_ = Chipset::kDescriptorFormatIch8;
+  int num_components_ = 0;
+  std::array<int64_t, kMaxComponents> component_sizes_ = {};
+  std::array<FlashRegion, kNumRegions> regions_ = {};
+  std::array<FlashMaster, kNumMasters> masters_ = {};
+  std::array<uint8_t, kNumInvalidInstructions> invalid_instructions_ = {};
+  int read_clock_frequency_ = 0;
+  int fast_read_clock_frequency_ = 0;
+  bool fast_read_support_ = false;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_FLASH_DESCRIPTOR_H_
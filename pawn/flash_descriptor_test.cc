@@ -0,0 +1,209 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/flash_descriptor.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "pawn/chipset.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+using ::testing::Not;
+
+void PutUint32(std::vector<uint8_t>& data, int offset, uint32_t value) {
+  std::memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+// Returns a descriptor with the signature at signature_offset, the component
+// section at 0x30 and the region section at 0x40.
+std::vector<uint8_t> MakeDescriptor(int signature_offset, uint32_t flcomp,
+                                    int num_components) {
+  std::vector<uint8_t> data(FlashDescriptor::kSize, 0xFF);
+  PutUint32(data, signature_offset, FlashDescriptor::kSignature);
+  PutUint32(data, signature_offset + 4,
+            (num_components - 1) << 8 | 0x04 << 16 /* FRBA */ |
+                0x03 /* FCBA */);
+  PutUint32(data, 0x30, flcomp);
+  PutUint32(data, 0x40, 0x00000000);  // Descriptor: 0x0000000-0x0000FFF
+  PutUint32(data, 0x44, 0x07FF0200);  // BIOS:       0x0200000-0x07FFFFF
+  PutUint32(data, 0x48, 0x01FF0001);  // ME:         0x0001000-0x01FFFFF
+  PutUint32(data, 0x4C, 0x00001FFF);  // GbE:        Unused
+  PutUint32(data, 0x50, 0x00001FFF);  // PDR:        Unused
+  return data;
+}
+
+TEST(FlashDescriptorTest, ParsesSingleComponent) {
+  auto descriptor = FlashDescriptor::Parse(
+      MakeDescriptor(0x10, 0x04 /* 8MiB */, /*num_components=*/1));
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+
+  EXPECT_THAT(descriptor->num_components(), Eq(1));
+  EXPECT_THAT(descriptor->total_size(), Eq(8 << 20));
+  const auto& bios = descriptor->region(FlashDescriptor::kRegionBios);
+  EXPECT_THAT(bios.base, Eq(0x200000));
+  EXPECT_THAT(bios.limit, Eq(0x7FFFFF));
+  EXPECT_THAT(descriptor->region(FlashDescriptor::kRegionGbe).used(),
+              IsFalse());
+  EXPECT_THAT(descriptor->ToString(), HasSubstr("Component 0: 8192 KiB"));
+  EXPECT_THAT(descriptor->ToString(), HasSubstr("BIOS"));
+  EXPECT_THAT(descriptor->ToString(), Not(HasSubstr("GbE")));
+}
+
+TEST(FlashDescriptorTest, ParsesTwoComponents) {
+  auto descriptor = FlashDescriptor::Parse(MakeDescriptor(
+      0x10, 0x03 << 3 /* 4MiB */ | 0x05 /* 16MiB */, /*num_components=*/2));
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+
+  EXPECT_THAT(descriptor->num_components(), Eq(2));
+  EXPECT_THAT(descriptor->component_size(0), Eq(16 << 20));
+  EXPECT_THAT(descriptor->component_size(1), Eq(4 << 20));
+  EXPECT_THAT(descriptor->total_size(), Eq(20 << 20));
+}
+
+TEST(FlashDescriptorTest, ParsesLegacyLayout) {
+  // ICH8 to ICH10 descriptors start with the signature.
+  auto descriptor = FlashDescriptor::Parse(
+      MakeDescriptor(0x00, 0x02 /* 2MiB */, /*num_components=*/1));
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+  EXPECT_THAT(descriptor->total_size(), Eq(2 << 20));
+}
+
+TEST(FlashDescriptorTest, ParsesReadClockFrequencies) {
+  auto descriptor = FlashDescriptor::Parse(MakeDescriptor(
+      0x10,
+      0x04 << 21 /* FRCF 50MHz */ | 1 << 20 /* FRS */ |
+          0x01 << 17 /* RCF 33MHz */ | 0x04,
+      /*num_components=*/1));
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+  EXPECT_THAT(descriptor->read_clock_frequency(), Eq(1));
+  EXPECT_THAT(descriptor->fast_read_support(), IsTrue());
+  EXPECT_THAT(descriptor->fast_read_clock_frequency(), Eq(4));
+}
+
+TEST(FlashDescriptorTest, RejectsMissingSignature) {
+  std::vector<uint8_t> data(FlashDescriptor::kSize, 0xFF);
+  EXPECT_THAT(FlashDescriptor::Parse(data).status().code(),
+              Eq(absl::StatusCode::kNotFound));
+  EXPECT_THAT(FlashDescriptor::Parse(absl::MakeSpan(data).first(0x20))
+                  .status()
+                  .code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+class ReadFromChipsetTest
+    : public ::testing::TestWithParam<Chipset::HardwareId> {};
+
+TEST_P(ReadFromChipsetTest, ReadsWithoutFlashCycles) {
+  // ICH8 to ICH10 descriptors start with the signature.
+  const bool legacy = GetParam().device < 0x3A00;
+  std::vector<uint8_t> data = MakeDescriptor(
+      legacy ? 0x00 : 0x10, 1 << 20 /* FRS */ | 0x01 /* 1MiB */,
+      /*num_components=*/1);
+  PutUint32(data, (legacy ? 0x00 : 0x10) + 8, 0x06 /* FMBA */);
+  PutUint32(data, 0x60, 0x0B0A0000);  // FLMSTR1
+  std::string image(1 << 20, '\xFF');
+  std::copy(data.begin(), data.end(), image.begin());
+
+  SimulatedDevice::Options options;
+  options.hardware_id = GetParam();
+  auto device = SimulatedDevice::Create(image, options);
+  ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*device)->memory_mapper());
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+
+  auto descriptor = FlashDescriptor::ReadFromChipset(**chipset);
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+  EXPECT_THAT(descriptor->total_size(), Eq(1 << 20));
+  EXPECT_THAT(descriptor->fast_read_support(), IsTrue());
+  EXPECT_THAT(descriptor->region(FlashDescriptor::kRegionBios).base,
+              Eq(0x200000));
+  const auto& bios = descriptor->master(FlashDescriptor::kMasterBios);
+  EXPECT_THAT(bios.read_access, Eq(0x0A));
+  EXPECT_THAT(bios.CanRead(FlashDescriptor::kRegionBios), IsTrue());
+  EXPECT_THAT(bios.CanRead(FlashDescriptor::kRegionMe), IsFalse());
+  EXPECT_THAT(bios.CanWrite(FlashDescriptor::kRegionGbe), IsTrue());
+  EXPECT_THAT((*device)->stats().flash_cycles, Eq(0));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Generations, ReadFromChipsetTest,
+    ::testing::Values(Chipset::HardwareId{0x8086, 0x2810, 0x02} /* ICH8 */,
+                      Chipset::HardwareId{0x8086, 0x8C4E, 0x05} /* Q87 */,
+                      Chipset::HardwareId{0x8086, 0xA146, 0x31} /* Q170 */));
+
+TEST(FlashDescriptorTest, ReadsWideFieldsOn100Series) {
+  // Two 32MiB components, which the older encoding would decode as 32MiB
+  // and 8MiB, and a BIOS region in the second one.
+  std::vector<uint8_t> data =
+      MakeDescriptor(0x10, 0x06 << 4 | 0x06, /*num_components=*/2);
+  PutUint32(data, 0x44, 0x3FFF2000);  // BIOS: 0x2000000-0x3FFFFFF
+  std::string image(1 << 20, '\xFF');
+  std::copy(data.begin(), data.end(), image.begin());
+
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0xA146, 0x31};  // Q170
+  auto device = SimulatedDevice::Create(image, options);
+  ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*device)->memory_mapper());
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+
+  auto descriptor = FlashDescriptor::ReadFromChipset(**chipset);
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+  EXPECT_THAT(descriptor->num_components(), Eq(2));
+  EXPECT_THAT(descriptor->component_size(1), Eq(32 << 20));
+  EXPECT_THAT(descriptor->total_size(), Eq(64 << 20));
+  EXPECT_THAT(descriptor->max_addressable_size(), Eq(128 << 20));
+  const auto& bios = descriptor->region(FlashDescriptor::kRegionBios);
+  EXPECT_THAT(bios.base, Eq(0x2000000));
+  EXPECT_THAT(bios.limit, Eq(0x3FFFFFF));
+  EXPECT_THAT(descriptor->region(FlashDescriptor::kRegionGbe).used(),
+              IsFalse());
+}
+
+TEST(FlashDescriptorTest, ReadFromChipsetRequiresValidDescriptor) {
+  auto device = SimulatedDevice::Create(std::string(1 << 20, '\xFF'), {});
+  ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*device)->memory_mapper());
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+  EXPECT_THAT(FlashDescriptor::ReadFromChipset(**chipset).status().code(),
+              Eq(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+}  // namespace security::pawn
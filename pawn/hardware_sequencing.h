@@ -0,0 +1,255 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// SPI flash read engine using hardware sequencing, specialized at compile time
+// for a chipset's register layout. Instead of going through the virtual
+// Read*Register()/Write*Register() functions, decoding into the register
+// structs and re-encoding them, the hot loop consists of raw register accesses
+// at constant offsets only.
+// The ChipsetT template parameter provides the layout and needs to define:
+//   kSpiBar                     SPI Base Address in Chipset::rcrb_mem()
+//   kRegisterMemorySize         Size of Chipset::rcrb_mem()
+//   HsfsReg etc.                Registers relative to SPIBAR, see mmio.h
+//   kHsfsFdone etc.             Raw register field masks and shifts
+// See IntelIch8Chipset for an example. Chipset::Create() selects the matching
+// instantiation once.
+
+#ifndef PAWN_HARDWARE_SEQUENCING_H_
+#define PAWN_HARDWARE_SEQUENCING_H_
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/cycle_waiter.h"
+#include "pawn/mmio.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+
+template <typename ChipsetT>
+class HardwareSequencingEngine {
+ public:
+  // Implement the Chipset::ReadSpiWithHardwareSequencing() overloads,
+  // arguments must already have been validated.
+  static absl::Status Read(
+      Chipset& chipset, int flash_address, int size, int block_size,
+      const std::function<bool(int flash_address, const char* data)>&
+          block_read,
+      const std::function<bool(int flash_address)>& block_read_error,
+      const std::function<void()>& block_read_done) {
+    CallbackSink sink(block_read, block_read_error, block_size);
+    absl::Status status =
+        Dispatch(chipset, flash_address, size, block_size, sink);
+    if (status.ok() && !sink.stopped && block_read_done) {
+      block_read_done();
+    }
+    return status;
+  }
+
+  static absl::Status ReadInto(Chipset& chipset, int flash_address,
+                               absl::Span<uint8_t> data, int block_size,
+                               absl::Span<Chipset::BlockStatus> block_status) {
+    SpanSink sink{data.data(), block_size, block_status};
+    absl::Status status =
+        Dispatch(chipset, flash_address, data.size(), block_size, sink);
+    if (!status.ok()) {
+      for (int i = sink.blocks_done; i < block_status.size(); ++i) {
+        block_status[i] = Chipset::kBlockNotRead;
+      }
+    }
+    return status;
+  }
+
+  static constexpr Chipset::ReadEngine kEngine = {&Read, &ReadInto};
+
+ private:
+  // Registers at their absolute offsets in Chipset::rcrb_mem().
+  template <typename Reg>
+  using SpiBarReg =
+      MmioReg<typename Reg::Type, ChipsetT::kSpiBar + Reg::kRegOffset,
+              ChipsetT::kRegisterMemorySize>;
+  using Hsfs = SpiBarReg<typename ChipsetT::HsfsReg>;
+  using Hsfc = SpiBarReg<typename ChipsetT::HsfcReg>;
+  using Faddr = SpiBarReg<typename ChipsetT::FaddrReg>;
+  using Fdata =
+      MmioRegArray<uint32_t, ChipsetT::kSpiBar + ChipsetT::FdataReg::kRegOffset,
+                   ChipsetT::FdataReg::kSize, ChipsetT::kRegisterMemorySize>;
+
+  // Sinks receive the blocks that were read. Buffer() returns where to store
+  // the FDATA contents of a block, BlockDone() returns whether to continue
+  // reading. Once a block has been drained into its buffer, the next flash
+  // cycle may already be running when BlockDone() is called for it. Its
+  // buffer must stay valid until then.
+
+  // Drains blocks into a ring of scratch buffers and hands them to the
+  // callbacks. At most one cycle is in flight, so two buffers suffice.
+  struct CallbackSink {
+    const std::function<bool(int flash_address, const char* data)>&
+        block_read;
+    const std::function<bool(int flash_address)>& block_read_error;
+    std::array<std::vector<uint32_t>, 2> ring;
+    bool stopped = false;
+
+    CallbackSink(const std::function<bool(int flash_address,
+                                          const char* data)>& block_read,
+                 const std::function<bool(int flash_address)>& block_read_error,
+                 int block_size)
+        : block_read(block_read),
+          block_read_error(block_read_error),
+          // FDATA is copied in whole words, also for a partial last one.
+          ring{std::vector<uint32_t>((block_size + 3) / 4, 0),
+               std::vector<uint32_t>((block_size + 3) / 4, 0)} {}
+
+    uint8_t* Buffer(int block) {
+      return reinterpret_cast<uint8_t*>(ring[block % ring.size()].data());
+    }
+    bool BlockDone(int block, int flash_address, bool error) {
+      // We may have tried to read a protected area.
+      stopped = (error && block_read_error &&
+                 !block_read_error(flash_address)) ||
+                !block_read(flash_address,
+                            reinterpret_cast<const char*>(Buffer(block)));
+      return !stopped;
+    }
+  };
+
+  // Stores blocks directly into the destination span.
+  struct SpanSink {
+    uint8_t* data;
+    int block_size;
+    absl::Span<Chipset::BlockStatus> block_status;
+    int blocks_done = 0;
+
+    uint8_t* Buffer(int block) { return data + block * block_size; }
+    bool BlockDone(int block, int /* flash_address */, bool error) {
+      if (!block_status.empty()) {
+        block_status[block] =
+            error ? Chipset::kBlockReadError : Chipset::kBlockOk;
+      }
+      blocks_done = block + 1;
+      return true;
+    }
+  };
+
+  template <typename Sink>
+  static absl::Status Dispatch(Chipset& chipset, int flash_address, int size,
+                               int block_size, Sink& sink) {
+    // Access the registers through a plain pointer into the mapped RCRB if
+    // possible, through PhysicalMemory otherwise.
+    PhysicalMemory& rcrb = *chipset.rcrb_mem();
+    if (volatile void* base = rcrb.MmioBase(); base != nullptr) {
+      return Run(base, chipset, flash_address, size, block_size, sink);
+    }
+    return Run(rcrb, chipset, flash_address, size, block_size, sink);
+  }
+
+  // Mem is either volatile void* or PhysicalMemory, see MmioReg.
+  template <typename Mem, typename Sink>
+  static absl::Status Run(Mem& mem, Chipset& chipset, int flash_address,
+                          int size, int block_size, Sink& sink) {
+    if (Hsfs::Read(mem) & ChipsetT::kHsfsScip) {
+      return absl::UnavailableError("SPI flash cycle in progress");
+    }
+
+    // Only read the setup registers once to learn the bits that need to be
+    // preserved, see Chipset::InvalidateRegisterShadow().
+    auto& shadow = chipset.register_shadow_;
+    if (!shadow.faddr) {
+      shadow.faddr = Faddr::Read(mem) & ~ChipsetT::kFaddrFlaMask;
+    }
+    if (!shadow.hsfc) {
+      shadow.hsfc = Hsfc::Read(mem) &
+                    ~(ChipsetT::kHsfcFdbcMask | ChipsetT::kHsfcFcycleMask |
+                      ChipsetT::kHsfcFgo);
+    }
+    const uint32_t faddr = *shadow.faddr;
+    const uint16_t hsfc =
+        *shadow.hsfc | (block_size - 1) << ChipsetT::kHsfcFdbcShift |
+        Chipset::kFcycleRead << ChipsetT::kHsfcFcycleShift |
+        ChipsetT::kHsfcFgo;
+    // Writing zeros to the other fields is safe: FLOCKDN can only be set, the
+    // rest is read-only.
+    constexpr uint16_t kHsfsClearStatus =
+        ChipsetT::kHsfsAel | ChipsetT::kHsfsFcerr | ChipsetT::kHsfsFdone;
+
+    auto start_cycle = [&mem, faddr, hsfc](int cur_flash_address) {
+      Hsfs::Write(mem, kHsfsClearStatus);
+      Faddr::Write(mem, faddr | cur_flash_address);
+      Hsfc::Write(mem, hsfc);
+    };
+    CycleWaiter& waiter = chipset.cycle_waiter();
+    auto wait_cycle = [&mem, &waiter](int cur_flash_address,
+                                     uint16_t& hsfs) -> absl::Status {
+      if (auto status = waiter.Wait([&mem, &hsfs] {
+            hsfs = Hsfs::Read(mem);
+            return (hsfs & ChipsetT::kHsfsFdone) != 0;
+          });
+          !status.ok()) {
+        return absl::DeadlineExceededError(
+            absl::StrFormat("Flash cycle at 0x%08X: %s", cur_flash_address,
+                            status.message()));
+      }
+      return absl::OkStatus();
+    };
+
+    // The loop is pipelined: as soon as a cycle completes, its FDATA contents
+    // are drained and the next cycle is started. The sink then processes the
+    // drained block while the controller is busy.
+    const int end_flash_address = flash_address + size;
+    if (size > 0) {
+      start_cycle(flash_address);
+    }
+    for (int block = 0, cur_flash_address = flash_address;
+         cur_flash_address < end_flash_address;
+         ++block, cur_flash_address += block_size) {
+      uint16_t hsfs;
+      if (auto status = wait_cycle(cur_flash_address, hsfs); !status.ok()) {
+        return status;
+      }
+
+      // The chipset only decodes memory accesses with a maximum width of
+      // 32-bit, hence the loop in 32-bit increments. The destination may be
+      // unaligned, memcpy() compiles to plain stores.
+      uint8_t* dest = sink.Buffer(block);
+      for (int i = 0; i < block_size; i += 4) {
+        const uint32_t fdata = Fdata::Read(mem, i / 4);
+        std::memcpy(dest + i, &fdata, sizeof(fdata));
+      }
+
+      const int next_flash_address = cur_flash_address + block_size;
+      const bool more = next_flash_address < end_flash_address;
+      if (more) {
+        start_cycle(next_flash_address);
+      }
+      if (!sink.BlockDone(block, cur_flash_address,
+                          (hsfs & ChipsetT::kHsfsFcerr) != 0)) {
+        // Do not leave with a cycle in flight.
+        return more ? wait_cycle(next_flash_address, hsfs)
+                    : absl::OkStatus();
+      }
+    }
+    return absl::OkStatus();
+  }
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_HARDWARE_SEQUENCING_H_
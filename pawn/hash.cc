@@ -0,0 +1,283 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/hash.h"
+
+#include <cpuid.h>      // __get_cpuid_count()
+#include <immintrin.h>  // _mm_sha256rnds2_epu32(), _mm_crc32_u64()
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr uint32_t kK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+constexpr uint32_t kInitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                       0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                       0x1f83d9ab, 0x5be0cd19};
+
+constexpr uint32_t RotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+uint32_t LoadBigEndian32(const uint8_t* p) {
+  return uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8 |
+         p[3];
+}
+
+bool CpuSupportsSse42() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid_count(1, 0, &eax, &ebx, &ecx, &edx) &&
+         (ecx & (1 << 20)) != 0;  // SSE4.2
+}
+
+// Table for the bitwise-reflected CRC32C polynomial.
+struct Crc32cTable {
+  uint32_t entries[256];
+
+  constexpr Crc32cTable() : entries() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+constexpr Crc32cTable kCrc32cTable;
+
+__attribute__((target("sse4.2"))) uint32_t Crc32cSse42(
+    absl::Span<const uint8_t> data, uint32_t crc) {
+  const uint8_t* p = data.data();
+  const uint8_t* const end = p + data.size();
+  uint64_t crc64 = ~crc;
+  for (; end - p >= 8; p += 8) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+  }
+  uint32_t crc32 = crc64;
+  for (; p < end; ++p) {
+    crc32 = _mm_crc32_u8(crc32, *p);
+  }
+  return ~crc32;
+}
+
+}  // namespace
+
+Sha256::Sha256(bool use_sha_ni)
+    : process_(use_sha_ni && CpuSupportsShaNi() ? &ProcessBlocksShaNi
+                                                : &ProcessBlocks) {
+  Reset();
+}
+
+bool Sha256::CpuSupportsShaNi() {
+  unsigned int eax, ebx, ecx, edx;
+  // The SHA-NI code also uses SSE4.1.
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+         (ebx & (1 << 29)) != 0 &&  // SHA
+         __get_cpuid_count(1, 0, &eax, &ebx, &ecx, &edx) &&
+         (ecx & (1 << 19)) != 0;  // SSE4.1
+}
+
+void Sha256::Reset() {
+  std::memcpy(state_, kInitialState, sizeof(state_));
+  length_ = 0;
+  buffered_ = 0;
+}
+
+void Sha256::Update(absl::Span<const uint8_t> data) {
+  length_ += data.size();
+  if (buffered_ > 0) {
+    const size_t size = std::min(data.size(), kBlockSize - buffered_);
+    std::memcpy(buffer_ + buffered_, data.data(), size);
+    buffered_ += size;
+    data.remove_prefix(size);
+    if (buffered_ < kBlockSize) {
+      return;
+    }
+    process_(state_, buffer_, 1);
+    buffered_ = 0;
+  }
+  const size_t num_blocks = data.size() / kBlockSize;
+  if (num_blocks > 0) {
+    process_(state_, data.data(), num_blocks);
+    data.remove_prefix(num_blocks * kBlockSize);
+  }
+  std::memcpy(buffer_, data.data(), data.size());
+  buffered_ = data.size();
+}
+
+Sha256::Digest Sha256::Final() {
+  // Pad with a one bit, zeros and the length in bits, to whole blocks.
+  const uint64_t bit_length = length_ * 8;
+  uint8_t padding[kBlockSize + 8] = {0x80};
+  const size_t padding_size =
+      (buffered_ < 56 ? 56 : 120) - buffered_ /* To the length */;
+  for (int i = 0; i < 8; ++i) {
+    padding[padding_size + i] = bit_length >> (56 - 8 * i);
+  }
+  Update(absl::MakeConstSpan(padding, padding_size + 8));
+
+  Digest digest;
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      digest[i * 4 + j] = state_[i] >> (24 - 8 * j);
+    }
+  }
+  Reset();
+  return digest;
+}
+
+std::string Sha256::ToHex(const Digest& digest) {
+  return absl::BytesToHexString(absl::string_view(
+      reinterpret_cast<const char*>(digest.data()), digest.size()));
+}
+
+void Sha256::ProcessBlocks(uint32_t* state, const uint8_t* data,
+                           size_t num_blocks) {
+  for (; num_blocks > 0; --num_blocks, data += kBlockSize) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = LoadBigEndian32(data + 4 * i);
+    }
+    for (int i = 16; i < 64; ++i) {
+      const uint32_t s0 = RotateRight(w[i - 15], 7) ^
+                          RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = RotateRight(w[i - 2], 17) ^
+                          RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      const uint32_t s1 =
+          RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+      const uint32_t ch = (e & f) ^ (~e & g);
+      const uint32_t t1 = h + s1 + ch + kK[i] + w[i];
+      const uint32_t s0 =
+          RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+      const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      const uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+// SHA256RNDS2 does two rounds on the state split into ABEF and CDGH halves.
+// SHA256MSG1 and SHA256MSG2 compute the message schedule, four words at a
+// time, each group of four rounds prepares the words of a later one.
+__attribute__((target("sha,sse4.1"))) void Sha256::ProcessBlocksShaNi(
+    uint32_t* state, const uint8_t* data, size_t num_blocks) {
+  // Message words are big-endian.
+  const __m128i kByteSwap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  __m128i state1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);        // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1B);  // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+  for (; num_blocks > 0; --num_blocks, data += kBlockSize) {
+    const __m128i abef = state0;
+    const __m128i cdgh = state1;
+    __m128i msgs[4];
+    for (int i = 0; i < 4; ++i) {
+      msgs[i] = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)),
+          kByteSwap);
+    }
+    for (int i = 0; i < 16; ++i) {
+      __m128i msg = _mm_add_epi32(
+          msgs[i % 4],
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&kK[4 * i])));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      msg = _mm_shuffle_epi32(msg, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      if (i >= 3 && i < 15) {
+        __m128i& next = msgs[(i + 1) % 4];
+        next = _mm_add_epi32(
+            next, _mm_alignr_epi8(msgs[i % 4], msgs[(i + 3) % 4], 4));
+        next = _mm_sha256msg2_epu32(next, msgs[i % 4]);
+      }
+      if (i >= 1 && i < 13) {
+        __m128i& previous = msgs[(i + 3) % 4];
+        previous = _mm_sha256msg1_epu32(previous, msgs[i % 4]);
+      }
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+uint32_t Crc32c(absl::Span<const uint8_t> data, uint32_t crc) {
+  static const bool sse42 = CpuSupportsSse42();
+  return sse42 ? Crc32cSse42(data, crc) : Crc32cPortable(data, crc);
+}
+
+uint32_t Crc32cPortable(absl::Span<const uint8_t> data, uint32_t crc) {
+  crc = ~crc;
+  for (uint8_t byte : data) {
+    crc = kCrc32cTable.entries[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+}  // namespace security::pawn
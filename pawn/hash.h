@@ -0,0 +1,76 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Checksums for fingerprinting dumps while they are read: SHA-256 (FIPS
+// 180-4), with the SHA extensions (SHA-NI) where the CPU has them, and
+// CRC32C (Castagnoli), with the SSE4.2 CRC32 instruction.
+
+#ifndef PAWN_HASH_H_
+#define PAWN_HASH_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/types/span.h"
+
+namespace security::pawn {
+
+class Sha256 {
+ public:
+  static constexpr int kBlockSize = 64;
+  using Digest = std::array<uint8_t, 32>;
+
+  // use_sha_ni is for testing, the extensions are only used if the CPU
+  // supports them.
+  explicit Sha256(bool use_sha_ni = true);
+
+  static bool CpuSupportsShaNi();
+
+  void Update(absl::Span<const uint8_t> data);
+  // Resets the state afterwards.
+  Digest Final();
+
+  bool sha_ni() const { return process_ != &ProcessBlocks; }
+
+  static std::string ToHex(const Digest& digest);
+
+ private:
+  using ProcessFunction = void (*)(uint32_t* state, const uint8_t* data,
+                                   size_t num_blocks);
+
+  static void ProcessBlocks(uint32_t* state, const uint8_t* data,
+                            size_t num_blocks);
+  static void ProcessBlocksShaNi(uint32_t* state, const uint8_t* data,
+                                 size_t num_blocks);
+  void Reset();
+
+  ProcessFunction process_;
+  uint32_t state_[8];
+  uint64_t length_ = 0;  // In bytes
+  uint8_t buffer_[kBlockSize];
+  size_t buffered_ = 0;
+};
+
+// Returns the CRC32C of data, continuing from crc, the result for previous
+// data.
+uint32_t Crc32c(absl::Span<const uint8_t> data, uint32_t crc = 0);
+// Same, without the CRC32 instruction. For testing.
+uint32_t Crc32cPortable(absl::Span<const uint8_t> data, uint32_t crc = 0);
+
+}  // namespace security::pawn
+
+#endif  // PAWN_HASH_H_
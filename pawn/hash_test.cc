@@ -0,0 +1,108 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/hash.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+
+absl::Span<const uint8_t> Bytes(absl::string_view data) {
+  return absl::MakeConstSpan(reinterpret_cast<const uint8_t*>(data.data()),
+                             data.size());
+}
+
+class Sha256Test : public ::testing::TestWithParam<bool /* SHA-NI */> {
+ protected:
+  void SetUp() override {
+    if (GetParam() && !Sha256::CpuSupportsShaNi()) {
+      GTEST_SKIP() << "No SHA extensions";
+    }
+  }
+
+  std::string Hash(absl::string_view data) {
+    Sha256 sha(GetParam());
+    sha.Update(Bytes(data));
+    return Sha256::ToHex(sha.Final());
+  }
+};
+
+TEST_P(Sha256Test, MatchesTestVectors) {
+  EXPECT_THAT(
+      Hash(""),
+      Eq("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+  EXPECT_THAT(
+      Hash("abc"),
+      Eq("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+  EXPECT_THAT(
+      Hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+      Eq("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+  EXPECT_THAT(
+      Hash(std::string(1000000, 'a')),
+      Eq("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+TEST_P(Sha256Test, MatchesPortableForAnySplit) {
+  std::mt19937 random(1);
+  std::vector<uint8_t> data(4096);
+  for (auto& byte : data) {
+    byte = random();
+  }
+  Sha256 portable(false);
+  portable.Update(data);
+  const Sha256::Digest expected = portable.Final();
+
+  for (size_t split : {0, 1, 63, 64, 65, 1000}) {
+    Sha256 sha(GetParam());
+    sha.Update(absl::MakeConstSpan(data).first(split));
+    sha.Update(absl::MakeConstSpan(data).subspan(split));
+    EXPECT_THAT(sha.Final(), Eq(expected)) << split;
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Implementations, Sha256Test, ::testing::Bool());
+
+TEST(Crc32cTest, MatchesTestVectors) {
+  EXPECT_THAT(Crc32c(Bytes("123456789")), Eq(0xE3069283));
+  EXPECT_THAT(Crc32cPortable(Bytes("123456789")), Eq(0xE3069283));
+  EXPECT_THAT(Crc32c(Bytes("")), Eq(0));
+  // 32 bytes of 0xFF, from RFC 3720
+  EXPECT_THAT(Crc32c(Bytes(std::string(32, '\xFF'))), Eq(0x62A8AB43));
+}
+
+TEST(Crc32cTest, Continues) {
+  const std::string data = "The quick brown fox jumps over the lazy dog";
+  for (size_t split = 0; split <= data.size(); ++split) {
+    EXPECT_THAT(Crc32c(Bytes(absl::string_view(data).substr(split)),
+                       Crc32c(Bytes(absl::string_view(data).substr(0, split)))),
+                Eq(Crc32cPortable(Bytes(data))))
+        << split;
+  }
+}
+
+}  // namespace
+}  // namespace security::pawn
@@ -0,0 +1,138 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/mapping_pool.h"
+
+#include <fcntl.h>     // open()
+#include <sys/mman.h>  // mmap(), munmap()
+#include <unistd.h>    // close(), sysconf()
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::pawn {
+
+struct MappingPool::Mapping {
+  void* addr;
+  uintptr_t physical_address;  // Page-aligned
+  size_t length;               // Multiple of the page size
+
+  uintptr_t end() const { return physical_address + length; }
+
+  ~Mapping() { munmap(addr, length); }
+};
+
+MappingPool::~MappingPool() {
+  // Mappings stay valid after their file descriptor is closed.
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+MappingPool& MappingPool::Default() {
+  static auto* pool = new MappingPool();
+  return *pool;
+}
+
+absl::Status MappingPool::OpenFile() {
+  if (fd_ != -1) {
+    return absl::OkStatus();
+  }
+  fd_ = open(path_.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd_ == -1 /* Error */) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Could not open physical memory file ", path_,
+        ". Make sure this process runs as root."));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<PhysicalMemory>> MappingPool::Map(
+    uintptr_t physical_address, size_t length, int flags) {
+  if (length == 0) {
+    return absl::InvalidArgumentError("Cannot map zero bytes");
+  }
+  static const uintptr_t kPageMask = sysconf(_SC_PAGESIZE) - 1;
+  uintptr_t start = physical_address & ~kPageMask;
+  uintptr_t end = (physical_address + length + kPageMask) & ~kPageMask;
+
+  absl::MutexLock lock(&mutex_);
+  std::shared_ptr<Mapping> mapping;
+  for (auto it = mappings_.begin(); it != mappings_.end();) {
+    std::shared_ptr<Mapping> live = it->second.lock();
+    if (!live) {
+      it = mappings_.erase(it);
+      continue;
+    }
+    if (live->physical_address <= start && live->end() >= end) {
+      mapping = std::move(live);
+      break;
+    }
+    ++it;
+  }
+
+  if (!mapping) {
+    if (auto status = OpenFile(); !status.ok()) {
+      return status;
+    }
+    // Replace live mappings that overlap or touch the requested range by a
+    // single one. Their views keep them alive until they are done.
+    for (auto it = mappings_.begin(); it != mappings_.end();) {
+      std::shared_ptr<Mapping> live = it->second.lock();
+      if (live && live->physical_address <= end && live->end() >= start) {
+        start = std::min(start, live->physical_address);
+        end = std::max(end, live->end());
+        it = mappings_.erase(it);
+        // Merging may make earlier mappings adjacent, start over.
+        it = mappings_.begin();
+        continue;
+      }
+      ++it;
+    }
+
+    void* addr = mmap(
+        nullptr /* Address hint */, end - start, PROT_READ | PROT_WRITE,
+        MAP_SHARED | ((flags & kMapPopulate) ? MAP_POPULATE : 0), fd_, start);
+    if (addr == MAP_FAILED) {
+      return absl::FailedPreconditionError(
+          absl::StrFormat("Could not map physical memory at 0x%08X: %s", start,
+                          std::strerror(errno)));
+    }
+    mapping.reset(new Mapping{addr, start, end - start});
+    mappings_[start] = mapping;
+  }
+
+  void* view = static_cast<uint8_t*>(mapping->addr) +
+               (physical_address - mapping->physical_address);
+  return std::unique_ptr<PhysicalMemory>(
+      new PhysicalMemory(view, std::move(mapping)));
+}
+
+int MappingPool::num_mappings() const {
+  absl::MutexLock lock(&mutex_);
+  return std::count_if(
+      mappings_.begin(), mappings_.end(),
+      [](const auto& entry) { return !entry.second.expired(); });
+}
+
+}  // namespace security::pawn
@@ -0,0 +1,88 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_MAPPING_POOL_H_
+#define PAWN_MAPPING_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+
+// Maps physical memory through a single file descriptor of /dev/mem. Requests
+// may start and end anywhere; they are widened to whole pages and served from
+// an existing mapping that covers them if there is one. Otherwise, a new
+// mapping is created that also covers any overlapping or adjacent live ones,
+// so that later requests for the combined range need no further mmap() calls.
+// The returned views keep their mapping alive, even beyond the pool.
+// This class is thread-safe.
+class MappingPool {
+ public:
+  static constexpr char kDevMemPath[] = "/dev/mem";
+
+  enum MapFlags {
+    kMapDefault = 0,
+    // Prefault the page tables of new mappings, for memory that is read in
+    // bulk. Existing mappings that cover a request are used as is.
+    kMapPopulate = 1 << 0,
+  };
+
+  // Maps from the file at path, which is only opened on first use.
+  explicit MappingPool(std::string path = kDevMemPath)
+      : path_(std::move(path)) {}
+
+  MappingPool(const MappingPool&) = delete;
+  MappingPool& operator=(const MappingPool&) = delete;
+
+  ~MappingPool();
+
+  // Returns the process-wide pool for /dev/mem, used by
+  // PhysicalMemory::Create().
+  static MappingPool& Default();
+
+  // Returns a view of length bytes of physical memory starting at
+  // physical_address.
+  absl::StatusOr<std::unique_ptr<PhysicalMemory>> Map(
+      uintptr_t physical_address, size_t length, int flags = kMapDefault)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Number of mappings that are still in use by views.
+  int num_mappings() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Mapping;
+
+  absl::Status OpenFile() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const std::string path_;
+
+  mutable absl::Mutex mutex_;
+  int fd_ ABSL_GUARDED_BY(mutex_) = -1;  // Error
+  // Live mappings, keyed by their first physical address
+  std::map<uintptr_t, std::weak_ptr<Mapping>> mappings_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_MAPPING_POOL_H_
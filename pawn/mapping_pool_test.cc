@@ -0,0 +1,135 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/mapping_pool.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <unistd.h>  // sysconf()
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsTrue;
+
+// Stands in for /dev/mem: a regular file of four pages in which every 32-bit
+// word holds its own offset.
+class MappingPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    page_size_ = sysconf(_SC_PAGESIZE);
+    path_ = ::testing::TempDir() + "/mapping_pool_test_mem";
+    std::string data(4 * page_size_, '\0');
+    for (uint32_t offset = 0; offset < data.size(); offset += 4) {
+      std::memcpy(&data[offset], &offset, sizeof(offset));
+    }
+    std::ofstream(path_, std::ios::binary).write(data.data(), data.size());
+  }
+
+  uintptr_t page_size_;
+  std::string path_;
+};
+
+TEST_F(MappingPoolTest, MapsUnalignedRanges) {
+  MappingPool pool(path_);
+  auto mem = pool.Map(page_size_ + 0x14, 8);
+  ASSERT_THAT(mem.status().ok(), IsTrue());
+  EXPECT_THAT((*mem)->ReadUint32(0), Eq(page_size_ + 0x14));
+  EXPECT_THAT((*mem)->ReadUint32(4), Eq(page_size_ + 0x18));
+}
+
+TEST_F(MappingPoolTest, SharesMappingsWithinPage) {
+  MappingPool pool(path_);
+  auto first = pool.Map(0x10, 4);
+  auto second = pool.Map(0x80, 0x10);
+  ASSERT_THAT(first.status().ok(), IsTrue());
+  ASSERT_THAT(second.status().ok(), IsTrue());
+  EXPECT_THAT(pool.num_mappings(), Eq(1));
+  EXPECT_THAT((*second)->ReadUint32(0), Eq(0x80));
+
+  // Writes through one view are visible in the other.
+  (*first)->WriteUint32(0x70, 0xCAFEF00D);
+  EXPECT_THAT((*second)->ReadUint32(0), Eq(0xCAFEF00D));
+}
+
+TEST_F(MappingPoolTest, CoalescesOverlappingAndAdjacentMappings) {
+  MappingPool pool(path_);
+  auto first = pool.Map(0, page_size_);
+  auto third = pool.Map(2 * page_size_, page_size_);
+  ASSERT_THAT(first.status().ok(), IsTrue());
+  ASSERT_THAT(third.status().ok(), IsTrue());
+  EXPECT_THAT(pool.num_mappings(), Eq(2));
+
+  // Touches the first and overlaps the third mapping.
+  auto second = pool.Map(page_size_, page_size_ + 4);
+  ASSERT_THAT(second.status().ok(), IsTrue());
+  EXPECT_THAT(pool.num_mappings(), Eq(1));
+
+  // Covered by the combined mapping, needs no new one.
+  auto all = pool.Map(0x20, 3 * page_size_ - 0x20);
+  ASSERT_THAT(all.status().ok(), IsTrue());
+  EXPECT_THAT(pool.num_mappings(), Eq(1));
+  EXPECT_THAT((*all)->ReadUint32(2 * page_size_), Eq(2 * page_size_ + 0x20));
+
+  // Views of replaced mappings remain valid.
+  EXPECT_THAT((*first)->ReadUint32(4), Eq(4));
+  EXPECT_THAT((*third)->ReadUint32(0), Eq(2 * page_size_));
+}
+
+TEST_F(MappingPoolTest, ReleasesUnusedMappings) {
+  MappingPool pool(path_);
+  {
+    auto mem = pool.Map(0, 4, MappingPool::kMapPopulate);
+    ASSERT_THAT(mem.status().ok(), IsTrue());
+    EXPECT_THAT(pool.num_mappings(), Eq(1));
+  }
+  EXPECT_THAT(pool.num_mappings(), Eq(0));
+}
+
+TEST_F(MappingPoolTest, ViewsOutliveThePool) {
+  std::unique_ptr<PhysicalMemory> mem;
+  {
+    MappingPool pool(path_);
+    auto mem_or = pool.Map(3 * page_size_, 4);
+    ASSERT_THAT(mem_or.status().ok(), IsTrue());
+    mem = std::move(mem_or).value();
+  }
+  EXPECT_THAT(mem->ReadUint32(0), Eq(3 * page_size_));
+}
+
+TEST_F(MappingPoolTest, RejectsEmptyRanges) {
+  MappingPool pool(path_);
+  EXPECT_THAT(pool.Map(0, 0).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+TEST_F(MappingPoolTest, FailsWithoutFile) {
+  MappingPool pool(::testing::TempDir() + "/mapping_pool_test_missing");
+  EXPECT_THAT(pool.Map(0, 4).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+}  // namespace security::pawn
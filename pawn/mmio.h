@@ -0,0 +1,144 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Typed accessors for memory-mapped registers at compile-time offsets. Each
+// access is a single volatile load or store of exactly the register's width,
+// so the compiler can neither merge, split nor hoist it, for example out of
+// a polling loop. Offsets are checked against the size of the register window
+// at compile time.
+// Example:
+//   using Hsfs = MmioReg<uint16_t, 0x3804, 0x4000 /* RCRB size */>;
+//   while (!(Hsfs::Read(rcrb) & 1)) {}
+
+#ifndef PAWN_MMIO_H_
+#define PAWN_MMIO_H_
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+namespace mmio {
+
+// Orders a register access against the surrounding memory accesses. Register
+// memory is mapped uncached, which x86 never reorders, so these only restrain
+// the compiler and cost no instructions there.
+inline void AcquireFence() {
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+inline void ReleaseFence() {
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+}  // namespace mmio
+
+// A register of type T at kOffset in a window of kWindowSize bytes of register
+// memory. The window may start at a (runtime) offset into the mapping, like
+// the SPI registers at SPIBAR in the RCRB.
+template <typename T, uint32_t kOffset, uint32_t kWindowSize>
+class MmioReg {
+ public:
+  static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, uint16_t> ||
+                    std::is_same_v<T, uint32_t> || std::is_same_v<T, uint64_t>,
+                "Registers must be 8, 16, 32 or 64 bits wide");
+  static_assert(kOffset % sizeof(T) == 0, "Register must be naturally aligned");
+  static_assert(kOffset + sizeof(T) <= kWindowSize,
+                "Register must be inside of its window");
+
+  using Type = T;
+  static constexpr uint32_t kRegOffset = kOffset;
+
+  // Accesses the register directly, base points to the start of the mapping.
+  static T Read(volatile void* base, uint32_t window = 0) {
+    const T value = *Address(base, window);
+    mmio::AcquireFence();
+    return value;
+  }
+  static void Write(volatile void* base, T value, uint32_t window = 0) {
+    mmio::ReleaseFence();
+    *Address(base, window) = value;
+  }
+
+  // Accesses the register in mem, directly if it allows so.
+  static T Read(PhysicalMemory& mem, uint32_t window = 0) {
+    if (volatile void* base = mem.MmioBase(); base != nullptr) {
+      return Read(base, window);
+    }
+    const int offset = window + kOffset;
+    if constexpr (sizeof(T) == 1) {
+      return mem.ReadUint8(offset);
+    } else if constexpr (sizeof(T) == 2) {
+      return mem.ReadUint16(offset);
+    } else if constexpr (sizeof(T) == 4) {
+      return mem.ReadUint32(offset);
+    } else {
+      return mem.ReadUint64(offset);
+    }
+  }
+  static void Write(PhysicalMemory& mem, T value, uint32_t window = 0) {
+    if (volatile void* base = mem.MmioBase(); base != nullptr) {
+      Write(base, value, window);
+      return;
+    }
+    const int offset = window + kOffset;
+    if constexpr (sizeof(T) == 1) {
+      mem.WriteUint8(offset, value);
+    } else if constexpr (sizeof(T) == 2) {
+      mem.WriteUint16(offset, value);
+    } else if constexpr (sizeof(T) == 4) {
+      mem.WriteUint32(offset, value);
+    } else {
+      mem.WriteUint64(offset, value);
+    }
+  }
+
+ private:
+  static volatile T* Address(volatile void* base, uint32_t window) {
+    return reinterpret_cast<volatile T*>(static_cast<volatile uint8_t*>(base) +
+                                         window + kOffset);
+  }
+};
+
+// kCount consecutive registers of type T, starting at kOffset, like FDATA0-15.
+// Indices are not checked at runtime.
+template <typename T, uint32_t kOffset, int kCount, uint32_t kWindowSize>
+class MmioRegArray {
+ public:
+  static_assert(kCount > 0);
+  static_assert(kOffset + kCount * sizeof(T) <= kWindowSize,
+                "Registers must be inside of their window");
+
+  using Type = T;
+  static constexpr uint32_t kRegOffset = kOffset;
+  static constexpr int kSize = kCount;
+
+  // Returns the register at index, at a compile-time offset.
+  template <int kIndex>
+  using At = MmioReg<T, kOffset + kIndex * sizeof(T), kWindowSize>;
+
+  template <typename Mem>
+  static T Read(Mem&& mem, int index, uint32_t window = 0) {
+    return At<0>::Read(mem, window + index * sizeof(T));
+  }
+  template <typename Mem>
+  static void Write(Mem&& mem, int index, T value, uint32_t window = 0) {
+    At<0>::Write(mem, value, window + index * sizeof(T));
+  }
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_MMIO_H_
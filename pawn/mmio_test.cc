@@ -0,0 +1,98 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/mmio.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::Pair;
+
+constexpr uint32_t kWindowSize = 0x100;
+
+using Reg8 = MmioReg<uint8_t, 0x03, kWindowSize>;
+using Reg16 = MmioReg<uint16_t, 0x06, kWindowSize>;
+using Reg32 = MmioReg<uint32_t, 0x08, kWindowSize>;
+using Reg64 = MmioReg<uint64_t, 0x10, kWindowSize>;
+using RegArray = MmioRegArray<uint32_t, 0x20, 4, kWindowSize>;
+
+class MmioRegTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(MmioRegTest, AccessesRegistersAtTheirWidth) {
+  std::vector<uint8_t> buffer(0x200);
+  BufferMemory mem(absl::MakeSpan(buffer), GetParam());
+  Reg8::Write(mem, 0x11);
+  Reg16::Write(mem, 0x2233);
+  Reg32::Write(mem, 0x44556677);
+  Reg64::Write(mem, 0x8899AABBCCDDEEFF);
+
+  EXPECT_THAT(Reg8::Read(mem), Eq(0x11));
+  EXPECT_THAT(Reg16::Read(mem), Eq(0x2233));
+  EXPECT_THAT(Reg32::Read(mem), Eq(0x44556677));
+  EXPECT_THAT(Reg64::Read(mem), Eq(0x8899AABBCCDDEEFF));
+  EXPECT_THAT(buffer[0x03], Eq(0x11));
+  EXPECT_THAT(buffer[0x06], Eq(0x33));
+  EXPECT_THAT(buffer[0x0B], Eq(0x44));
+  EXPECT_THAT(buffer[0x10], Eq(0xFF));
+  EXPECT_THAT(buffer[0x05], Eq(0x00));
+}
+
+TEST_P(MmioRegTest, AppliesWindowAndIndex) {
+  std::vector<uint8_t> buffer(0x200);
+  BufferMemory mem(absl::MakeSpan(buffer), GetParam());
+  constexpr uint32_t kWindow = 0x100;
+  Reg16::Write(mem, 0xBEEF, kWindow);
+  RegArray::Write(mem, 2, 0xCAFEF00D, kWindow);
+
+  EXPECT_THAT(buffer[0x106], Eq(0xEF));
+  EXPECT_THAT(buffer[0x128], Eq(0x0D));
+  EXPECT_THAT(RegArray::Read(mem, 2, kWindow), Eq(0xCAFEF00D));
+  EXPECT_THAT(RegArray::At<2>::Read(mem, kWindow), Eq(0xCAFEF00D));
+  EXPECT_THAT(RegArray::Read(mem, 1, kWindow), Eq(0));
+}
+
+INSTANTIATE_TEST_SUITE_P(DirectAndIndirect, MmioRegTest, ::testing::Bool());
+
+TEST(MmioRegIndirectTest, DoesSingleAccessPerRegister) {
+  std::vector<uint8_t> buffer(0x200);
+  BufferMemory mem(absl::MakeSpan(buffer), /*direct=*/false);
+  Reg16::Write(mem, 0x1234, 0x40);
+  Reg32::Read(mem);
+  RegArray::Read(mem, 3);
+  EXPECT_THAT(mem.accesses(), ElementsAre(Pair(0x46, 2), Pair(0x08, 4),
+                                          Pair(0x2C, 4)));
+}
+
+TEST(MmioRegDirectTest, BypassesVirtualAccessors) {
+  std::vector<uint8_t> buffer(0x200);
+  BufferMemory mem(absl::MakeSpan(buffer), /*direct=*/true);
+  Reg32::Write(mem, 1);
+  Reg32::Read(mem);
+  Reg32::Read(mem.MmioBase());
+  EXPECT_THAT(mem.accesses().size(), Eq(0));
+}
+
+}  // namespace
+}  // namespace security::pawn
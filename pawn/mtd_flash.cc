@@ -0,0 +1,184 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/mtd_flash.h"
+
+#include <dirent.h>        // opendir()
+#include <fcntl.h>         // open()
+#include <mtd/mtd-user.h>  // MEMGETINFO
+#include <sys/ioctl.h>     // ioctl()
+#include <sys/stat.h>      // fstat()
+#include <unistd.h>        // close(), pread()
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+// Reads a single-line sysfs attribute. Returns an empty string if there is
+// none.
+std::string ReadAttribute(const std::string& path) {
+  std::ifstream file(path);
+  std::string value;
+  std::getline(file, value);
+  return std::string(absl::StripAsciiWhitespace(value));
+}
+
+}  // namespace
+
+MtdFlash::~MtdFlash() { close(fd_); }
+
+absl::StatusOr<std::string> MtdFlash::FindIntelSpi(
+    const std::string& sysfs_path, const std::string& dev_path) {
+  DIR* dir = opendir(sysfs_path.c_str());
+  if (dir == nullptr) {
+    return absl::NotFoundError(
+        absl::StrCat("No MTD devices in ", sysfs_path,
+                     ". Make sure the spi-intel-platform or spi-intel-pci "
+                     "module is loaded."));
+  }
+  // Several flash chips are unlikely, use the lowest-numbered device.
+  int found = -1;
+  while (const dirent* entry = readdir(dir)) {
+    int index;
+    // Skips the read-only aliases (mtdNro) as well.
+    if (!absl::StartsWith(entry->d_name, "mtd") ||
+        !absl::SimpleAtoi(entry->d_name + 3, &index)) {
+      continue;
+    }
+    const std::string device = absl::StrCat(sysfs_path, "/", entry->d_name);
+    if (ReadAttribute(device + "/name") == kIntelSpiName &&
+        ReadAttribute(device + "/type") == "nor" &&
+        (found == -1 || index < found)) {
+      found = index;
+    }
+  }
+  closedir(dir);
+  if (found == -1) {
+    return absl::NotFoundError(absl::StrCat(
+        "No MTD device named ", kIntelSpiName, " in ", sysfs_path));
+  }
+  return absl::StrCat(dev_path, "/mtd", found);
+}
+
+absl::StatusOr<std::unique_ptr<MtdFlash>> MtdFlash::Open(
+    const std::string& path, const std::string& sysfs_path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1 /* Error */) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Could not open ", path, ": ", std::strerror(errno)));
+  }
+  std::unique_ptr<MtdFlash> mtd(new MtdFlash(path, fd));
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Could not stat ", path, ": ", std::strerror(errno)));
+  }
+  Info& info = mtd->info_;
+  if (S_ISREG(st.st_mode)) {
+    info.size = st.st_size;
+    return mtd;  // GCC 7 needs the extra move
+  }
+
+  // Prefer sysfs, as the attributes there are 64-bit. Fall back to the
+  // driver if sysfs is not mounted.
+  const std::string device = absl::StrCat(
+      sysfs_path, "/", path.substr(path.find_last_of('/') + 1));
+  info.name = ReadAttribute(device + "/name");
+  info.type = ReadAttribute(device + "/type");
+  if (!absl::SimpleAtoi(ReadAttribute(device + "/size"), &info.size) ||
+      !absl::SimpleAtoi(ReadAttribute(device + "/erasesize"),
+                        &info.erase_size)) {
+    mtd_info_user mtd_info;
+    if (ioctl(fd, MEMGETINFO, &mtd_info) == -1) {
+      return absl::FailedPreconditionError(
+          absl::StrCat(path, " is not an MTD device"));
+    }
+    info.size = mtd_info.size;
+    info.erase_size = mtd_info.erasesize;
+  }
+  return mtd;  // GCC 7 needs the extra move
+}
+
+bool MtdFlash::ReadFully(int64_t offset, absl::Span<uint8_t> data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    const ssize_t result = pread(fd_, data.data() + done, data.size() - done,
+                                 offset + done);
+    if (result == -1 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    done += result;
+  }
+  return true;
+}
+
+absl::Status MtdFlash::Read(int64_t flash_address, absl::Span<uint8_t> data,
+                            int block_size,
+                            absl::Span<Chipset::BlockStatus> block_status) {
+  if (flash_address % block_size != 0 || data.size() % block_size != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("Range 0x%08X+0x%X is not a multiple of %d bytes",
+                        flash_address, data.size(), block_size));
+  }
+  if (flash_address < 0 || flash_address + data.size() > info_.size) {
+    return absl::OutOfRangeError(absl::StrFormat(
+        "Range 0x%08X+0x%X is beyond the end of %s", flash_address,
+        data.size(), path_));
+  }
+
+  const int num_blocks = data.size() / block_size;
+  if (ReadFully(flash_address, data)) {
+    std::fill_n(block_status.begin(),
+                std::min<size_t>(num_blocks, block_status.size()),
+                Chipset::kBlockOk);
+    return absl::OkStatus();
+  }
+
+  // The driver fails the whole read if any part of it fails.
+  for (int i = 0; i < num_blocks; ++i) {
+    auto block = data.subspan(i * block_size, block_size);
+    const bool ok = ReadFully(flash_address + i * block_size, block);
+    if (!ok) {
+      std::fill(block.begin(), block.end(), 0xFF);
+    }
+    if (i < block_status.size()) {
+      block_status[i] = ok ? Chipset::kBlockOk : Chipset::kBlockReadError;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace security::pawn
@@ -0,0 +1,92 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef PAWN_MTD_FLASH_H_
+#define PAWN_MTD_FLASH_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+// Reads the SPI flash through a memory technology device (/dev/mtdN) of the
+// kernel's intel-spi driver. The driver runs the flash cycles itself, so this
+// needs neither /dev/mem nor I/O privileges and works on kernels built with
+// CONFIG_IO_STRICT_DEVMEM. Reads are large pread() calls, without any
+// polling of registers from user space.
+// Any regular file can stand in for the device, as can an mtdram device.
+class MtdFlash {
+ public:
+  static constexpr char kSysfsPath[] = "/sys/class/mtd";
+
+  // The intel-spi driver registers a single partition of this name that
+  // covers the whole flash.
+  static constexpr char kIntelSpiName[] = "BIOS";
+
+  struct Info {
+    std::string name;  // Empty for regular files
+    std::string type;  // For example "nor", empty for regular files
+    int64_t size = 0;
+    int64_t erase_size = 0;  // 0 for regular files
+  };
+
+  ~MtdFlash();
+
+  MtdFlash(const MtdFlash&) = delete;
+  MtdFlash& operator=(const MtdFlash&) = delete;
+
+  // Returns the path of the device node of the intel-spi driver's MTD.
+  static absl::StatusOr<std::string> FindIntelSpi(
+      const std::string& sysfs_path = kSysfsPath,
+      const std::string& dev_path = "/dev");
+
+  // Opens the MTD device node or regular file at path. The device's
+  // attributes are taken from sysfs_path, if present.
+  static absl::StatusOr<std::unique_ptr<MtdFlash>> Open(
+      const std::string& path, const std::string& sysfs_path = kSysfsPath);
+
+  const std::string& path() const { return path_; }
+  const Info& info() const { return info_; }
+
+  // Reads data.size() bytes starting at flash_address, which must be
+  // multiples of block_size. If the driver fails to read a part of the range,
+  // for example because it is not accessible to the BIOS master, that part
+  // is read block by block. Blocks that still fail are set to 0xFF and marked
+  // as kBlockReadError in block_status, if it is not empty. Returns an error
+  // if the range is beyond the end of the device.
+  absl::Status Read(int64_t flash_address, absl::Span<uint8_t> data,
+                    int block_size,
+                    absl::Span<Chipset::BlockStatus> block_status = {});
+
+ private:
+  MtdFlash(std::string path, int fd) : path_(std::move(path)), fd_(fd) {}
+
+  // Reads data.size() bytes at offset. Returns whether that succeeded.
+  bool ReadFully(int64_t offset, absl::Span<uint8_t> data);
+
+  std::string path_;
+  int fd_;
+  Info info_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_MTD_FLASH_H_
@@ -0,0 +1,144 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/mtd_flash.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>  // mkdir()
+#include <unistd.h>    // truncate()
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Each;
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsTrue;
+
+constexpr int kFlashSize = 64 << 10;  // 64KiB
+constexpr int kBlockSize = 64;
+
+void WriteFile(const std::string& path, const std::string& data) {
+  std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+class MtdFlashTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "/mtd_flash_test_image";
+    image_.resize(kFlashSize);
+    for (int i = 0; i < kFlashSize; ++i) {
+      image_[i] = static_cast<char>(i * 7 + i / 256);
+    }
+    WriteFile(path_, image_);
+  }
+
+  std::string path_;
+  std::string image_;
+};
+
+TEST_F(MtdFlashTest, ReadsRegularFile) {
+  auto mtd = MtdFlash::Open(path_);
+  ASSERT_THAT(mtd.ok(), IsTrue()) << mtd.status();
+  EXPECT_THAT((*mtd)->info().size, Eq(kFlashSize));
+  EXPECT_THAT((*mtd)->info().name, Eq(""));
+
+  std::vector<uint8_t> data(0x1000);
+  std::vector<Chipset::BlockStatus> block_status(data.size() / kBlockSize,
+                                                 Chipset::kBlockNotRead);
+  ASSERT_THAT((*mtd)
+                  ->Read(0x2000, absl::MakeSpan(data), kBlockSize,
+                         absl::MakeSpan(block_status))
+                  .ok(),
+              IsTrue());
+  EXPECT_THAT(std::string(data.begin(), data.end()),
+              Eq(image_.substr(0x2000, 0x1000)));
+  EXPECT_THAT(block_status, Each(Chipset::kBlockOk));
+}
+
+TEST_F(MtdFlashTest, RejectsInvalidRanges) {
+  auto mtd = MtdFlash::Open(path_);
+  ASSERT_THAT(mtd.ok(), IsTrue()) << mtd.status();
+  std::vector<uint8_t> data(2 * kBlockSize);
+  EXPECT_THAT((*mtd)->Read(kFlashSize - kBlockSize, absl::MakeSpan(data),
+                           kBlockSize)
+                  .code(),
+              Eq(absl::StatusCode::kOutOfRange));
+  EXPECT_THAT((*mtd)->Read(1, absl::MakeSpan(data), kBlockSize).code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+TEST_F(MtdFlashTest, MarksBlocksThatFailToRead) {
+  auto mtd = MtdFlash::Open(path_);
+  ASSERT_THAT(mtd.ok(), IsTrue()) << mtd.status();
+  // Reads past the new end of the file fail, like reads the driver rejects.
+  ASSERT_THAT(truncate(path_.c_str(), kFlashSize - kBlockSize), Eq(0));
+
+  std::vector<uint8_t> data(2 * kBlockSize);
+  std::vector<Chipset::BlockStatus> block_status(2, Chipset::kBlockNotRead);
+  ASSERT_THAT((*mtd)
+                  ->Read(kFlashSize - 2 * kBlockSize, absl::MakeSpan(data),
+                         kBlockSize, absl::MakeSpan(block_status))
+                  .ok(),
+              IsTrue());
+  EXPECT_THAT(block_status,
+              ElementsAre(Chipset::kBlockOk, Chipset::kBlockReadError));
+  EXPECT_THAT(std::string(data.begin(), data.begin() + kBlockSize),
+              Eq(image_.substr(kFlashSize - 2 * kBlockSize, kBlockSize)));
+  EXPECT_THAT(absl::MakeSpan(data).subspan(kBlockSize), Each(0xFF));
+}
+
+TEST_F(MtdFlashTest, FailsWithoutFile) {
+  EXPECT_THAT(MtdFlash::Open(::testing::TempDir() + "/mtd_flash_test_missing")
+                  .status()
+                  .code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(MtdFlashFindTest, FindsIntelSpiDevice) {
+  const std::string sysfs = ::testing::TempDir() + "/mtd_flash_test_sysfs";
+  mkdir(sysfs.c_str(), 0755);
+  auto add_device = [&sysfs](const std::string& device,
+                             const std::string& name) {
+    const std::string path = sysfs + "/" + device;
+    mkdir(path.c_str(), 0755);
+    WriteFile(path + "/name", name + "\n");
+    WriteFile(path + "/type", "nor\n");
+  };
+  add_device("mtd0", "mtdram test device");
+  add_device("mtd0ro", "mtdram test device");
+  add_device("mtd2", MtdFlash::kIntelSpiName);
+  add_device("mtd2ro", MtdFlash::kIntelSpiName);
+
+  auto found = MtdFlash::FindIntelSpi(sysfs, "/dev");
+  ASSERT_THAT(found.ok(), IsTrue()) << found.status();
+  EXPECT_THAT(*found, Eq("/dev/mtd2"));
+
+  EXPECT_THAT(MtdFlash::FindIntelSpi(sysfs + "/missing").status().code(),
+              Eq(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+}  // namespace security::pawn
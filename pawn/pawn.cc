@@ -16,31 +16,501 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iomanip>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/base/macros.h"
+#include "absl/cleanup/cleanup.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/bios_window.h"
+#include "pawn/block_sink.h"
 #include "pawn/chipset.h"
+#include "pawn/component_probe.h"
+#include "pawn/compressed_image.h"
+#include "pawn/flash_descriptor.h"
+#include "pawn/mtd_flash.h"
 #include "pawn/pci.h"
+#include "pawn/pci_ecam.h"
+#include "pawn/pci_snapshot.h"
+#include "pawn/pci_sysfs.h"
 #include "pawn/physical_memory.h"
+#include "pawn/read_plan.h"
+#include "pawn/sinks.h"
+#include "pawn/software_sequencing.h"
+#include "pawn/sparse_file.h"
+#include "pawn/trace.h"
 #include "pawn/version.h"
 
 ABSL_FLAG(bool, logo, true, "display version/copyright information");
+ABSL_FLAG(std::vector<std::string>, regions, {},
+          "comma-separated list of flash regions to dump (descriptor, bios, "
+          "me, gbe, pdr), default is the whole flash");
+ABSL_FLAG(int64_t, offset, 0, "start of a raw flash range to dump");
+ABSL_FLAG(int64_t, length, 0,
+          "size of a raw flash range to dump, 0 to not dump a range");
+ABSL_FLAG(bool, split_regions, false,
+          "write one file per selected region instead of a full-size image "
+          "with unread parts filled with 0xFF");
+ABSL_FLAG(bool, sparse, false,
+          "leave erased (all 0xFF) runs of the flash as holes in the output "
+          "and list them in OUTPUT.erased, see --restore_sparse");
+ABSL_FLAG(std::string, restore_sparse, "",
+          "if set, write the full image of this sparse output to OUTPUT "
+          "instead of reading the flash");
+ABSL_FLAG(int, compress, 0,
+          "if 1 (fastest) to 9 (smallest), write compressed output at this "
+          "zlib level, see --decompress");
+ABSL_FLAG(std::string, decompress, "",
+          "if set, write the image in this compressed output to OUTPUT "
+          "instead of reading the flash");
+ABSL_FLAG(std::vector<std::string>, sinks, {},
+          "comma-separated list of additional consumers of the read blocks: "
+          "classify (count erased, zero and data blocks), compare=FILE "
+          "(count blocks that changed since a previous full dump) or "
+          "hash[=FILE] (write SHA-256 hashes of the image and each region "
+          "and CRC32C of each 4KiB block to FILE, default OUTPUT.manifest)");
+ABSL_FLAG(bool, manifest, true,
+          "write the hashes of the dump to OUTPUT.manifest, as with "
+          "--sinks=hash, if --sinks has no hash sink");
+ABSL_FLAG(std::string, block_map, "",
+          "if set, write a bitmap of the blocks that hold valid data to this "
+          "file, one bit per 64-byte block, least-significant bit first");
+ABSL_FLAG(bool, bios_window, true,
+          "read the BIOS region through its memory-mapped decode window "
+          "below 4GiB instead of using hardware sequencing");
+ABSL_FLAG(std::string, read_method, "auto",
+          "how to read outside of the BIOS window: hwseq (hardware "
+          "sequencing), swseq (software sequencing) or auto to benchmark both "
+          "and use the faster one");
+ABSL_FLAG(bool, probe_components, true,
+          "skip a second flash component that is missing or mirrors the "
+          "first one");
+ABSL_FLAG(std::string, pci_backend, "auto",
+          "how to access the PCI configuration space: ecam (memory-mapped, "
+          "from the ACPI MCFG table), sysfs, ioport (ports CF8/CFC) or auto "
+          "to use the first one that works, in this order");
+ABSL_FLAG(std::string, pci_snapshot, "",
+          "if set, write the configuration space of the chipset's PCI "
+          "functions to this file, in the format of lspci -xxx");
+ABSL_FLAG(std::string, mtd, "",
+          "if set, read the flash through this MTD device of the kernel's "
+          "intel-spi driver, or auto to find it, instead of accessing the SPI "
+          "controller, for kernels that restrict /dev/mem");
+ABSL_FLAG(std::string, trace, "",
+          "if set, record PCI configuration space and chipset register "
+          "accesses to this file, for use with --replay");
+ABSL_FLAG(int, trace_events, 1 << 20,
+          "number of most recent accesses kept by --trace, a trace that "
+          "lost older ones cannot be replayed");
+ABSL_FLAG(std::string, replay, "",
+          "if set, replay a trace recorded with --trace instead of accessing "
+          "the hardware");
+ABSL_FLAG(bool, replay_timing, false,
+          "delay replayed accesses to match the timing of the recording");
+ABSL_FLAG(absl::Duration, cycle_timeout, absl::Seconds(1),
+          "give up if a single SPI flash cycle takes longer than this");
 
 namespace security::pawn {
 namespace {
 
+// Accumulates the number of bytes read and the time it took.
+struct Throughput {
+  const char* name;
+  int64_t bytes = 0;
+  absl::Duration time;
+
+  void Add(int64_t size, absl::Duration elapsed) {
+    bytes += size;
+    time += elapsed;
+  }
+
+  void Print() const {
+    if (bytes == 0) {
+      return;
+    }
+    absl::PrintF("%s: %d KiB in %s (%.1f MiB/s)\n", name, bytes >> 10,
+                 absl::FormatDuration(time),
+                 bytes / absl::ToDoubleSeconds(time) / (1 << 20));
+  }
+};
+
+// Writes data to a new file called filename. Returns whether that succeeded.
+bool WriteFile(const std::string& filename, absl::string_view data) {
+  FILE* file = fopen(filename.c_str(), "wb");
+  bool written =
+      file != nullptr &&
+      fwrite(data.data(), 1 /* Size */, data.size(), file) == data.size();
+  if (file != nullptr) {
+    written = fclose(file) == 0 && written;
+  }
+  return written;
+}
+
+// Reads the file called filename into data. Returns whether that succeeded.
+bool ReadFile(const std::string& filename, std::string& data) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  data.clear();
+  char buffer[1 << 16];
+  size_t size;
+  while ((size = fread(buffer, 1 /* Size */, sizeof(buffer), file)) > 0) {
+    data.append(buffer, size);
+  }
+  const bool read = !ferror(file);
+  return fclose(file) == 0 && read;
+}
+
+// Returns the output filename for a single region, for example
+// "bios_via_spi_hs.bios.bin" for "bios_via_spi_hs.bin".
+std::string SplitFilename(absl::string_view filename, absl::string_view name) {
+  const size_t dot = filename.rfind('.');
+  if (dot == absl::string_view::npos || dot == 0) {
+    return absl::StrCat(filename, ".", name);
+  }
+  return absl::StrCat(filename.substr(0, dot), ".", name,
+                      filename.substr(dot));
+}
+
+// Adds either a single full-size image, or one file per requested range of
+// plan, the sinks requested with --sinks and, unless disabled with
+// --nomanifest, the manifest to graph. Prints the ranges that plan skips.
+absl::Status AddSinks(const ReadPlan& plan,
+                      absl::Span<const Chipset::FregN> fregs,
+                      const char* dump_filename, int64_t flash_size,
+                      SinkGraph& graph) {
+  std::vector<ReadPlan::Range> files;
+  if (absl::GetFlag(FLAGS_split_regions)) {
+    for (const auto& range : plan.ranges()) {
+      files.push_back(range);
+      files.back().name = SplitFilename(dump_filename, range.name);
+    }
+  } else {
+    files.push_back({dump_filename, 0, flash_size});
+  }
+  FileSink::Options options;
+  options.sparse = absl::GetFlag(FLAGS_sparse);
+  CompressSink::Options compress_options;
+  compress_options.level = absl::GetFlag(FLAGS_compress);
+  if (compress_options.level != 0 && options.sparse) {
+    return absl::InvalidArgumentError(
+        "--compress and --sparse cannot be combined");
+  }
+  for (const auto& file : files) {
+    if (compress_options.level != 0) {
+      auto sink = CompressSink::Create(file.name, file.offset, file.size,
+                                       compress_options);
+      if (!sink.ok()) {
+        return sink.status();
+      }
+      graph.AddSink(std::move(sink).value());
+      continue;
+    }
+    auto sink = FileSink::Create(file.name, file.offset, file.size, options);
+    if (!sink.ok()) {
+      return sink.status();
+    }
+    graph.AddSink(std::move(sink).value());
+  }
+  const SinkContext context = {dump_filename, flash_size,
+                               ReadPlan::Regions(fregs, flash_size)};
+  std::vector<std::string> specs = absl::GetFlag(FLAGS_sinks);
+  if (absl::GetFlag(FLAGS_manifest) &&
+      std::none_of(specs.begin(), specs.end(), [](absl::string_view spec) {
+        return spec == "hash" || absl::StartsWith(spec, "hash=");
+      })) {
+    specs.push_back("hash");
+  }
+  for (const std::string& spec : specs) {
+    auto sink = CreateBlockSink(spec, context);
+    if (!sink.ok()) {
+      return sink.status();
+    }
+    graph.AddSink(std::move(sink).value());
+  }
+
+  for (const auto& range : plan.unreadable()) {
+    absl::PrintF("Skipping unreadable %s: 0x%08X - 0x%08X\n", range.name,
+                 range.offset, range.end() - 1);
+  }
+  return absl::OkStatus();
+}
+
+// Marks the blocks of slice whose status is kBlockOk as valid.
+void MarkValidBlocks(const BlockSlice& slice, BlockBitmap& valid_blocks) {
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    if (slice.ok(i)) {
+      valid_blocks.Set(slice.flash_address + i * slice.block_size);
+    }
+  }
+}
+
+// Waits for the sinks and prints their results, reports blocks that could not
+// be read and writes the block map. Returns whether that succeeded.
+bool FinishDumps(const ReadPlan& plan, const BlockBitmap& valid_blocks,
+                 int block_size, SinkGraph& graph) {
+  if (auto status = graph.Finish(); !status.ok()) {
+    absl::PrintF("Error: %s\n", status.message());
+    return false;
+  }
+  for (int i = 0; i < graph.num_sinks(); ++i) {
+    absl::PrintF("%s: %s\n", graph.sink(i).name(), graph.sink(i).Summary());
+  }
+  if (graph.stats().backpressure_time > absl::ZeroDuration()) {
+    absl::PrintF("Reading waited %s for slow sinks\n",
+                 absl::FormatDuration(graph.stats().backpressure_time));
+  }
+  const int64_t num_errors =
+      plan.read_size() / block_size - valid_blocks.Count();
+  if (num_errors > 0) {
+    absl::PrintF("Warning: %d blocks could not be read.\n", num_errors);
+  }
+
+  if (const std::string block_map = absl::GetFlag(FLAGS_block_map);
+      !block_map.empty()) {
+    if (!WriteFile(block_map, valid_blocks.ToBytes())) {
+      absl::PrintF("Error: Could not write block map to %s.\n", block_map);
+      return false;
+    }
+  }
+  return true;
+}
+
+absl::StatusOr<FlashDescriptor> ReadFlashDescriptor(Chipset& chipset,
+                                                    int block_size) {
+  std::vector<uint8_t> data(FlashDescriptor::kSize);
+  std::vector<Chipset::BlockStatus> block_status(data.size() / block_size);
+  if (auto status = chipset.ReadSpiWithHardwareSequencing(
+          0 /* Start address */, absl::MakeSpan(data), block_size,
+          absl::MakeSpan(block_status));
+      !status.ok()) {
+    return status;
+  }
+  if (std::find(block_status.begin(), block_status.end(),
+                Chipset::kBlockReadError) != block_status.end()) {
+    return absl::PermissionDeniedError("Descriptor region not readable");
+  }
+  return FlashDescriptor::Parse(data, chipset.GetFlashDescriptorFormat());
+}
+
+// Reads size bytes at flash_address with hardware and with software
+// sequencing and returns how long each took.
+absl::StatusOr<std::pair<absl::Duration, absl::Duration>> BenchmarkReadMethods(
+    Chipset& chipset, SoftwareSequencing& swseq, int64_t flash_address,
+    int size, int block_size) {
+  std::vector<uint8_t> data(size);
+  absl::Time start = absl::Now();
+  if (auto status = chipset.ReadSpiWithHardwareSequencing(
+          flash_address, absl::MakeSpan(data), block_size);
+      !status.ok()) {
+    return status;
+  }
+  const absl::Duration hwseq_time = absl::Now() - start;
+  start = absl::Now();
+  if (auto status = swseq.Read(flash_address, absl::MakeSpan(data),
+                               block_size);
+      !status.ok()) {
+    return status;
+  }
+  return std::make_pair(hwseq_time, absl::Now() - start);
+}
+
+// Opens the PCI configuration space with the named backend. Backends that
+// fail are skipped if backend is "auto".
+absl::StatusOr<std::unique_ptr<Pci>> CreatePci(absl::string_view backend) {
+  const bool any = backend == "auto";
+  if (any || backend == "ecam") {
+    auto ecam = EcamPci::Create();
+    if (ecam.ok()) {
+      absl::PrintF("Accessing PCI configuration space via ECAM\n");
+      return std::move(*ecam);
+    }
+    if (!any) {
+      return ecam.status();
+    }
+  }
+  if (any || backend == "sysfs") {
+    auto sysfs = SysfsPci::Create();
+    if (sysfs.ok()) {
+      absl::PrintF("Accessing PCI configuration space via sysfs\n");
+      return std::move(*sysfs);
+    }
+    if (!any) {
+      return sysfs.status();
+    }
+  }
+  if (any || backend == "ioport") {
+    // The I/O ports require ring-3 I/O privileges. This needs to be done as
+    // root.
+    absl::PrintF("Acquiring I/O port read permissions, this may fail...\n");
+    auto pci = Pci::Create();
+    if (!pci.ok()) {
+      return pci.status();
+    }
+    return std::make_unique<Pci>(*std::move(pci));
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown PCI backend: ", backend));
+}
+
+// Dumps the flash through the intel-spi driver's MTD device at path, or the
+// one found in sysfs if path is "auto". Only the PCI configuration space is
+// read directly, through sysfs. The flash layout and the BIOS master's read
+// permissions come from the flash descriptor, which the chipset derives its
+// FREG and FRAP registers from.
+int DumpFromMtd(const std::string& path, const char* dump_filename) {
+  enum {
+    kBlockSize = 64,
+    // The driver reads up to 64 bytes per flash cycle, but a large pread()
+    // saves system calls.
+    kChunkSize = 1 << 20 /* 1MiB */
+  };
+
+  std::string mtd_path = path;
+  if (mtd_path == "auto") {
+    auto found = MtdFlash::FindIntelSpi();
+    if (!found.ok()) {
+      absl::PrintF("Error: %s\n", found.status().message());
+      return EXIT_FAILURE;
+    }
+    mtd_path = *std::move(found);
+  }
+  auto mtd = MtdFlash::Open(mtd_path);
+  if (!mtd.ok()) {
+    absl::PrintF("Error: %s\n", mtd.status().message());
+    return EXIT_FAILURE;
+  }
+  const MtdFlash::Info& info = (*mtd)->info();
+  absl::PrintF("Reading flash through %s (%s, %d KiB, %d KiB erase size)\n",
+               mtd_path, info.name.empty() ? "file" : info.name,
+               info.size >> 10, info.erase_size >> 10);
+
+  // Without a known chipset, assume the older, narrower descriptor fields.
+  Chipset::FlashDescriptorFormat descriptor_format =
+      Chipset::kDescriptorFormatIch8;
+  if (auto pci = SysfsPci::Create(); pci.ok()) {
+    Chipset::HardwareId hw_id;
+    auto chipset = Chipset::Create(**pci, hw_id);
+    absl::PrintF(
+        "Chipset LPC device identification:  VID: 0x%04X  DID: 0x%04X  RID: "
+        "0x%02X (%d)\n",
+        hw_id.vendor, hw_id.device, hw_id.revision, hw_id.revision);
+    if (chipset.ok()) {
+      descriptor_format = (*chipset)->GetFlashDescriptorFormat();
+      auto bios_cntl = (*chipset)->ReadBiosCntlRegister();
+      absl::PrintF("BIOS Control Register (BIOS_CNTL):\n");
+      absl::PrintF("  SMM BIOS Write Protect Disable (SMM_BWP):   %d\n",
+                   bios_cntl.smm_bios_write_protect_disable);
+      absl::PrintF("  BIOS Lock Enable (BLE):                     %d\n",
+                   bios_cntl.bios_lock_enable);
+      absl::PrintF("  BIOS Write Enable (BIOSWE):                 %d\n",
+                   bios_cntl.bios_write_enable);
+    } else {
+      absl::PrintF("Warning: %s\n", chipset.status().message());
+    }
+  }
+
+  int64_t flash_size = info.size / kBlockSize * kBlockSize;
+  ReadPlan::Options plan_options;
+  Chipset::FregN fregs[FlashDescriptor::kNumRegions] = {};
+  std::vector<uint8_t> descriptor_data(FlashDescriptor::kSize);
+  absl::StatusOr<FlashDescriptor> descriptor =
+      absl::OutOfRangeError("Device too small");
+  if (flash_size >= FlashDescriptor::kSize) {
+    auto status = (*mtd)->Read(0 /* Start address */,
+                               absl::MakeSpan(descriptor_data), kBlockSize);
+    descriptor =
+        status.ok()
+            ? FlashDescriptor::Parse(descriptor_data, descriptor_format)
+            : absl::StatusOr<FlashDescriptor>(status);
+  }
+  if (descriptor.ok()) {
+    absl::PrintF("Flash descriptor:\n%s", descriptor->ToString());
+    flash_size = std::min(flash_size, descriptor->total_size());
+    for (int i = 0; i < FlashDescriptor::kNumRegions; ++i) {
+      fregs[i].region_base = descriptor->region(i).base;
+      fregs[i].region_limit = descriptor->region(i).limit;
+    }
+    Chipset::Frap frap = {};
+    frap.bios_region_read_access =
+        descriptor->master(FlashDescriptor::kMasterBios).read_access;
+    plan_options.frap = frap;
+  } else {
+    absl::PrintF("Warning: Could not read flash descriptor: %s\n",
+                 descriptor.status().message());
+    for (auto& freg : fregs) {
+      freg.region_base = 1;  // Unused
+    }
+  }
+
+  plan_options.regions = absl::GetFlag(FLAGS_regions);
+  plan_options.offset = absl::GetFlag(FLAGS_offset);
+  plan_options.length = absl::GetFlag(FLAGS_length);
+  plan_options.flash_size = flash_size;
+  plan_options.block_size = kBlockSize;
+  auto plan = ReadPlan::Create(plan_options, fregs);
+  if (!plan.ok()) {
+    absl::PrintF("Error: %s\n", plan.status().message());
+    return EXIT_FAILURE;
+  }
+
+  SinkGraph graph({});
+  if (auto status =
+          AddSinks(*plan, fregs, dump_filename, flash_size, graph);
+      !status.ok()) {
+    absl::PrintF("Error: %s\n", status.message());
+    return EXIT_FAILURE;
+  }
+
+  BlockBitmap valid_blocks(flash_size, kBlockSize);
+  Throughput throughput{"MTD"};
+  for (const auto& extent : plan->extents()) {
+    absl::PrintF("Reading %s: 0x%08X - 0x%08X", extent.name, extent.offset,
+                 extent.end() - 1);
+    fflush(STDIN_FILENO);
+    for (int64_t offset = extent.offset; offset < extent.end();
+         offset += kChunkSize) {
+      const int size = std::min<int64_t>(kChunkSize, extent.end() - offset);
+      std::shared_ptr<BlockSlice> slice =
+          graph.Allocate(offset, size, kBlockSize);
+      const absl::Time start = absl::Now();
+      QCHECK_OK((*mtd)->Read(offset, absl::MakeSpan(slice->data), kBlockSize,
+                             absl::MakeSpan(slice->block_status)));
+      throughput.Add(size, absl::Now() - start);
+      MarkValidBlocks(*slice, valid_blocks);
+      graph.Publish(std::move(slice));
+      absl::PrintF(".");
+      fflush(STDIN_FILENO);
+    }
+    absl::PrintF("\n");
+  }
+  throughput.Print();
+  return FinishDumps(*plan, valid_blocks, kBlockSize, graph) ? EXIT_SUCCESS
+                                                             : EXIT_FAILURE;
+}
+
 int PawnMain(int argc, char* argv[]) {
   const std::string usage = absl::StrFormat(
       "Extract BIOS/UEFI firmware\n"
@@ -59,11 +529,97 @@ int PawnMain(int argc, char* argv[]) {
                  kPawnCopyright);
   }
 
-  // We need to access the PCI configuration space, which requires to enable
-  // ring-3 I/O privileges. This needs to be done as root.
-  absl::PrintF("Acquiring I/O port read permissions, this may fail...\n");
-  auto pci = Pci::Create();
-  QCHECK_OK(pci.status());
+  if (const std::string compressed = absl::GetFlag(FLAGS_decompress);
+      !compressed.empty()) {
+    if (auto status = DecompressImage(compressed, dump_filename);
+        !status.ok()) {
+      absl::PrintF("Error: %s\n", status.message());
+      return EXIT_FAILURE;
+    }
+    absl::PrintF("Decompressed %s to %s\n", compressed, dump_filename);
+    return EXIT_SUCCESS;
+  }
+
+  if (const std::string sparse = absl::GetFlag(FLAGS_restore_sparse);
+      !sparse.empty()) {
+    if (auto status = RestoreSparseFile(sparse, dump_filename); !status.ok()) {
+      absl::PrintF("Error: %s\n", status.message());
+      return EXIT_FAILURE;
+    }
+    absl::PrintF("Restored %s to %s\n", sparse, dump_filename);
+    return EXIT_SUCCESS;
+  }
+
+  if (const std::string mtd = absl::GetFlag(FLAGS_mtd); !mtd.empty()) {
+    return DumpFromMtd(mtd, dump_filename);
+  }
+
+  if (const int trace_events = absl::GetFlag(FLAGS_trace_events);
+      trace_events <= 0) {
+    absl::PrintF("Error: --trace_events must be positive, got %d\n",
+                 trace_events);
+    return EXIT_FAILURE;
+  }
+
+  // A replayed trace stands in for the hardware.
+  std::unique_ptr<TraceReplay> replay;
+  if (const std::string replay_file = absl::GetFlag(FLAGS_replay);
+      !replay_file.empty()) {
+    std::string data;
+    if (!ReadFile(replay_file, data)) {
+      absl::PrintF("Error: Could not read trace from %s.\n", replay_file);
+      return EXIT_FAILURE;
+    }
+    TraceReplay::Options replay_options;
+    replay_options.timing = absl::GetFlag(FLAGS_replay_timing);
+    auto created = TraceReplay::Deserialize(data, replay_options);
+    QCHECK_OK(created.status());
+    replay = std::move(created).value();
+    absl::PrintF("Replaying %d accesses from %s\n", replay->remaining(),
+                 replay_file);
+  }
+  absl::Cleanup replay_checker = [&replay] {
+    if (replay && !replay->status().ok()) {
+      absl::PrintF("Error: Replay diverged from the trace: %s\n",
+                   replay->status().message());
+    }
+  };
+
+  // We need to access the PCI configuration space. Depending on the backend,
+  // this needs root or ring-3 I/O privileges.
+  std::unique_ptr<Pci> hardware_pci;
+  Pci* pci;
+  if (replay) {
+    pci = &replay->pci();
+  } else {
+    auto created = CreatePci(absl::GetFlag(FLAGS_pci_backend));
+    QCHECK_OK(created.status());
+    hardware_pci = std::move(created).value();
+    pci = hardware_pci.get();
+  }
+
+  // The trace is written on every exit, so that failed runs can be examined.
+  std::unique_ptr<TraceRecorder> recorder;
+  std::unique_ptr<Pci> traced_pci;
+  const std::string trace_file = absl::GetFlag(FLAGS_trace);
+  if (!trace_file.empty()) {
+    TraceRecorder::Options trace_options;
+    trace_options.capacity = absl::GetFlag(FLAGS_trace_events);
+    recorder = std::make_unique<TraceRecorder>(trace_options);
+    traced_pci = recorder->TracePci(*pci);
+    pci = traced_pci.get();
+  }
+  absl::Cleanup trace_writer = [&recorder, &trace_file] {
+    if (!recorder) {
+      return;
+    }
+    if (!WriteFile(trace_file, recorder->Serialize())) {
+      absl::PrintF("Error: Could not write trace to %s.\n", trace_file);
+    } else if (recorder->dropped() > 0) {
+      absl::PrintF("Warning: Trace lost the first %d accesses.\n",
+                   recorder->dropped());
+    }
+  };
 
   // Read chipset vendor and device ids as well as the hardware revision. Hint:
   // a vendor id of 0x8086 is "Intel".
@@ -71,24 +627,39 @@ int PawnMain(int argc, char* argv[]) {
   //                   display the device name.
   absl::PrintF("Reading chipset LPC device identification: ");
 
+  // Read each PCI function's configuration space only once. The chipset
+  // invalidates the registers that may change while pawn runs.
+  PciSnapshot pci_snapshot(*pci);
   Chipset::HardwareId hw_id;
-  auto chipset = Chipset::Create(*pci, hw_id);
+  auto chipset = Chipset::Create(pci_snapshot, hw_id);
   // TODO(cblichmann): Deal with Intel's "Compatible Revision Ids". They're
   //                   essentially faking RIDs on boot.
   absl::PrintF("  VID: 0x%04X  DID: 0x%04X  RID: 0x%02X (%d)\n", hw_id.vendor,
                hw_id.device, hw_id.revision, hw_id.revision);
   QCHECK_OK(chipset.status());
+  if (replay) {
+    (*chipset)->set_memory_mapper(replay->memory_mapper());
+  }
+  if (recorder) {
+    (*chipset)->set_memory_mapper(recorder->TraceMemory(
+        replay ? replay->memory_mapper() : Chipset::MemoryMapper()));
+  }
 
   // Map 16KiB of chipset configuration space at the physical address indicated
-  // by the RCBA register into our process. This also requires elevated
-  // privileges.
+  // by the RCBA register into our process. Chipsets without a root complex
+  // (100 Series and later) have their SPI registers in BAR0 of the SPI
+  // controller instead. This also requires elevated privileges.
   auto rcba = (*chipset)->ReadRcbaRegister();
-  // Root Complex Register Block Chipset Register Space
-  absl::PrintF(
-      "Mapping 16KiB chipset configuration space at RCBA = 0x%8X, this may "
-      "fail...\n",
-      rcba.base_address);
-  if (auto status = (*chipset)->MapRootComplex(rcba); !status.ok()) {
+  if (rcba.enable) {
+    // Root Complex Register Block Chipset Register Space
+    absl::PrintF(
+        "Mapping 16KiB chipset configuration space at RCBA = 0x%8X, this may "
+        "fail...\n",
+        rcba.base_address);
+  } else {
+    absl::PrintF("Mapping SPI controller registers, this may fail...\n");
+  }
+  if (auto status = (*chipset)->MapSpiRegisters(); !status.ok()) {
     absl::PrintF(
         "Error: %s\n"
         "       Check if your kernel was compiled with IO_STRICT_DEVMEM=y.\n"
@@ -142,6 +713,14 @@ int PawnMain(int argc, char* argv[]) {
   absl::PrintF("    BIOS Write Enable (BIOSWE):                 %d\n",
                bios_cntl.bios_write_enable);
 
+  if (const std::string snapshot_file = absl::GetFlag(FLAGS_pci_snapshot);
+      !snapshot_file.empty() &&
+      !WriteFile(snapshot_file, pci_snapshot.Serialize())) {
+    absl::PrintF("Error: Could not write PCI snapshot to %s.\n",
+                 snapshot_file);
+    return EXIT_FAILURE;
+  }
+
   absl::PrintF("  Protected Range Registers:\n");
   for (int i = 0; i < ABSL_ARRAYSIZE(regions); ++i) {
     const auto& region = regions[i];
@@ -163,40 +742,243 @@ int PawnMain(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  FILE* dump = fopen(dump_filename, "wb");
-  if (dump == nullptr) {
-    absl::PrintF("Error: Could not open output file for writing.\n");
-    return EXIT_FAILURE;
-  }
-  auto dump_closer = [dump] { fclose(dump); };
-
   enum {
     kBlockSize = 64,
-    kMaxFlash = 16 << 20 /* 16MiB, must be divisible by kBlockSize */
+    // Used if the flash descriptor cannot be read, must be divisible by
+    // kBlockSize.
+    kDefaultFlashSize = 16 << 20 /* 16MiB */
   };
-  absl::PrintF("Reading SPI flash");
-  fflush(STDIN_FILENO);
 
-  auto ssfs = (*chipset)->ReadSsfsRegister();
-  if (ssfs.spi_cycle_in_progress) {
+  if ((*chipset)->SupportsSoftwareSequencing() &&
+      (*chipset)->ReadSsfsRegister().spi_cycle_in_progress) {
     absl::PrintF("Error: SPI flash cycle in progress\n");
     return EXIT_FAILURE;
   }
 
-  QCHECK_OK((*chipset)->ReadSpiWithHardwareSequencing(
-      0 /* Start address */, kMaxFlash, kBlockSize,
-      [&dump](int64_t fla, const char* data) -> bool {
-        if (fla / kBlockSize % 256 == 0) {
-          absl::PrintF(".");
-          fflush(STDIN_FILENO);
-        }
-        if (fwrite(static_cast<const void*>(data), 1 /* Size */, kBlockSize,
-                   dump) != kBlockSize) {
-          LOG(FATAL) << "Could not write " << kBlockSize << " bytes.";
+  CycleWaiter::Options waiter_options = (*chipset)->cycle_waiter().options();
+  waiter_options.deadline = absl::GetFlag(FLAGS_cycle_timeout);
+  (*chipset)->cycle_waiter().set_options(waiter_options);
+
+  // Read the flash descriptor first to learn the actual flash size. Reading
+  // more than that only yields wrapped-around copies. The chipset's copy of
+  // the descriptor is available without any flash cycles.
+  int64_t flash_size = kDefaultFlashSize;
+  auto descriptor = FlashDescriptor::ReadFromChipset(**chipset);
+  if (!descriptor.ok()) {
+    descriptor = ReadFlashDescriptor(**chipset, kBlockSize);
+  }
+  if (descriptor.ok()) {
+    absl::PrintF("Flash descriptor:\n%s", descriptor->ToString());
+    flash_size = descriptor->total_size();
+    if (flash_size > descriptor->max_addressable_size()) {
+      absl::PrintF("Warning: Only the first %d MiB are addressable.\n",
+                   descriptor->max_addressable_size() >> 20);
+      flash_size = descriptor->max_addressable_size();
+    }
+  } else {
+    absl::PrintF("Warning: Could not read flash descriptor: %s\n",
+                 descriptor.status().message());
+  }
+
+  Chipset::FregN fregs[kNumFlashRegions];
+  for (int i = 0; i < ABSL_ARRAYSIZE(regions); ++i) {
+    fregs[i] = regions[i].freg;
+  }
+  ReadPlan::Options plan_options;
+  plan_options.regions = absl::GetFlag(FLAGS_regions);
+  plan_options.offset = absl::GetFlag(FLAGS_offset);
+  plan_options.length = absl::GetFlag(FLAGS_length);
+  plan_options.flash_size = flash_size;
+  plan_options.block_size = kBlockSize;
+  plan_options.frap = frap;
+  for (const auto& region : regions) {
+    plan_options.prs.push_back(region.pr);
+  }
+
+  // Flash linear addresses where the flash components start.
+  std::vector<int64_t> component_bases = {0};
+  if (descriptor.ok()) {
+    for (int i = 1; i < descriptor->num_components(); ++i) {
+      const int64_t base = descriptor->component_base(i);
+      if (base >= flash_size) {
+        break;
+      }
+      component_bases.push_back(base);
+      if (!absl::GetFlag(FLAGS_probe_components)) {
+        continue;
+      }
+      auto result = ComponentProbe::Probe(**chipset, *descriptor, i);
+      QCHECK_OK(result.status());
+      if (*result != ComponentProbe::kPresent) {
+        plan_options.skip.push_back(
+            {absl::StrFormat("component %d (%s)", i,
+                             ComponentProbe::ResultName(*result)),
+             base,
+             std::min(descriptor->component_size(i), flash_size - base)});
+      }
+    }
+  }
+  auto plan = ReadPlan::Create(plan_options, fregs);
+  if (!plan.ok()) {
+    absl::PrintF("Error: %s\n", plan.status().message());
+    return EXIT_FAILURE;
+  }
+
+  SinkGraph graph({});
+  if (auto status =
+          AddSinks(*plan, fregs, dump_filename, flash_size, graph);
+      !status.ok()) {
+    absl::PrintF("Error: %s\n", status.message());
+    return EXIT_FAILURE;
+  }
+
+  // Blocks that hold data read from flash. Blocks that were skipped or ended
+  // in a flash cycle error are holes, filled with 0xFF in the output.
+  BlockBitmap valid_blocks(flash_size, kBlockSize);
+  constexpr int kChunkSize = 256 * kBlockSize;
+
+  // The BIOS region can be copied from its memory-mapped decode window, which
+  // is much faster than hardware sequencing.
+  std::unique_ptr<BiosWindow> bios_window;
+  if (absl::GetFlag(FLAGS_bios_window)) {
+    if (auto window = BiosWindow::Create(**chipset); window.ok()) {
+      bios_window = std::move(window).value();
+      absl::PrintF("BIOS window: 0x%08X - 0x%08X (SPI prefetching: %d)\n",
+                   bios_window->flash_address(),
+                   bios_window->flash_address() + bios_window->size() - 1,
+                   bios_window->prefetch());
+    } else {
+      absl::PrintF("Warning: Not using BIOS window: %s\n",
+                   window.status().message());
+    }
+  }
+
+  // Software sequencing can use Fast Read at a higher clock, but needs more
+  // register accesses per cycle. Which one wins depends on the platform.
+  const std::string read_method = absl::GetFlag(FLAGS_read_method);
+  if (read_method != "auto" && read_method != "hwseq" &&
+      read_method != "swseq") {
+    absl::PrintF("Error: Unknown read method: %s\n", read_method);
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<SoftwareSequencing> swseq;
+  if (read_method != "hwseq") {
+    auto created = SoftwareSequencing::Create(**chipset);
+    absl::Status status = created.status();
+    if (created.ok()) {
+      status = (*created)
+                   ->Probe(descriptor.ok() ? &*descriptor : nullptr)
+                   .status();
+    }
+    if (status.ok()) {
+      swseq = std::move(created).value();
+      absl::PrintF("Software sequencing: JEDEC ID %s, %s\n",
+                   swseq->jedec_id() ? swseq->jedec_id()->ToString()
+                                     : "unknown",
+                   swseq->parameters().ToString());
+    } else if (read_method == "swseq") {
+      absl::PrintF("Error: Software sequencing not available: %s\n",
+                   status.message());
+      return EXIT_FAILURE;
+    } else {
+      absl::PrintF("Warning: Not using software sequencing: %s\n",
+                   status.message());
+    }
+  }
+  if (swseq && read_method == "auto") {
+    // Benchmark on the first chunk that is not read through the window.
+    for (const auto& extent : plan->extents()) {
+      const int size = std::min<int64_t>(kChunkSize, extent.size);
+      if (bios_window && bios_window->Contains(extent.offset, size)) {
+        continue;
+      }
+      auto times = BenchmarkReadMethods(**chipset, *swseq, extent.offset, size,
+                                        kBlockSize);
+      QCHECK_OK(times.status());
+      const bool use_swseq = times->second < times->first;
+      absl::PrintF(
+          "Read method benchmark: hardware sequencing %s, software "
+          "sequencing %s, using %s\n",
+          absl::FormatDuration(times->first),
+          absl::FormatDuration(times->second),
+          use_swseq ? "software sequencing" : "hardware sequencing");
+      if (!use_swseq) {
+        swseq.reset();
+      }
+      break;
+    }
+  }
+
+  Throughput hwseq_throughput{"Hardware sequencing"};
+  Throughput swseq_throughput{"Software sequencing"};
+  Throughput window_throughput{"BIOS window"};
+  Throughput component_throughput[FlashDescriptor::kMaxComponents] = {
+      {"Component 0"}, {"Component 1"}};
+
+  // Chunks must not straddle the window or component boundaries, so that
+  // each is read with a single method and attributed to a single component.
+  std::vector<int64_t> boundaries = component_bases;
+  if (bios_window) {
+    boundaries.push_back(bios_window->flash_address());
+    boundaries.push_back(bios_window->flash_address() + bios_window->size());
+  }
+
+  for (const auto& extent : plan->extents()) {
+    absl::PrintF("Reading %s: 0x%08X - 0x%08X", extent.name, extent.offset,
+                 extent.end() - 1);
+    fflush(STDIN_FILENO);
+    for (int64_t offset = extent.offset, end; offset < extent.end();
+         offset = end) {
+      end = std::min(offset + kChunkSize, extent.end());
+      for (int64_t boundary : boundaries) {
+        if (offset < boundary && end > boundary) {
+          end = boundary;
         }
-        return true;
-      },
-      nullptr /* Ignore block read errors */, [] { absl::PrintF("\n"); }));
+      }
+      const int size = end - offset;
+      std::shared_ptr<BlockSlice> slice =
+          graph.Allocate(offset, size, kBlockSize);
+      const auto data = absl::MakeSpan(slice->data);
+      const auto block_status = absl::MakeSpan(slice->block_status);
+      const absl::Time start = absl::Now();
+      if (bios_window && bios_window->Contains(offset, size)) {
+        bios_window->Read(offset, data);
+        std::fill(block_status.begin(), block_status.end(),
+                  Chipset::kBlockOk);
+        window_throughput.Add(size, absl::Now() - start);
+      } else if (swseq) {
+        QCHECK_OK(swseq->Read(offset, data, kBlockSize, block_status));
+        swseq_throughput.Add(size, absl::Now() - start);
+      } else {
+        QCHECK_OK((*chipset)->ReadSpiWithHardwareSequencing(
+            offset, data, kBlockSize, block_status));
+        hwseq_throughput.Add(size, absl::Now() - start);
+      }
+      const int component =
+          std::upper_bound(component_bases.begin(), component_bases.end(),
+                           offset) -
+          component_bases.begin() - 1;
+      component_throughput[component].Add(size, absl::Now() - start);
+      MarkValidBlocks(*slice, valid_blocks);
+      graph.Publish(std::move(slice));
+      absl::PrintF(".");
+      fflush(STDIN_FILENO);
+    }
+    absl::PrintF("\n");
+  }
+  hwseq_throughput.Print();
+  swseq_throughput.Print();
+  window_throughput.Print();
+  if (component_bases.size() > 1) {
+    for (const auto& throughput : component_throughput) {
+      throughput.Print();
+    }
+  }
+  if (!FinishDumps(*plan, valid_blocks, kBlockSize, graph)) {
+    return EXIT_FAILURE;
+  }
+  absl::PrintF("Flash cycle latency: %s",
+               (*chipset)->cycle_waiter().histogram().ToString());
   return EXIT_SUCCESS;
 }
 
@@ -14,10 +14,13 @@
 
 #include <sys/io.h>  // iopl(), inb(), inw(), inl(), outl()
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "pawn/pci.h"
 
 namespace security::pawn {
@@ -60,7 +63,7 @@ enum {
 };
 
 #define DEFINE_READCONFIGUINT(read_config, int_type, in_call)                  \
-  int_type read_config(uint32_t config_address) {                              \
+  int_type Pci::read_config(uint32_t config_address) {                         \
     /* Do not touch reserved bits. */                                          \
     uint32_t reserved_bits = inl(kConfigAddress) & 0x7F000000;                 \
     outl(config_address | reserved_bits, kConfigAddress);                      \
@@ -72,13 +75,21 @@ enum {
                    (config_address & (sizeof(uint32_t) - sizeof(int_type))));  \
   }                                                                            \
                                                                                \
-  int_type read_config(int bus, int device, int function, int offset) {        \
+  int_type Pci::read_config(int bus, int device, int function, int offset) {   \
+    /* Unqualified, so that this dispatches to the backend in use. */          \
     return read_config(pci::MakeConfigAddress(bus, device, function, offset)); \
   }
 
-DEFINE_READCONFIGUINT(Pci::ReadConfigUint8, uint8_t, inb);
-DEFINE_READCONFIGUINT(Pci::ReadConfigUint16, uint16_t, inw);
-DEFINE_READCONFIGUINT(Pci::ReadConfigUint32, uint32_t, inl);
+DEFINE_READCONFIGUINT(ReadConfigUint8, uint8_t, inb);
+DEFINE_READCONFIGUINT(ReadConfigUint16, uint16_t, inw);
+DEFINE_READCONFIGUINT(ReadConfigUint32, uint32_t, inl);
 #undef DEFINE_READCONFIGUINT
 
+void Pci::ReadConfigBlock(uint32_t config_address, absl::Span<uint8_t> data) {
+  for (size_t i = 0; i < data.size(); i += sizeof(uint32_t)) {
+    const uint32_t value = ReadConfigUint32(config_address + i);
+    std::memcpy(&data[i], &value, std::min(sizeof(value), data.size() - i));
+  }
+}
+
 }  // namespace security::pawn
@@ -23,6 +23,7 @@
 #include <memory>
 
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 #include "pawn/bits.h"
 
 namespace security::pawn {
@@ -70,20 +71,34 @@ class Pci {
   Pci(Pci&& other);
   Pci& operator=(Pci&& other);
 
-  ~Pci();
+  virtual ~Pci();
 
   static absl::StatusOr<Pci> Create();
 
   uint8_t ReadConfigUint8(int bus, int device, int function, int offset);
-  uint8_t ReadConfigUint8(uint32_t config_address);
+  virtual uint8_t ReadConfigUint8(uint32_t config_address);
   uint16_t ReadConfigUint16(int bus, int device, int function, int offset);
-  uint16_t ReadConfigUint16(uint32_t config_address);
+  virtual uint16_t ReadConfigUint16(uint32_t config_address);
   uint32_t ReadConfigUint32(int bus, int device, int function, int offset);
-  uint32_t ReadConfigUint32(uint32_t config_address);
+  virtual uint32_t ReadConfigUint32(uint32_t config_address);
 
- private:
+  // Reads data.size() bytes of a single function's configuration space,
+  // starting at the 32-bit aligned config_address. Backends override this if
+  // they can do so in one go.
+  virtual void ReadConfigBlock(uint32_t config_address,
+                               absl::Span<uint8_t> data);
+
+  // Tells caching backends that size bytes starting at config_address may
+  // have changed and need to be read again. Does nothing by default.
+  virtual void Invalidate(uint32_t /*config_address*/, int /*size*/) {}
+
+ protected:
+  // Allows subclasses to provide the configuration space by other means, for
+  // example by simulating a device.
   Pci() = default;
 
+ private:
+
   bool iopl_done_ = false;
 };
 
@@ -0,0 +1,147 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_ecam.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "pawn/bits.h"
+
+namespace security::pawn {
+namespace {
+
+// Layout of the MCFG table, see the PCI Firmware Specification 3.0, Page 42.
+enum {
+  kMcfgLengthOffset = 4,        // Length of the whole table (32-bit)
+  kMcfgAllocationsOffset = 44,  // After the header and 8 reserved bytes
+  kMcfgAllocationSize = 16,
+  // Offsets within a configuration space base address allocation structure.
+  kAllocationBaseOffset = 0,       // Base Address (64-bit)
+  kAllocationSegmentOffset = 8,    // PCI Segment Group Number (16-bit)
+  kAllocationStartBusOffset = 10,  // Start Bus Number (8-bit)
+  kAllocationEndBusOffset = 11,    // End Bus Number (8-bit)
+};
+
+template <typename IntT>
+IntT Load(absl::string_view data, int offset) {
+  IntT value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+absl::StatusOr<uint64_t> EcamPci::FindEcamBase(absl::string_view mcfg) {
+  if (mcfg.size() < kMcfgAllocationsOffset || mcfg.substr(0, 4) != "MCFG") {
+    return absl::FailedPreconditionError("Invalid MCFG table");
+  }
+  uint32_t length = Load<uint32_t>(mcfg, kMcfgLengthOffset);
+  if (length > mcfg.size()) {
+    return absl::FailedPreconditionError("Truncated MCFG table");
+  }
+  for (uint32_t offset = kMcfgAllocationsOffset;
+       offset + kMcfgAllocationSize <= length;
+       offset += kMcfgAllocationSize) {
+    if (Load<uint16_t>(mcfg, offset + kAllocationSegmentOffset) == 0 &&
+        Load<uint8_t>(mcfg, offset + kAllocationStartBusOffset) == 0) {
+      // Bus 0 is at the very start of the allocation.
+      return Load<uint64_t>(mcfg, offset + kAllocationBaseOffset);
+    }
+  }
+  return absl::NotFoundError("No ECAM window for bus 0 in MCFG table");
+}
+
+absl::StatusOr<std::unique_ptr<EcamPci>> EcamPci::Create(
+    const Options& options) {
+  std::ifstream file(options.mcfg_path, std::ios::binary);
+  if (!file) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Could not open ", options.mcfg_path,
+                     ". Make sure this process runs as root."));
+  }
+  std::string mcfg(std::istreambuf_iterator<char>(file), {});
+  auto base = FindEcamBase(mcfg);
+  if (!base.ok()) {
+    return base.status();
+  }
+
+  auto bus0 = options.memory_mapper
+                  ? options.memory_mapper(*base, kBusSize)
+                  : PhysicalMemory::Create(*base, kBusSize);
+  if (!bus0.ok()) {
+    return absl::Status(
+        bus0.status().code(),
+        absl::StrFormat("Could not map ECAM window at 0x%08X: %s", *base,
+                        bus0.status().message()));
+  }
+  return std::unique_ptr<EcamPci>(new EcamPci(*std::move(bus0)));
+}
+
+EcamPci::EcamPci(std::unique_ptr<PhysicalMemory> bus0)
+    : bus0_(std::move(bus0)),
+      mmio_(static_cast<volatile uint8_t*>(bus0_->MmioBase())) {}
+
+int EcamPci::EcamOffset(uint32_t config_address) {
+  if (bits::Value<23, 16>(config_address) != 0) {
+    return -1;
+  }
+  // Device and function numbers directly precede the register offset, so
+  // this moves them from bits 15-8 to bits 19-12.
+  return bits::Value<15, 8>(config_address) << 12 |
+         bits::Value<7, 0>(config_address);
+}
+
+template <typename IntT>
+IntT EcamPci::Read(uint32_t config_address) {
+  // ECAM supports naturally aligned accesses of 1, 2 and 4 bytes.
+  int offset =
+      EcamOffset(config_address & ~static_cast<uint32_t>(sizeof(IntT) - 1));
+  if (offset < 0) {
+    return static_cast<IntT>(~IntT{0});
+  }
+  if (mmio_) {
+    return *reinterpret_cast<volatile IntT*>(mmio_ + offset);
+  }
+  if constexpr (sizeof(IntT) == 1) {
+    return bus0_->ReadUint8(offset);
+  } else if constexpr (sizeof(IntT) == 2) {
+    return bus0_->ReadUint16(offset);
+  } else {
+    return bus0_->ReadUint32(offset);
+  }
+}
+
+uint8_t EcamPci::ReadConfigUint8(uint32_t config_address) {
+  return Read<uint8_t>(config_address);
+}
+
+uint16_t EcamPci::ReadConfigUint16(uint32_t config_address) {
+  return Read<uint16_t>(config_address);
+}
+
+uint32_t EcamPci::ReadConfigUint32(uint32_t config_address) {
+  return Read<uint32_t>(config_address);
+}
+
+}  // namespace security::pawn
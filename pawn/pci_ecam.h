@@ -0,0 +1,89 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_PCI_ECAM_H_
+#define PAWN_PCI_ECAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+
+// Accesses the PCI configuration space through the memory-mapped Enhanced
+// Configuration Access Mechanism (ECAM, also known as MMCONFIG). Unlike the
+// I/O port mechanism, a configuration read is a single memory load, needs no
+// I/O privileges and does not race against other users of ports CF8/CFC.
+// Only bus 0 is mapped, which holds all the chipset devices pawn uses. Reads
+// from other buses return all ones, like reads from absent devices do.
+class EcamPci : public Pci {
+ public:
+  // Location of the ACPI table that describes the ECAM windows.
+  static constexpr char kMcfgPath[] = "/sys/firmware/acpi/tables/MCFG";
+
+  // Size of the configuration space of a single bus.
+  static constexpr size_t kBusSize = 1 << 20;  // 1MiB
+
+  using MemoryMapper =
+      std::function<absl::StatusOr<std::unique_ptr<PhysicalMemory>>(
+          uintptr_t physical_address, size_t length)>;
+
+  struct Options {
+    std::string mcfg_path = kMcfgPath;
+
+    // Maps the ECAM window of bus 0. Uses PhysicalMemory::Create() if unset.
+    MemoryMapper memory_mapper;
+  };
+
+  // Returns the physical address of the configuration space of bus 0 in PCI
+  // segment group 0, as described by the raw ACPI MCFG table in mcfg.
+  static absl::StatusOr<uint64_t> FindEcamBase(absl::string_view mcfg);
+
+  static absl::StatusOr<std::unique_ptr<EcamPci>> Create(
+      const Options& options);
+  static absl::StatusOr<std::unique_ptr<EcamPci>> Create() {
+    return Create(Options());
+  }
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+  uint8_t ReadConfigUint8(uint32_t config_address) override;
+  uint16_t ReadConfigUint16(uint32_t config_address) override;
+  uint32_t ReadConfigUint32(uint32_t config_address) override;
+
+ private:
+  explicit EcamPci(std::unique_ptr<PhysicalMemory> bus0);
+
+  // Returns the offset of config_address within the mapped bus, or -1 if it
+  // addresses a different bus.
+  static int EcamOffset(uint32_t config_address);
+
+  template <typename IntT>
+  IntT Read(uint32_t config_address);
+
+  std::unique_ptr<PhysicalMemory> bus0_;
+  volatile uint8_t* mmio_;  // Direct access to bus0_, if available
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_PCI_ECAM_H_
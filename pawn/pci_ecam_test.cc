@@ -0,0 +1,147 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_ecam.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsTrue;
+
+constexpr uint64_t kEcamBase = 0xE0000000;
+
+template <typename IntT>
+void Put(std::string& data, int offset, IntT value) {
+  std::memcpy(&data[offset], &value, sizeof(value));
+}
+
+// Returns an MCFG table with an allocation for segment group 1 followed by
+// one for buses 0-255 of segment group 0.
+std::string MakeMcfg() {
+  std::string mcfg(44 + 2 * 16, '\0');
+  mcfg.replace(0, 4, "MCFG");
+  Put<uint32_t>(mcfg, 4, mcfg.size());
+  Put<uint64_t>(mcfg, 44, 0xD0000000);
+  Put<uint16_t>(mcfg, 44 + 8, 1);
+  Put<uint64_t>(mcfg, 60, kEcamBase);
+  Put<uint8_t>(mcfg, 60 + 11, 0xFF);
+  return mcfg;
+}
+
+TEST(EcamPciTest, FindsBus0OfSegmentGroup0) {
+  auto base = EcamPci::FindEcamBase(MakeMcfg());
+  ASSERT_THAT(base.ok(), IsTrue());
+  EXPECT_THAT(*base, Eq(kEcamBase));
+}
+
+TEST(EcamPciTest, RejectsInvalidTables) {
+  std::string mcfg = MakeMcfg();
+  EXPECT_THAT(EcamPci::FindEcamBase(mcfg.substr(0, 40)).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+  EXPECT_THAT(EcamPci::FindEcamBase(mcfg.substr(0, 60)).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+
+  std::string wrong_signature = mcfg;
+  wrong_signature[0] = 'X';
+  EXPECT_THAT(EcamPci::FindEcamBase(wrong_signature).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+
+  std::string no_segment_0 = mcfg;
+  Put<uint32_t>(no_segment_0, 4, 60);  // Drop the second allocation
+  EXPECT_THAT(EcamPci::FindEcamBase(no_segment_0).status().code(),
+              Eq(absl::StatusCode::kNotFound));
+}
+
+class EcamPciReadTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    // LPC device (B0:D31:F0) and SPI function (B0:D31:F5) of a Q170.
+    bus0_.assign(EcamPci::kBusSize, '\xFF');
+    int lpc = 31 << 15 | 0 << 12;
+    bus0_.replace(lpc, 256, 256, '\0');
+    Put<uint16_t>(bus0_, lpc + 0x00, 0x8086);
+    Put<uint16_t>(bus0_, lpc + 0x02, 0xA146);
+    Put<uint8_t>(bus0_, lpc + 0x08, 0x31);
+    int spi = 31 << 15 | 5 << 12;
+    bus0_.replace(spi, 256, 256, '\0');
+    Put<uint32_t>(bus0_, spi + 0xDC, 0x000000A8);
+
+    mcfg_path_ = ::testing::TempDir() + "/pci_ecam_test_MCFG";
+    std::string mcfg = MakeMcfg();
+    std::ofstream(mcfg_path_, std::ios::binary).write(mcfg.data(), mcfg.size());
+  }
+
+  std::string bus0_;
+  std::string mcfg_path_;
+};
+
+TEST_P(EcamPciReadTest, ReadsConfigurationSpace) {
+  uintptr_t mapped_address = 0;
+  size_t mapped_length = 0;
+  EcamPci::Options options;
+  options.mcfg_path = mcfg_path_;
+  options.memory_mapper = [&](uintptr_t physical_address, size_t length)
+      -> absl::StatusOr<std::unique_ptr<PhysicalMemory>> {
+    mapped_address = physical_address;
+    mapped_length = length;
+    return std::make_unique<BufferMemory>(
+        absl::MakeSpan(reinterpret_cast<uint8_t*>(bus0_.data()), bus0_.size()),
+        GetParam());
+  };
+  auto pci = EcamPci::Create(options);
+  ASSERT_THAT(pci.status().ok(), IsTrue());
+  EXPECT_THAT(mapped_address, Eq(kEcamBase));
+  EXPECT_THAT(mapped_length, Eq(EcamPci::kBusSize));
+
+  EXPECT_THAT((*pci)->ReadConfigUint16(pci::kVidRegister), Eq(0x8086));
+  EXPECT_THAT((*pci)->ReadConfigUint16(pci::kDidRegister), Eq(0xA146));
+  EXPECT_THAT((*pci)->ReadConfigUint8(pci::kRidRegister), Eq(0x31));
+  EXPECT_THAT((*pci)->ReadConfigUint32(pci::kVidRegister), Eq(0xA1468086));
+  EXPECT_THAT((*pci)->ReadConfigUint8(0, 31, 5, 0xDC), Eq(0xA8));
+  EXPECT_THAT((*pci)->ReadConfigUint32(0, 31, 5, 0xDC), Eq(0x000000A8));
+
+  // Absent device and a bus that is not mapped.
+  EXPECT_THAT((*pci)->ReadConfigUint16(0, 30, 0, 0x00), Eq(0xFFFF));
+  EXPECT_THAT((*pci)->ReadConfigUint32(1, 0, 0, 0x00), Eq(0xFFFFFFFF));
+}
+
+INSTANTIATE_TEST_SUITE_P(DirectAndIndirect, EcamPciReadTest,
+                         ::testing::Bool());
+
+TEST(EcamPciCreateTest, FailsWithoutMcfg) {
+  EcamPci::Options options;
+  options.mcfg_path = ::testing::TempDir() + "/pci_ecam_test_missing";
+  EXPECT_THAT(EcamPci::Create(options).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+}  // namespace security::pawn
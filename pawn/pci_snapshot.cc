@@ -0,0 +1,208 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_snapshot.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/types/span.h"
+#include "pawn/bits.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr int kBytesPerLine = 16;
+
+constexpr uint32_t FunctionAddress(uint32_t config_address) {
+  return config_address & ~uint32_t{0xFF};
+}
+
+// Parses "BB:DD.F", optionally preceded by a "DDDD:" domain as printed by
+// "lspci -D". Returns 0 on error.
+uint32_t ParseFunction(absl::string_view text) {
+  std::vector<absl::string_view> parts = absl::StrSplit(text, ':');
+  if (parts.size() == 3) {
+    if (parts[0] != "0000") {
+      return 0;  // Only PCI segment group 0 is supported
+    }
+    parts.erase(parts.begin());
+  }
+  std::pair<absl::string_view, absl::string_view> device_function =
+      absl::StrSplit(parts.back(), absl::MaxSplits('.', 1));
+  int bus;
+  int device;
+  int function;
+  if (parts.size() != 2 || !absl::SimpleHexAtoi(parts[0], &bus) ||
+      !absl::SimpleHexAtoi(device_function.first, &device) ||
+      !absl::SimpleHexAtoi(device_function.second, &function) || bus > 0xFF ||
+      device > 31 || function > 7) {
+    return 0;
+  }
+  return pci::MakeConfigAddress(bus, device, function, 0);
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<PciSnapshot>> PciSnapshot::Deserialize(
+    absl::string_view text) {
+  std::unique_ptr<PciSnapshot> snapshot(new PciSnapshot());
+  Function* current = nullptr;
+  int line_number = 0;
+  for (absl::string_view line : absl::StrSplit(text, '\n')) {
+    ++line_number;
+    line = absl::StripAsciiWhitespace(line);
+    if (line.empty()) {
+      continue;
+    }
+    auto error = [line_number](absl::string_view message) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Line ", line_number, ": ", message));
+    };
+    const absl::string_view first_word = line.substr(0, line.find(' '));
+    if (first_word.find('.') != absl::string_view::npos) {
+      // Start of a new function, lspci adds a description after the address.
+      uint32_t address = ParseFunction(first_word);
+      if (address == 0) {
+        return error("Invalid function address");
+      }
+      current = &snapshot->functions_[address];
+      current->data.fill(0xFF);
+      continue;
+    }
+    int offset;
+    if (!absl::SimpleHexAtoi(absl::StripSuffix(first_word, ":"), &offset) ||
+        first_word.back() != ':' || offset % kBytesPerLine != 0 ||
+        offset >= kConfigSize) {
+      return error("Expected a function address or an offset");
+    }
+    if (current == nullptr) {
+      return error("Data before the first function address");
+    }
+    std::vector<absl::string_view> bytes =
+        absl::StrSplit(line.substr(first_word.size()), ' ', absl::SkipEmpty());
+    if (bytes.size() > kBytesPerLine) {
+      return error("Too many bytes");
+    }
+    for (int i = 0; i < bytes.size(); ++i) {
+      int value;
+      if (!absl::SimpleHexAtoi(bytes[i], &value) || value > 0xFF) {
+        return error("Invalid byte");
+      }
+      current->data[offset + i] = value;
+    }
+  }
+  return snapshot;  // GCC 7 needs the extra move
+}
+
+std::string PciSnapshot::Serialize() const {
+  std::string text;
+  for (const auto& [address, function] : functions_) {
+    uint16_t vendor;
+    std::memcpy(&vendor, function.data.data(), sizeof(vendor));
+    if (vendor == 0xFFFF) {
+      continue;  // Not present
+    }
+    if (!text.empty()) {
+      text += "\n";
+    }
+    absl::StrAppendFormat(&text, "%02x:%02x.%x\n",
+                          bits::Value<23, 16>(address),
+                          bits::Value<15, 11>(address),
+                          bits::Value<10, 8>(address));
+    for (int offset = 0; offset < kConfigSize; offset += kBytesPerLine) {
+      absl::StrAppendFormat(&text, "%02x:", offset);
+      for (int i = 0; i < kBytesPerLine; ++i) {
+        absl::StrAppendFormat(&text, " %02x", function.data[offset + i]);
+      }
+      text += "\n";
+    }
+  }
+  return text;
+}
+
+void PciSnapshot::Invalidate(uint32_t config_address, int size) {
+  if (source_ == nullptr) {
+    return;
+  }
+  auto it = functions_.find(FunctionAddress(config_address));
+  if (it == functions_.end()) {
+    return;
+  }
+  const int offset = bits::Value<7, 0>(config_address);
+  const int last = std::min(offset + size, kConfigSize) - 1;
+  for (int reg = offset / 4; reg <= last / 4; ++reg) {
+    it->second.stale |= uint64_t{1} << reg;
+  }
+}
+
+PciSnapshot::Function* PciSnapshot::Capture(uint32_t config_address) {
+  const uint32_t address = FunctionAddress(config_address);
+  auto it = functions_.find(address);
+  if (it != functions_.end()) {
+    return &it->second;
+  }
+  if (source_ == nullptr) {
+    return nullptr;
+  }
+  Function& function = functions_[address];
+  source_->ReadConfigBlock(address, absl::MakeSpan(function.data));
+  return &function;
+}
+
+template <typename IntT>
+IntT PciSnapshot::Read(uint32_t config_address) {
+  Function* function = Capture(config_address);
+  if (function == nullptr) {
+    return static_cast<IntT>(~IntT{0});
+  }
+  // Like the hardware, only do naturally aligned accesses.
+  const int offset = bits::Value<7, 0>(config_address) & ~(sizeof(IntT) - 1);
+  const int reg = offset / 4;
+  if (function->stale & uint64_t{1} << reg) {
+    const uint32_t value = source_->ReadConfigUint32(
+        FunctionAddress(config_address) | reg * 4);
+    std::memcpy(&function->data[reg * 4], &value, sizeof(value));
+    function->stale &= ~(uint64_t{1} << reg);
+  }
+  IntT value;
+  std::memcpy(&value, &function->data[offset], sizeof(value));
+  return value;
+}
+
+uint8_t PciSnapshot::ReadConfigUint8(uint32_t config_address) {
+  return Read<uint8_t>(config_address);
+}
+
+uint16_t PciSnapshot::ReadConfigUint16(uint32_t config_address) {
+  return Read<uint16_t>(config_address);
+}
+
+uint32_t PciSnapshot::ReadConfigUint32(uint32_t config_address) {
+  return Read<uint32_t>(config_address);
+}
+
+}  // namespace security::pawn
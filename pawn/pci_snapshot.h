@@ -0,0 +1,92 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_PCI_SNAPSHOT_H_
+#define PAWN_PCI_SNAPSHOT_H_
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// Caches the PCI configuration space of the functions that are accessed
+// through it. The first access to a function reads its whole configuration
+// space from the source in one go, later accesses are served from the
+// snapshot. Registers that can change, like BIOS_CNTL, need to be invalidated
+// explicitly to be read again.
+// Snapshots can be serialized to, and restored from, the text format of
+// "lspci -xxx". A restored snapshot has no source, so that chipsets can be
+// inspected without touching hardware.
+class PciSnapshot : public Pci {
+ public:
+  // Size of the captured configuration space per function. This is what is
+  // reachable through I/O ports CF8/CFC.
+  static constexpr int kConfigSize = 256;
+
+  // Captures from source, which must outlive this instance.
+  explicit PciSnapshot(Pci& source) : source_(&source) {}
+
+  // Restores a snapshot from the output of Serialize() or of "lspci -xxx".
+  // Bytes that are missing, for example because lspci only showed the
+  // standard header, read as all ones.
+  static absl::StatusOr<std::unique_ptr<PciSnapshot>> Deserialize(
+      absl::string_view text);
+
+  // Returns the captured configuration space of all present functions.
+  // Invalidated registers keep their last captured value.
+  std::string Serialize() const;
+
+  // Marks size bytes starting at config_address for re-reading on their next
+  // access. Has no effect on restored snapshots.
+  void Invalidate(uint32_t config_address, int size) override;
+  // Forgets all captured functions.
+  void InvalidateAll() { functions_.clear(); }
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+  uint8_t ReadConfigUint8(uint32_t config_address) override;
+  uint16_t ReadConfigUint16(uint32_t config_address) override;
+  uint32_t ReadConfigUint32(uint32_t config_address) override;
+
+ private:
+  struct Function {
+    std::array<uint8_t, kConfigSize> data;
+    uint64_t stale = 0;  // One bit per 32-bit register
+  };
+
+  PciSnapshot() = default;
+
+  // Returns the captured function addressed by config_address, capturing it
+  // first if needed. Returns nullptr if there is nothing to capture from.
+  Function* Capture(uint32_t config_address);
+
+  template <typename IntT>
+  IntT Read(uint32_t config_address);
+
+  Pci* source_ = nullptr;
+  // Keyed by the function's configuration address at offset 0
+  std::map<uint32_t, Function> functions_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_PCI_SNAPSHOT_H_
@@ -0,0 +1,201 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_snapshot.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "absl/status/status.h"
+#include "pawn/chipset.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr uint32_t kBiosCntlRegister = pci::MakeConfigAddress(0, 31, 0, 0xDC);
+
+// Provides the LPC device of a Q87 and counts configuration space accesses.
+class FakePci : public Pci {
+ public:
+  FakePci() {
+    lpc_.fill(0);
+    Put<uint16_t>(0x00, 0x8086);
+    Put<uint16_t>(0x02, 0x8C4E);
+    Put<uint8_t>(0x08, 0x05);
+    Put<uint8_t>(0xDC, 0x08);
+  }
+
+  template <typename IntT>
+  void Put(int offset, IntT value) {
+    std::memcpy(&lpc_[offset], &value, sizeof(value));
+  }
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+  uint8_t ReadConfigUint8(uint32_t config_address) override {
+    return Read<uint8_t>(config_address);
+  }
+  uint16_t ReadConfigUint16(uint32_t config_address) override {
+    return Read<uint16_t>(config_address);
+  }
+  uint32_t ReadConfigUint32(uint32_t config_address) override {
+    return Read<uint32_t>(config_address);
+  }
+
+  int reads() const { return reads_; }
+
+ private:
+  template <typename IntT>
+  IntT Read(uint32_t config_address) {
+    ++reads_;
+    if ((config_address & ~0xFFu) != pci::MakeConfigAddress(0, 31, 0, 0)) {
+      return static_cast<IntT>(~IntT{0});
+    }
+    IntT value;
+    std::memcpy(&value, &lpc_[config_address & 0xFF], sizeof(value));
+    return value;
+  }
+
+  std::array<uint8_t, PciSnapshot::kConfigSize> lpc_;
+  int reads_ = 0;
+};
+
+TEST(PciSnapshotTest, CapturesFunctionOnce) {
+  FakePci source;
+  PciSnapshot snapshot(source);
+
+  EXPECT_THAT(snapshot.ReadConfigUint16(pci::kVidRegister), Eq(0x8086));
+  const int capture_reads = source.reads();
+  EXPECT_THAT(capture_reads, Eq(PciSnapshot::kConfigSize / 4));
+
+  EXPECT_THAT(snapshot.ReadConfigUint16(pci::kDidRegister), Eq(0x8C4E));
+  EXPECT_THAT(snapshot.ReadConfigUint8(pci::kRidRegister), Eq(0x05));
+  EXPECT_THAT(snapshot.ReadConfigUint32(kBiosCntlRegister), Eq(0x08));
+  EXPECT_THAT(source.reads(), Eq(capture_reads));
+}
+
+TEST(PciSnapshotTest, RereadsInvalidatedRegisters) {
+  FakePci source;
+  PciSnapshot snapshot(source);
+  EXPECT_THAT(snapshot.ReadConfigUint8(kBiosCntlRegister), Eq(0x08));
+
+  source.Put<uint8_t>(0xDC, 0x09);
+  source.Put<uint8_t>(0x08, 0x06);
+  EXPECT_THAT(snapshot.ReadConfigUint8(kBiosCntlRegister), Eq(0x08));
+
+  const int reads = source.reads();
+  snapshot.Invalidate(kBiosCntlRegister, 1);
+  EXPECT_THAT(snapshot.ReadConfigUint8(kBiosCntlRegister), Eq(0x09));
+  EXPECT_THAT(snapshot.ReadConfigUint8(kBiosCntlRegister), Eq(0x09));
+  EXPECT_THAT(source.reads(), Eq(reads + 1));
+  // Others stay as captured.
+  EXPECT_THAT(snapshot.ReadConfigUint8(pci::kRidRegister), Eq(0x05));
+
+  snapshot.InvalidateAll();
+  EXPECT_THAT(snapshot.ReadConfigUint8(pci::kRidRegister), Eq(0x06));
+}
+
+TEST(PciSnapshotTest, ChipsetRereadsBiosCntl) {
+  FakePci source;
+  PciSnapshot snapshot(source);
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create(snapshot, hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  EXPECT_THAT((*chipset)->ReadBiosCntlRegister().bios_write_enable,
+              IsFalse());
+
+  source.Put<uint8_t>(0xDC, 0x09);  // BIOSWE
+  EXPECT_THAT((*chipset)->ReadBiosCntlRegister().bios_write_enable, IsTrue());
+  // Other registers stay as captured.
+  source.Put<uint8_t>(0x08, 0x06);
+  EXPECT_THAT(snapshot.ReadConfigUint8(pci::kRidRegister), Eq(0x05));
+}
+
+TEST(PciSnapshotTest, ReturnsAllOnesForAbsentFunctions) {
+  FakePci source;
+  PciSnapshot snapshot(source);
+  EXPECT_THAT(snapshot.ReadConfigUint16(0, 30, 0, 0x00), Eq(0xFFFF));
+  // Absent functions are not serialized.
+  EXPECT_THAT(snapshot.Serialize(), Eq(""));
+}
+
+TEST(PciSnapshotTest, RoundTripsWithoutSource) {
+  FakePci source;
+  PciSnapshot snapshot(source);
+  snapshot.ReadConfigUint16(pci::kVidRegister);
+  const std::string text = snapshot.Serialize();
+  EXPECT_THAT(text, HasSubstr("00:1f.0\n00: 86 80 4e 8c 00 00"));
+
+  auto restored = PciSnapshot::Deserialize(text);
+  ASSERT_THAT(restored.status().ok(), IsTrue());
+  EXPECT_THAT((*restored)->Serialize(), Eq(text));
+  EXPECT_THAT((*restored)->ReadConfigUint8(kBiosCntlRegister), Eq(0x08));
+  // Nothing to capture from.
+  EXPECT_THAT((*restored)->ReadConfigUint8(0, 31, 3, 0x00), Eq(0xFF));
+
+  // Chipsets can be identified without touching hardware.
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create(**restored, hw_id);
+  ASSERT_THAT(chipset.status().ok(), IsTrue());
+  EXPECT_THAT(hw_id.device, Eq(0x8C4E));
+  EXPECT_THAT(hw_id.revision, Eq(0x05));
+}
+
+TEST(PciSnapshotTest, ParsesLspciOutput) {
+  auto snapshot = PciSnapshot::Deserialize(
+      "0000:00:1f.0 ISA bridge: Intel Corporation Q87 Express LPC "
+      "Controller (rev 05)\n"
+      "00: 86 80 4e 8c 07 00 10 02 05 00 01 06 00 00 80 00\n"
+      "10: 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00\n"
+      "\n"
+      "00:1f.3 SMBus: Intel Corporation 8 Series/C220 Series SMBus "
+      "Controller (rev 05)\n"
+      "00: 86 80 22 8c 03 00 80 02 05 00 05 0c 00 00 00 00\n");
+  ASSERT_THAT(snapshot.status().ok(), IsTrue());
+  EXPECT_THAT((*snapshot)->ReadConfigUint16(pci::kDidRegister), Eq(0x8C4E));
+  EXPECT_THAT((*snapshot)->ReadConfigUint32(0, 31, 0, 0x10), Eq(0));
+  EXPECT_THAT((*snapshot)->ReadConfigUint32(kBiosCntlRegister),
+              Eq(0xFFFFFFFF));
+  EXPECT_THAT((*snapshot)->ReadConfigUint16(0, 31, 3, 0x02), Eq(0x8C22));
+}
+
+TEST(PciSnapshotTest, RejectsMalformedText) {
+  for (const char* text : {
+           "00: 86 80\n",                // Data before any function
+           "00:1f.0\n01: 86 80\n",       // Unaligned offset
+           "00:1f.0\n00: 86 800\n",      // Invalid byte
+           "00:1f.0\n100: 00\n",         // Offset out of range
+           "00:2f.0\n00: 86 80\n",       // Invalid device
+           "0001:00:1f.0\n00: 86 80\n",  // Other segment group
+       }) {
+    EXPECT_THAT(PciSnapshot::Deserialize(text).status().code(),
+                Eq(absl::StatusCode::kInvalidArgument))
+        << text;
+  }
+}
+
+}  // namespace
+}  // namespace security::pawn
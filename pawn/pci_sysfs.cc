@@ -0,0 +1,102 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_sysfs.h"
+
+#include <fcntl.h>   // open()
+#include <unistd.h>  // close(), pread()
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "pawn/bits.h"
+
+namespace security::pawn {
+
+SysfsPci::~SysfsPci() {
+  for (const auto& [bdf, fd] : config_files_) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+absl::StatusOr<std::unique_ptr<SysfsPci>> SysfsPci::Create(
+    const std::string& devices_path) {
+  std::unique_ptr<SysfsPci> pci(new SysfsPci(devices_path));
+  if (pci->ConfigFile(pci::kVidRegister) == -1) {
+    return absl::NotFoundError(
+        absl::StrCat("No LPC device configuration space in ", devices_path));
+  }
+  return pci;  // GCC 7 needs the extra move
+}
+
+int SysfsPci::ConfigFile(uint32_t config_address) {
+  const uint32_t bdf = bits::Value<23, 8>(config_address);
+  auto [it, inserted] = config_files_.try_emplace(bdf, -1);
+  if (inserted) {
+    // Only PCI segment group 0 is supported, like with the I/O ports.
+    it->second = open(absl::StrFormat("%s/0000:%02x:%02x.%x/config",
+                                      devices_path_, bdf >> 8,
+                                      bits::Value<7, 3>(bdf),
+                                      bits::Value<2, 0>(bdf))
+                          .c_str(),
+                      O_RDONLY | O_CLOEXEC);
+  }
+  return it->second;
+}
+
+template <typename IntT>
+IntT SysfsPci::Read(uint32_t config_address) {
+  IntT value;
+  int fd = ConfigFile(config_address);
+  if (fd == -1 ||
+      pread(fd, &value, sizeof(value), bits::Value<7, 0>(config_address)) !=
+          static_cast<ssize_t>(sizeof(value))) {
+    return static_cast<IntT>(~IntT{0});
+  }
+  return value;
+}
+
+uint8_t SysfsPci::ReadConfigUint8(uint32_t config_address) {
+  return Read<uint8_t>(config_address);
+}
+
+uint16_t SysfsPci::ReadConfigUint16(uint32_t config_address) {
+  return Read<uint16_t>(config_address);
+}
+
+uint32_t SysfsPci::ReadConfigUint32(uint32_t config_address) {
+  return Read<uint32_t>(config_address);
+}
+
+void SysfsPci::ReadConfigBlock(uint32_t config_address,
+                               absl::Span<uint8_t> data) {
+  ssize_t bytes_read = 0;
+  if (int fd = ConfigFile(config_address); fd != -1) {
+    bytes_read = std::max<ssize_t>(
+        pread(fd, data.data(), data.size(), bits::Value<7, 0>(config_address)),
+        0);
+  }
+  std::fill(data.begin() + bytes_read, data.end(), 0xFF);
+}
+
+}  // namespace security::pawn
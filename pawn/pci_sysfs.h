@@ -0,0 +1,73 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef PAWN_PCI_SYSFS_H_
+#define PAWN_PCI_SYSFS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// Accesses the PCI configuration space through the config files the kernel
+// exports below /sys/bus/pci/devices. This needs no I/O privileges and the
+// kernel serializes accesses with its own, but each read is a system call.
+// Note: Only root may read past the standard 64-byte header. Reads that the
+//       kernel does not serve, as well as reads from absent devices, return
+//       all ones.
+class SysfsPci : public Pci {
+ public:
+  static constexpr char kDevicesPath[] = "/sys/bus/pci/devices";
+
+  ~SysfsPci() override;
+
+  // Fails if the LPC device (B0:D31:F0) cannot be found in devices_path.
+  static absl::StatusOr<std::unique_ptr<SysfsPci>> Create(
+      const std::string& devices_path = kDevicesPath);
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+  uint8_t ReadConfigUint8(uint32_t config_address) override;
+  uint16_t ReadConfigUint16(uint32_t config_address) override;
+  uint32_t ReadConfigUint32(uint32_t config_address) override;
+  // Reads the whole block with a single system call.
+  void ReadConfigBlock(uint32_t config_address,
+                       absl::Span<uint8_t> data) override;
+
+ private:
+  explicit SysfsPci(const std::string& devices_path)
+      : devices_path_(devices_path) {}
+
+  // Returns the file descriptor of the config file of the device addressed by
+  // config_address, opening it on first use. Returns -1 if there is none.
+  int ConfigFile(uint32_t config_address);
+
+  template <typename IntT>
+  IntT Read(uint32_t config_address);
+
+  std::string devices_path_;
+  // Open config files, keyed by bus, device and function number.
+  std::unordered_map<uint32_t, int> config_files_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_PCI_SYSFS_H_
@@ -0,0 +1,111 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/pci_sysfs.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>  // mkdir()
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "pawn/chipset.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsTrue;
+
+template <typename IntT>
+void Put(std::string& data, int offset, IntT value) {
+  std::memcpy(&data[offset], &value, sizeof(value));
+}
+
+class SysfsPciTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    devices_path_ = ::testing::TempDir() + "/pci_sysfs_test_devices";
+    mkdir(devices_path_.c_str(), 0755);
+
+    // LPC device of a Q87, with its full 256-byte configuration space.
+    std::string lpc(256, '\0');
+    Put<uint16_t>(lpc, 0x00, 0x8086);
+    Put<uint16_t>(lpc, 0x02, 0x8C4E);
+    Put<uint8_t>(lpc, 0x08, 0x05);
+    Put<uint32_t>(lpc, 0xF0, 0xFED1C001);
+    WriteConfig("0000:00:1f.0", lpc);
+
+    // As seen by an unprivileged process, only the standard header is
+    // readable.
+    std::string smbus(64, '\0');
+    Put<uint16_t>(smbus, 0x00, 0x8086);
+    WriteConfig("0000:00:1f.3", smbus);
+  }
+
+  void WriteConfig(const std::string& device, const std::string& config) {
+    std::string path = devices_path_ + "/" + device;
+    mkdir(path.c_str(), 0755);
+    std::ofstream(path + "/config", std::ios::binary)
+        .write(config.data(), config.size());
+  }
+
+  std::string devices_path_;
+};
+
+TEST_F(SysfsPciTest, ReadsConfigurationSpace) {
+  auto pci = SysfsPci::Create(devices_path_);
+  ASSERT_THAT(pci.status().ok(), IsTrue());
+
+  EXPECT_THAT((*pci)->ReadConfigUint16(pci::kVidRegister), Eq(0x8086));
+  EXPECT_THAT((*pci)->ReadConfigUint16(pci::kDidRegister), Eq(0x8C4E));
+  EXPECT_THAT((*pci)->ReadConfigUint8(pci::kRidRegister), Eq(0x05));
+  EXPECT_THAT((*pci)->ReadConfigUint32(0, 31, 0, 0xF0), Eq(0xFED1C001));
+  EXPECT_THAT((*pci)->ReadConfigUint16(0, 31, 3, 0x00), Eq(0x8086));
+
+  // Beyond the readable header, absent device and a different bus.
+  EXPECT_THAT((*pci)->ReadConfigUint32(0, 31, 3, 0x40), Eq(0xFFFFFFFF));
+  EXPECT_THAT((*pci)->ReadConfigUint16(0, 31, 5, 0x00), Eq(0xFFFF));
+  EXPECT_THAT((*pci)->ReadConfigUint8(1, 31, 0, 0x00), Eq(0xFF));
+}
+
+TEST_F(SysfsPciTest, IdentifiesChipset) {
+  auto pci = SysfsPci::Create(devices_path_);
+  ASSERT_THAT(pci.status().ok(), IsTrue());
+
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create(**pci, hw_id);
+  ASSERT_THAT(chipset.status().ok(), IsTrue());
+  EXPECT_THAT(hw_id.vendor, Eq(0x8086));
+  EXPECT_THAT(hw_id.device, Eq(0x8C4E));
+  EXPECT_THAT(hw_id.revision, Eq(0x05));
+  auto rcba = (*chipset)->ReadRcbaRegister();
+  EXPECT_THAT(rcba.base_address, Eq(0xFED1C000));
+  EXPECT_THAT(rcba.enable, IsTrue());
+}
+
+TEST(SysfsPciCreateTest, FailsWithoutLpcDevice) {
+  EXPECT_THAT(SysfsPci::Create(::testing::TempDir() + "/pci_sysfs_test_none")
+                  .status()
+                  .code(),
+              Eq(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+}  // namespace security::pawn
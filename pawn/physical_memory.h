@@ -29,35 +29,47 @@ class PhysicalMemory {
   PhysicalMemory(const PhysicalMemory&) = delete;
   PhysicalMemory& operator=(const PhysicalMemory&) = delete;
 
-  ~PhysicalMemory();
+  virtual ~PhysicalMemory();
 
+  // Maps length bytes starting at physical_offset, which need not be page
+  // aligned. See MappingPool::Default().
   static absl::StatusOr<std::unique_ptr<PhysicalMemory>> Create(
       uintptr_t physical_offset, size_t length);
 
   // Provides raw access to physical memory. See note below.
-  void* GetAt(int offset);
+  virtual void* GetAt(int offset);
+
+  // Returns a pointer through which memory-mapped registers can be accessed
+  // directly, or nullptr if all accesses must go through the Read*() and
+  // Write*() functions below (as is the case for simulated devices).
+  virtual volatile void* MmioBase();
 
   // Reads and writes physical memory in quantities of 1, 2 and 4 bytes at
   // physical location physical_offset + offset.
   // Note: No attempt is made to restrict offset in any way. Accesses beyond
   //       physical_offset + length - 1 will result in SIGSEGV or worse.
-  uint8_t ReadUint8(int offset) const;
-  uint16_t ReadUint16(int offset) const;
-  uint32_t ReadUint32(int offset) const;
-  uint64_t ReadUint64(int offset) const;
-  void WriteUint8(int offset, uint8_t value);
-  void WriteUint16(int offset, uint16_t value);
-  void WriteUint32(int offset, uint32_t value);
-  void WriteUint64(int offset, uint64_t value);
+  virtual uint8_t ReadUint8(int offset) const;
+  virtual uint16_t ReadUint16(int offset) const;
+  virtual uint32_t ReadUint32(int offset) const;
+  virtual uint64_t ReadUint64(int offset) const;
+  virtual void WriteUint8(int offset, uint8_t value);
+  virtual void WriteUint16(int offset, uint16_t value);
+  virtual void WriteUint32(int offset, uint32_t value);
+  virtual void WriteUint64(int offset, uint64_t value);
 
- private:
+ protected:
+  // Allows subclasses to back physical memory by other means, for example by
+  // simulating a device's memory-mapped registers.
   PhysicalMemory() = default;
 
-  absl::Status Init(uintptr_t physical_offset, size_t length);
+ private:
+  friend class MappingPool;
+
+  PhysicalMemory(void* mem, std::shared_ptr<void> mapping)
+      : mem_(mem), mapping_(std::move(mapping)) {}
 
-  int mem_fd_ = -1;  // Error
   void* mem_ = nullptr;
-  size_t length_ = 0;
+  std::shared_ptr<void> mapping_;  // Keeps mem_ mapped
 };
 
 }  // namespace security::pawn
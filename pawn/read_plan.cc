@@ -0,0 +1,266 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/read_plan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/base/macros.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+// Sorts ranges by offset and merges overlapping or adjacent ones.
+std::vector<ReadPlan::Range> Merge(std::vector<ReadPlan::Range> ranges) {
+  std::sort(ranges.begin(), ranges.end(),
+            [](const ReadPlan::Range& a, const ReadPlan::Range& b) {
+              return a.offset < b.offset;
+            });
+  std::vector<ReadPlan::Range> merged;
+  for (const ReadPlan::Range& range : ranges) {
+    if (!merged.empty() && range.offset <= merged.back().end()) {
+      ReadPlan::Range& last = merged.back();
+      last.size = std::max(last.end(), range.end()) - last.offset;
+      last.name += "+" + range.name;
+      continue;
+    }
+    merged.push_back(range);
+  }
+  return merged;
+}
+
+// Returns the parts of extents that do not overlap any of the (sorted,
+// non-overlapping) holes.
+std::vector<ReadPlan::Range> Subtract(
+    const std::vector<ReadPlan::Range>& extents,
+    const std::vector<ReadPlan::Range>& holes) {
+  std::vector<ReadPlan::Range> result;
+  for (const ReadPlan::Range& extent : extents) {
+    int64_t offset = extent.offset;
+    for (const ReadPlan::Range& hole : holes) {
+      if (hole.end() <= offset || hole.offset >= extent.end()) {
+        continue;
+      }
+      if (hole.offset > offset) {
+        result.push_back({extent.name, offset, hole.offset - offset});
+      }
+      offset = hole.end();
+    }
+    if (offset < extent.end()) {
+      result.push_back({extent.name, offset, extent.end() - offset});
+    }
+  }
+  return result;
+}
+
+constexpr const char* kRegionNames[] = {"descriptor", "bios", "me", "gbe",
+                                        "pdr"};
+constexpr int kBiosRegion = 1;
+
+}  // namespace
+
+BlockBitmap::BlockBitmap(int64_t flash_size, int block_size)
+    : block_size_(block_size),
+      num_blocks_((flash_size + block_size - 1) / block_size),
+      words_((num_blocks_ + 63) / 64, 0) {}
+
+void BlockBitmap::Set(int64_t fla, bool value) {
+  const int64_t block = fla / block_size_;
+  if (block < 0 || block >= num_blocks_) {
+    return;
+  }
+  const uint64_t mask = uint64_t{1} << (block % 64);
+  if (value) {
+    words_[block / 64] |= mask;
+  } else {
+    words_[block / 64] &= ~mask;
+  }
+}
+
+bool BlockBitmap::Test(int64_t fla) const {
+  const int64_t block = fla / block_size_;
+  if (block < 0 || block >= num_blocks_) {
+    return false;
+  }
+  return (words_[block / 64] >> (block % 64)) & 1;
+}
+
+void BlockBitmap::SetRange(int64_t offset, int64_t size, bool value) {
+  for (int64_t fla = offset; fla < offset + size; fla += block_size_) {
+    Set(fla, value);
+  }
+}
+
+int64_t BlockBitmap::Count() const {
+  int64_t count = 0;
+  for (uint64_t word : words_) {
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
+
+std::string BlockBitmap::ToBytes() const {
+  std::string bytes((num_blocks_ + 7) / 8, '\0');
+  for (int i = 0; i < bytes.size(); ++i) {
+    bytes[i] = static_cast<char>(words_[i / 8] >> (i % 8 * 8));
+  }
+  return bytes;
+}
+
+absl::StatusOr<ReadPlan> ReadPlan::Create(
+    const Options& options, absl::Span<const Chipset::FregN> fregs) {
+  if (options.block_size <= 0 || options.flash_size <= 0 ||
+      options.flash_size % options.block_size != 0) {
+    return absl::InvalidArgumentError(
+        "Flash size must be a positive multiple of the block size");
+  }
+
+  ReadPlan plan;
+  // Widens [offset, offset + size) to block boundaries, clamped to the flash
+  // size.
+  auto add_range = [&options, &plan](std::string name, int64_t offset,
+                                     int64_t size) -> absl::Status {
+    if (offset < 0 || size <= 0 || offset >= options.flash_size) {
+      return absl::OutOfRangeError(absl::StrFormat(
+          "%s (0x%08X, %d bytes) is outside of the flash", name, offset,
+          size));
+    }
+    const int64_t end = std::min(offset + size, options.flash_size);
+    offset -= offset % options.block_size;
+    const int64_t aligned_end =
+        (end + options.block_size - 1) / options.block_size *
+        options.block_size;
+    plan.ranges_.push_back({std::move(name), offset, aligned_end - offset});
+    return absl::OkStatus();
+  };
+
+  for (const std::string& name : options.regions) {
+    const int index = RegionIndex(name);
+    if (index < 0 || index >= fregs.size()) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("Unknown flash region: %s", name));
+    }
+    const Chipset::FregN& freg = fregs[index];
+    if (freg.region_base > freg.region_limit) {
+      return absl::NotFoundError(
+          absl::StrFormat("Flash region %s is not in use", name));
+    }
+    if (auto status = add_range(name, freg.region_base,
+                                int64_t{freg.region_limit} -
+                                    freg.region_base + 1);
+        !status.ok()) {
+      return status;
+    }
+  }
+  if (options.length != 0) {
+    if (auto status = add_range("range", options.offset, options.length);
+        !status.ok()) {
+      return status;
+    }
+  }
+  if (plan.ranges_.empty()) {
+    plan.ranges_.push_back({"flash", 0, options.flash_size});
+  }
+
+  // Collect what the BIOS master cannot read. Region and range granularity is
+  // 4KiB, so these are always block-aligned.
+  std::vector<Range> unreadable;
+  if (options.frap) {
+    for (int i = 0; i < fregs.size(); ++i) {
+      const Chipset::FregN& freg = fregs[i];
+      if (i == kBiosRegion || freg.region_base > freg.region_limit ||
+          (options.frap->bios_region_read_access >> i & 1)) {
+        continue;
+      }
+      unreadable.push_back({absl::StrFormat("%s (FRAP)", kRegionNames[i]),
+                            freg.region_base,
+                            int64_t{freg.region_limit} - freg.region_base + 1});
+    }
+  }
+  for (int i = 0; i < options.prs.size(); ++i) {
+    const Chipset::PrN& pr = options.prs[i];
+    if (!pr.read_protection_enable ||
+        pr.protected_range_base > pr.protected_range_limit) {
+      continue;
+    }
+    unreadable.push_back(
+        {absl::StrFormat("PR%d", i), pr.protected_range_base,
+         int64_t{pr.protected_range_limit} - pr.protected_range_base + 1});
+  }
+  for (const Range& range : options.skip) {
+    if (range.offset % options.block_size != 0 ||
+        range.size % options.block_size != 0) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "Skipped range %s is not block-aligned", range.name));
+    }
+    unreadable.push_back(range);
+  }
+
+  plan.flash_size_ = options.flash_size;
+  plan.block_size_ = options.block_size;
+  plan.unreadable_ = Merge(std::move(unreadable));
+  plan.extents_ = Subtract(Merge(plan.ranges_), plan.unreadable_);
+  return plan;
+}
+
+std::vector<ReadPlan::Range> ReadPlan::Regions(
+    absl::Span<const Chipset::FregN> fregs, int64_t flash_size) {
+  std::vector<Range> regions;
+  for (int i = 0; i < fregs.size() && i < ABSL_ARRAYSIZE(kRegionNames); ++i) {
+    const Chipset::FregN& freg = fregs[i];
+    if (freg.region_base > freg.region_limit ||
+        freg.region_base >= flash_size) {
+      continue;
+    }
+    const int64_t end =
+        std::min<int64_t>(int64_t{freg.region_limit} + 1, flash_size);
+    regions.push_back(
+        {kRegionNames[i], freg.region_base, end - freg.region_base});
+  }
+  return regions;
+}
+
+int ReadPlan::RegionIndex(const std::string& name) {
+  for (int i = 0; i < ABSL_ARRAYSIZE(kRegionNames); ++i) {
+    if (name == kRegionNames[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+BlockBitmap ReadPlan::ExtentBitmap() const {
+  BlockBitmap bitmap(flash_size_, block_size_);
+  for (const Range& extent : extents_) {
+    bitmap.SetRange(extent.offset, extent.size);
+  }
+  return bitmap;
+}
+
+int64_t ReadPlan::read_size() const {
+  int64_t size = 0;
+  for (const Range& extent : extents_) {
+    size += extent.size;
+  }
+  return size;
+}
+
+}  // namespace security::pawn
@@ -0,0 +1,158 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Computes which parts of the SPI flash to read for a dump. Callers select
+// flash regions by name and/or a raw byte range, the plan then holds the
+// requested ranges as well as the minimal set of extents that cover them.
+// If access permissions are specified, extents leave out the ranges that the
+// BIOS master cannot read, so that no flash cycles are wasted on them.
+// Use like this:
+//   ReadPlan::Options options;
+//   options.regions = {"bios"};
+//   options.flash_size = descriptor.total_size();
+//   auto plan = ReadPlan::Create(options, fregs);
+//   QCHECK_OK(plan.status());
+//   for (const auto& extent : plan->extents()) {
+//     ... read extent.offset, extent.size ...
+//   }
+
+#ifndef PAWN_READ_PLAN_H_
+#define PAWN_READ_PLAN_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+// One bit per block of flash, for example to track which blocks hold valid
+// data. Bit i is bit (i % 8) of byte i / 8 in ToBytes().
+class BlockBitmap {
+ public:
+  BlockBitmap() = default;
+  BlockBitmap(int64_t flash_size, int block_size);
+
+  int block_size() const { return block_size_; }
+  int64_t num_blocks() const { return num_blocks_; }
+
+  // Set or test the bit for the block containing flash linear address fla.
+  void Set(int64_t fla, bool value = true);
+  bool Test(int64_t fla) const;
+
+  // Sets the bits of all blocks in [offset, offset + size).
+  void SetRange(int64_t offset, int64_t size, bool value = true);
+
+  // Number of set bits.
+  int64_t Count() const;
+
+  std::string ToBytes() const;
+
+ private:
+  int block_size_ = 1;
+  int64_t num_blocks_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+class ReadPlan {
+ public:
+  // A range of flash linear addresses, size is a multiple of the block size.
+  struct Range {
+    std::string name;
+    int64_t offset;
+    int64_t size;
+
+    int64_t end() const { return offset + size; }
+  };
+
+  struct Options {
+    // Flash regions to read, by name (see RegionIndex()).
+    std::vector<std::string> regions;
+
+    // Raw byte range to read, in addition to the regions. Unused if length is
+    // zero.
+    int64_t offset = 0;
+    int64_t length = 0;
+
+    // Total size of the flash. If neither regions nor a range are selected,
+    // all of it is read.
+    int64_t flash_size = 0;
+
+    // Ranges are widened to multiples of this.
+    int block_size = 64;
+
+    // Access permissions of the BIOS master. If set, regions for which the
+    // BIOS Region Read Access (BRRA) bit is clear are not read. The BIOS
+    // region itself is always readable. Note that BMRAG only governs other
+    // masters' access to the BIOS region, so it does not restrict reads.
+    std::optional<Chipset::Frap> frap;
+
+    // Protected Range registers. Ranges with Read Protection Enable (RPE)
+    // set are not read.
+    std::vector<Chipset::PrN> prs;
+
+    // Further ranges not to read, for example a missing flash component.
+    // Their names describe the reason. Must be block-aligned.
+    std::vector<Range> skip;
+  };
+
+  // Creates a plan for the specified options. fregs holds the FREG0..4
+  // registers, indexed by region.
+  static absl::StatusOr<ReadPlan> Create(
+      const Options& options, absl::Span<const Chipset::FregN> fregs);
+
+  // Returns the FREG index for a region name ("descriptor", "bios", "me",
+  // "gbe" or "pdr"), or -1 if the name is unknown.
+  static int RegionIndex(const std::string& name);
+
+  // Returns the regions in use according to fregs, clamped to flash_size and
+  // named as in RegionIndex(), whether requested or not.
+  static std::vector<Range> Regions(absl::Span<const Chipset::FregN> fregs,
+                                    int64_t flash_size);
+
+  // The requested ranges, in the order they were specified.
+  const std::vector<Range>& ranges() const { return ranges_; }
+
+  // Sorted, non-overlapping extents that cover all readable parts of the
+  // requested ranges. Adjacent ranges are merged, so each extent is one
+  // contiguous read.
+  const std::vector<Range>& extents() const { return extents_; }
+
+  // Sorted, non-overlapping ranges that are known to be unreadable. These
+  // are left out of extents(). The name describes the reason.
+  const std::vector<Range>& unreadable() const { return unreadable_; }
+
+  // Number of bytes covered by extents().
+  int64_t read_size() const;
+
+  // Returns a bitmap of the blocks covered by extents().
+  BlockBitmap ExtentBitmap() const;
+
+ private:
+  ReadPlan() = default;
+
+  int64_t flash_size_ = 0;
+  int block_size_ = 0;
+  std::vector<Range> ranges_;
+  std::vector<Range> extents_;
+  std::vector<Range> unreadable_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_READ_PLAN_H_
@@ -0,0 +1,188 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/read_plan.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::FieldsAre;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr int64_t kFlashSize = 8 << 20;
+
+// Descriptor, BIOS, ME, GbE (unused), PDR (unused).
+std::vector<Chipset::FregN> MakeFregs() {
+  std::vector<Chipset::FregN> fregs(5);
+  fregs[0].region_base = 0x0000000;
+  fregs[0].region_limit = 0x0000FFF;
+  fregs[1].region_base = 0x0600000;
+  fregs[1].region_limit = 0x07FFFFF;
+  fregs[2].region_base = 0x0001000;
+  fregs[2].region_limit = 0x05FFFFF;
+  for (int i = 3; i < 5; ++i) {
+    fregs[i].region_base = 0x1FFF000;
+    fregs[i].region_limit = 0x0000FFF;
+  }
+  return fregs;
+}
+
+ReadPlan::Options MakeOptions() {
+  ReadPlan::Options options;
+  options.flash_size = kFlashSize;
+  return options;
+}
+
+TEST(ReadPlanTest, ReadsWholeFlashByDefault) {
+  auto plan = ReadPlan::Create(MakeOptions(), MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+  EXPECT_THAT(plan->extents(), ElementsAre(FieldsAre("flash", 0, kFlashSize)));
+  EXPECT_THAT(plan->read_size(), Eq(kFlashSize));
+}
+
+TEST(ReadPlanTest, SelectsRegions) {
+  ReadPlan::Options options = MakeOptions();
+  options.regions = {"bios"};
+  auto plan = ReadPlan::Create(options, MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+  EXPECT_THAT(plan->ranges(),
+              ElementsAre(FieldsAre("bios", 0x600000, 0x200000)));
+  EXPECT_THAT(plan->read_size(), Eq(0x200000));
+}
+
+TEST(ReadPlanTest, ListsRegionsInUse) {
+  EXPECT_THAT(ReadPlan::Regions(MakeFregs(), kFlashSize),
+              ElementsAre(FieldsAre("descriptor", 0, 0x1000),
+                          FieldsAre("bios", 0x600000, 0x200000),
+                          FieldsAre("me", 0x1000, 0x5FF000)));
+  EXPECT_THAT(ReadPlan::Regions(MakeFregs(), 0x700000),
+              ElementsAre(FieldsAre("descriptor", 0, 0x1000),
+                          FieldsAre("bios", 0x600000, 0x100000),
+                          FieldsAre("me", 0x1000, 0x5FF000)));
+}
+
+TEST(ReadPlanTest, MergesAdjacentRanges) {
+  ReadPlan::Options options = MakeOptions();
+  options.regions = {"bios", "descriptor", "me"};
+  options.offset = 0x7FFFF0;  // Overlaps BIOS, widened to a block boundary
+  options.length = 0x20;
+  auto plan = ReadPlan::Create(options, MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+  EXPECT_THAT(plan->ranges().size(), Eq(4));
+  EXPECT_THAT(plan->ranges()[3], FieldsAre("range", 0x7FFFC0, 0x40));
+  EXPECT_THAT(plan->extents(),
+              ElementsAre(FieldsAre("descriptor+me+bios+range", 0,
+                                    kFlashSize)));
+}
+
+TEST(ReadPlanTest, KeepsDisjointRangesApart) {
+  ReadPlan::Options options = MakeOptions();
+  options.regions = {"descriptor"};
+  options.offset = 0x10000;
+  options.length = 0x1000;
+  auto plan = ReadPlan::Create(options, MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+  EXPECT_THAT(plan->extents(),
+              ElementsAre(FieldsAre("descriptor", 0, 0x1000),
+                          FieldsAre("range", 0x10000, 0x1000)));
+}
+
+TEST(ReadPlanTest, SkipsUnreadableRanges) {
+  ReadPlan::Options options = MakeOptions();
+  // The BIOS master may read the descriptor and BIOS regions, but not ME.
+  options.frap = Chipset::Frap{};
+  options.frap->bios_region_read_access = 0x03;
+  options.prs.resize(5);
+  for (auto& pr : options.prs) {
+    pr.protected_range_base = 0x1FFF000;
+    pr.protected_range_limit = 0x0000FFF;
+  }
+  options.prs[2] = {/*write_protection_enable=*/false, 0, 0x6FFFFF,
+                    /*read_protection_enable=*/true, 0, 0x680000};
+  auto plan = ReadPlan::Create(options, MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+
+  EXPECT_THAT(plan->unreadable(),
+              ElementsAre(FieldsAre("me (FRAP)", 0x1000, 0x5FF000),
+                          FieldsAre("PR2", 0x680000, 0x80000)));
+  EXPECT_THAT(plan->extents(),
+              ElementsAre(FieldsAre("flash", 0, 0x1000),
+                          FieldsAre("flash", 0x600000, 0x80000),
+                          FieldsAre("flash", 0x700000, 0x100000)));
+
+  const BlockBitmap bitmap = plan->ExtentBitmap();
+  EXPECT_THAT(bitmap.num_blocks(), Eq(kFlashSize / 64));
+  EXPECT_THAT(bitmap.Count(), Eq(plan->read_size() / 64));
+  EXPECT_THAT(bitmap.Test(0x0FC0), IsTrue());
+  EXPECT_THAT(bitmap.Test(0x1000), IsFalse());
+  EXPECT_THAT(bitmap.Test(0x6FFFC0), IsFalse());
+  EXPECT_THAT(bitmap.Test(0x700000), IsTrue());
+}
+
+TEST(ReadPlanTest, SkipsRequestedRanges) {
+  ReadPlan::Options options = MakeOptions();
+  options.flash_size = 2 * kFlashSize;
+  options.skip = {{"component 1 (aliased)", kFlashSize, kFlashSize}};
+  auto plan = ReadPlan::Create(options, MakeFregs());
+  ASSERT_THAT(plan.ok(), IsTrue()) << plan.status();
+  EXPECT_THAT(plan->extents(), ElementsAre(FieldsAre("flash", 0, kFlashSize)));
+  EXPECT_THAT(plan->unreadable(),
+              ElementsAre(FieldsAre("component 1 (aliased)", kFlashSize,
+                                    kFlashSize)));
+
+  options.skip = {{"unaligned", 0x100, 0x20}};
+  EXPECT_THAT(ReadPlan::Create(options, MakeFregs()).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(BlockBitmapTest, SerializesLsbFirst) {
+  BlockBitmap bitmap(16 * 64, 64);
+  bitmap.Set(0);
+  bitmap.SetRange(9 * 64, 2 * 64);
+  bitmap.Set(10 * 64, false);
+  EXPECT_THAT(bitmap.ToBytes(), Eq(std::string("\x01\x02", 2)));
+}
+
+TEST(ReadPlanTest, RejectsInvalidSelections) {
+  ReadPlan::Options options = MakeOptions();
+  options.regions = {"bootloader"};
+  EXPECT_THAT(ReadPlan::Create(options, MakeFregs()).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+
+  options.regions = {"gbe"};
+  EXPECT_THAT(ReadPlan::Create(options, MakeFregs()).status().code(),
+              Eq(absl::StatusCode::kNotFound));
+
+  options.regions.clear();
+  options.offset = kFlashSize;
+  options.length = 0x1000;
+  EXPECT_THAT(ReadPlan::Create(options, MakeFregs()).status().code(),
+              Eq(absl::StatusCode::kOutOfRange));
+}
+
+}  // namespace
+}  // namespace security::pawn
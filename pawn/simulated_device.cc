@@ -0,0 +1,761 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/simulated_device.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "pawn/bits.h"
+#include "pawn/chipset_intel_100_series.h"
+#include "pawn/chipset_intel_200_series.h"
+#include "pawn/chipset_intel_300_series.h"
+#include "pawn/chipset_intel_8_series.h"
+#include "pawn/chipset_intel_9_series.h"
+#include "pawn/chipset_intel_ich10.h"
+#include "pawn/chipset_intel_ich8.h"
+#include "pawn/chipset_intel_ich9.h"
+#include "pawn/flash_descriptor.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+namespace {
+
+// Registers at the same offsets in all supported chipset generations. The
+// others are described by SpiLayout.
+using Regs = IntelIch8Chipset;
+using Pch100 = Intel100SeriesChipset;
+// The offsets are enumerators of different enums, compare them as ints.
+constexpr bool SameOffset(int a, int b) { return a == b; }
+static_assert(
+    SameOffset(Pch100::kBfprRegisterOffset, Regs::kBfprRegisterOffset) &&
+    SameOffset(Pch100::kHsfsRegisterOffset, Regs::kHsfsRegisterOffset) &&
+    SameOffset(Pch100::kHsfcRegisterOffset, Regs::kHsfcRegisterOffset) &&
+    SameOffset(Pch100::kFaddrRegisterOffset, Regs::kFaddrRegisterOffset) &&
+    SameOffset(Pch100::kFdata0RegisterOffset, Regs::kFdata0RegisterOffset) &&
+    SameOffset(Pch100::kFrapRegisterOffset, Regs::kFrapRegisterOffset) &&
+    SameOffset(Pch100::kFreg0RegisterOffset, Regs::kFreg0RegisterOffset));
+
+enum : uint8_t {
+  // HSFS, low byte
+  kHsfsFdone = 1 << 0,
+  kHsfsFcerr = 1 << 1,
+  kHsfsAel = 1 << 2,
+  kHsfsScip = 1 << 5,
+  // HSFS, high byte
+  kHsfsFlockdn = 1 << 7,
+  // HSFC, low byte
+  kHsfcFgo = 1 << 0,
+  // SSFS
+  kSsfsCds = 1 << 2,
+  kSsfsFcerr = 1 << 3,
+  kSsfsAel = 1 << 4,
+  // SSFC, low byte
+  kSsfcScgo = 1 << 1,
+};
+
+bool Overlaps(uint32_t base, uint32_t limit, uint32_t address, int size) {
+  return base <= limit && address <= limit && address + size - 1 >= base;
+}
+
+// Decodes FREGn and PRn registers. Before the 100 Series, bases and limits
+// have 13 bits and the two bits above each are reserved, i.e. zero.
+uint32_t RangeBase(uint32_t reg) { return bits::Value<14, 0>(reg) << 12; }
+
+uint32_t RangeLimit(uint32_t reg) {
+  return bits::Value<30, 16>(reg) << 12 | 0xFFF;
+}
+
+bool HasSpiFunction(const Chipset::HardwareId& id) {
+  return Intel100SeriesChipset::SupportsDevice(id) ||
+         Intel200SeriesChipset::SupportsDevice(id) ||
+         Intel300SeriesChipset::SupportsDevice(id);
+}
+
+uint32_t DefaultGcs(const Chipset::HardwareId& id) {
+  // Boot BIOS Straps (BBS) are in bits 11:10 and their encoding varies
+  // between generations. See the ReadGcsRegister() implementations.
+  if (IntelIch8Chipset::SupportsDevice(id) ||
+      IntelIch9Chipset::SupportsDevice(id) ||
+      IntelIch10Chipset::SupportsDevice(id)) {
+    return bits::Set<11, 10>(0b01);
+  }
+  if (Intel8SeriesChipset::IsIntegratedIo(id.device) ||
+      Intel9SeriesChipset::IsIntegratedIo(id.device)) {
+    return bits::Set<11, 10>(0b00);
+  }
+  return bits::Set<11, 10>(0b11);
+}
+
+}  // namespace
+
+struct SimulatedDevice::SpiLayout {
+  int pr0;
+  int ssfs;
+  int ssfc;
+  int preop;
+  int optype;
+  int opmenu;
+  int fdoc;
+  int fdod;
+  uint32_t fla_mask;
+  uint8_t fcycle_mask;  // In the low byte of HSFC
+  // Whether the software sequencing registers (SSFS to OPMENU) exist.
+  bool software_sequencing;
+
+  template <typename ChipsetT>
+  static constexpr SpiLayout Make(bool software_sequencing) {
+    return {ChipsetT::kPr0RegisterOffset,    ChipsetT::kSsfsRegisterOffset,
+            ChipsetT::kSsfcRegisterOffset,   ChipsetT::kPreopRegisterOffset,
+            ChipsetT::kOptypeRegisterOffset, ChipsetT::kOpmenuRegisterOffset,
+            ChipsetT::kFdocRegisterOffset,   ChipsetT::kFdodRegisterOffset,
+            ChipsetT::kFaddrFlaMask,         ChipsetT::kHsfcFcycleMask,
+            software_sequencing};
+  }
+};
+
+const SimulatedDevice::SpiLayout& SimulatedDevice::LayoutFor(
+    const Chipset::HardwareId& id) {
+  static constexpr auto kIchLayout = SpiLayout::Make<IntelIch8Chipset>(true);
+  static constexpr auto k100SeriesLayout =
+      SpiLayout::Make<Intel100SeriesChipset>(true);
+  static constexpr auto k300SeriesLayout =
+      SpiLayout::Make<Intel300SeriesChipset>(false);
+  if (Intel300SeriesChipset::SupportsDevice(id)) {
+    return k300SeriesLayout;
+  }
+  return HasSpiFunction(id) ? k100SeriesLayout : kIchLayout;
+}
+
+class SimulatedDevice::SimulatedPci : public Pci {
+ public:
+  explicit SimulatedPci(SimulatedDevice* device) : device_(device) {}
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+
+  uint8_t ReadConfigUint8(uint32_t config_address) override {
+    return device_->ReadConfig(config_address, sizeof(uint8_t));
+  }
+  uint16_t ReadConfigUint16(uint32_t config_address) override {
+    return device_->ReadConfig(config_address, sizeof(uint16_t));
+  }
+  uint32_t ReadConfigUint32(uint32_t config_address) override {
+    return device_->ReadConfig(config_address, sizeof(uint32_t));
+  }
+
+ private:
+  SimulatedDevice* device_;
+};
+
+class SimulatedDevice::SimulatedMemory : public PhysicalMemory {
+ public:
+  SimulatedMemory(SimulatedDevice* device, uint32_t rcrb_offset)
+      : device_(device), rcrb_offset_(rcrb_offset) {}
+
+  void* GetAt(int offset) override {
+    return &device_->rcrb_[rcrb_offset_ + offset];
+  }
+
+  // Register accesses have side effects, so direct access is not possible.
+  volatile void* MmioBase() override { return nullptr; }
+
+  uint8_t ReadUint8(int offset) const override {
+    return device_->ReadRcrb(rcrb_offset_ + offset, sizeof(uint8_t));
+  }
+  uint16_t ReadUint16(int offset) const override {
+    return device_->ReadRcrb(rcrb_offset_ + offset, sizeof(uint16_t));
+  }
+  uint32_t ReadUint32(int offset) const override {
+    return device_->ReadRcrb(rcrb_offset_ + offset, sizeof(uint32_t));
+  }
+  uint64_t ReadUint64(int offset) const override {
+    return device_->ReadRcrb(rcrb_offset_ + offset, sizeof(uint64_t));
+  }
+  void WriteUint8(int offset, uint8_t value) override {
+    device_->WriteRcrb(rcrb_offset_ + offset, value, sizeof(uint8_t));
+  }
+  void WriteUint16(int offset, uint16_t value) override {
+    device_->WriteRcrb(rcrb_offset_ + offset, value, sizeof(uint16_t));
+  }
+  void WriteUint32(int offset, uint32_t value) override {
+    device_->WriteRcrb(rcrb_offset_ + offset, value, sizeof(uint32_t));
+  }
+  void WriteUint64(int offset, uint64_t value) override {
+    device_->WriteRcrb(rcrb_offset_ + offset, value, sizeof(uint64_t));
+  }
+
+ private:
+  SimulatedDevice* device_;
+  uint32_t rcrb_offset_;
+};
+
+// Reads of the BIOS decode window are served from the flash image and have no
+// side effects.
+class SimulatedDevice::SimulatedBiosWindow : public PhysicalMemory {
+ public:
+  SimulatedBiosWindow(SimulatedDevice* device, uint32_t flash_address,
+                      size_t length)
+      : device_(device), flash_address_(flash_address), length_(length) {}
+
+  void* GetAt(int offset) override { return nullptr; }
+
+  // Allows direct access if the window does not wrap around.
+  volatile void* MmioBase() override {
+    std::string& image = device_->flash_image_;
+    return flash_address_ + length_ <= image.size()
+               ? &image[flash_address_]
+               : nullptr;
+  }
+
+  uint8_t ReadUint8(int offset) const override { return Read(offset, 1); }
+  uint16_t ReadUint16(int offset) const override { return Read(offset, 2); }
+  uint32_t ReadUint32(int offset) const override { return Read(offset, 4); }
+  uint64_t ReadUint64(int offset) const override { return Read(offset, 8); }
+
+  // The window is read-only.
+  void WriteUint8(int offset, uint8_t value) override {}
+  void WriteUint16(int offset, uint16_t value) override {}
+  void WriteUint32(int offset, uint32_t value) override {}
+  void WriteUint64(int offset, uint64_t value) override {}
+
+ private:
+  uint64_t Read(int offset, int width) const {
+    const std::string& image = device_->flash_image_;
+    uint64_t value = 0;
+    for (int i = 0; i < width; ++i) {
+      value |= uint64_t{static_cast<uint8_t>(
+                   image[(flash_address_ + offset + i) % image.size()])}
+               << (i * 8);
+    }
+    return value;
+  }
+
+  SimulatedDevice* device_;
+  uint32_t flash_address_;
+  size_t length_;
+};
+
+SimulatedDevice::SimulatedDevice(std::string flash_image,
+                                 const Options& options)
+    : flash_image_(std::move(flash_image)),
+      options_(options),
+      spi_function_(HasSpiFunction(options.hardware_id)),
+      layout_(&LayoutFor(options.hardware_id)),
+      rcrb_(kRcrbSize, 0),
+      pci_(std::make_unique<SimulatedPci>(this)) {
+  if (spi_function_) {
+    mmio_base_ = options_.spibar & ~(Pch100::kSpiBarSize - 1);
+    mmio_size_ = Pch100::kSpiBarSize;
+    spi_bar_ = Pch100::kSpiBar;
+  } else {
+    mmio_base_ = options_.rcba & ~(kRcrbSize - 1);
+    mmio_size_ = kRcrbSize;
+    spi_bar_ =
+        IntelIch8Chipset::SupportsDevice(options.hardware_id) ? 0x3020 : 0x3800;
+  }
+
+  auto put_config = [](std::array<uint8_t, 256>& config,
+                       uint32_t config_address, uint32_t value, int width) {
+    for (int i = 0; i < width; ++i, value >>= 8) {
+      config[(config_address & 0xFF) + i] = value & 0xFF;
+    }
+  };
+  put_config(lpc_config_, pci::kVidRegister, options_.hardware_id.vendor, 2);
+  put_config(lpc_config_, pci::kDidRegister, options_.hardware_id.device, 2);
+  put_config(lpc_config_, pci::kRidRegister, options_.hardware_id.revision, 1);
+  if (spi_function_) {
+    put_config(spi_config_, Pch100::kSpiVidRegister, 0x8086 /* Intel */, 2);
+    put_config(spi_config_, Pch100::kSpiVidRegister + 2, 0xA124 /* DID */, 2);
+    put_config(spi_config_, Pch100::kSpiCommandRegister, 0x0006 /* MSE, BME */,
+               2);
+    put_config(spi_config_, Pch100::kSpiBar0Register, mmio_base_, 4);
+    put_config(spi_config_, Pch100::kBiosCntlRegister, options_.bios_cntl, 1);
+  } else {
+    put_config(lpc_config_, Regs::kBiosCntlRegister, options_.bios_cntl, 1);
+    put_config(lpc_config_, Regs::kRcbaRegister, mmio_base_ | 1 /* EN */, 4);
+  }
+
+  auto put_rcrb = [this](uint32_t offset, uint32_t value, int width) {
+    for (int i = 0; i < width; ++i, value >>= 8) {
+      rcrb_[offset + i] = value & 0xFF;
+    }
+  };
+  if (!spi_function_) {
+    put_rcrb(Regs::kGcsRegister,
+             options_.gcs ? *options_.gcs : DefaultGcs(options_.hardware_id),
+             4);
+  }
+
+  if (options_.freg.empty()) {
+    const uint32_t size =
+        std::min<size_t>(flash_image_.size(), layout_->fla_mask + 1);
+    options_.freg = {MakeFregNRegister(0x0000, 0x0FFF),
+                     MakeFregNRegister(0x1000, size - 1)};
+  }
+  options_.freg.resize(5, MakeFregNRegister(0x1FFF000, 0x0000));
+  options_.pr.resize(5, 0);
+  put_rcrb(spi_bar_ + Regs::kBfprRegisterOffset, options_.freg[1], 4);
+  put_rcrb(spi_bar_ + Regs::kHsfsRegisterOffset,
+           bits::Set<15>(options_.flash_configuration_lockdown) |
+               bits::Set<14>(1) /* FDV */,
+           2);
+  put_rcrb(spi_bar_ + Regs::kFrapRegisterOffset, options_.frap, 4);
+  for (int i = 0; i < 5; ++i) {
+    put_rcrb(spi_bar_ + Regs::kFreg0RegisterOffset + i * 4, options_.freg[i],
+             4);
+    put_rcrb(spi_bar_ + layout_->pr0 + i * 4, options_.pr[i], 4);
+  }
+  if (layout_->software_sequencing) {
+    put_rcrb(spi_bar_ + layout_->preop, options_.preop, 2);
+    put_rcrb(spi_bar_ + layout_->optype, options_.optype, 2);
+    put_rcrb(spi_bar_ + layout_->opmenu, options_.opmenu, 4);
+    put_rcrb(spi_bar_ + layout_->opmenu + 4, options_.opmenu >> 32, 4);
+  }
+}
+
+SimulatedDevice::~SimulatedDevice() = default;
+
+absl::StatusOr<std::unique_ptr<SimulatedDevice>> SimulatedDevice::Create(
+    std::string flash_image, const Options& options) {
+  if (flash_image.empty()) {
+    return absl::InvalidArgumentError("Flash image must not be empty");
+  }
+  if (options.freg.size() > 5 || options.pr.size() > 5) {
+    return absl::InvalidArgumentError(
+        "At most 5 FREG and PR registers can be specified");
+  }
+  return absl::WrapUnique(new SimulatedDevice(std::move(flash_image), options));
+}
+
+absl::StatusOr<std::unique_ptr<SimulatedDevice>>
+SimulatedDevice::CreateFromFile(const std::string& filename,
+                                const Options& options) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    return absl::NotFoundError(
+        absl::StrFormat("Could not open flash image: %s", filename));
+  }
+  std::string flash_image(std::istreambuf_iterator<char>(file), {});
+  if (file.bad()) {
+    return absl::DataLossError(
+        absl::StrFormat("Could not read flash image: %s", filename));
+  }
+  return Create(std::move(flash_image), options);
+}
+
+uint32_t SimulatedDevice::MakeFregNRegister(uint32_t base, uint32_t limit) {
+  return bits::Set<30, 16>(limit >> 12) | bits::Set<14, 0>(base >> 12);
+}
+
+std::string SimulatedDevice::MakeFlashImage(int64_t size) {
+  std::string image(size, '\0');
+  for (int64_t i = 0; i < size; ++i) {
+    image[i] = static_cast<char>(i * 7 + i / 256);
+  }
+  return image;
+}
+
+std::string SimulatedDevice::MakeSfdp(int64_t flash_size) {
+  auto put = [](std::string& sfdp, int offset, uint32_t value) {
+    for (int i = 0; i < 4; ++i, value >>= 8) {
+      sfdp[offset + i] = static_cast<char>(value & 0xFF);
+    }
+  };
+  // SFDP header (revision 1.6, one parameter header), followed by the
+  // parameter header for a 9 dword BFPT at 0x10.
+  std::string sfdp(0x34, '\xFF');
+  put(sfdp, 0x00, 0x50444653);  // "SFDP"
+  put(sfdp, 0x04, 0xFF000106);
+  put(sfdp, 0x08, 0x09010600);
+  put(sfdp, 0x0C, 0xFF000010);
+  // BFPT: 4KiB erase, 3-byte addressing only, density in bits minus one.
+  put(sfdp, 0x10, 0xFFF920E5);
+  put(sfdp, 0x14, static_cast<uint32_t>(flash_size * 8 - 1));
+  return sfdp;
+}
+
+uint32_t SimulatedDevice::MakePrNRegister(uint32_t base, uint32_t limit,
+                                          bool read_protect,
+                                          bool write_protect) {
+  return bits::Set<31>(write_protect) | bits::Set<30, 16>(limit >> 12) |
+         bits::Set<15>(read_protect) | bits::Set<14, 0>(base >> 12);
+}
+
+Pci& SimulatedDevice::pci() { return *pci_; }
+
+absl::StatusOr<std::unique_ptr<PhysicalMemory>>
+SimulatedDevice::MapPhysicalMemory(uintptr_t physical_address, size_t length) {
+  if (physical_address >= mmio_base_ &&
+      physical_address + length <= uint64_t{mmio_base_} + mmio_size_) {
+    return std::make_unique<SimulatedMemory>(this,
+                                             physical_address - mmio_base_);
+  }
+
+  // The end of the BIOS region is decoded right below 4GiB.
+  constexpr uint64_t k4GiB = uint64_t{1} << 32;
+  const uint32_t bios = options_.freg[1];
+  if (RangeBase(bios) <= RangeLimit(bios)) {
+    const uint64_t window_size = std::min<uint64_t>(
+        RangeLimit(bios) - RangeBase(bios) + 1, kMaxBiosWindowSize);
+    if (physical_address >= k4GiB - window_size &&
+        physical_address + length <= k4GiB) {
+      return std::make_unique<SimulatedBiosWindow>(
+          this, RangeLimit(bios) + 1 - (k4GiB - physical_address), length);
+    }
+  }
+  return absl::FailedPreconditionError(absl::StrFormat(
+      "Physical memory range 0x%08X-0x%08X is not simulated",
+      physical_address, physical_address + length - 1));
+}
+
+Chipset::MemoryMapper SimulatedDevice::memory_mapper() {
+  return [this](uintptr_t physical_address, size_t length) {
+    return MapPhysicalMemory(physical_address, length);
+  };
+}
+
+uint32_t SimulatedDevice::ReadConfig(uint32_t config_address, int width) {
+  ++stats_.config_reads;
+  const int function = bits::Value<10, 8>(config_address);
+  const bool present =
+      function == 0 /* LPC */ || (function == 5 /* SPI */ && spi_function_);
+  if (bits::Value<23, 16>(config_address) != 0x00 /* Bus */ ||
+      bits::Value<15, 11>(config_address) != 31 /* Device */ || !present) {
+    // Reads from non-existent devices return all ones.
+    return 0xFFFFFFFF;
+  }
+  const auto& config = function == 0 ? lpc_config_ : spi_config_;
+  const int offset = bits::Value<7, 0>(config_address);
+  uint32_t value = 0;
+  for (int i = width - 1; i >= 0; --i) {
+    value = value << 8 | config[(offset + i) & 0xFF];
+  }
+  return value;
+}
+
+uint64_t SimulatedDevice::ReadRcrb(uint32_t offset, int width) {
+  ++stats_.mmio_reads;
+  UpdateHardwareSequencingCycle();
+  uint64_t value = 0;
+  for (int i = width - 1; i >= 0; --i) {
+    value = value << 8 | rcrb_[(offset + i) % kRcrbSize];
+  }
+  return value;
+}
+
+void SimulatedDevice::WriteRcrb(uint32_t offset, uint64_t value, int width) {
+  ++stats_.mmio_writes;
+  UpdateHardwareSequencingCycle();
+  bool start_cycle = false;
+  bool start_software_cycle = false;
+  bool select_descriptor_dword = false;
+  for (int i = 0; i < width; ++i, value >>= 8) {
+    const uint32_t rcrb_offset = (offset + i) % kRcrbSize;
+    const int spi_offset = static_cast<int>(rcrb_offset - spi_bar_);
+    if (spi_offset < 0 || spi_offset >= kSpiRegisterFileSize) {
+      // The remaining chipset configuration registers are read-only.
+      continue;
+    }
+    const uint8_t byte = value & 0xFF;
+    const WriteMask mask = SpiRegisterWriteMask(spi_offset);
+    uint8_t& reg = rcrb_[rcrb_offset];
+    reg = (reg & ~mask.rw) | (byte & mask.rw);
+    reg &= ~(byte & mask.rw1c);
+    if (spi_offset == Regs::kHsfsRegisterOffset + 1 && (byte & kHsfsFlockdn)) {
+      reg |= kHsfsFlockdn;  // Write-once, cleared on reset only.
+    }
+    if (spi_offset == Regs::kHsfcRegisterOffset && (byte & kHsfcFgo)) {
+      start_cycle = true;
+    }
+    if (layout_->software_sequencing && spi_offset == layout_->ssfc &&
+        (byte & kSsfcScgo)) {
+      start_software_cycle = true;
+    }
+    if (spi_offset >= layout_->fdoc && spi_offset < layout_->fdoc + 4) {
+      select_descriptor_dword = true;
+    }
+  }
+  if (select_descriptor_dword) {
+    UpdateFlashDescriptorObservability();
+  }
+  if (start_cycle) {
+    StartHardwareSequencingCycle();
+  }
+  if (start_software_cycle) {
+    RunSoftwareSequencingCycle();
+  }
+}
+
+uint32_t SimulatedDevice::ReadSpiRegister32(int spi_offset) const {
+  uint32_t value;
+  std::memcpy(&value, &rcrb_[spi_bar_ + spi_offset], sizeof(value));
+  return value;
+}
+
+SimulatedDevice::WriteMask SimulatedDevice::SpiRegisterWriteMask(
+    int spi_offset) const {
+  const bool locked = flash_configuration_lockdown();
+  switch (spi_offset) {
+    case Regs::kHsfsRegisterOffset:
+      return {0x00, kHsfsAel | kHsfsFcerr | kHsfsFdone};
+    case Regs::kHsfcRegisterOffset:
+      return {static_cast<uint8_t>(layout_->fcycle_mask | kHsfcFgo), 0x00};
+    case Regs::kHsfcRegisterOffset + 1:
+      return {0xBF /* FSMIE, FDBC */, 0x00};
+    case Regs::kFaddrRegisterOffset + 3:
+      return {static_cast<uint8_t>(layout_->fla_mask >> 24), 0x00};
+    default:
+      break;
+  }
+  if (layout_->software_sequencing) {
+    if (spi_offset == layout_->ssfs) {
+      return {0x00, kSsfsAel | kSsfsFcerr | kSsfsCds};
+    }
+    if (spi_offset == layout_->ssfc) {
+      return {0x7E /* COP, SPOP, ACS, SCGO */, 0x00};
+    }
+    if (spi_offset == layout_->ssfc + 1) {
+      return {0xFF /* SME, DS, DBC */, 0x00};
+    }
+    if (spi_offset == layout_->ssfc + 2) {
+      return {0x07 /* SCF */, 0x00};
+    }
+  }
+  if (spi_offset == layout_->fdoc) {
+    return {0xFC /* FDSI */, 0x00};
+  }
+  if (spi_offset == layout_->fdoc + 1) {
+    return {0x7F /* FDSS, FDSI */, 0x00};
+  }
+  if ((spi_offset >= Regs::kFaddrRegisterOffset &&
+       spi_offset < Regs::kFaddrRegisterOffset + 3) ||
+      (spi_offset >= Regs::kFdata0RegisterOffset &&
+       spi_offset < Regs::kFdata0RegisterOffset + 16 * 4)) {
+    return {0xFF, 0x00};
+  }
+  if (!locked &&
+      ((spi_offset >= layout_->pr0 && spi_offset < layout_->pr0 + 5 * 4) ||
+       (layout_->software_sequencing && spi_offset >= layout_->preop &&
+        spi_offset < layout_->opmenu + 8))) {
+    return {0xFF, 0x00};
+  }
+  return {0x00, 0x00};
+}
+
+bool SimulatedDevice::flash_configuration_lockdown() const {
+  return rcrb_[spi_bar_ + Regs::kHsfsRegisterOffset + 1] & kHsfsFlockdn;
+}
+
+void SimulatedDevice::StartHardwareSequencingCycle() {
+  if (cycle_in_progress_) {
+    return;
+  }
+  ++stats_.flash_cycles;
+  cycle_in_progress_ = true;
+  cycle_hangs_ = options_.hang_after_cycles >= 0 &&
+                 stats_.flash_cycles > options_.hang_after_cycles;
+  cycle_start_ = absl::Now();
+  rcrb_[spi_bar_ + Regs::kHsfsRegisterOffset] |= kHsfsScip;
+  UpdateHardwareSequencingCycle();
+}
+
+void SimulatedDevice::UpdateHardwareSequencingCycle() {
+  if (!cycle_in_progress_ || cycle_hangs_) {
+    return;
+  }
+  if (options_.cycle_latency > absl::ZeroDuration() &&
+      absl::Now() - cycle_start_ < options_.cycle_latency) {
+    return;
+  }
+  CompleteHardwareSequencingCycle();
+}
+
+void SimulatedDevice::CompleteHardwareSequencingCycle() {
+  cycle_in_progress_ = false;
+  uint8_t& hsfs = rcrb_[spi_bar_ + Regs::kHsfsRegisterOffset];
+  uint8_t& hsfc = rcrb_[spi_bar_ + Regs::kHsfcRegisterOffset];
+  const uint32_t flash_address =
+      ReadSpiRegister32(Regs::kFaddrRegisterOffset) & layout_->fla_mask;
+  const int size =
+      bits::Value<5, 0>(rcrb_[spi_bar_ + Regs::kHsfcRegisterOffset + 1]) + 1;
+  const auto cycle =
+      static_cast<Chipset::FlashCycle>((hsfc & layout_->fcycle_mask) >> 1);
+  hsfs &= ~kHsfsScip;
+  hsfc &= ~kHsfcFgo;
+
+  // Only read cycles are simulated, writes and erases always fail.
+  uint8_t status = cycle == Chipset::kFcycleRead
+                       ? CheckFlashRead(flash_address, size)
+                       : kHsfsFcerr;
+  if (status == 0) {
+    uint8_t* fdata = &rcrb_[spi_bar_ + Regs::kFdata0RegisterOffset];
+    for (int i = 0; i < size; ++i) {
+      fdata[i] = flash_image_[(flash_address + i) % flash_image_.size()];
+    }
+  } else {
+    ++stats_.flash_cycle_errors;
+  }
+  hsfs |= status | kHsfsFdone;
+}
+
+void SimulatedDevice::UpdateFlashDescriptorObservability() {
+  auto image_dword = [this](uint32_t offset) -> uint32_t {
+    uint32_t value = 0xFFFFFFFF;
+    if (offset + sizeof(value) <= flash_image_.size()) {
+      std::memcpy(&value, &flash_image_[offset], sizeof(value));
+    }
+    return value;
+  };
+  const uint32_t fdoc = ReadSpiRegister32(layout_->fdoc);
+  const int index = bits::Value<11, 2>(fdoc);  // FDSI
+
+  // Without a valid descriptor, the chipset has nothing to serve.
+  uint32_t fdod = 0xFFFFFFFF;
+  int map = -1;
+  if (image_dword(0x10) == FlashDescriptor::kSignature) {
+    map = 0x10;
+  } else if (image_dword(0x00) == FlashDescriptor::kSignature) {
+    map = 0x00;
+  }
+  if (map >= 0) {
+    const uint32_t flmap0 = image_dword(map + 0x04);
+    const uint32_t flmap1 = image_dword(map + 0x08);
+    const int section_base[] = {
+        map,  // Signature and Descriptor Map
+        static_cast<int>(bits::Value<7, 0>(flmap0) << 4),    // FCBA
+        static_cast<int>(bits::Value<23, 16>(flmap0) << 4),  // FRBA
+        static_cast<int>(bits::Value<7, 0>(flmap1) << 4),    // FMBA
+    };
+    const int section = bits::Value<14, 12>(fdoc);  // FDSS
+    if (section < 4) {
+      fdod = image_dword(section_base[section] + index * 4);
+    }
+  }
+  std::memcpy(&rcrb_[spi_bar_ + layout_->fdod], &fdod,
+              sizeof(fdod));
+}
+
+void SimulatedDevice::RunSoftwareSequencingCycle() {
+  ++stats_.flash_cycles;
+  uint8_t& ssfs = rcrb_[spi_bar_ + layout_->ssfs];
+  uint8_t& ssfc = rcrb_[spi_bar_ + layout_->ssfc];
+  ssfc &= ~kSsfcScgo;
+  const int cop = bits::Value<6, 4>(ssfc);
+  const uint8_t dbc = rcrb_[spi_bar_ + layout_->ssfc + 1];
+  const int size = bits::Test<6>(dbc) /* DS */ ? bits::Value<5, 0>(dbc) + 1
+                                               : 0;
+  const uint8_t opcode = rcrb_[spi_bar_ + layout_->opmenu + cop];
+  const int optype = bits::Value<1, 0>(
+      rcrb_[spi_bar_ + layout_->optype + cop / 4] >> (cop % 4 * 2));
+  const uint32_t flash_address =
+      ReadSpiRegister32(Regs::kFaddrRegisterOffset) & layout_->fla_mask;
+
+  // Data as the flash chip returns it. The byte after the address of Fast
+  // Read and Read SFDP is a dummy byte.
+  std::string data(size, '\xFF');
+  uint8_t status = 0;
+  auto copy = [&data](const std::string& source, uint32_t offset, int skip,
+                      bool wrap) {
+    for (int i = skip; i < data.size(); ++i) {
+      const size_t pos = offset + i - skip;
+      if (wrap || pos < source.size()) {
+        data[i] = source[pos % source.size()];
+      }
+    }
+  };
+  if (opcode == 0x9F && optype == 0 /* Read without address */) {
+    copy(std::string(options_.jedec_id.begin(), options_.jedec_id.end()), 0,
+         0, false);
+  } else if (opcode == 0x5A && optype == 2 /* Read with address */) {
+    if (!options_.sfdp.empty()) {
+      copy(options_.sfdp, flash_address, 1, false);
+    }
+  } else if ((opcode == 0x03 || opcode == 0x0B) && optype == 2) {
+    const int skip = opcode == 0x0B ? 1 : 0;
+    const uint8_t hsfs_status =
+        CheckFlashRead(flash_address, std::max(size - skip, 1));
+    if (hsfs_status & kHsfsFcerr) {
+      status |= kSsfsFcerr;
+    }
+    if (hsfs_status & kHsfsAel) {
+      status |= kSsfsAel;
+    }
+    if (status == 0) {
+      copy(flash_image_, flash_address, skip, true);
+    }
+  } else {
+    // Other opcodes, in particular writes and erases, are not simulated.
+    status = kSsfsFcerr;
+  }
+
+  if (status == 0) {
+    std::memcpy(&rcrb_[spi_bar_ + Regs::kFdata0RegisterOffset], data.data(),
+                data.size());
+  } else {
+    ++stats_.flash_cycle_errors;
+  }
+  ssfs |= status | kSsfsCds;
+}
+
+uint8_t SimulatedDevice::CheckFlashRead(uint32_t flash_address,
+                                        int size) const {
+  for (const auto& [base, limit] : options_.error_ranges) {
+    if (Overlaps(base, limit, flash_address, size)) {
+      return kHsfsFcerr;
+    }
+  }
+  const uint32_t brra = bits::Value<7, 0>(options_.frap);
+  for (int i = 0; i < 5; ++i) {
+    // Protected ranges may be reprogrammed until FLOCKDN is set.
+    const uint32_t pr = ReadSpiRegister32(layout_->pr0 + i * 4);
+    if (bits::Test<15>(pr) /* Read Protection Enable */ &&
+        Overlaps(RangeBase(pr), RangeLimit(pr), flash_address, size)) {
+      return kHsfsFcerr | kHsfsAel;
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    if ((brra & (1 << i)) == 0 &&
+        Overlaps(RangeBase(options_.freg[i]), RangeLimit(options_.freg[i]),
+                 flash_address, size)) {
+      return kHsfsFcerr | kHsfsAel;
+    }
+  }
+  return 0;
+}
+
+uint64_t BufferMemory::Read(int offset, int width) const {
+  accesses_.emplace_back(offset, width);
+  uint64_t value = 0;
+  std::memcpy(&value, &buffer_[offset], width);  // Little-endian
+  return value;
+}
+
+void BufferMemory::Write(int offset, uint64_t value, int width) {
+  accesses_.emplace_back(offset, width);
+  std::memcpy(&buffer_[offset], &value, width);
+}
+
+}  // namespace security::pawn
@@ -0,0 +1,293 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulated Intel ICH/PCH with an attached SPI flash chip. This allows to drive
+// Chipset and all of its subclasses end to end without root privileges or real
+// hardware, for example in tests and throughput benchmarks.
+// Use like this:
+//   auto device = SimulatedDevice::Create(flash_image, {});
+//   QCHECK_OK(device.status());
+//   Chipset::HardwareId hw_id;
+//   auto chipset = Chipset::Create((*device)->pci(), hw_id);
+//   QCHECK_OK(chipset.status());
+//   (*chipset)->set_memory_mapper((*device)->memory_mapper());
+//   QCHECK_OK((*chipset)->MapSpiRegisters());
+//   ...
+//
+// The simulation covers the LPC device's PCI configuration space (B0:D31:F0)
+// and the Root Complex Register Block (RCRB), including the SPI register file
+// at SPIBAR. For 100 Series chipsets and later, which have no RCRB, it covers
+// the SPI controller's PCI configuration space (B0:D31:F5) and the SPI
+// register file in its BAR0 instead, with the register layout of these
+// generations. Hardware sequencing flash cycles behave as described in the
+// datasheets: setting HSFC.FGO starts a cycle and sets HSFS.SCIP. Once the
+// configured cycle latency has passed, the cycle completes and sets FDONE (and
+// FCERR/AEL on errors). The status bits are R/WC, FLOCKDN is write-once.
+// Software sequencing cycles complete immediately. The flash descriptor
+// observability registers (FDOC/FDOD) serve the descriptor in the flash image.
+
+#ifndef PAWN_SIMULATED_DEVICE_H_
+#define PAWN_SIMULATED_DEVICE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+
+class Pci;
+
+class SimulatedDevice {
+ public:
+  struct Options {
+    Chipset::HardwareId hardware_id = {0x8086 /* Intel */, 0x8C4E /* Q87 */,
+                                       0x05};
+
+    // Root Complex Base Address. The EN bit is always set.
+    uint32_t rcba = 0xFED1C000;
+
+    // SPI Base Address, BAR0 of the SPI controller on 100 Series chipsets and
+    // later. Memory space decoding is always enabled.
+    uint32_t spibar = 0xFE010000;
+
+    // BIOS Control Register (8-bit). Lives in the SPI controller on 100 Series
+    // chipsets and later.
+    uint8_t bios_cntl = 0x00;
+
+    // General Control and Status Register. If unset, the Boot BIOS Straps
+    // indicate SPI, using the encoding of the simulated chipset generation.
+    std::optional<uint32_t> gcs;
+
+    // HSFS Flash Configuration Lock-Down (FLOCKDN)
+    bool flash_configuration_lockdown = false;
+
+    // Flash Regions Access Permissions Register. By default, the BIOS may read
+    // and write all regions.
+    uint32_t frap = 0x0000FFFF;
+
+    // Raw FREG0..4 register values. If empty, FREG0 covers the first 4KiB as
+    // the flash descriptor and FREG1 (BIOS) the remainder of the flash image.
+    // All other regions are unused. BFPR always mirrors FREG1.
+    std::vector<uint32_t> freg;
+
+    // Raw PR0..4 register values. Missing ones are zero.
+    std::vector<uint32_t> pr;
+
+    // Raw PREOP, OPTYPE and OPMENU register values, as left by the BIOS.
+    // Like the other configuration registers, these are locked by FLOCKDN.
+    uint16_t preop = 0;
+    uint16_t optype = 0;
+    uint64_t opmenu = 0;
+
+    // Manufacturer and device id returned for Read JEDEC ID (0x9F).
+    std::array<uint8_t, 3> jedec_id = {0xEF, 0x40, 0x18};  // W25Q128
+
+    // Serial Flash Discoverable Parameters returned for Read SFDP (0x5A),
+    // see MakeSfdp(). If empty, the chip does not support SFDP and returns
+    // all ones.
+    std::string sfdp;
+
+    // Time it takes the controller to complete a flash cycle.
+    absl::Duration cycle_latency = absl::ZeroDuration();
+
+    // Fault injection: Flash cycles touching any of these flash linear
+    // address ranges (inclusive) complete with FCERR set.
+    std::vector<std::pair<uint32_t, uint32_t>> error_ranges;
+
+    // Fault injection: If non-negative, the controller never signals FDONE
+    // for any flash cycle started after this many cycles, i.e. it hangs.
+    int64_t hang_after_cycles = -1;
+  };
+
+  struct Stats {
+    int64_t config_reads = 0;
+    int64_t mmio_reads = 0;
+    int64_t mmio_writes = 0;
+    int64_t flash_cycles = 0;
+    int64_t flash_cycle_errors = 0;
+  };
+
+  SimulatedDevice(const SimulatedDevice&) = delete;
+  SimulatedDevice& operator=(const SimulatedDevice&) = delete;
+
+  ~SimulatedDevice();
+
+  // Creates a new simulated device with the specified SPI flash contents.
+  // Flash linear addresses beyond the size of the image wrap around, like
+  // they do on real flash chips.
+  static absl::StatusOr<std::unique_ptr<SimulatedDevice>> Create(
+      std::string flash_image, const Options& options);
+
+  // Like Create(), but reads the SPI flash contents from a file.
+  static absl::StatusOr<std::unique_ptr<SimulatedDevice>> CreateFromFile(
+      const std::string& filename, const Options& options);
+
+  // Encodes a FREGn register value for the specified flash linear address
+  // range (inclusive). Both addresses are truncated to 4KiB granularity.
+  // Addresses above 32MiB are only valid for 100 Series chipsets and later.
+  static uint32_t MakeFregNRegister(uint32_t base, uint32_t limit);
+
+  // Encodes a PRn register value for the specified flash linear address range
+  // (inclusive). Both addresses are truncated to 4KiB granularity.
+  static uint32_t MakePrNRegister(uint32_t base, uint32_t limit,
+                                  bool read_protect, bool write_protect);
+
+  // Returns a minimal SFDP table with a Basic Flash Parameter Table for a
+  // flash chip of flash_size bytes that supports 3-byte addressing.
+  static std::string MakeSfdp(int64_t flash_size);
+
+  // Returns a flash image of size bytes with a pattern that only repeats
+  // every 64KiB, so that data read from the wrong address shows.
+  static std::string MakeFlashImage(int64_t size);
+
+  // Returns access to the simulated PCI configuration space.
+  Pci& pci();
+
+  // Maps parts of the simulated physical memory. Only the RCRB (or SPIBAR) and
+  // the BIOS decode window below 4GiB, which maps the end of the BIOS region
+  // (FREG1, at most 16MiB of it), are available.
+  absl::StatusOr<std::unique_ptr<PhysicalMemory>> MapPhysicalMemory(
+      uintptr_t physical_address, size_t length);
+
+  // Returns a memory mapper suitable for Chipset::set_memory_mapper(). The
+  // returned function must not outlive this instance.
+  Chipset::MemoryMapper memory_mapper();
+
+  const std::string& flash_image() const { return flash_image_; }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  class SimulatedPci;
+  class SimulatedMemory;
+  class SimulatedBiosWindow;
+
+  // Offsets and widths of the SPI registers that differ between generations.
+  struct SpiLayout;
+  static const SpiLayout& LayoutFor(const Chipset::HardwareId& id);
+
+  // Write semantics of a single byte in the SPI register file.
+  struct WriteMask {
+    uint8_t rw;    // Read/Write
+    uint8_t rw1c;  // Read/Write-Clear
+  };
+
+  enum : uint32_t {
+    kRcrbSize = 0x4000,  // 16KiB
+    kSpiRegisterFileSize = 0x200,
+    kMaxBiosWindowSize = 16 << 20,  // 16MiB
+  };
+
+  SimulatedDevice(std::string flash_image, const Options& options);
+
+  uint32_t ReadConfig(uint32_t config_address, int width);
+
+  uint64_t ReadRcrb(uint32_t offset, int width);
+  void WriteRcrb(uint32_t offset, uint64_t value, int width);
+  uint32_t ReadSpiRegister32(int spi_offset) const;
+  WriteMask SpiRegisterWriteMask(int spi_offset) const;
+  bool flash_configuration_lockdown() const;
+
+  // Hardware sequencing cycle state machine.
+  void StartHardwareSequencingCycle();
+  void UpdateHardwareSequencingCycle();
+  void CompleteHardwareSequencingCycle();
+  // Updates FDOD with the descriptor dword selected in FDOC.
+  void UpdateFlashDescriptorObservability();
+  // Executes a software sequencing cycle, these complete immediately.
+  void RunSoftwareSequencingCycle();
+  // Checks whether the size bytes starting at flash_address may be read.
+  // Returns the HSFS status bits (FCERR, AEL) to set if not.
+  uint8_t CheckFlashRead(uint32_t flash_address, int size) const;
+
+  std::string flash_image_;
+  Options options_;
+  Stats stats_;
+  // Whether the SPI controller is a PCI function of its own (100 Series and
+  // later).
+  bool spi_function_;
+  const SpiLayout* layout_;
+  // Physical address and size of the memory that holds the SPI registers,
+  // either the RCRB or SPIBAR.
+  uint32_t mmio_base_;
+  uint32_t mmio_size_;
+  // Offset of the SPI registers in rcrb_.
+  uint32_t spi_bar_;
+  std::array<uint8_t, 256> lpc_config_ = {};
+  std::array<uint8_t, 256> spi_config_ = {};
+  std::vector<uint8_t> rcrb_;
+  std::unique_ptr<SimulatedPci> pci_;
+
+  bool cycle_in_progress_ = false;
+  bool cycle_hangs_ = false;
+  absl::Time cycle_start_;
+};
+
+// Memory without side effects, backed by a caller-owned buffer. Direct access
+// through MmioBase() is only available if direct is set. Records the offset
+// and width of every access that does not go through MmioBase().
+class BufferMemory : public PhysicalMemory {
+ public:
+  BufferMemory(absl::Span<uint8_t> buffer, bool direct)
+      : buffer_(buffer), direct_(direct) {}
+
+  void* GetAt(int offset) override { return &buffer_[offset]; }
+  volatile void* MmioBase() override {
+    return direct_ ? buffer_.data() : nullptr;
+  }
+
+  uint8_t ReadUint8(int offset) const override { return Read(offset, 1); }
+  uint16_t ReadUint16(int offset) const override { return Read(offset, 2); }
+  uint32_t ReadUint32(int offset) const override { return Read(offset, 4); }
+  uint64_t ReadUint64(int offset) const override { return Read(offset, 8); }
+  void WriteUint8(int offset, uint8_t value) override {
+    Write(offset, value, 1);
+  }
+  void WriteUint16(int offset, uint16_t value) override {
+    Write(offset, value, 2);
+  }
+  void WriteUint32(int offset, uint32_t value) override {
+    Write(offset, value, 4);
+  }
+  void WriteUint64(int offset, uint64_t value) override {
+    Write(offset, value, 8);
+  }
+
+  // Pairs of offset and width.
+  const std::vector<std::pair<int, int>>& accesses() const {
+    return accesses_;
+  }
+
+ private:
+  uint64_t Read(int offset, int width) const;
+  void Write(int offset, uint64_t value, int width);
+
+  absl::Span<uint8_t> buffer_;
+  bool direct_;
+  mutable std::vector<std::pair<int, int>> accesses_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_SIMULATED_DEVICE_H_
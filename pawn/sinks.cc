@@ -0,0 +1,315 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/sinks.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/types/span.h"
+
+namespace security::pawn {
+namespace {
+
+bool IsZero(absl::Span<const uint8_t> data) {
+  return std::all_of(data.begin(), data.end(),
+                     [](uint8_t byte) { return byte == 0; });
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<FileSink>> FileSink::Create(
+    const std::string& filename, int64_t offset, int64_t size,
+    const Options& options) {
+  auto writer = AsyncWriter::Create(filename, options.writer);
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  return absl::WrapUnique(new FileSink(filename, offset, size, options.sparse,
+                                       std::move(writer).value()));
+}
+
+void FileSink::PadTo(int64_t pos) {
+  if (pos_ >= pos) {
+    return;
+  }
+  if (sparse_) {
+    erased_run_ += pos - pos_;
+  } else {
+    writer_->AppendFill(kFill, pos - pos_);
+  }
+  pos_ = pos;
+}
+
+void FileSink::EndErasedRun() {
+  if (erased_run_ >= kMinHoleSize) {
+    writer_->AppendHole(erased_run_);
+    index_.Add(pos_ - erased_run_, erased_run_);
+  } else {
+    writer_->AppendFill(kFill, erased_run_);
+  }
+  erased_run_ = 0;
+}
+
+absl::Status FileSink::Consume(const BlockSlice& slice) {
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    const int64_t fla = slice.flash_address + i * slice.block_size;
+    if (!slice.ok(i) || fla < offset_ ||
+        fla + slice.block_size > offset_ + size_) {
+      continue;
+    }
+    PadTo(fla - offset_);
+    const auto block = slice.block(i);
+    if (sparse_ && IsErased(block)) {
+      erased_run_ += block.size();
+    } else {
+      if (erased_run_ > 0) {
+        EndErasedRun();
+      }
+      writer_->Append(block.data(), block.size());
+    }
+    pos_ += block.size();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FileSink::Finish() {
+  PadTo(size_);
+  if (!sparse_) {
+    return writer_->Close();
+  }
+  EndErasedRun();
+  if (auto status = writer_->Close(); !status.ok()) {
+    return status;
+  }
+  index_.set_size(size_);
+  return index_.Write(SparseIndex::Filename(filename_));
+}
+
+std::string FileSink::Summary() const { return writer_->stats().ToString(); }
+
+absl::StatusOr<std::unique_ptr<CompareSink>> CompareSink::Create(
+    const std::string& baseline) {
+  const int fd = open(baseline.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open ", baseline, ": ", strerror(errno)));
+  }
+  return absl::WrapUnique(new CompareSink(baseline, fd));
+}
+
+CompareSink::~CompareSink() { close(fd_); }
+
+std::string CompareSink::name() const {
+  return absl::StrCat("compare=", baseline_);
+}
+
+absl::Status CompareSink::Consume(const BlockSlice& slice) {
+  buffer_.resize(slice.data.size());
+  const ssize_t size =
+      pread(fd_, buffer_.data(), buffer_.size(), slice.flash_address);
+  if (size == -1) {
+    return absl::InternalError(
+        absl::StrCat("Could not read ", baseline_, ": ", strerror(errno)));
+  }
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    if (!slice.ok(i)) {
+      continue;
+    }
+    ++compared_blocks_;
+    const size_t pos = static_cast<size_t>(i) * slice.block_size;
+    if (pos + slice.block_size <= static_cast<size_t>(size) &&
+        memcmp(&buffer_[pos], slice.block(i).data(), slice.block_size) == 0) {
+      continue;
+    }
+    ++changed_blocks_;
+    if (first_change_ == -1) {
+      first_change_ = slice.flash_address + pos;
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::string CompareSink::Summary() const {
+  if (changed_blocks_ == 0) {
+    return absl::StrFormat("%d blocks match", compared_blocks_);
+  }
+  return absl::StrFormat("%d of %d blocks changed, first at 0x%08X",
+                         changed_blocks_, compared_blocks_, first_change_);
+}
+
+absl::Status ClassifySink::Consume(const BlockSlice& slice) {
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    if (!slice.ok(i)) {
+      ++unread_blocks_;
+    } else if (IsErased(slice.block(i))) {
+      ++erased_blocks_;
+    } else if (IsZero(slice.block(i))) {
+      ++zero_blocks_;
+    } else {
+      ++data_blocks_;
+    }
+  }
+  return absl::OkStatus();
+}
+
+std::string ClassifySink::Summary() const {
+  return absl::StrFormat("%d erased, %d zero, %d data, %d unread blocks",
+                         erased_blocks_, zero_blocks_, data_blocks_,
+                         unread_blocks_);
+}
+
+HashSink::HashSink(std::string manifest, int64_t size,
+                   std::vector<ReadPlan::Range> regions)
+    : manifest_(std::move(manifest)), size_(size) {
+  for (auto& range : regions) {
+    regions_.push_back({std::move(range), Sha256(), {}});
+  }
+}
+
+std::string HashSink::name() const { return absl::StrCat("hash=", manifest_); }
+
+void HashSink::Hash(absl::Span<const uint8_t> data) {
+  image_sha_.Update(data);
+  const int64_t end = pos_ + data.size();
+  for (Region& region : regions_) {
+    const int64_t from = std::max(pos_, region.range.offset);
+    const int64_t to = std::min(end, region.range.end());
+    if (from < to) {
+      region.sha.Update(data.subspan(from - pos_, to - from));
+    }
+  }
+  while (!data.empty()) {
+    const size_t size = std::min<size_t>(
+        data.size(), kCrcBlockSize - pos_ % kCrcBlockSize);
+    crc_ = Crc32c(data.first(size), crc_);
+    data.remove_prefix(size);
+    pos_ += size;
+    if (pos_ % kCrcBlockSize == 0) {
+      crcs_.push_back(crc_);
+      crc_ = 0;
+    }
+  }
+}
+
+void HashSink::FillTo(int64_t pos) {
+  static const auto* const kFillBlock = [] {
+    auto* block = new uint8_t[kCrcBlockSize];
+    std::fill_n(block, kCrcBlockSize, FileSink::kFill);
+    return block;
+  }();
+  while (pos_ < pos) {
+    Hash(absl::MakeConstSpan(
+        kFillBlock, std::min<int64_t>(kCrcBlockSize, pos - pos_)));
+  }
+}
+
+absl::Status HashSink::Consume(const BlockSlice& slice) {
+  for (int i = 0; i < slice.num_blocks(); ++i) {
+    const int64_t fla = slice.flash_address + i * slice.block_size;
+    if (!slice.ok(i) || fla < pos_ || fla + slice.block_size > size_) {
+      continue;
+    }
+    FillTo(fla);
+    Hash(slice.block(i));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status HashSink::Finish() {
+  FillTo(size_);
+  if (pos_ % kCrcBlockSize != 0) {
+    crcs_.push_back(crc_);
+  }
+  image_digest_ = image_sha_.Final();
+  for (Region& region : regions_) {
+    region.digest = region.sha.Final();
+  }
+
+  const std::string text = manifest();
+  FILE* file = fopen(manifest_.c_str(), "wb");
+  bool written =
+      file != nullptr &&
+      fwrite(text.data(), 1 /* Size */, text.size(), file) == text.size();
+  if (file != nullptr) {
+    written = fclose(file) == 0 && written;
+  }
+  if (!written) {
+    return absl::InternalError(absl::StrCat("Could not write ", manifest_));
+  }
+  return absl::OkStatus();
+}
+
+std::string HashSink::manifest() const {
+  std::string text = absl::StrFormat("pawn-manifest 1\nsize 0x%X\n", size_);
+  absl::StrAppendFormat(&text, "sha256 image 0x%08X 0x%08X %s\n", 0, size_,
+                        Sha256::ToHex(image_digest_));
+  for (const Region& region : regions_) {
+    absl::StrAppendFormat(&text, "sha256 %s 0x%08X 0x%08X %s\n",
+                          region.range.name, region.range.offset,
+                          region.range.size, Sha256::ToHex(region.digest));
+  }
+  for (int i = 0; i < crcs_.size(); ++i) {
+    absl::StrAppendFormat(&text, "crc32c 0x%08X %08x\n",
+                          int64_t{i} * kCrcBlockSize, crcs_[i]);
+  }
+  return text;
+}
+
+std::string HashSink::Summary() const {
+  return absl::StrFormat("SHA-256 %s%s", Sha256::ToHex(image_digest_),
+                         image_sha_.sha_ni() ? " (SHA-NI)" : "");
+}
+
+absl::StatusOr<std::unique_ptr<BlockSink>> CreateBlockSink(
+    absl::string_view spec, const SinkContext& context) {
+  if (spec == "classify") {
+    return std::make_unique<ClassifySink>();
+  }
+  if (absl::ConsumePrefix(&spec, "compare=") && !spec.empty()) {
+    auto sink = CompareSink::Create(std::string(spec));
+    if (!sink.ok()) {
+      return sink.status();
+    }
+    return std::move(*sink);  // GCC 7 needs the extra move
+  }
+  if (spec == "hash") {
+    return std::make_unique<HashSink>(absl::StrCat(context.output, ".manifest"),
+                                      context.flash_size, context.regions);
+  }
+  if (absl::ConsumePrefix(&spec, "hash=") && !spec.empty()) {
+    return std::make_unique<HashSink>(std::string(spec), context.flash_size,
+                                      context.regions);
+  }
+  return absl::InvalidArgumentError(absl::StrCat("Unknown sink: ", spec));
+}
+
+}  // namespace security::pawn
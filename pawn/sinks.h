@@ -0,0 +1,207 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Block sinks that come with Pawn. Consumers of read blocks only need to be
+// added here, see CreateBlockSink().
+
+#ifndef PAWN_SINKS_H_
+#define PAWN_SINKS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "pawn/async_writer.h"
+#include "pawn/block_sink.h"
+#include "pawn/hash.h"
+#include "pawn/read_plan.h"
+#include "pawn/sparse_file.h"
+
+namespace security::pawn {
+
+// Writes the readable blocks within a range of flash linear addresses to a
+// file. Parts of the range that are not read are filled with 0xFF, the value
+// of erased flash.
+class FileSink : public BlockSink {
+ public:
+  static constexpr uint8_t kFill = 0xFF;
+
+  // Shorter erased runs are written in sparse files.
+  static constexpr int64_t kMinHoleSize = 16 << 10;  // 16KiB
+
+  struct Options {
+    AsyncWriter::Options writer;
+
+    // Leave runs of erased blocks and fill as holes in the file, and list
+    // them in a SparseIndex next to it.
+    bool sparse = false;
+  };
+
+  static absl::StatusOr<std::unique_ptr<FileSink>> Create(
+      const std::string& filename, int64_t offset, int64_t size,
+      const Options& options);
+
+  std::string name() const override { return filename_; }
+  absl::Status Consume(const BlockSlice& slice) override;
+  // Pads the file to its full size and closes it.
+  absl::Status Finish() override;
+  std::string Summary() const override;
+
+ private:
+  FileSink(std::string filename, int64_t offset, int64_t size, bool sparse,
+           std::unique_ptr<AsyncWriter> writer)
+      : filename_(std::move(filename)),
+        offset_(offset),
+        size_(size),
+        sparse_(sparse),
+        writer_(std::move(writer)) {}
+
+  void PadTo(int64_t pos);
+  // Writes the pending erased run, as a hole if it is long enough.
+  void EndErasedRun();
+
+  const std::string filename_;
+  const int64_t offset_;
+  const int64_t size_;
+  const bool sparse_;
+  std::unique_ptr<AsyncWriter> writer_;
+  int64_t pos_ = 0;  // Current file position, including the erased run
+  int64_t erased_run_ = 0;  // Erased bytes before pos_, not written yet
+  SparseIndex index_;
+};
+
+// Counts the readable blocks that differ from a previous dump of the whole
+// flash, or that are beyond its end.
+class CompareSink : public BlockSink {
+ public:
+  static absl::StatusOr<std::unique_ptr<CompareSink>> Create(
+      const std::string& baseline);
+
+  ~CompareSink() override;
+
+  std::string name() const override;
+  absl::Status Consume(const BlockSlice& slice) override;
+  std::string Summary() const override;
+
+  int64_t compared_blocks() const { return compared_blocks_; }
+  int64_t changed_blocks() const { return changed_blocks_; }
+  // Lowest flash linear address of a changed block, or -1.
+  int64_t first_change() const { return first_change_; }
+
+ private:
+  CompareSink(std::string baseline, int fd)
+      : baseline_(std::move(baseline)), fd_(fd) {}
+
+  const std::string baseline_;
+  const int fd_;
+  std::string buffer_;
+  int64_t compared_blocks_ = 0;
+  int64_t changed_blocks_ = 0;
+  int64_t first_change_ = -1;
+};
+
+// Counts blocks by content: erased (all 0xFF), zero, other data, and the ones
+// that could not be read.
+class ClassifySink : public BlockSink {
+ public:
+  std::string name() const override { return "classify"; }
+  absl::Status Consume(const BlockSlice& slice) override;
+  std::string Summary() const override;
+
+  int64_t erased_blocks() const { return erased_blocks_; }
+  int64_t zero_blocks() const { return zero_blocks_; }
+  int64_t data_blocks() const { return data_blocks_; }
+  int64_t unread_blocks() const { return unread_blocks_; }
+
+ private:
+  int64_t erased_blocks_ = 0;
+  int64_t zero_blocks_ = 0;
+  int64_t data_blocks_ = 0;
+  int64_t unread_blocks_ = 0;
+};
+
+// Hashes the full-size image, with the parts that are not read filled with
+// 0xFF like in a FileSink, and the flash regions within it while the blocks
+// stream by. Finish() writes a manifest with the SHA-256 of the image and
+// of each region, and the CRC32C of each 4KiB block:
+//   pawn-manifest 1
+//   size 0x1000000
+//   sha256 image 0x00000000 0x01000000 <hex digest>
+//   sha256 bios 0x00600000 0x00A00000 <hex digest>
+//   crc32c 0x00000000 <hex CRC>
+class HashSink : public BlockSink {
+ public:
+  static constexpr int kCrcBlockSize = 4096;
+
+  HashSink(std::string manifest, int64_t size,
+           std::vector<ReadPlan::Range> regions);
+
+  std::string name() const override;
+  absl::Status Consume(const BlockSlice& slice) override;
+  // Hashes the rest of the image and writes the manifest.
+  absl::Status Finish() override;
+  std::string Summary() const override;
+
+  // Available after Finish().
+  std::string manifest() const;
+  const Sha256::Digest& image_digest() const { return image_digest_; }
+
+ private:
+  struct Region {
+    ReadPlan::Range range;
+    Sha256 sha;
+    Sha256::Digest digest;
+  };
+
+  // Hashes data at image offset pos_.
+  void Hash(absl::Span<const uint8_t> data);
+  // Hashes fill up to image offset pos.
+  void FillTo(int64_t pos);
+
+  const std::string manifest_;
+  const int64_t size_;
+  int64_t pos_ = 0;
+  Sha256 image_sha_;
+  Sha256::Digest image_digest_ = {};
+  std::vector<Region> regions_;
+  uint32_t crc_ = 0;  // Of the current block
+  std::vector<uint32_t> crcs_;
+};
+
+// What sinks may need to know about the dump.
+struct SinkContext {
+  // Name of the full-size output file.
+  std::string output;
+  int64_t flash_size = 0;
+  // Flash regions, see ReadPlan::Regions().
+  std::vector<ReadPlan::Range> regions;
+};
+
+// Creates a sink from a command-line specification, one of:
+//   classify       see ClassifySink
+//   compare=FILE   see CompareSink
+//   hash[=FILE]    see HashSink, the manifest goes to FILE or
+//                  OUTPUT.manifest
+absl::StatusOr<std::unique_ptr<BlockSink>> CreateBlockSink(
+    absl::string_view spec, const SinkContext& context);
+
+}  // namespace security::pawn
+
+#endif  // PAWN_SINKS_H_
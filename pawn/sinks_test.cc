@@ -0,0 +1,194 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/sinks.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/hash.h"
+#include "pawn/sparse_file.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// Returns a slice of four 4-byte blocks at flash_address with data
+// "AAAABBBBCCCCDDDD", of which the third could not be read.
+BlockSlice MakeSlice(int64_t flash_address) {
+  BlockSlice slice;
+  slice.flash_address = flash_address;
+  slice.block_size = 4;
+  const std::string data = "AAAABBBBCCCCDDDD";
+  slice.data.assign(data.begin(), data.end());
+  slice.block_status = {Chipset::kBlockOk, Chipset::kBlockOk,
+                        Chipset::kBlockReadError, Chipset::kBlockOk};
+  return slice;
+}
+
+TEST(FileSinkTest, WritesReadableBlocksInRange) {
+  const std::string path = ::testing::TempDir() + "/sinks_test_file";
+  auto sink = FileSink::Create(path, 4 /* Offset */, 24 /* Size */, {});
+  ASSERT_THAT(sink.ok(), IsTrue());
+  EXPECT_THAT((*sink)->Consume(MakeSlice(0)).ok(), IsTrue());
+  EXPECT_THAT((*sink)->Finish().ok(), IsTrue());
+  EXPECT_THAT(ReadFile(path), Eq("BBBB\xFF\xFF\xFF\xFF"
+                                 "DDDD\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
+                                 "\xFF\xFF\xFF\xFF"));
+}
+
+TEST(FileSinkTest, LeavesErasedRunsAsHoles) {
+  const std::string path = ::testing::TempDir() + "/sinks_test_sparse";
+  constexpr int kSize = 4 * FileSink::kMinHoleSize;
+  FileSink::Options options;
+  options.sparse = true;
+  auto sink = FileSink::Create(path, 0 /* Offset */, kSize, options);
+  ASSERT_THAT(sink.ok(), IsTrue());
+  // Two slices with data, a short erased run of an unreadable block, and a
+  // long one of erased blocks and fill each.
+  BlockSlice slice = MakeSlice(0);
+  slice.data.resize(FileSink::kMinHoleSize);
+  slice.block_status.resize(slice.data.size() / slice.block_size,
+                            Chipset::kBlockOk);
+  std::fill(slice.data.begin() + 16, slice.data.end(), 0xFF);
+  EXPECT_THAT((*sink)->Consume(slice).ok(), IsTrue());
+  slice.flash_address = 2 * FileSink::kMinHoleSize;
+  EXPECT_THAT((*sink)->Consume(slice).ok(), IsTrue());
+  EXPECT_THAT((*sink)->Finish().ok(), IsTrue());
+
+  auto index = SparseIndex::Read(SparseIndex::Filename(path));
+  ASSERT_THAT(index.ok(), IsTrue()) << index.status();
+  EXPECT_THAT(index->size(), Eq(kSize));
+  ASSERT_THAT(index->runs().size(), Eq(2));
+  EXPECT_THAT(index->runs()[0].offset, Eq(16));
+  EXPECT_THAT(index->runs()[0].size, Eq(2 * FileSink::kMinHoleSize - 16));
+  EXPECT_THAT(index->runs()[1].offset, Eq(2 * FileSink::kMinHoleSize + 16));
+  EXPECT_THAT(index->runs()[1].size, Eq(2 * FileSink::kMinHoleSize - 16));
+  EXPECT_THAT(ReadFile(path).size(), Eq(kSize));
+
+  const std::string restored = ::testing::TempDir() + "/sinks_test_restored";
+  ASSERT_THAT(RestoreSparseFile(path, restored).ok(), IsTrue());
+  std::string expected(kSize, '\xFF');
+  expected.replace(0, 16, "AAAABBBBCCCCDDDD");
+  expected.replace(2 * FileSink::kMinHoleSize, 16, "AAAABBBBCCCCDDDD");
+  // The third block of the slices could not be read.
+  expected.replace(8, 4, "\xFF\xFF\xFF\xFF");
+  expected.replace(2 * FileSink::kMinHoleSize + 8, 4, "\xFF\xFF\xFF\xFF");
+  EXPECT_THAT(ReadFile(restored), Eq(expected));
+}
+
+TEST(CompareSinkTest, CountsChangedBlocks) {
+  const std::string path = ::testing::TempDir() + "/sinks_test_baseline";
+  std::ofstream(path, std::ios::binary) << "AAAAXXXXCCCCDDDDAAAA";
+  auto sink = CompareSink::Create(path);
+  ASSERT_THAT(sink.ok(), IsTrue());
+  EXPECT_THAT((*sink)->Consume(MakeSlice(0)).ok(), IsTrue());
+  // Only the first block is within the baseline.
+  EXPECT_THAT((*sink)->Consume(MakeSlice(16)).ok(), IsTrue());
+  EXPECT_THAT((*sink)->compared_blocks(), Eq(6));
+  EXPECT_THAT((*sink)->changed_blocks(), Eq(3));
+  EXPECT_THAT((*sink)->first_change(), Eq(4));
+  EXPECT_THAT((*sink)->Summary(), HasSubstr("3 of 6 blocks changed"));
+}
+
+TEST(ClassifySinkTest, CountsBlockTypes) {
+  BlockSlice slice = MakeSlice(0);
+  std::fill_n(slice.data.begin(), 4, 0xFF);
+  std::fill_n(slice.data.begin() + 4, 4, 0x00);
+  ClassifySink sink;
+  EXPECT_THAT(sink.Consume(slice).ok(), IsTrue());
+  EXPECT_THAT(sink.erased_blocks(), Eq(1));
+  EXPECT_THAT(sink.zero_blocks(), Eq(1));
+  EXPECT_THAT(sink.data_blocks(), Eq(1));
+  EXPECT_THAT(sink.unread_blocks(), Eq(1));
+}
+
+TEST(HashSinkTest, HashesImageAndRegions) {
+  const std::string path = ::testing::TempDir() + "/sinks_test_manifest";
+  constexpr int kSize = 2 * HashSink::kCrcBlockSize;
+  HashSink sink(path, kSize,
+                {{"first", 0, HashSink::kCrcBlockSize},
+                 {"second", HashSink::kCrcBlockSize, HashSink::kCrcBlockSize}});
+  EXPECT_THAT(sink.Consume(MakeSlice(HashSink::kCrcBlockSize)).ok(), IsTrue());
+  EXPECT_THAT(sink.Finish().ok(), IsTrue());
+
+  // The image as a FileSink writes it
+  std::string image(kSize, '\xFF');
+  image.replace(HashSink::kCrcBlockSize, 8, "AAAABBBB");
+  image.replace(HashSink::kCrcBlockSize + 12, 4, "DDDD");
+  auto hash = [](absl::string_view data) {
+    Sha256 sha;
+    sha.Update(absl::MakeConstSpan(
+        reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+    return Sha256::ToHex(sha.Final());
+  };
+  auto crc = [](absl::string_view data) {
+    return Crc32c(absl::MakeConstSpan(
+        reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+  };
+  const absl::string_view first =
+      absl::string_view(image).substr(0, HashSink::kCrcBlockSize);
+  const absl::string_view second =
+      absl::string_view(image).substr(HashSink::kCrcBlockSize);
+  EXPECT_THAT(Sha256::ToHex(sink.image_digest()), Eq(hash(image)));
+  EXPECT_THAT(
+      ReadFile(path),
+      Eq(absl::StrFormat("pawn-manifest 1\n"
+                         "size 0x2000\n"
+                         "sha256 image 0x00000000 0x00002000 %s\n"
+                         "sha256 first 0x00000000 0x00001000 %s\n"
+                         "sha256 second 0x00001000 0x00001000 %s\n"
+                         "crc32c 0x00000000 %08x\n"
+                         "crc32c 0x00001000 %08x\n",
+                         hash(image), hash(first), hash(second), crc(first),
+                         crc(second))));
+}
+
+TEST(CreateBlockSinkTest, ParsesSpecifications) {
+  const SinkContext context = {"image.bin", 0x1000, {}};
+  auto classify = CreateBlockSink("classify", context);
+  ASSERT_THAT(classify.ok(), IsTrue());
+  EXPECT_THAT((*classify)->name(), Eq("classify"));
+  EXPECT_THAT(CreateBlockSink("compare=/nonexistent", context).ok(),
+              IsFalse());
+  auto hash = CreateBlockSink("hash", context);
+  ASSERT_THAT(hash.ok(), IsTrue());
+  EXPECT_THAT((*hash)->name(), Eq("hash=image.bin.manifest"));
+  EXPECT_THAT(CreateBlockSink("unknown", context).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace security::pawn
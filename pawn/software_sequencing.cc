@@ -0,0 +1,402 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/software_sequencing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/types/span.h"
+#include "pawn/bits.h"
+#include "pawn/chipset.h"
+#include "pawn/flash_descriptor.h"
+
+namespace security::pawn {
+namespace {
+
+// "SFDP" in little-endian byte order.
+constexpr uint32_t kSfdpSignature = 0x50444653;
+
+uint32_t ReadUint32(absl::Span<const uint8_t> data, int offset) {
+  uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+bool IsValidFrequency(int frequency) {
+  return frequency == Chipset::kScf20Mhz || frequency == Chipset::kScf33Mhz ||
+         frequency == Chipset::kScf50Mhz;
+}
+
+}  // namespace
+
+bool SoftwareSequencing::JedecId::valid() const {
+  return !(manufacturer == 0x00 && device == 0x0000) &&
+         !(manufacturer == 0xFF && device == 0xFFFF);
+}
+
+std::string SoftwareSequencing::JedecId::ToString() const {
+  return absl::StrFormat("%02X %04X", manufacturer, device);
+}
+
+std::string SoftwareSequencing::Parameters::ToString() const {
+  return absl::StrFormat(
+      "%s (0x%02X) at %dMHz",
+      read_opcode == kOpcodeFastRead ? "Fast Read" : "Read", read_opcode,
+      FrequencyMhz(frequency));
+}
+
+SoftwareSequencing::SoftwareSequencing(Chipset& chipset) : chipset_(chipset) {}
+
+SoftwareSequencing::~SoftwareSequencing() {
+  if (optype_ != original_optype_) {
+    chipset_.WriteOptypeRegister(original_optype_);
+  }
+  if (opmenu_ != original_opmenu_) {
+    chipset_.WriteOpmenuRegister(original_opmenu_);
+  }
+}
+
+absl::StatusOr<std::unique_ptr<SoftwareSequencing>> SoftwareSequencing::Create(
+    Chipset& chipset) {
+  if (!chipset.SupportsSoftwareSequencing()) {
+    return absl::UnimplementedError(
+        "Chipset does not support software sequencing");
+  }
+  auto swseq = absl::WrapUnique(new SoftwareSequencing(chipset));
+  swseq->locked_ = chipset.ReadHsfsRegister().flash_configuration_lockdown;
+  swseq->faddr_reserved_ = chipset.ReadFaddrRegister().reserved25;
+  swseq->original_optype_ = swseq->optype_ = chipset.ReadOptypeRegister();
+  swseq->original_opmenu_ = swseq->opmenu_ = chipset.ReadOpmenuRegister();
+  return swseq;
+}
+
+int SoftwareSequencing::FrequencyMhz(Chipset::SpiCycleFrequency frequency) {
+  switch (frequency) {
+    case Chipset::kScf20Mhz:
+      return 20;
+    case Chipset::kScf33Mhz:
+      return 33;
+    case Chipset::kScf50Mhz:
+      return 50;
+  }
+  return 0;
+}
+
+absl::StatusOr<int> SoftwareSequencing::OpcodeIndex(uint8_t opcode,
+                                                    OpcodeType type) {
+  auto menu_opcode = [this](int i) -> uint8_t { return opmenu_ >> (i * 8); };
+  auto menu_type = [this](int i) { return optype_ >> (i * 2) & 0x3; };
+  for (int i = 0; i < kNumOpcodes; ++i) {
+    if (menu_opcode(i) == opcode && menu_type(i) == type) {
+      return i;
+    }
+  }
+  if (locked_) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Opcode 0x%02X is not in the locked-down opcode menu", opcode));
+  }
+
+  // Prefer an unused entry, the BIOS may rely on the others while we run.
+  int index = kNumOpcodes - 1;
+  for (int i = 0; i < kNumOpcodes; ++i) {
+    if (menu_opcode(i) == 0x00) {
+      index = i;
+      break;
+    }
+  }
+  optype_ = (optype_ & ~(0x3 << (index * 2))) | type << (index * 2);
+  opmenu_ = (opmenu_ & ~(uint64_t{0xFF} << (index * 8))) |
+            uint64_t{opcode} << (index * 8);
+  chipset_.WriteOptypeRegister(optype_);
+  chipset_.WriteOpmenuRegister(opmenu_);
+  return index;
+}
+
+absl::StatusOr<bool> SoftwareSequencing::RunCycle(int opcode_index,
+                                                  uint32_t flash_address,
+                                                  int size) {
+  // Clear AEL, FCERR and CDS (R/WC).
+  chipset_.WriteSsfsRegister({0, true, true, true, false, false});
+  chipset_.WriteFaddrRegister({faddr_reserved_, flash_address});
+  const uint32_t data_byte_count = std::max(size - 1, 0);
+  chipset_.WriteSsfcRegister({
+      0,                                    // Reserved
+      parameters_.frequency,                // SCF
+      false,                                // SME
+      size > 0,                             // DS
+      data_byte_count,                      // DBC
+      false,                                // Reserved
+      static_cast<uint32_t>(opcode_index),  // COP
+      false,                                // SPOP
+      false,                                // ACS
+      true,                                 // SCGO
+      false,                                // Reserved
+  });
+
+  Chipset::Ssfs ssfs;
+  if (auto status = chipset_.cycle_waiter().Wait([this, &ssfs] {
+        ssfs = chipset_.ReadSsfsRegister();
+        return ssfs.cycle_done_status || ssfs.flash_cycle_error;
+      });
+      !status.ok()) {
+    return absl::DeadlineExceededError(absl::StrFormat(
+        "Flash cycle at 0x%08X: %s", flash_address, status.message()));
+  }
+  return !ssfs.flash_cycle_error;
+}
+
+void SoftwareSequencing::CopyFdata(int skip, absl::Span<uint8_t> data) {
+  // FDATA is only accessible in 32-bit units.
+  const int end = skip + data.size();
+  for (int i = skip / 4 * 4; i < end; i += 4) {
+    const uint32_t fdata = chipset_.ReadFdataNRegister(i / 4);
+    uint8_t bytes[4];
+    std::memcpy(bytes, &fdata, sizeof(bytes));
+    for (int j = std::max(skip - i, 0); j < 4 && i + j < end; ++j) {
+      data[i + j - skip] = bytes[j];
+    }
+  }
+}
+
+absl::Status SoftwareSequencing::ReadWithOpcode(uint8_t opcode,
+                                                int dummy_bytes,
+                                                uint32_t flash_address,
+                                                absl::Span<uint8_t> data) {
+  auto index = OpcodeIndex(opcode, kOptypeReadWithAddress);
+  if (!index.ok()) {
+    return index.status();
+  }
+  const int cycle_bytes = kMaxCycleBytes - dummy_bytes;
+  for (int pos = 0; pos < data.size(); pos += cycle_bytes) {
+    const int size = std::min<int>(cycle_bytes, data.size() - pos);
+    auto ok = RunCycle(*index, flash_address + pos, dummy_bytes + size);
+    if (!ok.ok()) {
+      return ok.status();
+    }
+    if (!*ok) {
+      return absl::DataLossError(absl::StrFormat(
+          "Flash cycle error at 0x%08X", flash_address + pos));
+    }
+    CopyFdata(dummy_bytes, data.subspan(pos, size));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<SoftwareSequencing::JedecId>
+SoftwareSequencing::ReadJedecId() {
+  auto index = OpcodeIndex(kOpcodeReadJedecId, kOptypeReadWithoutAddress);
+  if (!index.ok()) {
+    return index.status();
+  }
+  auto ok = RunCycle(*index, 0, 3);
+  if (!ok.ok()) {
+    return ok.status();
+  }
+  if (!*ok) {
+    return absl::DataLossError("Read JEDEC ID failed");
+  }
+  uint8_t id[3];
+  CopyFdata(0, absl::MakeSpan(id));
+  return JedecId{id[0], static_cast<uint16_t>(id[1] << 8 | id[2])};
+}
+
+absl::StatusOr<SoftwareSequencing::Sfdp> SoftwareSequencing::ReadSfdp() {
+  // SFDP header followed by the first parameter header, which always
+  // describes the Basic Flash Parameter Table (BFPT).
+  uint8_t header[16];
+  if (auto status = ReadWithOpcode(kOpcodeReadSfdp, 1, 0,
+                                   absl::MakeSpan(header));
+      !status.ok()) {
+    return status;
+  }
+  if (ReadUint32(header, 0) != kSfdpSignature) {
+    return absl::NotFoundError("No SFDP signature");
+  }
+  const int bfpt_dwords = header[11];
+  const uint32_t bfpt_address = ReadUint32(header, 12) & 0xFFFFFF;
+  if (header[8] != 0x00 /* ID LSB */ || bfpt_dwords < 2) {
+    return absl::NotFoundError("No Basic Flash Parameter Table");
+  }
+
+  uint8_t bfpt[8];
+  if (auto status = ReadWithOpcode(kOpcodeReadSfdp, 1, bfpt_address,
+                                   absl::MakeSpan(bfpt));
+      !status.ok()) {
+    return status;
+  }
+  // Address Bytes are 0 for 3-byte only, 1 for 3- or 4-byte, 2 for 4-byte
+  // only. Flash Memory Density is in bits, either N + 1 or 2^N if bit 31 is
+  // set.
+  const uint32_t dword1 = ReadUint32(bfpt, 0);
+  const uint32_t dword2 = ReadUint32(bfpt, 4);
+  const int64_t density_bits = bits::Test<31>(dword2)
+                                   ? int64_t{1} << (dword2 & 0x3F)
+                                   : int64_t{dword2} + 1;
+  return Sfdp{header[5], header[4], density_bits / 8,
+              bits::Value<18, 17>(dword1) != 2};
+}
+
+absl::StatusOr<SoftwareSequencing::Parameters> SoftwareSequencing::Probe(
+    const FlashDescriptor* descriptor) {
+  // Probe with the slowest, universally supported settings.
+  parameters_ = {};
+  jedec_id_.reset();
+  sfdp_.reset();
+
+  // Opcodes missing from a locked-down menu just mean less information.
+  if (auto id = ReadJedecId(); id.ok()) {
+    if (!id->valid()) {
+      return absl::FailedPreconditionError(
+          absl::StrFormat("No flash chip responds, JEDEC ID %s",
+                          id->ToString()));
+    }
+    jedec_id_ = *id;
+  } else if (id.status().code() != absl::StatusCode::kFailedPrecondition) {
+    return id.status();
+  }
+  if (auto sfdp = ReadSfdp(); sfdp.ok()) {
+    if (!sfdp->three_byte_address) {
+      return absl::FailedPreconditionError(
+          "Flash chip only supports 4-byte addresses");
+    }
+    sfdp_ = *sfdp;
+  } else if (sfdp.status().code() != absl::StatusCode::kFailedPrecondition &&
+             sfdp.status().code() != absl::StatusCode::kNotFound) {
+    return sfdp.status();
+  }
+
+  // JESD216 requires SFDP devices to support Fast Read.
+  bool fast_read = (descriptor != nullptr && descriptor->fast_read_support()) ||
+                   sfdp_.has_value();
+  if (fast_read && !OpcodeIndex(kOpcodeFastRead, kOptypeReadWithAddress).ok()) {
+    fast_read = false;
+  }
+  if (!fast_read) {
+    if (auto index = OpcodeIndex(kOpcodeRead, kOptypeReadWithAddress);
+        !index.ok()) {
+      return index.status();
+    }
+  }
+
+  Parameters parameters;
+  parameters.read_opcode = fast_read ? kOpcodeFastRead : kOpcodeRead;
+  if (descriptor != nullptr) {
+    const int frequency = fast_read ? descriptor->fast_read_clock_frequency()
+                                    : descriptor->read_clock_frequency();
+    if (IsValidFrequency(frequency)) {
+      parameters.frequency =
+          static_cast<Chipset::SpiCycleFrequency>(frequency);
+    }
+  }
+  parameters_ = parameters;
+  return parameters_;
+}
+
+absl::Status SoftwareSequencing::Read(
+    int flash_address, absl::Span<uint8_t> data, int block_size,
+    absl::Span<Chipset::BlockStatus> block_status) {
+  if (block_size <= 0 || data.size() % block_size != 0) {
+    return absl::InvalidArgumentError(
+        "Size must be divisible by a positive block size");
+  }
+  if (!block_status.empty() &&
+      block_status.size() != data.size() / block_size) {
+    return absl::InvalidArgumentError(
+        "Block status must have one entry per block");
+  }
+  if (chipset_.ReadHsfsRegister().spi_cycle_in_progress ||
+      chipset_.ReadSsfsRegister().spi_cycle_in_progress) {
+    return absl::UnavailableError("SPI flash cycle in progress");
+  }
+  auto index = OpcodeIndex(parameters_.read_opcode, kOptypeReadWithAddress);
+  if (!index.ok()) {
+    return index.status();
+  }
+
+  // Fast Read returns a dummy byte before the data. The controller has no
+  // notion of dummy cycles, so it is read as data and skipped.
+  const int dummy_bytes = parameters_.read_opcode == kOpcodeFastRead ? 1 : 0;
+  const int cycle_bytes = kMaxCycleBytes - dummy_bytes;
+  std::fill(block_status.begin(), block_status.end(), Chipset::kBlockOk);
+  for (int pos = 0; pos < data.size(); pos += cycle_bytes) {
+    const int size = std::min<int>(cycle_bytes, data.size() - pos);
+    auto ok = RunCycle(*index, flash_address + pos, dummy_bytes + size);
+    if (!ok.ok()) {
+      for (int i = pos / block_size; i < block_status.size(); ++i) {
+        if (block_status[i] == Chipset::kBlockOk) {
+          block_status[i] = Chipset::kBlockNotRead;
+        }
+      }
+      return ok.status();
+    }
+    if (*ok) {
+      CopyFdata(dummy_bytes, data.subspan(pos, size));
+      continue;
+    }
+    // The cycle may straddle readable blocks. Read the blocks it touched
+    // again with cycles of their own to find the ones that actually fail.
+    for (int i = pos / block_size; i <= (pos + size - 1) / block_size; ++i) {
+      if (!block_status.empty() &&
+          block_status[i] == Chipset::kBlockReadError) {
+        continue;
+      }
+      auto block_ok =
+          ReadBlock(*index, dummy_bytes, flash_address + i * block_size,
+                    data.subspan(i * block_size, block_size));
+      if (!block_ok.ok()) {
+        for (int j = i; j < block_status.size(); ++j) {
+          if (block_status[j] == Chipset::kBlockOk) {
+            block_status[j] = Chipset::kBlockNotRead;
+          }
+        }
+        return block_ok.status();
+      }
+      if (!*block_ok && !block_status.empty()) {
+        block_status[i] = Chipset::kBlockReadError;
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<bool> SoftwareSequencing::ReadBlock(int opcode_index,
+                                                   int dummy_bytes,
+                                                   uint32_t flash_address,
+                                                   absl::Span<uint8_t> block) {
+  const int cycle_bytes = kMaxCycleBytes - dummy_bytes;
+  bool all_ok = true;
+  for (int pos = 0; pos < block.size(); pos += cycle_bytes) {
+    const int size = std::min<int>(cycle_bytes, block.size() - pos);
+    auto ok = RunCycle(opcode_index, flash_address + pos, dummy_bytes + size);
+    if (!ok.ok()) {
+      return ok.status();
+    }
+    if (*ok) {
+      CopyFdata(dummy_bytes, block.subspan(pos, size));
+    } else {
+      all_ok = false;
+    }
+  }
+  return all_ok;
+}
+
+}  // namespace security::pawn
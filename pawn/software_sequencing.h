@@ -0,0 +1,190 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// SPI flash read engine using software sequencing. Unlike hardware
+// sequencing, where the controller picks the SPI opcode and clock itself,
+// software sequencing sends an opcode from the Opcode Menu (OPMENU) at the
+// SPI Cycle Frequency (SCF) selected for each cycle. This allows to use the
+// Fast Read (0x0B) opcode at the highest clock the flash chip supports.
+// Use like this:
+//   auto swseq = SoftwareSequencing::Create(*chipset);
+//   QCHECK_OK(swseq.status());
+//   QCHECK_OK((*swseq)->Probe(&descriptor).status());
+//   QCHECK_OK((*swseq)->Read(flash_address, absl::MakeSpan(data), 64));
+//
+// If the opcode menu is not locked down (FLOCKDN), missing opcodes are
+// programmed into it. The original menu is restored on destruction.
+
+#ifndef PAWN_SOFTWARE_SEQUENCING_H_
+#define PAWN_SOFTWARE_SEQUENCING_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+
+namespace security::pawn {
+
+class FlashDescriptor;
+
+class SoftwareSequencing {
+ public:
+  // SPI flash opcodes used for reading.
+  enum Opcode : uint8_t {
+    kOpcodeRead = 0x03,
+    kOpcodeFastRead = 0x0B,  // Followed by one dummy byte
+    kOpcodeReadSfdp = 0x5A,  // Followed by one dummy byte
+    kOpcodeReadJedecId = 0x9F,
+  };
+
+  // Opcode Type Configuration (OPTYPE) encoding.
+  enum OpcodeType {
+    kOptypeReadWithoutAddress = 0,
+    kOptypeWriteWithoutAddress,
+    kOptypeReadWithAddress,
+    kOptypeWriteWithAddress,
+  };
+
+  // Number of entries in the opcode menu.
+  static constexpr int kNumOpcodes = 8;
+
+  // Result of the Read JEDEC ID (0x9F) opcode.
+  struct JedecId {
+    uint8_t manufacturer;
+    uint16_t device;
+
+    // All zeros or all ones mean that no flash chip responded.
+    bool valid() const;
+    std::string ToString() const;
+  };
+
+  // The parts of the Serial Flash Discoverable Parameters (JESD216) that are
+  // relevant for reading, taken from the Basic Flash Parameter Table.
+  struct Sfdp {
+    int major_revision;
+    int minor_revision;
+    int64_t density;  // Bytes
+    // Whether the chip can be read with 3-byte addresses. Chips that only
+    // support 4-byte addressing cannot be read by the controller.
+    bool three_byte_address;
+  };
+
+  // How to read the flash chip.
+  struct Parameters {
+    uint8_t read_opcode = kOpcodeRead;
+    Chipset::SpiCycleFrequency frequency = Chipset::kScf20Mhz;
+
+    std::string ToString() const;
+  };
+
+  SoftwareSequencing(const SoftwareSequencing&) = delete;
+  SoftwareSequencing& operator=(const SoftwareSequencing&) = delete;
+
+  // Restores the original opcode menu, if it was changed.
+  ~SoftwareSequencing();
+
+  // Creates a software sequencing engine for chipset, which must have its
+  // SPI registers mapped. Returns absl::UnimplementedError() if the chipset
+  // has no software sequencing.
+  static absl::StatusOr<std::unique_ptr<SoftwareSequencing>> Create(
+      Chipset& chipset);
+
+  // Returns the SPI clock frequency in MHz for an SCF value.
+  static int FrequencyMhz(Chipset::SpiCycleFrequency frequency);
+
+  // Sends the Read JEDEC ID opcode.
+  absl::StatusOr<JedecId> ReadJedecId();
+
+  // Reads the SFDP header and Basic Flash Parameter Table. Returns
+  // absl::NotFoundError() if the chip does not support SFDP.
+  absl::StatusOr<Sfdp> ReadSfdp();
+
+  // Chooses safe read parameters: Fast Read if the descriptor or SFDP say the
+  // chip supports it, at the clock frequency the descriptor declares for the
+  // respective opcode. Without a descriptor, the clock stays at 20MHz.
+  // descriptor may be nullptr. Returns an error if no flash chip responds.
+  absl::StatusOr<Parameters> Probe(const FlashDescriptor* descriptor);
+
+  const Parameters& parameters() const { return parameters_; }
+  void set_parameters(const Parameters& parameters) {
+    parameters_ = parameters;
+  }
+
+  // Available after Probe().
+  const std::optional<JedecId>& jedec_id() const { return jedec_id_; }
+  const std::optional<Sfdp>& sfdp() const { return sfdp_; }
+
+  // Reads data.size() bytes starting at flash linear address flash_address
+  // into data, with the same semantics as
+  // Chipset::ReadSpiWithHardwareSequencing(). Flash cycles are not aligned
+  // to blocks, so the blocks touched by a failing cycle are read again on
+  // their own, and only those that still fail are marked with
+  // kBlockReadError.
+  absl::Status Read(int flash_address, absl::Span<uint8_t> data,
+                    int block_size,
+                    absl::Span<Chipset::BlockStatus> block_status = {});
+
+ private:
+  // Maximum number of bytes per flash cycle, limited by the FDATA registers.
+  static constexpr int kMaxCycleBytes = 64;
+
+  explicit SoftwareSequencing(Chipset& chipset);
+
+  // Returns the opcode menu index of opcode with the given type. If there is
+  // none, programs it into the menu if the menu is not locked.
+  absl::StatusOr<int> OpcodeIndex(uint8_t opcode, OpcodeType type);
+
+  // Runs a single flash cycle for the opcode at opcode_index, transferring
+  // size bytes (at most kMaxCycleBytes) into FDATA. Returns whether the cycle
+  // completed without error, or absl::DeadlineExceededError().
+  absl::StatusOr<bool> RunCycle(int opcode_index, uint32_t flash_address,
+                                int size);
+
+  // Copies data.size() bytes from FDATA into data, skipping the first skip
+  // bytes.
+  void CopyFdata(int skip, absl::Span<uint8_t> data);
+
+  // Reads block with cycles that start at its first byte, so that they do
+  // not touch neighbouring blocks. Returns whether all cycles completed
+  // without error.
+  absl::StatusOr<bool> ReadBlock(int opcode_index, int dummy_bytes,
+                                 uint32_t flash_address,
+                                 absl::Span<uint8_t> block);
+
+  // Runs a read-type opcode with dummy_bytes in front of the data, in as many
+  // cycles as needed. Stops at the first failing cycle.
+  absl::Status ReadWithOpcode(uint8_t opcode, int dummy_bytes,
+                              uint32_t flash_address,
+                              absl::Span<uint8_t> data);
+
+  Chipset& chipset_;
+  bool locked_;
+  uint32_t faddr_reserved_;
+  uint16_t original_optype_;
+  uint64_t original_opmenu_;
+  uint16_t optype_;
+  uint64_t opmenu_;
+  Parameters parameters_;
+  std::optional<JedecId> jedec_id_;
+  std::optional<Sfdp> sfdp_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_SOFTWARE_SEQUENCING_H_
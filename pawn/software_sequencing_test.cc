@@ -0,0 +1,209 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pawn/software_sequencing.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/flash_descriptor.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr int kFlashSize = 1 << 20;  // 1MiB
+constexpr int kBlockSize = 64;
+
+// Returns a flash descriptor with a single 1MiB component and the specified
+// Flash Components Register bits.
+std::vector<uint8_t> MakeDescriptor(uint32_t flcomp) {
+  std::vector<uint8_t> data(FlashDescriptor::kSize, 0xFF);
+  auto put = [&data](int offset, uint32_t value) {
+    std::memcpy(data.data() + offset, &value, sizeof(value));
+  };
+  put(0x10, FlashDescriptor::kSignature);
+  put(0x14, 0x04 << 16 /* FRBA */ | 0x03 /* FCBA */);
+  put(0x30, flcomp | 0x01 /* 1MiB */);
+  return data;
+}
+
+class SoftwareSequencingTest : public ::testing::Test {
+ protected:
+  void SetUpDevice(const SimulatedDevice::Options& options) {
+    auto device = SimulatedDevice::Create(
+        SimulatedDevice::MakeFlashImage(kFlashSize), options);
+    ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+    device_ = std::move(device).value();
+    Chipset::HardwareId hw_id;
+    auto chipset = Chipset::Create(device_->pci(), hw_id);
+    ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+    chipset_ = std::move(chipset).value();
+    chipset_->set_memory_mapper(device_->memory_mapper());
+    ASSERT_THAT(chipset_->MapSpiRegisters().ok(), IsTrue());
+    auto swseq = SoftwareSequencing::Create(*chipset_);
+    ASSERT_THAT(swseq.ok(), IsTrue()) << swseq.status();
+    swseq_ = std::move(swseq).value();
+  }
+
+  // Reads and compares size bytes at flash_address against the image.
+  void ExpectReads(int flash_address, int size) {
+    std::vector<uint8_t> data(size);
+    ASSERT_THAT(
+        swseq_->Read(flash_address, absl::MakeSpan(data), kBlockSize).ok(),
+        IsTrue());
+    EXPECT_THAT(std::string(data.begin(), data.end()),
+                Eq(device_->flash_image().substr(flash_address, size)));
+  }
+
+  std::unique_ptr<SimulatedDevice> device_;
+  std::unique_ptr<Chipset> chipset_;
+  std::unique_ptr<SoftwareSequencing> swseq_;
+};
+
+TEST_F(SoftwareSequencingTest, ProbesFastReadFromSfdp) {
+  SimulatedDevice::Options options;
+  options.sfdp = SimulatedDevice::MakeSfdp(kFlashSize);
+  SetUpDevice(options);
+
+  auto parameters = swseq_->Probe(nullptr);
+  ASSERT_THAT(parameters.ok(), IsTrue()) << parameters.status();
+  EXPECT_THAT(parameters->read_opcode,
+              Eq(SoftwareSequencing::kOpcodeFastRead));
+  EXPECT_THAT(parameters->frequency, Eq(Chipset::kScf20Mhz));
+  ASSERT_THAT(swseq_->jedec_id().has_value(), IsTrue());
+  EXPECT_THAT(swseq_->jedec_id()->ToString(), Eq("EF 4018"));
+  ASSERT_THAT(swseq_->sfdp().has_value(), IsTrue());
+  EXPECT_THAT(swseq_->sfdp()->density, Eq(kFlashSize));
+
+  // Fast Read cycles do not line up with blocks.
+  ExpectReads(0x1000, 16 * kBlockSize);
+
+  // The opcode menu was programmed and is restored afterwards.
+  EXPECT_THAT(chipset_->ReadOpmenuRegister(), Eq(0x0B5A9Fu));
+  swseq_.reset();
+  EXPECT_THAT(chipset_->ReadOpmenuRegister(), Eq(0u));
+}
+
+TEST_F(SoftwareSequencingTest, UsesDescriptorClockFrequency) {
+  SetUpDevice({});
+  auto descriptor = FlashDescriptor::Parse(MakeDescriptor(
+      0x01 << 21 /* FRCF 33MHz */ | 1 << 20 /* FRS */));
+  ASSERT_THAT(descriptor.ok(), IsTrue()) << descriptor.status();
+
+  auto parameters = swseq_->Probe(&*descriptor);
+  ASSERT_THAT(parameters.ok(), IsTrue()) << parameters.status();
+  EXPECT_THAT(parameters->ToString(), Eq("Fast Read (0x0B) at 33MHz"));
+  EXPECT_THAT(swseq_->sfdp().has_value(), IsFalse());
+  EXPECT_THAT(chipset_->ReadSsfcRegister().spi_cycle_frequency,
+              Eq(Chipset::kScf20Mhz));
+  ExpectReads(0x2000, 4 * kBlockSize);
+  EXPECT_THAT(chipset_->ReadSsfcRegister().spi_cycle_frequency,
+              Eq(Chipset::kScf33Mhz));
+}
+
+TEST_F(SoftwareSequencingTest, UsesLockedOpcodeMenu) {
+  SimulatedDevice::Options options;
+  options.flash_configuration_lockdown = true;
+  options.sfdp = SimulatedDevice::MakeSfdp(kFlashSize);
+  options.opmenu = 0x03 << 16;  // Read at index 2
+  options.optype = SoftwareSequencing::kOptypeReadWithAddress << 4;
+  SetUpDevice(options);
+
+  // Neither Read JEDEC ID nor Read SFDP are available.
+  auto parameters = swseq_->Probe(nullptr);
+  ASSERT_THAT(parameters.ok(), IsTrue()) << parameters.status();
+  EXPECT_THAT(parameters->ToString(), Eq("Read (0x03) at 20MHz"));
+  EXPECT_THAT(swseq_->jedec_id().has_value(), IsFalse());
+  ExpectReads(0x3000, 4 * kBlockSize);
+  EXPECT_THAT(chipset_->ReadOpmenuRegister(), Eq(0x030000u));
+}
+
+TEST_F(SoftwareSequencingTest, RejectsLockedMenuWithoutRead) {
+  SimulatedDevice::Options options;
+  options.flash_configuration_lockdown = true;
+  SetUpDevice(options);
+  EXPECT_THAT(swseq_->Probe(nullptr).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST_F(SoftwareSequencingTest, MarksBlocksOfFailedCycles) {
+  SimulatedDevice::Options options;
+  options.sfdp = SimulatedDevice::MakeSfdp(kFlashSize);
+  options.error_ranges = {{0x1000, 0x103F}};
+  SetUpDevice(options);
+  ASSERT_THAT(swseq_->Probe(nullptr).ok(), IsTrue());
+
+  // 63-byte cycles starting at 0x0F80: the ones at 0x0FFE and 0x103D fail
+  // and touch blocks 1 to 3, but only block 2 fails when read on its own.
+  std::vector<uint8_t> data(4 * kBlockSize);
+  std::vector<Chipset::BlockStatus> block_status(4);
+  ASSERT_THAT(swseq_
+                  ->Read(0x0F80, absl::MakeSpan(data), kBlockSize,
+                         absl::MakeSpan(block_status))
+                  .ok(),
+              IsTrue());
+  EXPECT_THAT(block_status,
+              ElementsAre(Chipset::kBlockOk, Chipset::kBlockOk,
+                          Chipset::kBlockReadError, Chipset::kBlockOk));
+  EXPECT_THAT(std::string(data.begin(), data.begin() + 2 * kBlockSize),
+              Eq(device_->flash_image().substr(0x0F80, 2 * kBlockSize)));
+  EXPECT_THAT(std::string(data.begin() + 3 * kBlockSize, data.end()),
+              Eq(device_->flash_image().substr(0x1040, kBlockSize)));
+}
+
+TEST_F(SoftwareSequencingTest, Reads100SeriesRegisters) {
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0xA146, 0x31};  // Q170
+  options.sfdp = SimulatedDevice::MakeSfdp(kFlashSize);
+  SetUpDevice(options);
+
+  auto parameters = swseq_->Probe(nullptr);
+  ASSERT_THAT(parameters.ok(), IsTrue()) << parameters.status();
+  EXPECT_THAT(parameters->read_opcode,
+              Eq(SoftwareSequencing::kOpcodeFastRead));
+  ExpectReads(0x4000, 8 * kBlockSize);
+}
+
+TEST(SoftwareSequencingCreateTest, RequiresSoftwareSequencing) {
+  SimulatedDevice::Options options;
+  options.hardware_id = {0x8086, 0xA306, 0x10};  // Q370
+  auto device = SimulatedDevice::Create(
+      SimulatedDevice::MakeFlashImage(kFlashSize), options);
+  ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*device)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*device)->memory_mapper());
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+  EXPECT_THAT(SoftwareSequencing::Create(**chipset).status().code(),
+              Eq(absl::StatusCode::kUnimplemented));
+}
+
+}  // namespace
+}  // namespace security::pawn
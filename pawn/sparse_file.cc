@@ -0,0 +1,192 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/sparse_file.h"
+
+#include <fcntl.h>     // open()
+#include <sys/stat.h>  // fstat()
+#include <unistd.h>    // close(), pread()
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "pawn/async_writer.h"
+
+namespace security::pawn {
+namespace {
+
+constexpr absl::string_view kHeader = "pawn-sparse-index 1";
+
+// Parses a hex number with 0x prefix.
+bool ParseHex(absl::string_view text, int64_t& value) {
+  return absl::ConsumePrefix(&text, "0x") && absl::SimpleHexAtoi(text, &value);
+}
+
+}  // namespace
+
+std::string SparseIndex::Filename(absl::string_view path) {
+  return absl::StrCat(path, ".erased");
+}
+
+absl::StatusOr<SparseIndex> SparseIndex::Parse(absl::string_view text) {
+  std::vector<absl::string_view> lines =
+      absl::StrSplit(text, '\n', absl::SkipEmpty());
+  int64_t size;
+  if (lines.size() < 2 || lines[0] != kHeader ||
+      !absl::ConsumePrefix(&lines[1], "size ") || !ParseHex(lines[1], size) ||
+      size < 0) {
+    return absl::InvalidArgumentError("Not a sparse file index");
+  }
+  SparseIndex index;
+  index.set_size(size);
+  for (int i = 2; i < lines.size(); ++i) {
+    std::vector<absl::string_view> fields = absl::StrSplit(lines[i], ' ');
+    Run run;
+    if (fields.size() != 2 || !ParseHex(fields[0], run.offset) ||
+        !ParseHex(fields[1], run.size) || run.size <= 0 ||
+        run.offset < (index.runs_.empty() ? 0 : index.runs_.back().end()) ||
+        run.end() > size) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid run in sparse file index: ", lines[i]));
+    }
+    index.runs_.push_back(run);
+  }
+  return index;
+}
+
+absl::StatusOr<SparseIndex> SparseIndex::Read(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open ", path, ": ", std::strerror(errno)));
+  }
+  absl::Cleanup closer = [file] { fclose(file); };
+  std::string text;
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1 /* Size */, sizeof(buffer), file)) > 0) {
+    text.append(buffer, size);
+  }
+  if (ferror(file)) {
+    return absl::InternalError(absl::StrCat("Could not read ", path));
+  }
+  return Parse(text);
+}
+
+void SparseIndex::Add(int64_t offset, int64_t size) {
+  if (!runs_.empty() && runs_.back().end() == offset) {
+    runs_.back().size += size;
+    return;
+  }
+  runs_.push_back({offset, size});
+}
+
+std::string SparseIndex::Serialize() const {
+  std::string text = absl::StrFormat("%s\nsize 0x%X\n", kHeader, size_);
+  for (const Run& run : runs_) {
+    absl::StrAppendFormat(&text, "0x%08X 0x%08X\n", run.offset, run.size);
+  }
+  return text;
+}
+
+absl::Status SparseIndex::Write(const std::string& path) const {
+  const std::string text = Serialize();
+  FILE* file = fopen(path.c_str(), "wb");
+  bool written =
+      file != nullptr &&
+      fwrite(text.data(), 1 /* Size */, text.size(), file) == text.size();
+  if (file != nullptr) {
+    written = fclose(file) == 0 && written;
+  }
+  if (!written) {
+    return absl::InternalError(absl::StrCat("Could not write ", path));
+  }
+  return absl::OkStatus();
+}
+
+int64_t SparseIndex::erased_size() const {
+  int64_t size = 0;
+  for (const Run& run : runs_) {
+    size += run.size;
+  }
+  return size;
+}
+
+absl::Status RestoreSparseFile(const std::string& path,
+                               const std::string& output) {
+  auto index = SparseIndex::Read(SparseIndex::Filename(path));
+  if (!index.ok()) {
+    return index.status();
+  }
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return absl::NotFoundError(
+        absl::StrCat("Could not open ", path, ": ", std::strerror(errno)));
+  }
+  absl::Cleanup closer = [fd] { close(fd); };
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size != index->size()) {
+    return absl::FailedPreconditionError(
+        absl::StrCat(path, " does not match its index"));
+  }
+  auto writer = AsyncWriter::Create(output, {});
+  if (!writer.ok()) {
+    return writer.status();
+  }
+
+  std::vector<uint8_t> buffer(1 << 20);
+  int64_t pos = 0;
+  // Copies the data up to end.
+  auto copy_to = [&](int64_t end) -> absl::Status {
+    while (pos < end) {
+      const ssize_t size = pread(
+          fd, buffer.data(), std::min<int64_t>(buffer.size(), end - pos), pos);
+      if (size <= 0) {
+        return absl::InternalError(absl::StrCat("Could not read ", path));
+      }
+      (*writer)->Append(buffer.data(), size);
+      pos += size;
+    }
+    return absl::OkStatus();
+  };
+  for (const SparseIndex::Run& run : index->runs()) {
+    if (auto status = copy_to(run.offset); !status.ok()) {
+      return status;
+    }
+    (*writer)->AppendFill(0xFF, run.size);
+    pos = run.end();
+  }
+  if (auto status = copy_to(index->size()); !status.ok()) {
+    return status;
+  }
+  return (*writer)->Close();
+}
+
+}  // namespace security::pawn
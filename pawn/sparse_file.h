@@ -0,0 +1,78 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Sparse dumps leave runs of erased flash (all 0xFF) unwritten, as holes in
+// the file that take no disk space. As holes read back as zeros, a side index
+// lists the runs, so that the full image can be restored.
+
+#ifndef PAWN_SPARSE_FILE_H_
+#define PAWN_SPARSE_FILE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace security::pawn {
+
+// Erased runs of a sparse file. The text format has a header line, the file
+// size and one line per run, all numbers in hex:
+//   pawn-sparse-index 1
+//   size 0x1000000
+//   0x00010000 0x00200000
+class SparseIndex {
+ public:
+  struct Run {
+    int64_t offset;
+    int64_t size;
+
+    int64_t end() const { return offset + size; }
+  };
+
+  // Returns the name of the index for the sparse file at path.
+  static std::string Filename(absl::string_view path);
+
+  static absl::StatusOr<SparseIndex> Parse(absl::string_view text);
+  static absl::StatusOr<SparseIndex> Read(const std::string& path);
+
+  // Adds a run after all previous ones, merging adjacent runs.
+  void Add(int64_t offset, int64_t size);
+
+  std::string Serialize() const;
+  absl::Status Write(const std::string& path) const;
+
+  // Size of the full image.
+  int64_t size() const { return size_; }
+  void set_size(int64_t size) { size_ = size; }
+
+  const std::vector<Run>& runs() const { return runs_; }
+  int64_t erased_size() const;
+
+ private:
+  int64_t size_ = 0;
+  std::vector<Run> runs_;
+};
+
+// Writes the full image of the sparse file at path to output, filling the
+// runs in its index with 0xFF.
+absl::Status RestoreSparseFile(const std::string& path,
+                               const std::string& output);
+
+}  // namespace security::pawn
+
+#endif  // PAWN_SPARSE_FILE_H_
@@ -0,0 +1,80 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/sparse_file.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "absl/status/status.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+TEST(SparseIndexTest, MergesAdjacentRuns) {
+  SparseIndex index;
+  index.Add(0x1000, 0x1000);
+  index.Add(0x2000, 0x3000);
+  index.Add(0x8000, 0x1000);
+  ASSERT_THAT(index.runs().size(), Eq(2));
+  EXPECT_THAT(index.runs()[0].size, Eq(0x4000));
+  EXPECT_THAT(index.erased_size(), Eq(0x5000));
+}
+
+TEST(SparseIndexTest, RoundTrips) {
+  SparseIndex index;
+  index.set_size(0x10000);
+  index.Add(0x1000, 0x1000);
+  index.Add(0x8000, 0x8000);
+  EXPECT_THAT(index.Serialize(), Eq("pawn-sparse-index 1\n"
+                                    "size 0x10000\n"
+                                    "0x00001000 0x00001000\n"
+                                    "0x00008000 0x00008000\n"));
+  auto parsed = SparseIndex::Parse(index.Serialize());
+  ASSERT_THAT(parsed.ok(), IsTrue()) << parsed.status();
+  EXPECT_THAT(parsed->size(), Eq(0x10000));
+  ASSERT_THAT(parsed->runs().size(), Eq(2));
+  EXPECT_THAT(parsed->runs()[1].offset, Eq(0x8000));
+  EXPECT_THAT(parsed->runs()[1].size, Eq(0x8000));
+}
+
+TEST(SparseIndexTest, RejectsInvalidIndexes) {
+  EXPECT_THAT(SparseIndex::Parse("").ok(), IsFalse());
+  EXPECT_THAT(SparseIndex::Parse("pawn-sparse-index 2\nsize 0x10\n").ok(),
+              IsFalse());
+  // Beyond the end
+  EXPECT_THAT(
+      SparseIndex::Parse("pawn-sparse-index 1\nsize 0x10\n0x8 0x10\n").ok(),
+      IsFalse());
+  // Overlapping
+  EXPECT_THAT(SparseIndex::Parse("pawn-sparse-index 1\nsize 0x100\n"
+                                 "0x10 0x10\n0x18 0x10\n")
+                  .ok(),
+              IsFalse());
+}
+
+TEST(RestoreSparseFileTest, FailsWithoutIndex) {
+  EXPECT_THAT(RestoreSparseFile(::testing::TempDir() + "/no_such_file",
+                                ::testing::TempDir() + "/restored")
+                  .code(),
+              Eq(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+}  // namespace security::pawn
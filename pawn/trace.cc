@@ -0,0 +1,458 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/trace.h"
+
+#include <immintrin.h>  // _mm_pause()
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/mapping_pool.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+
+namespace security::pawn {
+namespace {
+
+// File layout, all little-endian:
+//   char magic[8]
+//   uint64_t tsc_frequency  // In Hz, 0 if unknown
+//   uint64_t dropped
+//   uint64_t num_events
+// followed by num_events records of kRecordSize bytes:
+//   uint64_t tsc, address, value
+//   uint8_t op, width
+constexpr char kMagic[8] = {'P', 'A', 'W', 'N', 'T', 'R', 'C', '1'};
+constexpr size_t kHeaderSize = sizeof(kMagic) + 3 * sizeof(uint64_t);
+constexpr size_t kRecordSize = 3 * sizeof(uint64_t) + 2;
+
+void AppendUint64(std::string& data, uint64_t value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t ConsumeUint64(absl::string_view& data) {
+  uint64_t value;
+  std::memcpy(&value, data.data(), sizeof(value));
+  data.remove_prefix(sizeof(value));
+  return value;
+}
+
+const char* OpName(TraceEvent::Op op) {
+  switch (op) {
+    case TraceEvent::kConfigRead:
+      return "config read";
+    case TraceEvent::kMap:
+    case TraceEvent::kMapUntraced:
+    case TraceEvent::kMapError:
+      return "mapping";
+    case TraceEvent::kMemoryRead:
+      return "memory read";
+    case TraceEvent::kMemoryWrite:
+      return "memory write";
+  }
+  return "unknown";
+}
+
+// Mappings match regardless of whether they were traced or failed.
+TraceEvent::Op Kind(TraceEvent::Op op) {
+  return op == TraceEvent::kMapUntraced || op == TraceEvent::kMapError
+             ? TraceEvent::kMap
+             : op;
+}
+
+constexpr uint64_t AllOnes(int width) {
+  return width >= 8 ? ~uint64_t{0} : (uint64_t{1} << (width * 8)) - 1;
+}
+
+}  // namespace
+
+class TraceRecorder::TracingPci : public Pci {
+ public:
+  TracingPci(Pci& pci, TraceRecorder* recorder)
+      : pci_(pci), recorder_(recorder) {}
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+
+  uint8_t ReadConfigUint8(uint32_t config_address) override {
+    return Traced(config_address, pci_.ReadConfigUint8(config_address));
+  }
+  uint16_t ReadConfigUint16(uint32_t config_address) override {
+    return Traced(config_address, pci_.ReadConfigUint16(config_address));
+  }
+  uint32_t ReadConfigUint32(uint32_t config_address) override {
+    return Traced(config_address, pci_.ReadConfigUint32(config_address));
+  }
+
+  void Invalidate(uint32_t config_address, int size) override {
+    pci_.Invalidate(config_address, size);
+  }
+
+  // Keeps the backend's block read and records it as 32-bit reads, which is
+  // how the default implementation replays it.
+  void ReadConfigBlock(uint32_t config_address,
+                       absl::Span<uint8_t> data) override {
+    pci_.ReadConfigBlock(config_address, data);
+    for (size_t i = 0; i < data.size(); i += sizeof(uint32_t)) {
+      uint32_t value = 0xFFFFFFFF;
+      std::memcpy(&value, &data[i], std::min(sizeof(value), data.size() - i));
+      recorder_->Record(TraceEvent::kConfigRead, sizeof(value),
+                        config_address + i, value);
+    }
+  }
+
+ private:
+  template <typename IntT>
+  IntT Traced(uint32_t config_address, IntT value) {
+    recorder_->Record(TraceEvent::kConfigRead, sizeof(IntT), config_address,
+                      value);
+    return value;
+  }
+
+  Pci& pci_;
+  TraceRecorder* recorder_;
+};
+
+// Forces all register accesses through the Read*() and Write*() functions, so
+// that they can be recorded.
+class TraceRecorder::TracingMemory : public PhysicalMemory {
+ public:
+  TracingMemory(std::unique_ptr<PhysicalMemory> mem, uintptr_t physical_address,
+                TraceRecorder* recorder)
+      : mem_(std::move(mem)),
+        physical_address_(physical_address),
+        recorder_(recorder) {}
+
+  void* GetAt(int offset) override { return mem_->GetAt(offset); }
+  volatile void* MmioBase() override { return nullptr; }
+
+  uint8_t ReadUint8(int offset) const override {
+    return Traced(offset, mem_->ReadUint8(offset));
+  }
+  uint16_t ReadUint16(int offset) const override {
+    return Traced(offset, mem_->ReadUint16(offset));
+  }
+  uint32_t ReadUint32(int offset) const override {
+    return Traced(offset, mem_->ReadUint32(offset));
+  }
+  uint64_t ReadUint64(int offset) const override {
+    return Traced(offset, mem_->ReadUint64(offset));
+  }
+  void WriteUint8(int offset, uint8_t value) override {
+    mem_->WriteUint8(offset, value);
+    RecordWrite(offset, value);
+  }
+  void WriteUint16(int offset, uint16_t value) override {
+    mem_->WriteUint16(offset, value);
+    RecordWrite(offset, value);
+  }
+  void WriteUint32(int offset, uint32_t value) override {
+    mem_->WriteUint32(offset, value);
+    RecordWrite(offset, value);
+  }
+  void WriteUint64(int offset, uint64_t value) override {
+    mem_->WriteUint64(offset, value);
+    RecordWrite(offset, value);
+  }
+
+ private:
+  template <typename IntT>
+  IntT Traced(int offset, IntT value) const {
+    recorder_->Record(TraceEvent::kMemoryRead, sizeof(IntT),
+                      physical_address_ + offset, value);
+    return value;
+  }
+
+  template <typename IntT>
+  void RecordWrite(int offset, IntT value) {
+    recorder_->Record(TraceEvent::kMemoryWrite, sizeof(IntT),
+                      physical_address_ + offset, value);
+  }
+
+  std::unique_ptr<PhysicalMemory> mem_;
+  uintptr_t physical_address_;
+  TraceRecorder* recorder_;
+};
+
+TraceRecorder::TraceRecorder(const Options& options)
+    : options_(options), start_tsc_(ReadTsc()), start_time_(absl::Now()) {
+  CHECK_GT(options.capacity, 0) << "Trace capacity must be positive";
+  events_.resize(options.capacity);
+}
+
+std::unique_ptr<Pci> TraceRecorder::TracePci(Pci& pci) {
+  return std::make_unique<TracingPci>(pci, this);
+}
+
+Chipset::MemoryMapper TraceRecorder::TraceMemory(
+    Chipset::MemoryMapper mapper) {
+  if (!mapper) {
+    mapper = [](uintptr_t physical_address, size_t length) {
+      return MappingPool::Default().Map(physical_address, length);
+    };
+  }
+  return [this, mapper = std::move(mapper)](uintptr_t physical_address,
+                                            size_t length)
+             -> absl::StatusOr<std::unique_ptr<PhysicalMemory>> {
+    auto mem = mapper(physical_address, length);
+    if (!mem.ok()) {
+      Record(TraceEvent::kMapError, 0, physical_address,
+             static_cast<uint64_t>(mem.status().code()));
+      return mem.status();
+    }
+    if (length > options_.max_traced_mapping_size) {
+      Record(TraceEvent::kMapUntraced, 0, physical_address, length);
+      return mem;
+    }
+    Record(TraceEvent::kMap, 0, physical_address, length);
+    return std::make_unique<TracingMemory>(std::move(mem).value(),
+                                           physical_address, this);
+  };
+}
+
+std::vector<TraceEvent> TraceRecorder::events() const {
+  std::vector<TraceEvent> events;
+  events.reserve(num_events_ - dropped());
+  for (uint64_t i = dropped(); i < num_events_; ++i) {
+    events.push_back(events_[i % events_.size()]);
+  }
+  return events;
+}
+
+std::string TraceRecorder::Serialize() const {
+  const double seconds = absl::ToDoubleSeconds(absl::Now() - start_time_);
+  const uint64_t tsc_frequency =
+      seconds > 0 ? (ReadTsc() - start_tsc_) / seconds : 0;
+
+  const std::vector<TraceEvent> events = this->events();
+  std::string data(kMagic, sizeof(kMagic));
+  data.reserve(kHeaderSize + events.size() * kRecordSize);
+  AppendUint64(data, tsc_frequency);
+  AppendUint64(data, dropped());
+  AppendUint64(data, events.size());
+  for (const TraceEvent& event : events) {
+    AppendUint64(data, event.tsc);
+    AppendUint64(data, event.address);
+    AppendUint64(data, event.value);
+    data.push_back(event.op);
+    data.push_back(event.width);
+  }
+  return data;
+}
+
+class TraceReplay::ReplayPci : public Pci {
+ public:
+  explicit ReplayPci(TraceReplay* replay) : replay_(replay) {}
+
+  using Pci::ReadConfigUint16;
+  using Pci::ReadConfigUint32;
+  using Pci::ReadConfigUint8;
+
+  uint8_t ReadConfigUint8(uint32_t config_address) override {
+    return replay_->Read(TraceEvent::kConfigRead, 1, config_address);
+  }
+  uint16_t ReadConfigUint16(uint32_t config_address) override {
+    return replay_->Read(TraceEvent::kConfigRead, 2, config_address);
+  }
+  uint32_t ReadConfigUint32(uint32_t config_address) override {
+    return replay_->Read(TraceEvent::kConfigRead, 4, config_address);
+  }
+
+ private:
+  TraceReplay* replay_;
+};
+
+class TraceReplay::ReplayMemory : public PhysicalMemory {
+ public:
+  ReplayMemory(TraceReplay* replay, uintptr_t physical_address, bool traced)
+      : replay_(replay), physical_address_(physical_address), traced_(traced) {}
+
+  void* GetAt(int) override { return nullptr; }
+  volatile void* MmioBase() override { return nullptr; }
+
+  uint8_t ReadUint8(int offset) const override { return Read(offset, 1); }
+  uint16_t ReadUint16(int offset) const override { return Read(offset, 2); }
+  uint32_t ReadUint32(int offset) const override { return Read(offset, 4); }
+  uint64_t ReadUint64(int offset) const override { return Read(offset, 8); }
+  void WriteUint8(int offset, uint8_t value) override {
+    Write(offset, value, 1);
+  }
+  void WriteUint16(int offset, uint16_t value) override {
+    Write(offset, value, 2);
+  }
+  void WriteUint32(int offset, uint32_t value) override {
+    Write(offset, value, 4);
+  }
+  void WriteUint64(int offset, uint64_t value) override {
+    Write(offset, value, 8);
+  }
+
+ private:
+  uint64_t Read(int offset, int width) const {
+    return traced_ ? replay_->Read(TraceEvent::kMemoryRead, width,
+                                   physical_address_ + offset)
+                   : AllOnes(width);
+  }
+
+  void Write(int offset, uint64_t value, int width) {
+    if (traced_) {
+      replay_->Write(width, physical_address_ + offset, value);
+    }
+  }
+
+  TraceReplay* replay_;
+  uintptr_t physical_address_;
+  bool traced_;
+};
+
+TraceReplay::TraceReplay(const Options& options)
+    : options_(options), pci_(std::make_unique<ReplayPci>(this)) {}
+
+TraceReplay::~TraceReplay() = default;
+
+absl::StatusOr<std::unique_ptr<TraceReplay>> TraceReplay::Deserialize(
+    absl::string_view data, const Options& options) {
+  if (data.size() < kHeaderSize ||
+      data.substr(0, sizeof(kMagic)) !=
+          absl::string_view(kMagic, sizeof(kMagic))) {
+    return absl::InvalidArgumentError("Not a trace file");
+  }
+  data.remove_prefix(sizeof(kMagic));
+  auto replay = absl::WrapUnique(new TraceReplay(options));
+  replay->tsc_frequency_ = ConsumeUint64(data);
+  if (const uint64_t dropped = ConsumeUint64(data); dropped != 0) {
+    return absl::FailedPreconditionError(absl::StrFormat(
+        "Trace is incomplete, %d events were dropped", dropped));
+  }
+  const uint64_t num_events = ConsumeUint64(data);
+  if (data.size() != num_events * kRecordSize) {
+    return absl::InvalidArgumentError("Trace file is truncated");
+  }
+  replay->events_.reserve(num_events);
+  while (!data.empty()) {
+    TraceEvent event;
+    event.tsc = ConsumeUint64(data);
+    event.address = ConsumeUint64(data);
+    event.value = ConsumeUint64(data);
+    event.op = static_cast<TraceEvent::Op>(data[0]);
+    event.width = data[1];
+    data.remove_prefix(2);
+    if (event.op > TraceEvent::kMemoryWrite) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("Unknown operation in trace: %d", event.op));
+    }
+    replay->events_.push_back(event);
+  }
+  return replay;  // GCC 7 needs the extra move
+}
+
+Pci& TraceReplay::pci() { return *pci_; }
+
+Chipset::MemoryMapper TraceReplay::memory_mapper() {
+  return [this](uintptr_t physical_address, size_t length)
+             -> absl::StatusOr<std::unique_ptr<PhysicalMemory>> {
+    const TraceEvent* event = Next(TraceEvent::kMap, 0, physical_address);
+    if (event == nullptr) {
+      return status_;
+    }
+    if (event->op == TraceEvent::kMapError) {
+      return absl::Status(static_cast<absl::StatusCode>(event->value),
+                          "Mapping failed during recording");
+    }
+    if (event->value != length) {
+      status_ = absl::FailedPreconditionError(absl::StrFormat(
+          "Trace mismatch at event %d: mapping of %d bytes at 0x%08X, "
+          "recorded %d bytes",
+          next_ - 1, length, physical_address, event->value));
+      return status_;
+    }
+    return std::make_unique<ReplayMemory>(
+        this, physical_address, event->op == TraceEvent::kMap);
+  };
+}
+
+const TraceEvent* TraceReplay::Next(TraceEvent::Op op, int width,
+                                    uint64_t address) {
+  if (!status_.ok()) {
+    return nullptr;
+  }
+  if (next_ == events_.size()) {
+    status_ = absl::OutOfRangeError(absl::StrFormat(
+        "Trace ended before %s of %d bytes at 0x%08X", OpName(op), width,
+        address));
+    return nullptr;
+  }
+  const TraceEvent& event = events_[next_];
+  if (Kind(event.op) != op || event.width != width ||
+      event.address != address) {
+    status_ = absl::FailedPreconditionError(absl::StrFormat(
+        "Trace mismatch at event %d: %s of %d bytes at 0x%08X, recorded %s "
+        "of %d bytes at 0x%08X",
+        next_, OpName(op), width, address, OpName(event.op), event.width,
+        event.address));
+    return nullptr;
+  }
+  ++next_;
+
+  if (options_.timing && tsc_frequency_ != 0) {
+    if (next_ == 1) {
+      start_time_ = absl::Now();
+    }
+    const absl::Time due =
+        start_time_ + absl::Nanoseconds((event.tsc - events_[0].tsc) * 1e9 /
+                                        tsc_frequency_);
+    // Sleeping is too coarse for short delays, spin for the rest.
+    if (const absl::Duration wait = due - absl::Now();
+        wait > absl::Microseconds(100)) {
+      absl::SleepFor(wait - absl::Microseconds(50));
+    }
+    while (absl::Now() < due) {
+      _mm_pause();
+    }
+  }
+  return &event;
+}
+
+uint64_t TraceReplay::Read(TraceEvent::Op op, int width, uint64_t address) {
+  const TraceEvent* event = Next(op, width, address);
+  return event != nullptr ? event->value : AllOnes(width);
+}
+
+void TraceReplay::Write(int width, uint64_t address, uint64_t value) {
+  const TraceEvent* event = Next(TraceEvent::kMemoryWrite, width, address);
+  if (event != nullptr && event->value != value) {
+    status_ = absl::FailedPreconditionError(absl::StrFormat(
+        "Trace mismatch at event %d: write of 0x%X to 0x%08X, recorded 0x%X",
+        next_ - 1, value, address, event->value));
+  }
+}
+
+}  // namespace security::pawn
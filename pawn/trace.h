@@ -0,0 +1,193 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Tracing and replay of hardware accesses.
+// TraceRecorder wraps a Pci and the memory mapper of a Chipset and logs every
+// configuration space read, every mapping and every access to mapped memory
+// with a time stamp counter (TSC) value. Events go into a fixed-size ring
+// buffer, so recording costs no allocations or system calls, and are
+// serialized into a compact binary file at the end. Once the buffer is full,
+// the oldest events are dropped.
+// TraceReplay serves a recorded trace back to a Chipset as if it were
+// hardware, optionally with the recorded timing. Each access must match the
+// next recorded event. Use like this:
+//   TraceRecorder recorder({});
+//   std::unique_ptr<Pci> traced_pci = recorder.TracePci(pci);
+//   auto chipset = Chipset::Create(*traced_pci, hw_id);
+//   (*chipset)->set_memory_mapper(recorder.TraceMemory());
+//   ...
+//   WriteFile(filename, recorder.Serialize());
+// and later, on any machine:
+//   auto replay = TraceReplay::Deserialize(data, {});
+//   auto chipset = Chipset::Create((*replay)->pci(), hw_id);
+//   (*chipset)->set_memory_mapper((*replay)->memory_mapper());
+//   ...
+//   QCHECK_OK((*replay)->status());
+//
+// Mappings larger than Options::max_traced_mapping_size, like the BIOS decode
+// window, are read in bulk through their direct pointer. Their accesses are
+// not recorded, and they read as all ones on replay.
+
+#ifndef PAWN_TRACE_H_
+#define PAWN_TRACE_H_
+
+#include <x86intrin.h>  // __rdtsc()
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "pawn/chipset.h"
+#include "pawn/pci.h"
+
+namespace security::pawn {
+
+// A single recorded hardware access.
+struct TraceEvent {
+  enum Op : uint8_t {
+    kConfigRead = 0,  // address: config address
+    kMap,             // address: physical address, value: length
+    kMapUntraced,     // Like kMap, accesses are not recorded
+    kMapError,        // address: physical address, value: absl::StatusCode
+    kMemoryRead,      // address: physical address
+    kMemoryWrite,     // address: physical address
+  };
+
+  uint64_t tsc;
+  uint64_t address;
+  uint64_t value;
+  Op op;
+  uint8_t width;  // Access size in bytes, 0 for mappings
+};
+
+class TraceRecorder {
+ public:
+  struct Options {
+    // Number of events kept in the ring buffer, must be positive. At 32 bytes
+    // each, the default uses 32MiB.
+    int capacity = 1 << 20;
+
+    // Larger mappings are not traced, see above.
+    size_t max_traced_mapping_size = 64 << 10;  // 64KiB
+  };
+
+  explicit TraceRecorder(const Options& options);
+
+  TraceRecorder(const TraceRecorder&) = delete;
+  TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+  static uint64_t ReadTsc() { return __rdtsc(); }
+
+  // Returns a Pci that forwards to pci and records all reads. Both pci and
+  // this recorder must outlive it.
+  std::unique_ptr<Pci> TracePci(Pci& pci);
+
+  // Returns a memory mapper that maps through mapper, or through
+  // MappingPool::Default() if it is empty, and records the mappings and all
+  // accesses to them. This recorder must outlive the mapped memory.
+  Chipset::MemoryMapper TraceMemory(Chipset::MemoryMapper mapper = {});
+
+  void Record(TraceEvent::Op op, int width, uint64_t address,
+              uint64_t value) {
+    events_[num_events_++ % events_.size()] = {
+        ReadTsc(), address, value, op, static_cast<uint8_t>(width)};
+  }
+
+  // Returns the recorded events, oldest first.
+  std::vector<TraceEvent> events() const;
+
+  // Number of events that were overwritten because the buffer was full.
+  int64_t dropped() const {
+    return num_events_ > events_.size() ? num_events_ - events_.size() : 0;
+  }
+
+  // Returns the binary trace file contents.
+  std::string Serialize() const;
+
+ private:
+  class TracingPci;
+  class TracingMemory;
+
+  Options options_;
+  std::vector<TraceEvent> events_;
+  uint64_t num_events_ = 0;
+
+  // For calibrating the TSC frequency
+  uint64_t start_tsc_;
+  absl::Time start_time_;
+};
+
+class TraceReplay {
+ public:
+  struct Options {
+    // Delay each access until the time it happened at relative to the first
+    // recorded event, for timing-faithful performance tests.
+    bool timing = false;
+  };
+
+  TraceReplay(const TraceReplay&) = delete;
+  TraceReplay& operator=(const TraceReplay&) = delete;
+
+  ~TraceReplay();
+
+  // Parses a trace as returned by TraceRecorder::Serialize(). Traces that
+  // dropped events cannot be replayed.
+  static absl::StatusOr<std::unique_ptr<TraceReplay>> Deserialize(
+      absl::string_view data, const Options& options);
+
+  // The recorded PCI configuration space and physical memory. Both must not
+  // outlive this object.
+  Pci& pci();
+  Chipset::MemoryMapper memory_mapper();
+
+  // Returns an error if an access did not match the trace. Accesses after the
+  // first mismatch read as all ones.
+  const absl::Status& status() const { return status_; }
+
+  // Number of events that have not been replayed yet.
+  int64_t remaining() const { return events_.size() - next_; }
+
+  // TSC frequency of the recording machine, 0 if unknown.
+  uint64_t tsc_frequency() const { return tsc_frequency_; }
+
+ private:
+  class ReplayPci;
+  class ReplayMemory;
+
+  explicit TraceReplay(const Options& options);
+
+  // Returns the next event if it matches the access, nullptr otherwise.
+  const TraceEvent* Next(TraceEvent::Op op, int width, uint64_t address);
+  uint64_t Read(TraceEvent::Op op, int width, uint64_t address);
+  void Write(int width, uint64_t address, uint64_t value);
+
+  Options options_;
+  std::vector<TraceEvent> events_;
+  size_t next_ = 0;
+  uint64_t tsc_frequency_ = 0;
+  absl::Time start_time_;
+  absl::Status status_;
+  std::unique_ptr<ReplayPci> pci_;
+};
+
+}  // namespace security::pawn
+
+#endif  // PAWN_TRACE_H_
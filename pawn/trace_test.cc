@@ -0,0 +1,207 @@
+// Copyright 2014-2024 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pawn/trace.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "pawn/chipset.h"
+#include "pawn/pci.h"
+#include "pawn/physical_memory.h"
+#include "pawn/simulated_device.h"
+
+namespace security::pawn {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::IsFalse;
+using ::testing::IsTrue;
+
+constexpr int kFlashSize = 1 << 20;  // 1MiB
+constexpr int kBlockSize = 64;
+
+// Creates a chipset on pci and memory_mapper and reads size bytes at
+// flash_address with hardware sequencing.
+std::vector<uint8_t> ReadFlash(Pci& pci, Chipset::MemoryMapper memory_mapper,
+                               int flash_address, int size) {
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create(pci, hw_id);
+  EXPECT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  if (!chipset.ok()) {
+    return {};
+  }
+  (*chipset)->set_memory_mapper(std::move(memory_mapper));
+  EXPECT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+  std::vector<uint8_t> data(size);
+  EXPECT_THAT((*chipset)
+                  ->ReadSpiWithHardwareSequencing(
+                      flash_address, absl::MakeSpan(data), kBlockSize)
+                  .ok(),
+              IsTrue());
+  return data;
+}
+
+class TraceTest : public ::testing::TestWithParam<Chipset::HardwareId> {
+ protected:
+  void SetUp() override {
+    SimulatedDevice::Options options;
+    options.hardware_id = GetParam();
+    auto device = SimulatedDevice::Create(
+        SimulatedDevice::MakeFlashImage(kFlashSize), options);
+    ASSERT_THAT(device.ok(), IsTrue()) << device.status();
+    device_ = std::move(device).value();
+  }
+
+  // Reads from the simulated device and returns the recorded trace.
+  std::string Record(int flash_address, int size) {
+    TraceRecorder recorder({});
+    std::unique_ptr<Pci> pci = recorder.TracePci(device_->pci());
+    ReadFlash(*pci, recorder.TraceMemory(device_->memory_mapper()),
+              flash_address, size);
+    EXPECT_THAT(recorder.dropped(), Eq(0));
+    return recorder.Serialize();
+  }
+
+  std::unique_ptr<SimulatedDevice> device_;
+};
+
+TEST_P(TraceTest, ReplaysRecordedRead) {
+  const std::string trace = Record(0x2000, 0x1000);
+  const int64_t cycles = device_->stats().flash_cycles;
+
+  auto replay = TraceReplay::Deserialize(trace, {});
+  ASSERT_THAT(replay.ok(), IsTrue()) << replay.status();
+  const std::vector<uint8_t> data = ReadFlash(
+      (*replay)->pci(), (*replay)->memory_mapper(), 0x2000, 0x1000);
+  EXPECT_THAT((*replay)->status().ok(), IsTrue()) << (*replay)->status();
+  EXPECT_THAT((*replay)->remaining(), Eq(0));
+  EXPECT_THAT(data, Eq(std::vector<uint8_t>(
+                        device_->flash_image().begin() + 0x2000,
+                        device_->flash_image().begin() + 0x3000)));
+
+  // The replay did not touch the device.
+  EXPECT_THAT(device_->stats().flash_cycles, Eq(cycles));
+}
+
+TEST_P(TraceTest, DetectsDivergence) {
+  auto replay = TraceReplay::Deserialize(Record(0x2000, 0x1000), {});
+  ASSERT_THAT(replay.ok(), IsTrue()) << replay.status();
+
+  Chipset::HardwareId hw_id;
+  auto chipset = Chipset::Create((*replay)->pci(), hw_id);
+  ASSERT_THAT(chipset.ok(), IsTrue()) << chipset.status();
+  (*chipset)->set_memory_mapper((*replay)->memory_mapper());
+  ASSERT_THAT((*chipset)->MapSpiRegisters().ok(), IsTrue());
+  std::vector<uint8_t> data(kBlockSize);
+  (*chipset)
+      ->ReadSpiWithHardwareSequencing(0x4000, absl::MakeSpan(data), kBlockSize)
+      .IgnoreError();
+  EXPECT_THAT((*replay)->status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    ChipsetGenerations, TraceTest,
+    ::testing::Values(Chipset::HardwareId{0x8086, 0x8C4E /* Q87 */, 0x05},
+                      Chipset::HardwareId{0x8086, 0xA145 /* Z170 */, 0x31}));
+
+TEST(TraceRecorderTest, DropsOldestEvents) {
+  TraceRecorder::Options options;
+  options.capacity = 4;
+  TraceRecorder recorder(options);
+  for (int i = 0; i < 6; ++i) {
+    recorder.Record(TraceEvent::kConfigRead, 4, 0x80000000 + i * 4, i);
+  }
+  EXPECT_THAT(recorder.dropped(), Eq(2));
+  const std::vector<TraceEvent> events = recorder.events();
+  ASSERT_THAT(events.size(), Eq(4));
+  EXPECT_THAT(events.front().value, Eq(2));
+  EXPECT_THAT(events.back().value, Eq(5));
+
+  EXPECT_THAT(TraceReplay::Deserialize(recorder.Serialize(), {})
+                  .status()
+                  .code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(TraceReplayTest, RejectsInvalidTraces) {
+  EXPECT_THAT(TraceReplay::Deserialize("PAWN", {}).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+
+  TraceRecorder recorder({});
+  recorder.Record(TraceEvent::kConfigRead, 4, 0x8000F800, 0x8C4E8086);
+  std::string trace = recorder.Serialize();
+  trace.pop_back();
+  EXPECT_THAT(TraceReplay::Deserialize(trace, {}).status().code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(TraceReplayTest, ReplaysMappingErrors) {
+  TraceRecorder recorder({});
+  Chipset::MemoryMapper mapper = recorder.TraceMemory(
+      [](uintptr_t, size_t) -> absl::StatusOr<std::unique_ptr<PhysicalMemory>> {
+        return absl::PermissionDeniedError("No access");
+      });
+  EXPECT_THAT(mapper(0xFED1C000, 0x4000).status().code(),
+              Eq(absl::StatusCode::kPermissionDenied));
+
+  auto replay = TraceReplay::Deserialize(recorder.Serialize(), {});
+  ASSERT_THAT(replay.ok(), IsTrue()) << replay.status();
+  EXPECT_THAT((*replay)->memory_mapper()(0xFED1C000, 0x4000).status().code(),
+              Eq(absl::StatusCode::kPermissionDenied));
+  EXPECT_THAT((*replay)->status().ok(), IsTrue());
+
+  // Past the end of the trace
+  EXPECT_THAT((*replay)->pci().ReadConfigUint32(0x8000F800),
+              Eq(0xFFFFFFFF));
+  EXPECT_THAT((*replay)->status().ok(), IsFalse());
+}
+
+TEST(TraceReplayTest, KeepsRecordedTiming) {
+  constexpr absl::Duration kDelay = absl::Milliseconds(20);
+  TraceRecorder recorder({});
+  recorder.Record(TraceEvent::kConfigRead, 4, 0x8000F800, 0x8C4E8086);
+  absl::SleepFor(kDelay);
+  recorder.Record(TraceEvent::kConfigRead, 4, 0x8000F808, 0x0C010005);
+
+  TraceReplay::Options options;
+  options.timing = true;
+  auto replay = TraceReplay::Deserialize(recorder.Serialize(), options);
+  ASSERT_THAT(replay.ok(), IsTrue()) << replay.status();
+  ASSERT_THAT((*replay)->tsc_frequency(), Ge(1));
+
+  Pci& pci = (*replay)->pci();
+  EXPECT_THAT(pci.ReadConfigUint32(0x8000F800), Eq(0x8C4E8086));
+  const absl::Time start = absl::Now();
+  EXPECT_THAT(pci.ReadConfigUint32(0x8000F808), Eq(0x0C010005));
+  // Allow for some error in the TSC calibration.
+  EXPECT_THAT(absl::Now() - start, Ge(kDelay * 0.9));
+  EXPECT_THAT((*replay)->status().ok(), IsTrue());
+}
+
+}  // namespace
+}  // namespace security::pawn